@@ -0,0 +1,583 @@
+/*
+ * QEMU Geforce NV2A pushbuffer capture
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+#include "capture.h"
+#include "exec/ram_addr.h"
+#include "qemu/fast-hash.h"
+#include "pgraph/texture.h"
+#include "ui/xemu-notifications.h"
+#include "ui/xemu-settings.h"
+#include "xemu-version.h"
+
+/*
+ * Only PGRAPH state that is not reconstructed by the method stream itself is
+ * saved. The pgraph lock must be held by callers of the state functions.
+ */
+#define CAPTURE_STATE_FIELDS                \
+    X(regs_)                                \
+    X(context_surfaces_2d)                  \
+    X(image_blit)                           \
+    X(kelvin)                               \
+    X(beta)                                 \
+    X(dma_color)                            \
+    X(dma_zeta)                             \
+    X(surface_color)                        \
+    X(surface_zeta)                         \
+    X(surface_type)                         \
+    X(surface_shape)                        \
+    X(last_surface_shape)                   \
+    X(dma_a)                                \
+    X(dma_b)                                \
+    X(texture_matrix_enable)                \
+    X(dma_state)                            \
+    X(dma_notifies)                         \
+    X(dma_semaphore)                        \
+    X(dma_report)                           \
+    X(report_offset)                        \
+    X(zpass_pixel_count_enable)             \
+    X(dma_vertex_a)                         \
+    X(dma_vertex_b)                         \
+    X(vertex_state_shader_v0)               \
+    X(program_data)                         \
+    X(vsh_constants)                        \
+    X(ltctxa)                               \
+    X(ltctxb)                               \
+    X(ltc1)                                 \
+    X(material_alpha)                       \
+    X(light_infinite_half_vector)           \
+    X(light_infinite_direction)             \
+    X(light_local_position)                 \
+    X(light_local_attenuation)              \
+    X(point_params)
+
+#define CAPTURE_ATTR_FIELDS                 \
+    X(dma_select)                           \
+    X(offset)                               \
+    X(inline_array_offset)                  \
+    X(inline_value)                         \
+    X(format)                               \
+    X(size)                                 \
+    X(count)                                \
+    X(stride)                               \
+    X(needs_conversion)
+
+typedef struct NV2ACaptureSpaceState {
+    uint8_t *ptr;
+    size_t num_pages;
+    uint64_t *hash;
+    unsigned long *valid;
+} NV2ACaptureSpaceState;
+
+typedef struct NV2ACaptureState {
+    FILE *file;
+    char *path;
+    int frames_remaining;
+
+    GHashTable *data_ids;
+    uint32_t next_data_id;
+
+    NV2ACaptureSpaceState spaces[2];
+
+    uint64_t num_methods;
+    uint64_t num_page_maps;
+} NV2ACaptureState;
+
+static NV2ACaptureState capture;
+static int capture_frames_requested;
+
+void nv2a_dbg_capture_frames(int num_frames)
+{
+    qatomic_set(&capture_frames_requested, num_frames);
+}
+
+bool nv2a_dbg_capture_active(void)
+{
+    return qatomic_read(&capture.file) != NULL ||
+           qatomic_read(&capture_frames_requested) > 0;
+}
+
+bool nv2a_capture_is_active(void)
+{
+    return capture.file != NULL;
+}
+
+size_t nv2a_capture_get_state_size(void)
+{
+    size_t size = 0;
+    PGRAPHState *pg = NULL;
+    VertexAttribute *attr = NULL;
+
+#define X(field) size += sizeof(pg->field);
+    CAPTURE_STATE_FIELDS
+#undef X
+#define X(field) size += sizeof(attr->field) * NV2A_VERTEXSHADER_ATTRIBUTES;
+    CAPTURE_ATTR_FIELDS
+#undef X
+
+    /* Keep following records word aligned */
+    return ROUND_UP(size, 8);
+}
+
+void nv2a_capture_save_state(NV2AState *d, uint8_t *buf)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+#define X(field) \
+    memcpy(buf, &pg->field, sizeof(pg->field)); \
+    buf += sizeof(pg->field);
+    CAPTURE_STATE_FIELDS
+#undef X
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+#define X(field) \
+        memcpy(buf, &attr->field, sizeof(attr->field)); \
+        buf += sizeof(attr->field);
+        CAPTURE_ATTR_FIELDS
+#undef X
+    }
+}
+
+void nv2a_capture_load_state(NV2AState *d, const uint8_t *buf)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+#define X(field) \
+    memcpy(&pg->field, buf, sizeof(pg->field)); \
+    buf += sizeof(pg->field);
+    CAPTURE_STATE_FIELDS
+#undef X
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+#define X(field) \
+        memcpy(&attr->field, buf, sizeof(attr->field)); \
+        buf += sizeof(attr->field);
+        CAPTURE_ATTR_FIELDS
+#undef X
+        attr->inline_buffer_populated = false;
+    }
+
+    /* Everything the renderers track as dirty must be re-uploaded */
+    bitmap_fill(pg->regs_dirty, ARRAY_SIZE(pg->regs_) / sizeof(uint32_t));
+    pg->program_data_dirty = true;
+    memset(pg->vsh_constants_dirty, 1, sizeof(pg->vsh_constants_dirty));
+    memset(pg->ltctxa_dirty, 1, sizeof(pg->ltctxa_dirty));
+    memset(pg->ltctxb_dirty, 1, sizeof(pg->ltctxb_dirty));
+    memset(pg->ltc1_dirty, 1, sizeof(pg->ltc1_dirty));
+    memset(pg->texture_dirty, 1, sizeof(pg->texture_dirty));
+    pg->surface_color.buffer_dirty = true;
+    pg->surface_zeta.buffer_dirty = true;
+    pg->primitive_mode = PRIM_TYPE_INVALID;
+    pgraph_reset_inline_buffers(pg);
+}
+
+static void capture_write_record(enum NV2ACaptureRecordType type,
+                                 const void *a, size_t a_len,
+                                 const void *b, size_t b_len)
+{
+    NV2ACaptureRecord rec = {
+        .type = type,
+        .length = a_len + b_len,
+    };
+    fwrite(&rec, sizeof(rec), 1, capture.file);
+    if (a_len) {
+        fwrite(a, a_len, 1, capture.file);
+    }
+    if (b_len) {
+        fwrite(b, b_len, 1, capture.file);
+    }
+}
+
+static void capture_write_page(enum NV2ACaptureSpace space, size_t page_index,
+                               uint64_t hash)
+{
+    const uint8_t *data =
+        capture.spaces[space].ptr + page_index * NV2A_CAPTURE_PAGE_SIZE;
+
+    gpointer id_p = g_hash_table_lookup(capture.data_ids, &hash);
+    uint32_t data_id;
+    if (id_p) {
+        data_id = GPOINTER_TO_UINT(id_p) - 1;
+    } else {
+        data_id = capture.next_data_id++;
+        capture_write_record(NV2A_CAPTURE_REC_PAGE_DATA, data,
+                             NV2A_CAPTURE_PAGE_SIZE, NULL, 0);
+        uint64_t *key = g_new(uint64_t, 1);
+        *key = hash;
+        g_hash_table_insert(capture.data_ids, key,
+                            GUINT_TO_POINTER(data_id + 1));
+    }
+
+    NV2ACapturePageMap map = {
+        .space = space,
+        .page_index = page_index,
+        .data_id = data_id,
+    };
+    capture_write_record(NV2A_CAPTURE_REC_PAGE_MAP, &map, sizeof(map), NULL, 0);
+    capture.num_page_maps++;
+}
+
+/*
+ * Record any page in [addr, addr+size) which has not been recorded yet, or
+ * which may have been modified by the CPU since it was last recorded. Pages
+ * that are consumed by the GPU have their dirty bits cleared by the renderer
+ * on upload, so testing (but not clearing) the renderer's dirty client keeps
+ * the number of pages hashed per draw proportional to what the CPU touched.
+ */
+static void capture_sync_range(NV2AState *d, enum NV2ACaptureSpace space,
+                               hwaddr addr, hwaddr size, int dirty_client)
+{
+    if (!size) {
+        return;
+    }
+
+    NV2ACaptureSpaceState *s = &capture.spaces[space];
+    size_t first = addr / NV2A_CAPTURE_PAGE_SIZE;
+    size_t last = MIN((addr + size - 1) / NV2A_CAPTURE_PAGE_SIZE,
+                      s->num_pages - 1);
+    ram_addr_t ram_base = memory_region_get_ram_addr(d->vram);
+
+    for (size_t page = first; page <= last; page++) {
+        bool valid = test_bit(page, s->valid);
+        if (valid && dirty_client >= 0 &&
+            !cpu_physical_memory_get_dirty(
+                ram_base + page * NV2A_CAPTURE_PAGE_SIZE,
+                NV2A_CAPTURE_PAGE_SIZE, dirty_client)) {
+            continue;
+        }
+
+        uint64_t hash =
+            fast_hash(s->ptr + page * NV2A_CAPTURE_PAGE_SIZE,
+                      NV2A_CAPTURE_PAGE_SIZE);
+        if (valid && s->hash[page] == hash) {
+            continue;
+        }
+
+        s->hash[page] = hash;
+        set_bit(page, s->valid);
+        capture_write_page(space, page, hash);
+    }
+}
+
+static void capture_sync_ramin(NV2AState *d)
+{
+    capture_sync_range(d, NV2A_CAPTURE_SPACE_RAMIN, 0,
+                       memory_region_size(&d->ramin), -1);
+}
+
+static void capture_sync_dma_range(NV2AState *d, hwaddr dma_obj,
+                                   hwaddr offset, hwaddr size,
+                                   int dirty_client)
+{
+    if (!dma_obj || !size) {
+        return;
+    }
+
+    DMAObject dma = nv_dma_load(d, dma_obj);
+    hwaddr addr = (dma.address & 0x07FFFFFF) + offset;
+    capture_sync_range(d, NV2A_CAPTURE_SPACE_VRAM, addr, size, dirty_client);
+}
+
+static void capture_sync_surfaces(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned int height =
+        pg->surface_shape.clip_y + pg->surface_shape.clip_height;
+    pgraph_apply_anti_aliasing_factor(pg, NULL, &height);
+
+    capture_sync_dma_range(d, pg->dma_color, pg->surface_color.offset,
+                           pg->surface_color.pitch * height,
+                           DIRTY_MEMORY_NV2A);
+    capture_sync_dma_range(d, pg->dma_zeta, pg->surface_zeta.offset,
+                           pg->surface_zeta.pitch * height,
+                           DIRTY_MEMORY_NV2A);
+}
+
+static void capture_sync_textures(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (!pgraph_is_texture_enabled(pg, i)) {
+            continue;
+        }
+
+        TextureShape shape = pgraph_get_texture_shape(pg, i);
+        hwaddr addr = pgraph_get_texture_phys_addr(pg, i);
+        size_t length = pgraph_get_texture_length(pg, &shape);
+        capture_sync_range(d, NV2A_CAPTURE_SPACE_VRAM, addr, length,
+                           DIRTY_MEMORY_NV2A_TEX);
+
+        size_t palette_length;
+        hwaddr palette_addr =
+            pgraph_get_texture_palette_phys_addr_length(pg, i, &palette_length);
+        capture_sync_range(d, NV2A_CAPTURE_SPACE_VRAM, palette_addr,
+                           palette_length, DIRTY_MEMORY_NV2A_TEX);
+    }
+}
+
+static void capture_sync_vertex_arrays(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned int num_elements = 0;
+
+    if (pg->inline_elements_length) {
+        for (unsigned int i = 0; i < pg->inline_elements_length; i++) {
+            num_elements = MAX(num_elements, pg->inline_elements[i] + 1);
+        }
+    } else if (pg->draw_arrays_length) {
+        num_elements = pg->draw_arrays_max_count;
+    }
+
+    if (!num_elements) {
+        return;
+    }
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        if (!attr->count) {
+            continue;
+        }
+        hwaddr size = attr->stride * (num_elements - 1) +
+                      attr->size * attr->count;
+        capture_sync_dma_range(
+            d, attr->dma_select ? pg->dma_vertex_b : pg->dma_vertex_a,
+            attr->offset, size, DIRTY_MEMORY_NV2A);
+    }
+}
+
+static void capture_begin(NV2AState *d, int num_frames)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    g_autofree gchar *timestamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    g_autofree gchar *filename =
+        g_strdup_printf("nv2a-%s.nv2acap", timestamp);
+    char *path = g_build_filename(xemu_settings_get_base_path(), filename,
+                                  NULL);
+
+    FILE *file = qemu_fopen(path, "wb");
+    if (!file) {
+        g_autofree gchar *msg =
+            g_strdup_printf("Failed to create capture file %s", path);
+        xemu_queue_error_message(msg);
+        g_free(path);
+        return;
+    }
+
+    capture.path = path;
+    capture.frames_remaining = num_frames;
+    capture.next_data_id = 0;
+    capture.num_methods = 0;
+    capture.num_page_maps = 0;
+    capture.data_ids =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    capture.spaces[NV2A_CAPTURE_SPACE_VRAM].ptr = d->vram_ptr;
+    capture.spaces[NV2A_CAPTURE_SPACE_VRAM].num_pages =
+        memory_region_size(d->vram) / NV2A_CAPTURE_PAGE_SIZE;
+    capture.spaces[NV2A_CAPTURE_SPACE_RAMIN].ptr = d->ramin_ptr;
+    capture.spaces[NV2A_CAPTURE_SPACE_RAMIN].num_pages =
+        memory_region_size(&d->ramin) / NV2A_CAPTURE_PAGE_SIZE;
+    for (int i = 0; i < ARRAY_SIZE(capture.spaces); i++) {
+        capture.spaces[i].hash = g_new0(uint64_t, capture.spaces[i].num_pages);
+        capture.spaces[i].valid = bitmap_new(capture.spaces[i].num_pages);
+    }
+
+    NV2ACaptureFileHeader header = {
+        .magic = NV2A_CAPTURE_MAGIC,
+        .format_version = NV2A_CAPTURE_FORMAT_VERSION,
+        .vram_size = memory_region_size(d->vram),
+        .ramin_size = memory_region_size(&d->ramin),
+    };
+    pstrcpy(header.xemu_version, sizeof(header.xemu_version), xemu_version);
+    fwrite(&header, sizeof(header), 1, file);
+
+    qatomic_set(&capture.file, file);
+
+    size_t state_size = nv2a_capture_get_state_size();
+    g_autofree uint8_t *state = g_malloc0(state_size);
+    nv2a_capture_save_state(d, state);
+    capture_write_record(NV2A_CAPTURE_REC_STATE, state, state_size, NULL, 0);
+
+    capture_sync_ramin(d);
+
+    g_autofree gchar *msg = g_strdup_printf("Capturing %d frames to %s",
+                                            num_frames, path);
+    xemu_queue_notification(msg);
+}
+
+static void capture_end(void)
+{
+    capture_write_record(NV2A_CAPTURE_REC_END, NULL, 0, NULL, 0);
+    fclose(capture.file);
+    qatomic_set(&capture.file, NULL);
+
+    g_autofree gchar *msg = g_strdup_printf(
+        "Capture complete: %" PRIu64 " methods, %u unique pages",
+        capture.num_methods, capture.next_data_id);
+    xemu_queue_notification(msg);
+
+    g_hash_table_destroy(capture.data_ids);
+    capture.data_ids = NULL;
+    for (int i = 0; i < ARRAY_SIZE(capture.spaces); i++) {
+        g_free(capture.spaces[i].hash);
+        g_free(capture.spaces[i].valid);
+        capture.spaces[i].hash = NULL;
+        capture.spaces[i].valid = NULL;
+    }
+    g_free(capture.path);
+    capture.path = NULL;
+}
+
+static void capture_sync_image_blit(NV2AState *d, uint32_t size)
+{
+    PGRAPHState *pg = &d->pgraph;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+    unsigned int height = size >> 16;
+
+    capture_sync_dma_range(d, context_surfaces->dma_image_source,
+                           context_surfaces->source_offset,
+                           context_surfaces->source_pitch *
+                               (image_blit->in_y + height),
+                           DIRTY_MEMORY_NV2A);
+    capture_sync_dma_range(d, context_surfaces->dma_image_dest,
+                           context_surfaces->dest_offset,
+                           context_surfaces->dest_pitch *
+                               (image_blit->out_y + height),
+                           DIRTY_MEMORY_NV2A);
+}
+
+void nv2a_capture_pre_method(NV2AState *d, unsigned int subchannel,
+                             unsigned int method, uint32_t parameter)
+{
+    if (!capture.file) {
+        return;
+    }
+
+    /* Object binds read instance memory */
+    if (method == NV_SET_OBJECT || (method >= 0x180 && method < 0x200)) {
+        capture_sync_ramin(d);
+        return;
+    }
+
+    /* pgraph_method loads CTX_SWITCH1 from the subchannel's CTX_CACHE1 */
+    uint32_t ctx_1 =
+        pgraph_reg_r(&d->pgraph, NV_PGRAPH_CTX_CACHE1 + subchannel * 4);
+    uint32_t graphics_class = GET_MASK(ctx_1, NV_PGRAPH_CTX_SWITCH1_GRCLASS);
+
+    /* Methods which may cause the renderer to read guest memory */
+    switch (graphics_class) {
+    case NV_IMAGE_BLIT:
+        if (method == NV09F_SIZE) {
+            capture_sync_image_blit(d, parameter);
+        }
+        break;
+    case NV_KELVIN_PRIMITIVE:
+        switch (method) {
+        case NV097_SET_BEGIN_END:
+            capture_sync_surfaces(d);
+            capture_sync_textures(d);
+            if (parameter == NV097_SET_BEGIN_END_OP_END) {
+                capture_sync_vertex_arrays(d);
+            }
+            break;
+        case NV097_ARRAY_ELEMENT16:
+        case NV097_ARRAY_ELEMENT32:
+        case NV097_DRAW_ARRAYS:
+            capture_sync_vertex_arrays(d);
+            break;
+        case NV097_CLEAR_SURFACE:
+        case NV097_FLIP_STALL:
+            capture_sync_surfaces(d);
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void nv2a_capture_context(NV2AState *d, unsigned int channel_id)
+{
+    if (!capture.file) {
+        return;
+    }
+
+    NV2ACaptureContext ctx = {
+        .channel_id = channel_id,
+    };
+    capture_write_record(NV2A_CAPTURE_REC_CONTEXT, &ctx, sizeof(ctx), NULL, 0);
+}
+
+static bool is_frame_boundary(NV2AState *d, unsigned int method)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    return method == NV097_FLIP_STALL &&
+           GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CTX_SWITCH1),
+                    NV_PGRAPH_CTX_SWITCH1_GRCLASS) == NV_KELVIN_PRIMITIVE;
+}
+
+void nv2a_capture_method(NV2AState *d, unsigned int subchannel,
+                         unsigned int method, uint32_t parameter,
+                         const uint32_t *parameters,
+                         size_t num_words_available,
+                         size_t max_lookahead_words, bool inc,
+                         ssize_t num_words_processed)
+{
+    if (!capture.file) {
+        int requested = qatomic_read(&capture_frames_requested);
+        if (requested > 0 && is_frame_boundary(d, method)) {
+            qatomic_set(&capture_frames_requested, 0);
+            capture_begin(d, requested);
+        }
+        return;
+    }
+
+    /*
+     * pgraph_method may peek a few words past the available method count to
+     * squash repeated draws, so record enough lookahead for replay to make
+     * the same decision.
+     */
+    size_t num_words =
+        MIN(max_lookahead_words,
+            MAX(MAX(num_words_available, (size_t)num_words_processed), 7));
+
+    NV2ACaptureMethod m = {
+        .subchannel = subchannel,
+        .inc = inc,
+        .method = method,
+        .parameter = parameter,
+        .num_words_available = num_words_available,
+        .num_words = num_words,
+        .num_words_processed = num_words_processed,
+    };
+    capture_write_record(NV2A_CAPTURE_REC_METHOD, &m, sizeof(m), parameters,
+                         num_words * sizeof(uint32_t));
+    capture.num_methods++;
+
+    if (is_frame_boundary(d, method) && --capture.frames_remaining <= 0) {
+        capture_end();
+    }
+}
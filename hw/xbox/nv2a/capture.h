@@ -0,0 +1,113 @@
+/*
+ * QEMU Geforce NV2A pushbuffer capture and replay
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_CAPTURE_H
+#define HW_XBOX_NV2A_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A capture is a flat stream of records, each prefixed with a
+ * NV2ACaptureRecord header. All values are host (little) endian; captures
+ * are only expected to be replayed by the same xemu build that wrote them,
+ * which is enforced by the version string in the file header.
+ *
+ * Memory is stored as deduplicated page snapshots: every unique page
+ * content is written once as a PAGE_DATA record and assigned the next
+ * sequential id, and PAGE_MAP records bind a guest page to a data id at the
+ * point in the method stream where the page was observed to change.
+ */
+
+#define NV2A_CAPTURE_MAGIC 0x4341504e /* 'NPAC' */
+#define NV2A_CAPTURE_FORMAT_VERSION 1
+#define NV2A_CAPTURE_PAGE_SIZE 4096
+
+enum NV2ACaptureRecordType {
+    NV2A_CAPTURE_REC_STATE = 1,
+    NV2A_CAPTURE_REC_PAGE_DATA,
+    NV2A_CAPTURE_REC_PAGE_MAP,
+    NV2A_CAPTURE_REC_CONTEXT,
+    NV2A_CAPTURE_REC_METHOD,
+    NV2A_CAPTURE_REC_END,
+};
+
+enum NV2ACaptureSpace {
+    NV2A_CAPTURE_SPACE_VRAM = 0,
+    NV2A_CAPTURE_SPACE_RAMIN,
+};
+
+typedef struct NV2ACaptureFileHeader {
+    uint32_t magic;
+    uint32_t format_version;
+    uint64_t vram_size;
+    uint64_t ramin_size;
+    char xemu_version[64];
+} NV2ACaptureFileHeader;
+
+typedef struct NV2ACaptureRecord {
+    uint32_t type;
+    uint32_t length; /* Payload length, excluding this header */
+} NV2ACaptureRecord;
+
+typedef struct NV2ACapturePageMap {
+    uint32_t space;
+    uint32_t page_index;
+    uint32_t data_id;
+} NV2ACapturePageMap;
+
+typedef struct NV2ACaptureContext {
+    uint32_t channel_id;
+} NV2ACaptureContext;
+
+/* Followed by num_words parameter words */
+typedef struct NV2ACaptureMethod {
+    uint8_t subchannel;
+    uint8_t inc;
+    uint16_t reserved;
+    uint32_t method;
+    uint32_t parameter;
+    uint32_t num_words_available;
+    uint32_t num_words;
+    uint32_t num_words_processed;
+} NV2ACaptureMethod;
+
+typedef struct NV2AState NV2AState;
+
+/* capture.c */
+bool nv2a_capture_is_active(void);
+void nv2a_capture_pre_method(NV2AState *d, unsigned int subchannel,
+                             unsigned int method, uint32_t parameter);
+void nv2a_capture_context(NV2AState *d, unsigned int channel_id);
+void nv2a_capture_method(NV2AState *d, unsigned int subchannel,
+                         unsigned int method, uint32_t parameter,
+                         const uint32_t *parameters,
+                         size_t num_words_available,
+                         size_t max_lookahead_words, bool inc,
+                         ssize_t num_words_processed);
+size_t nv2a_capture_get_state_size(void);
+void nv2a_capture_save_state(NV2AState *d, uint8_t *buf);
+void nv2a_capture_load_state(NV2AState *d, const uint8_t *buf);
+
+/* replay.c */
+bool nv2a_replay_is_enabled(void);
+void nv2a_replay_run(NV2AState *d);
+
+#endif
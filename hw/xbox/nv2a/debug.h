@@ -81,24 +81,36 @@
     _X(NV2A_PROF_CLEAR) \
     _X(NV2A_PROF_QUEUE_SUBMIT) \
     _X(NV2A_PROF_QUEUE_SUBMIT_AUX) \
+    _X(NV2A_PROF_QUEUE_SUBMIT_DEFERRED) \
     _X(NV2A_PROF_PIPELINE_NOTDIRTY) \
     _X(NV2A_PROF_PIPELINE_GEN) \
     _X(NV2A_PROF_PIPELINE_BIND) \
     _X(NV2A_PROF_PIPELINE_RENDERPASSES) \
     _X(NV2A_PROF_BEGIN_ENDS) \
+    _X(NV2A_PROF_BEGIN_ENDS_MERGED) \
+    _X(NV2A_PROF_BEGIN_ENDS_CULLED) \
     _X(NV2A_PROF_DRAW_ARRAYS) \
+    _X(NV2A_PROF_DRAW_ARRAYS_INDIRECT) \
     _X(NV2A_PROF_INLINE_BUFFERS) \
     _X(NV2A_PROF_INLINE_ARRAYS) \
     _X(NV2A_PROF_INLINE_ELEMENTS) \
     _X(NV2A_PROF_QUERY) \
     _X(NV2A_PROF_SHADER_GEN) \
+    _X(NV2A_PROF_SHADER_SPV_CACHE_HIT) \
+    _X(NV2A_PROF_SHADER_GEN_PENDING) \
     _X(NV2A_PROF_SHADER_BIND) \
     _X(NV2A_PROF_SHADER_BIND_NOTDIRTY) \
     _X(NV2A_PROF_SHADER_UBO_DIRTY) \
     _X(NV2A_PROF_SHADER_UBO_NOTDIRTY) \
     _X(NV2A_PROF_ATTR_BIND) \
+    _X(NV2A_PROF_ATTR_FETCH) \
     _X(NV2A_PROF_TEX_UPLOAD) \
+    _X(NV2A_PROF_TEX_INVALIDATE) \
+    _X(NV2A_PROF_TEX_INVALIDATE_VISITED) \
+    _X(NV2A_PROF_TEX_DECODE_ASYNC) \
+    _X(NV2A_PROF_TEX_DECODE_COMPUTE) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1) \
+    _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1_STALL) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_2) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_3) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4) \
@@ -106,9 +118,15 @@
     _X(NV2A_PROF_SURF_SWIZZLE) \
     _X(NV2A_PROF_SURF_CREATE) \
     _X(NV2A_PROF_SURF_DOWNLOAD) \
+    _X(NV2A_PROF_SURF_DOWNLOAD_QUEUED) \
+    _X(NV2A_PROF_SURF_DOWNLOAD_QUEUED_HIT) \
+    _X(NV2A_PROF_SURF_DOWNLOAD_RESOLVE) \
     _X(NV2A_PROF_SURF_UPLOAD) \
+    _X(NV2A_PROF_SURF_RESCALE) \
     _X(NV2A_PROF_SURF_TO_TEX) \
     _X(NV2A_PROF_SURF_TO_TEX_FALLBACK) \
+    _X(NV2A_PROF_IMAGE_BLIT_GPU) \
+    _X(NV2A_PROF_IMAGE_BLIT_CPU) \
     _X(NV2A_PROF_QUEUE_SUBMIT_1) \
     _X(NV2A_PROF_QUEUE_SUBMIT_2) \
     _X(NV2A_PROF_QUEUE_SUBMIT_3) \
@@ -151,6 +169,10 @@ static inline void nv2a_profile_inc_counter(enum NV2A_PROF_COUNTERS_ENUM cnt)
     g_nv2a_stats.frame_working.counters[cnt] += 1;
 }
 
+void nv2a_dbg_capture_frames(int num_frames);
+bool nv2a_dbg_capture_active(void);
+void nv2a_replay_set_path(const char *path);
+
 #ifdef CONFIG_RENDERDOC
 void nv2a_dbg_renderdoc_init(void);
 void *nv2a_dbg_renderdoc_get_api(void);
@@ -172,16 +172,61 @@ int nv2a_get_screen_off(void)
     return g_nv2a->vga.sr[VGA_SEQ_CLOCK_MODE] & VGA_SR01_SCREEN_OFF;
 }
 
+/*
+ * Wait until the guest has flipped to a frame after *flip_count, or until
+ * timeout_ms elapsed. Returns true if a new frame was flipped to.
+ */
+bool nv2a_wait_for_flip(unsigned int *flip_count, int timeout_ms)
+{
+    NV2AState *d = g_nv2a;
+    bool flipped = true;
+
+    qemu_mutex_lock(&d->pcrtc.flip_lock);
+    if (d->pcrtc.flip_count == *flip_count) {
+        qemu_cond_timedwait(&d->pcrtc.flip_cond, &d->pcrtc.flip_lock,
+                            timeout_ms);
+        flipped = d->pcrtc.flip_count != *flip_count;
+    }
+    *flip_count = d->pcrtc.flip_count;
+    qemu_mutex_unlock(&d->pcrtc.flip_lock);
+
+    return flipped;
+}
+
 static void nv2a_vga_gfx_update(void *opaque)
 {
     VGACommonState *vga = opaque;
     vga->hw_ops->gfx_update(vga);
+}
+
+#define NV2A_VBLANK_PERIOD_NS (NANOSECONDS_PER_SECOND / 60)
+
+static void nv2a_vblank(void *opaque)
+{
+    NV2AState *d = opaque;
 
-    NV2AState *d = container_of(vga, NV2AState, vga);
     d->pcrtc.pending_interrupts |= NV_PCRTC_INTR_0_VBLANK;
     d->pcrtc.raster = 0;
-
     nv2a_update_irq(d);
+
+    /* Keep a steady cadence, but don't try to catch up after a stall */
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    d->pcrtc.vblank_deadline += NV2A_VBLANK_PERIOD_NS;
+    if (d->pcrtc.vblank_deadline <= now) {
+        d->pcrtc.vblank_deadline = now + NV2A_VBLANK_PERIOD_NS;
+    }
+    timer_mod(d->vblank_timer, d->pcrtc.vblank_deadline);
+}
+
+/*
+ * The deadline is absolute, so it has to be restarted whenever the virtual
+ * clock may have jumped, e.g. after loading a snapshot.
+ */
+static void nv2a_start_vblank_timer(NV2AState *d)
+{
+    d->pcrtc.vblank_deadline =
+        qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + NV2A_VBLANK_PERIOD_NS;
+    timer_mod(d->vblank_timer, d->pcrtc.vblank_deadline);
 }
 
 static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
@@ -300,6 +345,7 @@ static void nv2a_reset(NV2AState *d)
     d->pfifo.pending_interrupts = 0;
     d->ptimer.pending_interrupts = 0;
     d->pcrtc.pending_interrupts = 0;
+    nv2a_start_vblank_timer(d);
 
     for (int i = 0; i < 256; i++) {
         d->puserdac.palette[i*3]   = i;
@@ -335,6 +381,12 @@ static void nv2a_realize(PCIDevice *dev, Error **errp)
     qemu_mutex_init(&d->pfifo.lock);
     qemu_cond_init(&d->pfifo.fifo_cond);
     qemu_cond_init(&d->pfifo.fifo_idle_cond);
+
+    qemu_mutex_init(&d->pcrtc.flip_lock);
+    qemu_cond_init(&d->pcrtc.flip_cond);
+
+    d->vblank_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nv2a_vblank, d);
+    nv2a_start_vblank_timer(d);
 }
 
 static void nv2a_exitfn(PCIDevice *dev)
@@ -344,10 +396,15 @@ static void nv2a_exitfn(PCIDevice *dev)
 
     d->exiting = true;
 
+    timer_free(d->vblank_timer);
+
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
     qemu_thread_join(&d->pfifo.thread);
 
     pgraph_destroy(&d->pgraph);
+
+    qemu_cond_destroy(&d->pcrtc.flip_cond);
+    qemu_mutex_destroy(&d->pcrtc.flip_lock);
 }
 
 static void nv2a_reset_hold(Object *obj, ResetType type)
@@ -406,7 +463,9 @@ static int nv2a_pre_load(void *opaque)
 static int nv2a_post_load(void *opaque, int version_id)
 {
     NV2AState *d = opaque;
+    d->pgraph.program_data_dirty = true;
     qatomic_set(&d->pgraph.flush_pending, true);
+    nv2a_start_vblank_timer(d);
     nv2a_unlock_fifo(d);
     return 0;
 }
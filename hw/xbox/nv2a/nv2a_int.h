@@ -66,6 +66,38 @@ typedef struct DMAObject {
     hwaddr limit;
 } DMAObject;
 
+/* Maximum number of methods decoded ahead of the puller */
+#define NV2A_PFIFO_METHOD_QUEUE_SIZE 128
+
+/*
+ * CACHE1 registers written while decoding, committed together once the
+ * puller has consumed the methods that produced them
+ */
+typedef struct PFIFOPusherState {
+    uint32_t dma_get;
+    uint32_t dma_state;
+    uint32_t dma_subroutine;
+    uint32_t dma_dcount;
+    uint32_t dma_data_shadow;
+    uint32_t dma_rsvd_shadow;
+    uint32_t dma_get_jmp_shadow;
+    uint32_t engine;
+    uint32_t pull1_engine;
+} PFIFOPusherState;
+
+typedef struct PFIFOMethodEntry {
+    PFIFOPusherState pre; /* Pusher state at the first data word */
+    uint32_t engine; /* Subchannel engine bindings after the method */
+    uint32_t subchannel;
+    uint32_t method;
+    uint32_t parameter;
+    uint32_t *parameters;
+    size_t num_words_available;
+    size_t max_lookahead_words;
+    unsigned int channel_id;
+    bool inc;
+} PFIFOMethodEntry;
+
 typedef struct NV2AState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -102,6 +134,10 @@ typedef struct NV2AState {
         QemuCond fifo_idle_cond;
         bool fifo_kick;
         bool halt;
+
+        /* Only accessed by the PFIFO thread */
+        PFIFOMethodEntry method_queue[NV2A_PFIFO_METHOD_QUEUE_SIZE];
+        unsigned int method_queue_len;
     } pfifo;
 
     struct {
@@ -127,6 +163,12 @@ typedef struct NV2AState {
         uint32_t enabled_interrupts;
         hwaddr start;
         uint32_t raster;
+        int64_t vblank_deadline;
+
+        /* Signalled when the guest points the CRTC at a new frame */
+        QemuMutex flip_lock;
+        QemuCond flip_cond;
+        unsigned int flip_count;
     } pcrtc;
 
     struct {
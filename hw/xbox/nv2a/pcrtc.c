@@ -67,6 +67,11 @@ void pcrtc_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
         // assert(val < memory_region_size(d->vram));
         d->pcrtc.start = val;
 
+        qemu_mutex_lock(&d->pcrtc.flip_lock);
+        d->pcrtc.flip_count++;
+        qemu_cond_broadcast(&d->pcrtc.flip_cond);
+        qemu_mutex_unlock(&d->pcrtc.flip_lock);
+
         NV2A_DPRINTF("PCRTC_START - %x %x %x %x\n",
                 d->vram_ptr[val+64], d->vram_ptr[val+64+1],
                 d->vram_ptr[val+64+2], d->vram_ptr[val+64+3]);
@@ -20,6 +20,7 @@
  */
 
 #include "nv2a_int.h"
+#include "capture.h"
 
 typedef struct RAMHTEntry {
     uint32_t handle;
@@ -122,124 +123,254 @@ static bool is_flip_stall_complete(NV2AState *d)
     return false;
 }
 
-static bool pfifo_stall_for_flip(NV2AState *d)
+/* Must be called with the pgraph lock held */
+static bool pfifo_puller_should_stall(NV2AState *d)
 {
-    bool should_stall = false;
+    PGRAPHState *pg = &d->pgraph;
 
-    if (qatomic_read(&d->pgraph.waiting_for_flip)) {
-        qemu_mutex_lock(&d->pgraph.lock);
+    if (pg->waiting_for_flip) {
         if (!is_flip_stall_complete(d)) {
-            should_stall = true;
-        } else {
-            d->pgraph.waiting_for_flip = false;
+            return true;
         }
-        qemu_mutex_unlock(&d->pgraph.lock);
+        pg->waiting_for_flip = false;
     }
 
-    return should_stall;
+    return pg->waiting_for_nop || pg->waiting_for_context_switch ||
+           !can_fifo_access(d);
 }
 
-static bool pfifo_puller_should_stall(NV2AState *d)
+static PFIFOPusherState pfifo_get_pusher_state(NV2AState *d)
 {
-    return pfifo_stall_for_flip(d) || qatomic_read(&d->pgraph.waiting_for_nop) ||
-           qatomic_read(&d->pgraph.waiting_for_context_switch) ||
-           !can_fifo_access(d);
+    return (PFIFOPusherState){
+        .dma_get = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET],
+        .dma_state = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE],
+        .dma_subroutine = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE],
+        .dma_dcount = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT],
+        .dma_data_shadow = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW],
+        .dma_rsvd_shadow = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW],
+        .dma_get_jmp_shadow =
+            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW],
+        .engine = d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE],
+        .pull1_engine = GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PULL1],
+                                 NV_PFIFO_CACHE1_PULL1_ENGINE),
+    };
 }
 
-static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
-                                uint32_t parameter, uint32_t *parameters,
-                                size_t num_words_available,
-                                size_t max_lookahead_words)
+static void pfifo_set_pusher_state(NV2AState *d, const PFIFOPusherState *s)
 {
-    if (pfifo_puller_should_stall(d)) {
-        return -1;
-    }
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET] = s->dma_get;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE] = s->dma_state;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE] = s->dma_subroutine;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT] = s->dma_dcount;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = s->dma_data_shadow;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW] = s->dma_rsvd_shadow;
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] = s->dma_get_jmp_shadow;
+    d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE] = s->engine;
+    SET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PULL1],
+             NV_PFIFO_CACHE1_PULL1_ENGINE, s->pull1_engine);
+}
 
-    uint32_t *pull0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL0];
-    uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
-    uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
-    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
-    ssize_t num_proc = -1;
+/* Pusher state after the puller consumed num_words of a queued method */
+static PFIFOPusherState pfifo_advance_pusher_state(const PFIFOMethodEntry *e,
+                                                   size_t num_words)
+{
+    PFIFOPusherState s = e->pre;
+    uint32_t method_count =
+        GET_MASK(s.dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
+
+    s.dma_get += num_words * 4;
+    if (e->inc) {
+        SET_MASK(s.dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                 (e->method + 4 * num_words) >> 2);
+    }
+    SET_MASK(s.dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+             method_count - MIN(method_count, num_words));
+    s.dma_dcount += num_words;
+
+    if (num_words) {
+        s.dma_data_shadow = ldl_le_p(&e->parameters[num_words - 1]);
+        s.engine = e->engine;
+        s.pull1_engine = GET_MASK(e->engine, 3 << (4 * e->subchannel));
+    }
 
-    // TODO think more about locking
+    return s;
+}
 
-    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS) ||
-        (*status & NV_PFIFO_CACHE1_STATUS_LOW_MARK)) {
-        return -1;
-    }
+/*
+ * Queue a method for the puller. Object handles are resolved here, while the
+ * pfifo lock is still held, as RAMHT lookup depends on PFIFO registers. The
+ * engine binding is only recorded in the entry, it takes effect when the
+ * method is consumed.
+ */
+static void pfifo_queue_method(NV2AState *d, const PFIFOPusherState *pre,
+                               uint32_t word, uint32_t *word_ptr,
+                               size_t num_words_available)
+{
+    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
 
-    uint32_t method = method_entry & 0x1FFC;
+    uint32_t method_type =
+        GET_MASK(pre->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE);
     uint32_t subchannel =
-        GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL);
-    bool inc = !GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE);
-
-    if (method == 0) {
-        RAMHTEntry entry = ramht_lookup(d, parameter);
+        GET_MASK(pre->dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL);
+    uint32_t method =
+        GET_MASK(pre->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD) << 2;
+    uint32_t method_count =
+        GET_MASK(pre->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
+
+    assert((method & 3) == 0);
+    assert(d->pfifo.method_queue_len < NV2A_PFIFO_METHOD_QUEUE_SIZE);
+
+    PFIFOMethodEntry *e =
+        &d->pfifo.method_queue[d->pfifo.method_queue_len++];
+    e->pre = *pre;
+    e->subchannel = subchannel;
+    e->method = method & 0x1FFC;
+    e->parameter = word;
+    e->parameters = word_ptr;
+    e->num_words_available = MIN(method_count, num_words_available);
+    e->max_lookahead_words = num_words_available;
+    e->inc = method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC;
+    e->channel_id = 0;
+    e->engine = pre->engine;
+
+    *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+
+    if (e->method == 0) {
+        RAMHTEntry entry = ramht_lookup(d, word);
         assert(entry.valid);
         // assert(entry.channel_id == state->channel_id);
         assert(entry.engine == ENGINE_GRAPHICS);
 
         /* the engine is bound to the subchannel */
         assert(subchannel < 8);
-        SET_MASK(*engine_reg, 3 << (4*subchannel), entry.engine);
-        SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, entry.engine);
-
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
-
-        // Switch contexts if necessary
-        if (can_fifo_access(d)) {
-            pgraph_context_switch(d, entry.channel_id);
-            if (!d->pgraph.waiting_for_context_switch) {
-                num_proc =
-                    pgraph_method(d, subchannel, 0, entry.instance, parameters,
-                                  num_words_available, max_lookahead_words, inc);
-            }
-        }
+        SET_MASK(e->engine, 3 << (4*subchannel), entry.engine);
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-
-    } else if (method >= 0x100) {
+        e->parameter = entry.instance;
+        e->channel_id = entry.channel_id;
+    } else if (e->method >= 0x100) {
         // method passed to engine
 
         /* methods that take objects.
          * TODO: Check this range is correct for the nv2a */
-        if (method >= 0x180 && method < 0x200) {
-            //bql_lock();
-            RAMHTEntry entry = ramht_lookup(d, parameter);
+        if (e->method >= 0x180 && e->method < 0x200) {
+            RAMHTEntry entry = ramht_lookup(d, word);
             assert(entry.valid);
             // assert(entry.channel_id == state->channel_id);
-            parameter = entry.instance;
-            //bql_unlock();
+            e->parameter = entry.instance;
         }
 
-        enum FIFOEngine engine = GET_MASK(*engine_reg, 3 << (4*subchannel));
+        enum FIFOEngine engine = GET_MASK(e->engine, 3 << (4*subchannel));
         assert(engine == ENGINE_GRAPHICS);
-        SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
+    } else {
+        assert(false);
+    }
+}
+
+/*
+ * Execute the queued methods. The pfifo lock is dropped and the pgraph lock
+ * taken once for the whole queue rather than once per method.
+ *
+ * On return, *state holds the pusher state following the last method that
+ * was fully consumed. Methods after a stall, or after a method that consumed
+ * a different number of words than was assumed when decoding, are discarded
+ * and will be decoded again from the pushbuffer. Methods that PGRAPH merged
+ * into a batched draw are skipped instead.
+ *
+ * Returns false if the puller stalled.
+ */
+static bool pfifo_run_puller(NV2AState *d, PFIFOPusherState *state)
+{
+    uint32_t *pull0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL0];
+    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
+    PFIFOMethodEntry *queue = d->pfifo.method_queue;
+    unsigned int queue_len = d->pfifo.method_queue_len;
+    bool stalled = false;
+    bool processed = false;
+
+    d->pfifo.method_queue_len = 0;
+
+    if (!queue_len) {
+        return true;
+    }
+
+    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS)) {
+        *state = queue[0].pre;
+        return false;
+    }
+
+    // TODO: this is fucked
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&d->pgraph.lock);
 
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
+    for (unsigned int i = 0; i < queue_len; i++) {
+        PFIFOMethodEntry *e = &queue[i];
 
-        if (can_fifo_access(d)) {
-            num_proc =
-                pgraph_method(d, subchannel, method, parameter, parameters,
-                              num_words_available, max_lookahead_words, inc);
+        if (pfifo_puller_should_stall(d)) {
+            *state = e->pre;
+            stalled = true;
+            break;
         }
 
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-    } else {
-        assert(false);
+        if (e->method == 0) {
+            // Switch contexts if necessary
+            pgraph_context_switch(d, e->channel_id);
+            if (d->pgraph.waiting_for_context_switch) {
+                *state = e->pre;
+                stalled = true;
+                break;
+            }
+            nv2a_capture_context(d, e->channel_id);
+        }
+
+        nv2a_capture_pre_method(d, e->subchannel, e->method, e->parameter);
+        ssize_t num_proc =
+            pgraph_method(d, e->subchannel, e->method, e->parameter,
+                          e->parameters, e->num_words_available,
+                          e->max_lookahead_words, e->inc);
+        nv2a_capture_method(d, e->subchannel, e->method, e->parameter,
+                            e->parameters, e->num_words_available,
+                            e->max_lookahead_words, e->inc, num_proc);
+        processed = true;
+
+        if ((size_t)num_proc > e->num_words_available) {
+            /*
+             * PGRAPH merged the END and BEGIN methods that follow into the
+             * current batch. Skip their entries and keep executing the
+             * queue, rather than discarding and decoding it again.
+             */
+            uint32_t merged_end = e->pre.dma_get + num_proc * 4;
+            unsigned int j = i + 1;
+            while (j < queue_len && queue[j].pre.dma_get < merged_end) {
+                j++;
+            }
+            PFIFOMethodEntry *last = &queue[j - 1];
+            if (j > i + 1 &&
+                last->pre.dma_get + last->num_words_available * 4 ==
+                    merged_end) {
+                i = j - 1;
+                if (j < queue_len && queue[j].pre.dma_get == merged_end + 4) {
+                    continue;
+                }
+                *state = pfifo_advance_pusher_state(last,
+                                                    last->num_words_available);
+                break;
+            }
+        }
+
+        if ((size_t)num_proc != e->num_words_available) {
+            *state = pfifo_advance_pusher_state(e, num_proc);
+            break;
+        }
     }
 
-    if (num_proc > 0) {
+    qemu_mutex_unlock(&d->pgraph.lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    if (processed) {
         *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
     }
 
-    return num_proc;
+    return !stalled;
 }
 
 static bool pfifo_pusher_should_stall(NV2AState *d)
@@ -248,56 +379,23 @@ static bool pfifo_pusher_should_stall(NV2AState *d)
            qatomic_read(&d->pgraph.waiting_for_nop);
 }
 
-static void pfifo_run_pusher(NV2AState *d)
+/*
+ * Decode pushbuffer commands into the method queue until it is full or the
+ * pushbuffer is empty. *s is advanced as if every queued method will be
+ * fully consumed by the puller.
+ */
+static void pfifo_decode_methods(NV2AState *d, uint8_t *dma, hwaddr dma_len,
+                                 PFIFOPusherState *s)
 {
-    uint32_t *push0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH0];
-    uint32_t *push1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1];
-    uint32_t *dma_subroutine = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE];
-    uint32_t *dma_state = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE];
-    uint32_t *dma_push = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUSH];
-    uint32_t *dma_get = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
     uint32_t *dma_put = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
-    uint32_t *dma_dcount = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT];
-    uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
-
-    if (!GET_MASK(*push0, NV_PFIFO_CACHE1_PUSH0_ACCESS) ||
-        !GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS) ||
-        GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_STATUS)) {
-        return;
-    }
-
-    // TODO: should we become busy here??
-    // NV_PFIFO_CACHE1_DMA_PUSH_STATE _BUSY
 
-    unsigned int channel_id = GET_MASK(*push1,
-                                       NV_PFIFO_CACHE1_PUSH1_CHID);
-
-
-    /* Channel running DMA mode */
-    uint32_t channel_modes = d->pfifo.regs[NV_PFIFO_MODE];
-    assert(channel_modes & (1 << channel_id));
-
-    assert(GET_MASK(*push1, NV_PFIFO_CACHE1_PUSH1_MODE)
-            == NV_PFIFO_CACHE1_PUSH1_MODE_DMA);
-
-    /* We're running so there should be no pending errors... */
-    assert(GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)
-            == NV_PFIFO_CACHE1_DMA_STATE_ERROR_NONE);
-
-    hwaddr dma_instance =
-        GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_DMA_INSTANCE],
-                 NV_PFIFO_CACHE1_DMA_INSTANCE_ADDRESS) << 4;
-
-    hwaddr dma_len;
-    uint8_t *dma = nv_dma_map(d, dma_instance, &dma_len);
-
-    while (!pfifo_pusher_should_stall(d)) {
-        uint32_t dma_get_v = *dma_get;
+    while (d->pfifo.method_queue_len < NV2A_PFIFO_METHOD_QUEUE_SIZE) {
+        uint32_t dma_get_v = s->dma_get;
         uint32_t dma_put_v = *dma_put;
         if (dma_get_v == dma_put_v) break;
         if (dma_get_v >= dma_len) {
             assert(false);
-            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+            SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
                      NV_PFIFO_CACHE1_DMA_STATE_ERROR_PROTECTION);
             break;
         }
@@ -310,75 +408,44 @@ static void pfifo_run_pusher(NV2AState *d)
         uint32_t word = ldl_le_p(word_ptr);
         dma_get_v += 4;
 
-        uint32_t method_type =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE);
-        uint32_t method_subchannel =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL);
-        uint32_t method =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD) << 2;
         uint32_t method_count =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
+            GET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
 
         uint32_t subroutine_state =
-            GET_MASK(*dma_subroutine, NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE);
+            GET_MASK(s->dma_subroutine, NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE);
 
         if (method_count) {
-            /* data word of methods command */
-            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = word;
-
-            assert((method & 3) == 0);
-            uint32_t method_entry = 0;
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_ADDRESS, method >> 2);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE, method_type);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL,
-                     method_subchannel);
-
-            *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
-
-            ssize_t num_words_processed =
-                pfifo_run_puller(d, method_entry, word, word_ptr,
-                                 MIN(method_count, num_words_available),
-                                 num_words_available);
-            if (num_words_processed < 0) {
-                break;
-            }
-
-            dma_get_v += (num_words_processed-1)*4;
-
-            if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
-                         (method + 4*num_words_processed) >> 2);
-            }
-            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
-                     method_count - MIN(method_count, num_words_processed));
-
-            (*dma_dcount) += num_words_processed;
+            /* data word of methods command, see pfifo_advance_pusher_state */
+            PFIFOPusherState pre = *s;
+            pfifo_queue_method(d, &pre, word, word_ptr, num_words_available);
+            PFIFOMethodEntry *e =
+                &d->pfifo.method_queue[d->pfifo.method_queue_len - 1];
+            *s = pfifo_advance_pusher_state(e, e->num_words_available);
+            continue;
         } else {
             /* no command active - this is the first word of a new one */
-            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW] = word;
+            s->dma_rsvd_shadow = word;
 
             /* match all forms */
             if ((word & 0xe0000003) == 0x20000000) {
                 /* old jump */
-                d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
-                    dma_get_v;
+                s->dma_get_jmp_shadow = dma_get_v;
                 dma_get_v = word & 0x1fffffff;
                 NV2A_DPRINTF("pb OLD_JMP 0x%x\n", dma_get_v);
             } else if ((word & 3) == 1) {
                 /* jump */
-                d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
-                    dma_get_v;
+                s->dma_get_jmp_shadow = dma_get_v;
                 dma_get_v = word & 0xfffffffc;
                 NV2A_DPRINTF("pb JMP 0x%x\n", dma_get_v);
             } else if ((word & 3) == 2) {
                 /* call */
                 if (subroutine_state) {
-                    SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+                    SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
                              NV_PFIFO_CACHE1_DMA_STATE_ERROR_CALL);
                     break;
                 } else {
-                    *dma_subroutine = dma_get_v;
-                    SET_MASK(*dma_subroutine,
+                    s->dma_subroutine = dma_get_v;
+                    SET_MASK(s->dma_subroutine,
                              NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 1);
                     dma_get_v = word & 0xfffffffc;
                     NV2A_DPRINTF("pb CALL 0x%x\n", dma_get_v);
@@ -386,50 +453,108 @@ static void pfifo_run_pusher(NV2AState *d)
             } else if (word == 0x00020000) {
                 /* return */
                 if (!subroutine_state) {
-                    SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+                    SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
                              NV_PFIFO_CACHE1_DMA_STATE_ERROR_RETURN);
                     // break;
                 } else {
-                    dma_get_v = *dma_subroutine & 0xfffffffc;
-                    SET_MASK(*dma_subroutine,
+                    dma_get_v = s->dma_subroutine & 0xfffffffc;
+                    SET_MASK(s->dma_subroutine,
                              NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 0);
                     NV2A_DPRINTF("pb RET 0x%x\n", dma_get_v);
                 }
             } else if ((word & 0xe0030003) == 0) {
                 /* increasing methods */
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
                          (word & 0x1fff) >> 2 );
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
                          (word >> 13) & 7);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
                          (word >> 18) & 0x7ff);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
                          NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC);
-                *dma_dcount = 0;
+                s->dma_dcount = 0;
             } else if ((word & 0xe0030003) == 0x40000000) {
                 /* non-increasing methods */
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
                          (word & 0x1fff) >> 2 );
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
                          (word >> 13) & 7);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
                          (word >> 18) & 0x7ff);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
                          NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_NON_INC);
-                *dma_dcount = 0;
+                s->dma_dcount = 0;
             } else {
                 NV2A_DPRINTF("pb reserved cmd 0x%x - 0x%x\n",
                              dma_get_v, word);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+                SET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
                          NV_PFIFO_CACHE1_DMA_STATE_ERROR_RESERVED_CMD);
                 // break;
                 assert(false);
             }
         }
 
-        *dma_get = dma_get_v;
+        s->dma_get = dma_get_v;
+
+        if (GET_MASK(s->dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)) {
+            break;
+        }
+    }
+}
+
+static void pfifo_run_pusher(NV2AState *d)
+{
+    uint32_t *push0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH0];
+    uint32_t *push1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1];
+    uint32_t *dma_state = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE];
+    uint32_t *dma_push = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUSH];
+
+    if (!GET_MASK(*push0, NV_PFIFO_CACHE1_PUSH0_ACCESS) ||
+        !GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS) ||
+        GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_STATUS)) {
+        return;
+    }
+
+    // TODO: should we become busy here??
+    // NV_PFIFO_CACHE1_DMA_PUSH_STATE _BUSY
+
+    unsigned int channel_id = GET_MASK(*push1,
+                                       NV_PFIFO_CACHE1_PUSH1_CHID);
+
 
-        if (GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)) {
+    /* Channel running DMA mode */
+    uint32_t channel_modes = d->pfifo.regs[NV_PFIFO_MODE];
+    assert(channel_modes & (1 << channel_id));
+
+    assert(GET_MASK(*push1, NV_PFIFO_CACHE1_PUSH1_MODE)
+            == NV_PFIFO_CACHE1_PUSH1_MODE_DMA);
+
+    /* We're running so there should be no pending errors... */
+    assert(GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)
+            == NV_PFIFO_CACHE1_DMA_STATE_ERROR_NONE);
+
+    hwaddr dma_instance =
+        GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_DMA_INSTANCE],
+                 NV_PFIFO_CACHE1_DMA_INSTANCE_ADDRESS) << 4;
+
+    hwaddr dma_len;
+    uint8_t *dma = nv_dma_map(d, dma_instance, &dma_len);
+
+    /*
+     * The pushbuffer, shadow and engine registers are only updated once
+     * queued methods have been executed, so the guest never sees them run
+     * ahead of the puller.
+     */
+    while (!pfifo_pusher_should_stall(d)) {
+        PFIFOPusherState start = pfifo_get_pusher_state(d);
+        PFIFOPusherState state = start;
+
+        pfifo_decode_methods(d, dma, dma_len, &state);
+        bool stalled = !pfifo_run_puller(d, &state);
+        pfifo_set_pusher_state(d, &state);
+
+        if (stalled || !memcmp(&start, &state, sizeof(state)) ||
+            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)) {
             break;
         }
     }
@@ -458,6 +583,11 @@ void *pfifo_thread(void *arg)
     rcu_register_thread();
 
     qemu_mutex_lock(&d->pfifo.lock);
+
+    if (nv2a_replay_is_enabled()) {
+        nv2a_replay_run(d);
+    }
+
     while (true) {
         d->pfifo.fifo_kick = false;
 
@@ -473,7 +603,9 @@ void *pfifo_thread(void *arg)
             qemu_cond_broadcast(&d->pfifo.fifo_idle_cond);
 
             // Both the pusher and puller are waiting for some action
+            pgraph_dynamic_scale_begin_idle(&d->pgraph);
             qemu_cond_wait(&d->pfifo.fifo_cond, &d->pfifo.lock);
+            pgraph_dynamic_scale_end_idle(&d->pgraph);
         }
 
         if (d->exiting) {
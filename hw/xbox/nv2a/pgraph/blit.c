@@ -0,0 +1,222 @@
+/*
+ * QEMU Geforce NV2A image blit routines
+ *
+ * Copyright (c) 2012 espes
+ * Copyright (c) 2015 Jannik Vogel
+ * Copyright (c) 2018-2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "blit.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BLIT_HAVE_SSE2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BLIT_HAVE_NEON 1
+#endif
+
+/*
+ * Hardware blends with an 8-bit beta k against a full scale of 255:
+ *
+ *   out = (src * (k << 7) + dst * (0x7f80 - (k << 7))) / 0x7f80
+ *       = (src * k + dst * (255 - k)) / 255
+ *
+ * The numerator fits in 16 bits, and for x <= 255 * 255,
+ * x / 255 == (x + 1 + (x >> 8)) >> 8, so the whole blend can be done in
+ * 16-bit lanes without a division.
+ */
+static inline uint8_t blend_channel(uint8_t src, uint8_t dst, unsigned int k)
+{
+    unsigned int x = src * k + dst * (255 - k);
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+static void blend_row_generic(uint8_t *dest, const uint8_t *source,
+                              unsigned int width, unsigned int k,
+                              bool patch_alpha, uint8_t alpha)
+{
+    for (unsigned int x = 0; x < width; x++) {
+        for (unsigned int ch = 0; ch < 3; ch++) {
+            dest[x * 4 + ch] =
+                blend_channel(source[x * 4 + ch], dest[x * 4 + ch], k);
+        }
+        if (patch_alpha) {
+            dest[x * 4 + 3] = alpha;
+        }
+    }
+}
+
+static void patch_alpha_row_generic(uint8_t *dest, unsigned int width,
+                                    uint8_t alpha)
+{
+    for (unsigned int x = 0; x < width; x++) {
+        dest[x * 4 + 3] = alpha;
+    }
+}
+
+#if defined(BLIT_HAVE_SSE2)
+
+static void blend_row(uint8_t *dest, const uint8_t *source,
+                      unsigned int width, unsigned int k, bool patch_alpha,
+                      uint8_t alpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i src_mul = _mm_set1_epi16(k);
+    const __m128i dst_mul = _mm_set1_epi16(255 - k);
+    const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i keep_mask = _mm_set1_epi32(patch_alpha ? 0 : 0xff000000);
+    const __m128i alpha_bits = _mm_set1_epi32(patch_alpha ?
+                                              (uint32_t)alpha << 24 : 0);
+
+    unsigned int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(source + x * 4));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + x * 4));
+
+        __m128i lo = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), src_mul),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), dst_mul));
+        __m128i hi = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), src_mul),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), dst_mul));
+        lo = _mm_srli_epi16(
+            _mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(
+            _mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+
+        __m128i out = _mm_and_si128(_mm_packus_epi16(lo, hi), rgb_mask);
+        out = _mm_or_si128(out, _mm_and_si128(d, keep_mask));
+        out = _mm_or_si128(out, alpha_bits);
+        _mm_storeu_si128((__m128i *)(dest + x * 4), out);
+    }
+
+    blend_row_generic(dest + x * 4, source + x * 4, width - x, k,
+                      patch_alpha, alpha);
+}
+
+static void patch_alpha_row(uint8_t *dest, unsigned int width, uint8_t alpha)
+{
+    const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i alpha_bits = _mm_set1_epi32((uint32_t)alpha << 24);
+
+    unsigned int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dest + x * 4));
+        d = _mm_or_si128(_mm_and_si128(d, rgb_mask), alpha_bits);
+        _mm_storeu_si128((__m128i *)(dest + x * 4), d);
+    }
+
+    patch_alpha_row_generic(dest + x * 4, width - x, alpha);
+}
+
+#elif defined(BLIT_HAVE_NEON)
+
+static void blend_row(uint8_t *dest, const uint8_t *source,
+                      unsigned int width, unsigned int k, bool patch_alpha,
+                      uint8_t alpha)
+{
+    const uint8x8_t src_mul = vdup_n_u8(k);
+    const uint8x8_t dst_mul = vdup_n_u8(255 - k);
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x4_t s = vld4_u8(source + x * 4);
+        uint8x8x4_t d = vld4_u8(dest + x * 4);
+
+        for (int ch = 0; ch < 3; ch++) {
+            uint16x8_t v = vmlal_u8(vmull_u8(s.val[ch], src_mul), d.val[ch],
+                                    dst_mul);
+            v = vaddq_u16(vaddq_u16(v, vdupq_n_u16(1)), vshrq_n_u16(v, 8));
+            d.val[ch] = vshrn_n_u16(v, 8);
+        }
+        if (patch_alpha) {
+            d.val[3] = vdup_n_u8(alpha);
+        }
+
+        vst4_u8(dest + x * 4, d);
+    }
+
+    blend_row_generic(dest + x * 4, source + x * 4, width - x, k,
+                      patch_alpha, alpha);
+}
+
+static void patch_alpha_row(uint8_t *dest, unsigned int width, uint8_t alpha)
+{
+    const uint32x4_t rgb_mask = vdupq_n_u32(0x00ffffff);
+    const uint32x4_t alpha_bits = vdupq_n_u32((uint32_t)alpha << 24);
+
+    unsigned int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        uint32x4_t d = vld1q_u32((const uint32_t *)(dest + x * 4));
+        d = vorrq_u32(vandq_u32(d, rgb_mask), alpha_bits);
+        vst1q_u32((uint32_t *)(dest + x * 4), d);
+    }
+
+    patch_alpha_row_generic(dest + x * 4, width - x, alpha);
+}
+
+#else
+
+#define blend_row blend_row_generic
+#define patch_alpha_row patch_alpha_row_generic
+
+#endif
+
+static bool rows_overlap(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    return a < b + len && b < a + len;
+}
+
+void image_blit_rect(uint8_t *dest, unsigned int dest_pitch,
+                     const uint8_t *source, unsigned int source_pitch,
+                     unsigned int width, unsigned int height,
+                     unsigned int bytes_per_pixel,
+                     ImageBlitOperation operation, uint32_t beta,
+                     bool patch_alpha, uint8_t alpha)
+{
+    if (operation == IMAGE_BLIT_SRCCOPY) {
+        size_t row_size = (size_t)width * bytes_per_pixel;
+        for (unsigned int y = 0; y < height; y++) {
+            memmove(dest, source, row_size);
+            if (patch_alpha) {
+                /* Row is still in cache */
+                patch_alpha_row(dest, width, alpha);
+            }
+            source += source_pitch;
+            dest += dest_pitch;
+        }
+        return;
+    }
+
+    /* FIXME: Blend is always done as 32bpp */
+    unsigned int k = beta >> 23;
+    for (unsigned int y = 0; y < height; y++) {
+        if (rows_overlap(dest, source, (size_t)width * 4)) {
+            /* Vector loads would read pixels the loop already wrote */
+            blend_row_generic(dest, source, width, k, patch_alpha, alpha);
+        } else {
+            blend_row(dest, source, width, k, patch_alpha, alpha);
+        }
+        source += source_pitch;
+        dest += dest_pitch;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * QEMU Geforce NV2A image blit routines
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_BLIT_H
+#define HW_XBOX_NV2A_PGRAPH_BLIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum ImageBlitOperation {
+    IMAGE_BLIT_SRCCOPY,
+    IMAGE_BLIT_BLEND_AND,
+} ImageBlitOperation;
+
+/*
+ * CPU implementation of an NV09F blit between two linear images in memory.
+ *
+ * Rows are processed top to bottom and each row is moved as if by memmove, so
+ * overlapping blits within one surface behave as they always have.
+ *
+ * BLEND_AND mixes the RGB channels of 32bpp pixels by beta (the BetaState
+ * value, of which only bits 30:23 are implemented) and leaves destination
+ * alpha untouched. If patch_alpha is set, the alpha byte of every written
+ * 32bpp pixel is then replaced with alpha, as required by the X8R8G8B8
+ * color formats. Both happen in a single pass over each row.
+ */
+void image_blit_rect(uint8_t *dest, unsigned int dest_pitch,
+                     const uint8_t *source, unsigned int source_pitch,
+                     unsigned int width, unsigned int height,
+                     unsigned int bytes_per_pixel,
+                     ImageBlitOperation operation, uint32_t beta,
+                     bool patch_alpha, uint8_t alpha);
+
+#endif
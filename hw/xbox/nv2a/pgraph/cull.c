@@ -0,0 +1,346 @@
+/*
+ * Geforce NV2A PGRAPH CPU batch culling
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hw/xbox/nv2a/nv2a_int.h"
+#include "ui/xemu-settings.h"
+#include "vsh-cpu.h"
+
+/*
+ * Before a batch is handed to the renderer, its vertices are transformed on
+ * the CPU and the batch is dropped if no triangle can produce a fragment,
+ * because all of them are outside the same clip plane or have coincident
+ * vertices. Anything the CPU transform cannot model exactly is drawn as usual.
+ */
+
+/* Larger batches are rarely invisible and would cost more than they save */
+#define CULL_MAX_VERTICES 4096
+/* Translated programs are dropped all at once when the cache is full */
+#define CULL_MAX_PROGRAMS 1024
+#define CULL_CHUNK_SIZE 32
+
+typedef struct CullVertex {
+    float x, y;
+    uint8_t clip;
+} CullVertex;
+
+void pgraph_cull_init(PGRAPHState *pg)
+{
+    pg->cull_programs =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                              (GDestroyNotify)vsh_cpu_program_free);
+    pg->cull_fixed_function =
+        vsh_cpu_compile_fixed_function(NV_IGRAPH_XF_XFCTX_CMAT0);
+}
+
+void pgraph_cull_finalize(PGRAPHState *pg)
+{
+    g_hash_table_destroy(pg->cull_programs);
+    pg->cull_programs = NULL;
+    vsh_cpu_program_free(pg->cull_fixed_function);
+    pg->cull_fixed_function = NULL;
+    g_free(pg->cull_vertices);
+    pg->cull_vertices = NULL;
+    pg->cull_vertices_capacity = 0;
+}
+
+/*
+ * Programs that fail to translate are cached as NULL and never culled. The
+ * software renderer shares the translations.
+ */
+const VshCpuProgram *pgraph_get_vsh_cpu_program(PGRAPHState *pg)
+{
+    int program_start = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_C),
+                                 NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
+    pgraph_update_vertex_program_cache(pg, program_start);
+
+    uint64_t key = pg->program_cache_hash;
+    gpointer prog;
+    if (g_hash_table_lookup_extended(pg->cull_programs, &key, NULL, &prog)) {
+        return prog;
+    }
+
+    if (g_hash_table_size(pg->cull_programs) >= CULL_MAX_PROGRAMS) {
+        g_hash_table_remove_all(pg->cull_programs);
+    }
+
+    prog = vsh_cpu_compile_program(
+        (const uint32_t (*)[4])&pg->program_data[program_start],
+        pg->program_cache_length);
+    g_hash_table_insert(pg->cull_programs, g_memdup2(&key, sizeof(key)),
+                        prog);
+    return prog;
+}
+
+/*
+ * Same extent as the software renderer binds, in non anti-aliased pixels so
+ * it matches the coordinates the transform produces.
+ */
+static void get_viewport(PGRAPHState *pg, bool fixed_function,
+                         VshCpuViewport *vp)
+{
+    unsigned int width, height;
+    if (pg->surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE) {
+        width = 1 << pg->surface_shape.log_width;
+        height = 1 << pg->surface_shape.log_height;
+    } else {
+        unsigned int aa_width = 1, aa_height = 1;
+        pgraph_apply_anti_aliasing_factor(pg, &aa_width, &aa_height);
+        width = pg->surface_shape.clip_width +
+                DIV_ROUND_UP(pg->surface_shape.clip_x, aa_width);
+        height = pg->surface_shape.clip_height +
+                 DIV_ROUND_UP(pg->surface_shape.clip_y, aa_height);
+    }
+
+    memset(vp, 0, sizeof(*vp));
+    vp->width = width;
+    vp->height = height;
+    vp->fixed_function = fixed_function;
+    vp->z_perspective = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0) &
+                        NV_PGRAPH_CONTROL_0_Z_PERSPECTIVE_ENABLE;
+
+    /* Depth clamping and floating point depth keep everything, be safe */
+    bool z_clamp = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_ZCOMPRESSOCCLUDE),
+                            NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN) ==
+                   NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN_CLAMP;
+    if (!z_clamp && !pg->surface_shape.z_format) {
+        uint32_t zclip_min = pgraph_reg_r(pg, NV_PGRAPH_ZCLIPMIN);
+        uint32_t zclip_max = pgraph_reg_r(pg, NV_PGRAPH_ZCLIPMAX);
+        vp->depth_clip = true;
+        memcpy(&vp->zmin, &zclip_min, sizeof(vp->zmin));
+        memcpy(&vp->zmax, &zclip_max, sizeof(vp->zmax));
+    }
+
+    if (fixed_function) {
+        const float *vpoff =
+            (const float *)pg->vsh_constants[NV_IGRAPH_XF_XFCTX_VPOFF];
+        vp->offset_x = vpoff[0];
+        vp->offset_y = vpoff[1];
+    }
+}
+
+static CullVertex *reserve_vertices(PGRAPHState *pg, unsigned int count)
+{
+    if (count > pg->cull_vertices_capacity) {
+        pg->cull_vertices_capacity = MAX(count, pg->cull_vertices_capacity * 2);
+        pg->cull_vertices =
+            g_renew(CullVertex, pg->cull_vertices, pg->cull_vertices_capacity);
+    }
+    return pg->cull_vertices;
+}
+
+static void transform_vertices(PGRAPHState *pg, const VshCpuProgram *prog,
+                               const VshCpuViewport *vp,
+                               const PGRAPHVertexFetch *f,
+                               const uint32_t *elements, unsigned int start,
+                               unsigned int count, CullVertex *out)
+{
+    float inputs[CULL_CHUNK_SIZE][VSH_CPU_INPUTS][4];
+    float outputs[CULL_CHUNK_SIZE][VSH_CPU_OUTPUTS][4];
+    float screen[CULL_CHUNK_SIZE][4];
+    uint8_t clip[CULL_CHUNK_SIZE];
+
+    for (unsigned int base = 0; base < count; base += CULL_CHUNK_SIZE) {
+        unsigned int n = MIN(count - base, CULL_CHUNK_SIZE);
+
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int index =
+                elements ? elements[base + i] : start + base + i;
+            pgraph_fetch_vertex(pg, f, index, inputs[i]);
+        }
+        vsh_cpu_execute(prog, (const float (*)[4])pg->vsh_constants,
+                        (const float (*)[VSH_CPU_INPUTS][4])inputs, outputs,
+                        n);
+        vsh_cpu_project(vp, (const float (*)[VSH_CPU_OUTPUTS][4])outputs,
+                        screen, clip, n);
+
+        for (unsigned int i = 0; i < n; i++) {
+            out[base + i].x = screen[i][0];
+            out[base + i].y = screen[i][1];
+            out[base + i].clip = clip[i];
+        }
+    }
+}
+
+static bool same_position(const CullVertex *a, const CullVertex *b)
+{
+    return !memcmp(&a->x, &b->x, sizeof(a->x)) &&
+           !memcmp(&a->y, &b->y, sizeof(a->y));
+}
+
+static bool is_triangle_invisible(const CullVertex *a, const CullVertex *b,
+                                  const CullVertex *c, bool cull_degenerate)
+{
+    if (a->clip & b->clip & c->clip) {
+        return true;
+    }
+    if (!cull_degenerate || ((a->clip | b->clip | c->clip) & VSH_CPU_CLIP_W)) {
+        return false;
+    }
+    return same_position(a, b) || same_position(b, c) || same_position(a, c);
+}
+
+/* Walk the triangles of the primitive as the software renderer does */
+static bool are_primitives_invisible(unsigned int primitive_mode,
+                                     const CullVertex *v, unsigned int count,
+                                     bool cull_degenerate)
+{
+    switch (primitive_mode) {
+    case PRIM_TYPE_TRIANGLES:
+        for (unsigned int i = 0; i + 2 < count; i += 3) {
+            if (!is_triangle_invisible(&v[i], &v[i + 1], &v[i + 2],
+                                       cull_degenerate)) {
+                return false;
+            }
+        }
+        return true;
+    case PRIM_TYPE_TRIANGLE_STRIP:
+        for (unsigned int i = 0; i + 2 < count; i++) {
+            if (!is_triangle_invisible(&v[i], &v[i + 1], &v[i + 2],
+                                       cull_degenerate)) {
+                return false;
+            }
+        }
+        return true;
+    case PRIM_TYPE_TRIANGLE_FAN:
+    case PRIM_TYPE_POLYGON:
+        for (unsigned int i = 1; i + 1 < count; i++) {
+            if (!is_triangle_invisible(&v[0], &v[i], &v[i + 1],
+                                       cull_degenerate)) {
+                return false;
+            }
+        }
+        return true;
+    case PRIM_TYPE_QUADS:
+        for (unsigned int i = 0; i + 3 < count; i += 4) {
+            if (!is_triangle_invisible(&v[i], &v[i + 1], &v[i + 2],
+                                       cull_degenerate) ||
+                !is_triangle_invisible(&v[i], &v[i + 2], &v[i + 3],
+                                       cull_degenerate)) {
+                return false;
+            }
+        }
+        return true;
+    case PRIM_TYPE_QUAD_STRIP:
+        for (unsigned int i = 0; i + 3 < count; i += 2) {
+            if (!is_triangle_invisible(&v[i], &v[i + 1], &v[i + 3],
+                                       cull_degenerate) ||
+                !is_triangle_invisible(&v[i], &v[i + 3], &v[i + 2],
+                                       cull_degenerate)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        /* Points and lines have a width, don't bother */
+        return false;
+    }
+}
+
+static unsigned int get_batch_vertex_count(PGRAPHState *pg,
+                                           const PGRAPHVertexFetch *f)
+{
+    if (pg->draw_arrays_length) {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < pg->draw_arrays_length; i++) {
+            count += pg->draw_arrays_count[i];
+        }
+        return count;
+    } else if (pg->inline_elements_length) {
+        return pg->inline_elements_length;
+    } else if (pg->inline_buffer_length) {
+        return pg->inline_buffer_length;
+    }
+    return f->inline_array_vertices;
+}
+
+bool pgraph_cull_batch(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!g_config.perf.cull_batches || pg->zpass_pixel_count_enable) {
+        return false;
+    }
+
+    uint32_t csv0_d = pgraph_reg_r(pg, NV_PGRAPH_CSV0_D);
+    unsigned int mode = GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_MODE);
+    bool fixed_function = mode == 0;
+    if (!fixed_function && mode != 2) {
+        return false;
+    }
+    if (fixed_function && GET_MASK(csv0_d, NV_PGRAPH_CSV0_D_SKIN)) {
+        return false;
+    }
+
+    const VshCpuProgram *prog =
+        fixed_function ? pg->cull_fixed_function :
+                         pgraph_get_vsh_cpu_program(pg);
+    if (!prog) {
+        return false;
+    }
+
+    PGRAPHVertexFetch f;
+    pgraph_setup_vertex_fetch(d, &f);
+    unsigned int count = get_batch_vertex_count(pg, &f);
+    if (!count || count > CULL_MAX_VERTICES) {
+        return false;
+    }
+
+    VshCpuViewport vp;
+    get_viewport(pg, fixed_function, &vp);
+
+    /* Degenerate triangles still draw edges and points in other modes */
+    uint32_t setupraster = pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER);
+    bool cull_degenerate =
+        GET_MASK(setupraster, NV_PGRAPH_SETUPRASTER_FRONTFACEMODE) ==
+            NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_FILL &&
+        GET_MASK(setupraster, NV_PGRAPH_SETUPRASTER_BACKFACEMODE) ==
+            NV_PGRAPH_SETUPRASTER_FRONTFACEMODE_FILL;
+
+    CullVertex *v = reserve_vertices(pg, count);
+    unsigned int provoking_element;
+
+    if (pg->draw_arrays_length) {
+        /* Each range is a separate primitive */
+        for (unsigned int i = 0; i < pg->draw_arrays_length; i++) {
+            unsigned int n = pg->draw_arrays_count[i];
+            transform_vertices(pg, prog, &vp, &f, NULL,
+                               pg->draw_arrays_start[i], n, v);
+            if (!are_primitives_invisible(pg->primitive_mode, v, n,
+                                          cull_degenerate)) {
+                return false;
+            }
+        }
+        provoking_element = pg->draw_arrays_max_count - 1;
+    } else {
+        const uint32_t *elements =
+            pg->inline_elements_length ? pg->inline_elements : NULL;
+        transform_vertices(pg, prog, &vp, &f, elements, 0, count, v);
+        if (!are_primitives_invisible(pg->primitive_mode, v, count,
+                                      cull_degenerate)) {
+            return false;
+        }
+        provoking_element = elements ? elements[count - 1] : count - 1;
+    }
+
+    /* Leave attribute state as if the batch had been drawn */
+    pgraph_update_inline_values_from_vertex(pg, &f, provoking_element);
+    nv2a_profile_inc_counter(NV2A_PROF_BEGIN_ENDS_CULLED);
+
+    return true;
+}
@@ -0,0 +1,171 @@
+/*
+ * Geforce NV2A PGRAPH dynamic resolution scaling
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hw/xbox/nv2a/nv2a_int.h"
+#include "ui/xemu-settings.h"
+
+/*
+ * At every guest flip, the time PGRAPH was busy (not waiting for the guest or
+ * the flip) and the time the GPU spent on submitted work are compared against
+ * the time since the previous flip. A frame that can't be finished in time
+ * pushes this load towards 1, so the surface scale is stepped down before
+ * that. It is stepped back up once the next scale is expected to fit too.
+ * Changes are applied by the renderer without a flush, surfaces are rescaled
+ * when they are next used.
+ *
+ * The configured surface scale is the upper limit.
+ */
+
+#define LOAD_SMOOTHING 0.1f
+
+/* Step down above this load, step up if the next scale is expected below */
+#define LOAD_HIGH 0.9f
+#define LOAD_LOW 0.75f
+
+/* Assume half of a frame's cost grows with the number of pixels */
+#define PIXEL_COST_FRACTION 0.5f
+
+#define FRAMES_TO_STEP_DOWN 10
+#define FRAMES_TO_STEP_UP 120
+#define MAX_STEP_UP_BACKOFF 16
+
+/* Shaders and surfaces are rebuilt right after a change, don't count these */
+#define COOLDOWN_FRAMES 60
+
+/* Longer intervals are loading screens or pauses and say nothing about load */
+#define MAX_FLIP_INTERVAL_US 200000
+
+static void reset_frame_counts(PGRAPHState *pg)
+{
+    pg->dynamic_scale.frames_over_budget = 0;
+    pg->dynamic_scale.frames_under_budget = 0;
+}
+
+static void set_scale(NV2AState *d, unsigned int scale)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    /* Stepping down shortly after stepping up, be slower to try again */
+    if (scale < pg->surface_scale_factor &&
+        pg->dynamic_scale.frames_since_change < 2 * FRAMES_TO_STEP_UP) {
+        pg->dynamic_scale.step_up_backoff =
+            MIN(pg->dynamic_scale.step_up_backoff * 2, MAX_STEP_UP_BACKOFF);
+    }
+
+    pg->renderer->ops.apply_surface_scale_factor(d, scale);
+
+    pg->dynamic_scale.scale = pg->surface_scale_factor;
+    pg->dynamic_scale.cooldown = COOLDOWN_FRAMES;
+    pg->dynamic_scale.frames_since_change = 0;
+    reset_frame_counts(pg);
+}
+
+static float get_step_up_cost(unsigned int scale)
+{
+    float pixels = (float)((scale + 1) * (scale + 1)) / (scale * scale);
+    return 1.0f - PIXEL_COST_FRACTION + PIXEL_COST_FRACTION * pixels;
+}
+
+void pgraph_dynamic_scale_begin_idle(PGRAPHState *pg)
+{
+    pg->dynamic_scale.idle_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+}
+
+void pgraph_dynamic_scale_end_idle(PGRAPHState *pg)
+{
+    pg->dynamic_scale.idle_time +=
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - pg->dynamic_scale.idle_start;
+}
+
+void pgraph_dynamic_scale_flip(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!pg->renderer->ops.apply_surface_scale_factor) {
+        return;
+    }
+
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    int64_t interval = now - pg->dynamic_scale.last_flip;
+    int64_t busy = interval - pg->dynamic_scale.idle_time;
+    pg->dynamic_scale.last_flip = now;
+    pg->dynamic_scale.idle_time = 0;
+
+    int64_t gpu_time = 0;
+    if (pg->renderer->ops.get_gpu_time) {
+        uint64_t total = pg->renderer->ops.get_gpu_time(d);
+        gpu_time = total - pg->dynamic_scale.last_gpu_time;
+        pg->dynamic_scale.last_gpu_time = total;
+    }
+
+    unsigned int max_scale = MAX(g_config.display.quality.surface_scale, 1);
+
+    if (!g_config.display.quality.dynamic_scale) {
+        if (pg->surface_scale_factor != max_scale) {
+            set_scale(d, max_scale);
+        }
+        pg->dynamic_scale.scale = 0;
+        return;
+    }
+
+    /* Changed by a flush or by the user, start over */
+    if (pg->dynamic_scale.scale != pg->surface_scale_factor) {
+        pg->dynamic_scale.scale = pg->surface_scale_factor;
+        pg->dynamic_scale.load = 0;
+        pg->dynamic_scale.cooldown = COOLDOWN_FRAMES;
+        pg->dynamic_scale.frames_since_change = 0;
+        pg->dynamic_scale.step_up_backoff = 1;
+        reset_frame_counts(pg);
+    }
+
+    pg->dynamic_scale.frames_since_change++;
+
+    if (interval <= 0 || interval > MAX_FLIP_INTERVAL_US) {
+        reset_frame_counts(pg);
+        return;
+    }
+
+    float load = (float)MAX(busy, gpu_time) / interval;
+    pg->dynamic_scale.load += (load - pg->dynamic_scale.load) * LOAD_SMOOTHING;
+
+    if (pg->dynamic_scale.cooldown > 0) {
+        pg->dynamic_scale.cooldown--;
+        return;
+    }
+
+    unsigned int scale = pg->surface_scale_factor;
+
+    if (scale > max_scale) {
+        set_scale(d, max_scale);
+    } else if (scale > 1 && pg->dynamic_scale.load > LOAD_HIGH) {
+        pg->dynamic_scale.frames_under_budget = 0;
+        if (++pg->dynamic_scale.frames_over_budget >= FRAMES_TO_STEP_DOWN) {
+            set_scale(d, scale - 1);
+        }
+    } else if (scale < max_scale &&
+               pg->dynamic_scale.load * get_step_up_cost(scale) < LOAD_LOW) {
+        pg->dynamic_scale.frames_over_budget = 0;
+        if (++pg->dynamic_scale.frames_under_budget >=
+            FRAMES_TO_STEP_UP * pg->dynamic_scale.step_up_backoff) {
+            set_scale(d, scale + 1);
+        }
+    } else {
+        reset_frame_counts(pg);
+    }
+}
@@ -20,9 +20,124 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/blit.h"
 #include "renderer.h"
 
-// TODO: Optimize. Ideally this should all be done via OpenGL.
+void pgraph_gl_init_blit(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    glGenFramebuffers(ARRAY_SIZE(r->blit_fbo), r->blit_fbo);
+}
+
+void pgraph_gl_finalize_blit(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    glDeleteFramebuffers(ARRAY_SIZE(r->blit_fbo), r->blit_fbo);
+    memset(r->blit_fbo, 0, sizeof(r->blit_fbo));
+}
+
+static bool blit_surface_contains(SurfaceBinding *surface,
+                                  unsigned int bytes_per_pixel,
+                                  unsigned int pitch, unsigned int x,
+                                  unsigned int y, unsigned int width,
+                                  unsigned int height)
+{
+    return surface->color && !surface->swizzle &&
+           surface->fmt.bytes_per_pixel == bytes_per_pixel &&
+           surface->pitch == pitch && x + width <= surface->width &&
+           y + height <= surface->height;
+}
+
+/*
+ * Copy between two resident surfaces without touching VRAM. The destination
+ * becomes draw dirty and is written back like any other rendered surface.
+ */
+static bool blit_surfaces_on_gpu(NV2AState *d, SurfaceBinding *surf_src,
+                                 SurfaceBinding *surf_dest,
+                                 unsigned int bytes_per_pixel,
+                                 bool patch_alpha, uint8_t alpha)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+
+    if (image_blit->operation != NV09F_SET_OPERATION_SRCCOPY ||
+        !surf_src || !surf_dest || surf_src == surf_dest ||
+        surf_src->fmt.gl_internal_format !=
+            surf_dest->fmt.gl_internal_format ||
+        !blit_surface_contains(surf_src, bytes_per_pixel,
+                               context_surfaces->source_pitch,
+                               image_blit->in_x, image_blit->in_y,
+                               image_blit->width, image_blit->height) ||
+        !blit_surface_contains(surf_dest, bytes_per_pixel,
+                               context_surfaces->dest_pitch,
+                               image_blit->out_x, image_blit->out_y,
+                               image_blit->width, image_blit->height)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_IMAGE_BLIT_GPU);
+
+    pgraph_gl_rescale_surface(d, surf_src);
+    pgraph_gl_rescale_surface(d, surf_dest);
+    pgraph_gl_upload_surface_data(d, surf_src, false);
+    pgraph_gl_upload_surface_data(d, surf_dest, false);
+
+    /* Surfaces are stored bottom-up */
+    unsigned int scale = pg->surface_scale_factor;
+    GLint width = image_blit->width * scale;
+    GLint height = image_blit->height * scale;
+    GLint src_x = image_blit->in_x * scale;
+    GLint src_y =
+        (surf_src->height - image_blit->in_y - image_blit->height) * scale;
+    GLint dst_x = image_blit->out_x * scale;
+    GLint dst_y =
+        (surf_dest->height - image_blit->out_y - image_blit->height) * scale;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, r->blit_fbo[0]);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, surf_src->gl_buffer, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->blit_fbo[1]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, surf_dest->gl_buffer, 0);
+    assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+    assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+
+    glDisable(GL_SCISSOR_TEST);
+    glBlitFramebuffer(src_x, src_y, src_x + width, src_y + height, dst_x,
+                      dst_y, dst_x + width, dst_y + height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    if (patch_alpha) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(dst_x, dst_y, width, height);
+        glDisable(GL_DITHER);
+        glColorMask(false, false, false, true);
+        glClearColor(0.0f, 0.0f, 0.0f, alpha / 255.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
+
+    pg->draw_time++;
+    surf_dest->draw_time = pg->draw_time;
+    surf_dest->frame_time = pg->frame_time;
+    surf_dest->draw_dirty = true;
+    surf_dest->cleared = false;
+
+    return true;
+}
+
 void pgraph_gl_image_blit(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -55,6 +170,37 @@ void pgraph_gl_image_blit(NV2AState *d)
             break;
     }
 
+    ImageBlitOperation operation;
+    switch (image_blit->operation) {
+    case NV09F_SET_OPERATION_SRCCOPY:
+        operation = IMAGE_BLIT_SRCCOPY;
+        break;
+    case NV09F_SET_OPERATION_BLEND_AND:
+        operation = IMAGE_BLIT_BLEND_AND;
+        break;
+    default:
+        fprintf(stderr, "Unknown blit operation: 0x%x\n",
+                image_blit->operation);
+        assert(false && "Unknown blit operation");
+        return;
+    }
+
+    bool needs_alpha_patching;
+    uint8_t alpha_override;
+    switch (context_surfaces->color_format) {
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0xff;
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0;
+        break;
+    default:
+        needs_alpha_patching = false;
+        alpha_override = 0;
+    }
+
     hwaddr source_dma_len, dest_dma_len;
 
     uint8_t *source = (uint8_t *)nv_dma_map(
@@ -71,11 +217,21 @@ void pgraph_gl_image_blit(NV2AState *d)
     hwaddr dest_addr = dest - d->vram_ptr;
 
     SurfaceBinding *surf_src = pgraph_gl_surface_get(d, source_addr);
+    SurfaceBinding *surf_dest = pgraph_gl_surface_get(d, dest_addr);
+
+    NV2A_DPRINTF("  - 0x%tx -> 0x%tx\n", source_addr, dest_addr);
+
+    if (blit_surfaces_on_gpu(d, surf_src, surf_dest, bytes_per_pixel,
+                             needs_alpha_patching, alpha_override)) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_IMAGE_BLIT_CPU);
+
     if (surf_src) {
         pgraph_gl_surface_download_if_dirty(d, surf_src);
     }
 
-    SurfaceBinding *surf_dest = pgraph_gl_surface_get(d, dest_addr);
     if (surf_dest) {
         if (image_blit->height < surf_dest->height ||
             image_blit->width < surf_dest->width) {
@@ -106,65 +262,11 @@ void pgraph_gl_image_blit(NV2AState *d)
            memory_region_size(d->vram));
     assert(dest_addr + dest_offset + dest_size <= memory_region_size(d->vram));
 
-    uint8_t *source_row = source + source_offset;
-    uint8_t *dest_row = dest + dest_offset;
-
-    if (image_blit->operation == NV09F_SET_OPERATION_SRCCOPY) {
-        // NV2A_GL_DPRINTF(false, "NV09F_SET_OPERATION_SRCCOPY");
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            memmove(dest_row, source_row, image_blit->width * bytes_per_pixel);
-            source_row += context_surfaces->source_pitch;
-            dest_row += context_surfaces->dest_pitch;
-        }
-    } else if (image_blit->operation == NV09F_SET_OPERATION_BLEND_AND) {
-        // NV2A_GL_DPRINTF(false, "NV09F_SET_OPERATION_BLEND_AND");
-        uint32_t max_beta_mult = 0x7f80;
-        uint32_t beta_mult = beta->beta >> 16;
-        uint32_t inv_beta_mult = max_beta_mult - beta_mult;
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            for (unsigned int x = 0; x < image_blit->width; x++) {
-                for (unsigned int ch = 0; ch < 3; ch++) {
-                    uint32_t a = source_row[x * 4 + ch] * beta_mult;
-                    uint32_t b = dest_row[x * 4 + ch] * inv_beta_mult;
-                    dest_row[x * 4 + ch] = (a + b) / max_beta_mult;
-                }
-            }
-            source_row += context_surfaces->source_pitch;
-            dest_row += context_surfaces->dest_pitch;
-        }
-    } else {
-        fprintf(stderr, "Unknown blit operation: 0x%x\n",
-                image_blit->operation);
-        assert(false && "Unknown blit operation");
-    }
-
-    NV2A_DPRINTF("  - 0x%tx -> 0x%tx\n", source_addr, dest_addr);
-
-    bool needs_alpha_patching;
-    uint8_t alpha_override;
-    switch (context_surfaces->color_format) {
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0xff;
-        break;
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0;
-        break;
-    default:
-        needs_alpha_patching = false;
-        alpha_override = 0;
-    }
-
-    if (needs_alpha_patching) {
-        dest_row = dest + dest_offset;
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            for (unsigned int x = 0; x < image_blit->width; x++) {
-                dest_row[x * 4 + 3] = alpha_override;
-            }
-            dest_row += context_surfaces->dest_pitch;
-        }
-    }
+    image_blit_rect(dest + dest_offset, context_surfaces->dest_pitch,
+                    source + source_offset, context_surfaces->source_pitch,
+                    image_blit->width, image_blit->height, bytes_per_pixel,
+                    operation, beta->beta, needs_alpha_patching,
+                    alpha_override);
 
     dest_addr += dest_offset;
     memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
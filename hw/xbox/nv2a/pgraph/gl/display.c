@@ -34,12 +34,19 @@ void pgraph_gl_init_display(NV2AState *d)
 
     glo_set_current(g_nv2a_context_display);
 
-    glGenTextures(1, &r->gl_display_buffer);
-    r->gl_display_buffer_internal_format = 0;
-    r->gl_display_buffer_width = 0;
-    r->gl_display_buffer_height = 0;
-    r->gl_display_buffer_format = 0;
-    r->gl_display_buffer_type = 0;
+    for (int i = 0; i < GL_DISPLAY_BUFFER_COUNT; i++) {
+        DisplayBuffer *buf = &r->display_buffers[i];
+        glGenTextures(1, &buf->texture);
+        buf->internal_format = 0;
+        buf->width = 0;
+        buf->height = 0;
+        buf->format = 0;
+        buf->type = 0;
+        buf->ready_fence = NULL;
+        buf->release_fence = NULL;
+    }
+    r->display_buffer_index = 0;
+    r->presented_display_buffer = -1;
 
     const char *vs =
         "#version 330\n"
@@ -114,8 +121,19 @@ void pgraph_gl_finalize_display(PGRAPHState *pg)
 
     glo_set_current(g_nv2a_context_display);
 
-    glDeleteTextures(1, &r->gl_display_buffer);
-    r->gl_display_buffer = 0;
+    for (int i = 0; i < GL_DISPLAY_BUFFER_COUNT; i++) {
+        DisplayBuffer *buf = &r->display_buffers[i];
+        if (buf->ready_fence) {
+            glDeleteSync(buf->ready_fence);
+            buf->ready_fence = NULL;
+        }
+        if (buf->release_fence) {
+            glDeleteSync(buf->release_fence);
+            buf->release_fence = NULL;
+        }
+        glDeleteTextures(1, &buf->texture);
+        buf->texture = 0;
+    }
 
     glDeleteProgram(r->disp_rndr.prog);
     r->disp_rndr.prog = 0;
@@ -260,7 +278,8 @@ static void render_display_pvideo_overlay(NV2AState *d)
     pgraph_apply_scaling_factor(pg, &out_width, &out_height);
 
     // Translate for the GL viewport origin.
-    out_y = MAX(r->gl_display_buffer_height - 1 - (int)(out_y + out_height), 0);
+    DisplayBuffer *buf = &r->display_buffers[r->display_buffer_index];
+    out_y = MAX(buf->height - 1 - (int)(out_y + out_height), 0);
 
     glActiveTexture(GL_TEXTURE0 + 1);
     glBindTexture(GL_TEXTURE_2D, r->disp_rndr.pvideo_tex);
@@ -298,15 +317,33 @@ static void render_display(NV2AState *d, SurfaceBinding *surface)
 
     pgraph_apply_scaling_factor(pg, &width, &height);
 
+    /*
+     * Render into the next buffer of the ring, the UI may still be sampling
+     * the previous ones.
+     */
+    r->display_buffer_index =
+        (r->display_buffer_index + 1) % GL_DISPLAY_BUFFER_COUNT;
+    DisplayBuffer *buf = &r->display_buffers[r->display_buffer_index];
+
+    GLsync release_fence = qatomic_xchg(&buf->release_fence, NULL);
+    if (release_fence) {
+        glWaitSync(release_fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(release_fence);
+    }
+    if (buf->ready_fence) {
+        glDeleteSync(buf->ready_fence);
+        buf->ready_fence = NULL;
+    }
+
     glBindFramebuffer(GL_FRAMEBUFFER, r->disp_rndr.fbo);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, r->gl_display_buffer);
+    glBindTexture(GL_TEXTURE_2D, buf->texture);
     bool recreate = (
-        surface->fmt.gl_internal_format != r->gl_display_buffer_internal_format
-        || width != r->gl_display_buffer_width
-        || height != r->gl_display_buffer_height
-        || surface->fmt.gl_format != r->gl_display_buffer_format
-        || surface->fmt.gl_type != r->gl_display_buffer_type
+        surface->fmt.gl_internal_format != buf->internal_format
+        || width != buf->width
+        || height != buf->height
+        || surface->fmt.gl_format != buf->format
+        || surface->fmt.gl_type != buf->type
         );
 
     if (recreate) {
@@ -321,23 +358,23 @@ static void render_display(NV2AState *d, SurfaceBinding *surface)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        r->gl_display_buffer_internal_format = surface->fmt.gl_internal_format;
-        r->gl_display_buffer_width = width;
-        r->gl_display_buffer_height = height;
-        r->gl_display_buffer_format = surface->fmt.gl_format;
-        r->gl_display_buffer_type = surface->fmt.gl_type;
+        buf->internal_format = surface->fmt.gl_internal_format;
+        buf->width = width;
+        buf->height = height;
+        buf->format = surface->fmt.gl_format;
+        buf->type = surface->fmt.gl_type;
         glTexImage2D(GL_TEXTURE_2D, 0,
-            r->gl_display_buffer_internal_format,
-            r->gl_display_buffer_width,
-            r->gl_display_buffer_height,
+            buf->internal_format,
+            buf->width,
+            buf->height,
             0,
-            r->gl_display_buffer_format,
-            r->gl_display_buffer_type,
+            buf->format,
+            buf->type,
             NULL);
     }
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        GL_TEXTURE_2D, r->gl_display_buffer, 0);
+        GL_TEXTURE_2D, buf->texture, 0);
     GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(1, DrawBuffers);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
@@ -365,15 +402,8 @@ static void render_display(NV2AState *d, SurfaceBinding *surface)
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
         GL_TEXTURE_2D, 0, 0);
-}
 
-static void gl_fence(void)
-{
-    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-    int result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
-                                         (GLuint64)(5000000000));
-    assert(result == GL_CONDITION_SATISFIED || result == GL_ALREADY_SIGNALED);
-    glDeleteSync(fence);
+    buf->ready_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void pgraph_gl_sync(NV2AState *d)
@@ -389,15 +419,23 @@ void pgraph_gl_sync(NV2AState *d)
 
     /* FIXME: Sanity check surface dimensions */
 
-    /* Wait for queued commands to complete */
+    pgraph_gl_rescale_surface(d, surface);
+
+    /*
+     * Order display rendering after queued commands on the GPU, neither this
+     * thread nor the UI thread waits for them to complete.
+     */
     pgraph_gl_upload_surface_data(d, surface, !tcg_enabled());
-    gl_fence();
+    GLsync surface_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
     assert(glGetError() == GL_NO_ERROR);
 
     /* Render framebuffer in display context */
     glo_set_current(g_nv2a_context_display);
+    glWaitSync(surface_fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(surface_fence);
     render_display(d, surface);
-    gl_fence();
+    glFlush();
     assert(glGetError() == GL_NO_ERROR);
 
     /* Switch back to original context */
@@ -440,5 +478,31 @@ int pgraph_gl_get_framebuffer_surface(NV2AState *d)
     qemu_mutex_unlock(&d->pfifo.lock);
     qemu_event_wait(&d->pgraph.sync_complete);
 
-    return r->gl_display_buffer;
+    /* Sample the frame only once it has been rendered */
+    DisplayBuffer *buf = &r->display_buffers[r->display_buffer_index];
+    if (buf->ready_fence) {
+        glWaitSync(buf->ready_fence, 0, GL_TIMEOUT_IGNORED);
+    }
+    r->presented_display_buffer = r->display_buffer_index;
+
+    return buf->texture;
+}
+
+void pgraph_gl_release_framebuffer_surface(NV2AState *d)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+
+    if (r->presented_display_buffer < 0) {
+        return;
+    }
+
+    /* Don't render over the frame until the UI's commands sampling it ran */
+    DisplayBuffer *buf = &r->display_buffers[r->presented_display_buffer];
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    fence = qatomic_xchg(&buf->release_fence, fence);
+    if (fence) {
+        glDeleteSync(fence);
+    }
+    r->presented_display_buffer = -1;
 }
@@ -61,6 +61,7 @@ static void pgraph_gl_init(NV2AState *d, Error **errp)
     pgraph_gl_init_buffers(d);
     pgraph_gl_init_shaders(pg);
     pgraph_gl_init_display(d);
+    pgraph_gl_init_blit(pg);
 
     pgraph_gl_update_entire_memory_buffer(d);
 
@@ -80,6 +81,7 @@ static void pgraph_gl_finalize(NV2AState *d)
     pgraph_gl_finalize_reports(pg);
     pgraph_gl_finalize_buffers(pg);
     pgraph_gl_finalize_display(pg);
+    pgraph_gl_finalize_blit(pg);
 
     glo_set_current(NULL);
 
@@ -89,6 +91,8 @@ static void pgraph_gl_finalize(NV2AState *d)
 
 static void pgraph_gl_flip_stall(NV2AState *d)
 {
+    pgraph_gl_queue_surface_downloads(d);
+    pgraph_gl_fence_memory_buffer(&d->pgraph);
     NV2A_GL_DFRAME_TERMINATOR();
     glFinish();
 }
@@ -194,7 +198,9 @@ static PGRAPHRenderer pgraph_gl_renderer = {
         .surface_update = pgraph_gl_surface_update,
         .set_surface_scale_factor = pgraph_gl_set_surface_scale_factor,
         .get_surface_scale_factor = pgraph_gl_get_surface_scale_factor,
+        .apply_surface_scale_factor = pgraph_gl_apply_surface_scale_factor,
         .get_framebuffer_surface = pgraph_gl_get_framebuffer_surface,
+        .release_framebuffer_surface = pgraph_gl_release_framebuffer_surface,
     }
 };
 
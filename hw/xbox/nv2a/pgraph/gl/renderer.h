@@ -26,6 +26,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/interval-tree.h"
 
 #include "hw/hw.h"
 
@@ -38,8 +39,11 @@
 #include "gloffscreen.h"
 #include "constants.h"
 
+#define MEMORY_BUFFER_MAX_FENCES 64
+
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode range; /* [vram_addr, vram_addr + size) */
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -53,6 +57,7 @@ typedef struct SurfaceBinding {
     unsigned int width;
     unsigned int height;
     unsigned int pitch;
+    unsigned int scale; /* Of gl_buffer, see pgraph_gl_rescale_surface */
     size_t size;
 
     bool cleared;
@@ -64,6 +69,18 @@ typedef struct SurfaceBinding {
 
     GLuint gl_buffer;
     SurfaceFormatInfo fmt;
+
+    /* Readback queued at end of frame for surfaces the CPU reads */
+    GLuint readback_pbo;
+    GLsync readback_fence;
+    bool readback_hint;
+    bool readback_queued;
+    bool readback_resolved;
+    int readback_draw_time;
+    unsigned int readback_stride;
+    unsigned int readback_height;
+    size_t readback_row_size;
+    size_t readback_size;
 } SurfaceBinding;
 
 typedef struct TextureBinding {
@@ -157,6 +174,8 @@ typedef struct TextureLruNode {
     TextureKey key;
     TextureBinding *binding;
     bool possibly_dirty;
+    IntervalTreeNode texture_range;
+    IntervalTreeNode palette_range;
 } TextureLruNode;
 
 typedef struct QueryReport {
@@ -167,23 +186,45 @@ typedef struct QueryReport {
     GLuint *queries;
 } QueryReport;
 
+#define GL_DISPLAY_BUFFER_COUNT 3
+
+typedef struct DisplayBuffer {
+    GLuint texture;
+    GLint internal_format;
+    GLsizei width;
+    GLsizei height;
+    GLenum format;
+    GLenum type;
+    GLsync ready_fence; // Signaled once the frame has been rendered
+    GLsync release_fence; // Signaled once the UI is done sampling the frame
+} DisplayBuffer;
+
 typedef struct PGRAPHGLState {
     GLuint gl_framebuffer;
-    GLuint gl_display_buffer;
-    GLint gl_display_buffer_internal_format;
-    GLsizei gl_display_buffer_width;
-    GLsizei gl_display_buffer_height;
-    GLenum gl_display_buffer_format;
-    GLenum gl_display_buffer_type;
+    DisplayBuffer display_buffers[GL_DISPLAY_BUFFER_COUNT];
+    unsigned int display_buffer_index;
+    int presented_display_buffer;
 
     Lru element_cache;
     VertexLruNode *element_cache_entries;
     GLuint gl_inline_array_buffer;
     GLuint gl_memory_buffer;
+    uint8_t *gl_memory_buffer_mapped; /* Persistent mapping, if supported */
+    uint64_t *memory_buffer_page_serials; /* Last draw batch to read a page */
+    uint64_t memory_buffer_serial; /* Current, unfenced draw batch */
+    uint64_t memory_buffer_completed_serial;
+    bool memory_buffer_used;
+    struct {
+        GLsync fence;
+        uint64_t serial;
+    } memory_buffer_fences[MEMORY_BUFFER_MAX_FENCES];
+    unsigned int memory_buffer_fence_tail, memory_buffer_num_fences;
+    hwaddr memory_buffer_last_addr, memory_buffer_last_end;
     GLuint gl_vertex_array;
     GLuint gl_inline_buffer[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    IntervalTreeRoot surface_ranges; /* Index of surfaces by VRAM range */
     SurfaceBinding *color_binding, *zeta_binding;
     bool downloads_pending;
     QemuEvent downloads_complete;
@@ -193,6 +234,8 @@ typedef struct PGRAPHGLState {
     TextureBinding *texture_binding[NV2A_MAX_TEXTURES];
     Lru texture_cache;
     TextureLruNode *texture_cache_entries;
+    IntervalTreeRoot texture_ranges; /* Index of cache entries by VRAM range */
+    IntervalTreeRoot palette_ranges;
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
@@ -213,6 +256,15 @@ typedef struct PGRAPHGLState {
         GLuint tex_loc, surface_size_loc;
     } s2t_rndr;
 
+    GLuint blit_fbo[2]; /* NV09F read, draw */
+
+    struct down_rndr {
+        GLuint fbo, vao, vbo, prog, tex;
+        GLuint tex_loc, scale_loc, surface_size_loc, swizzle_loc;
+        GLenum tex_internal_format;
+        unsigned int tex_width, tex_height;
+    } down_rndr;
+
     struct disp_rndr {
         GLuint fbo, vao, vbo, prog;
         GLuint display_size_loc;
@@ -243,6 +295,7 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element, un
 bool pgraph_gl_check_surface_to_texture_compatibility(const SurfaceBinding *surface, const TextureShape *shape);
 GLuint pgraph_gl_compile_shader(const char *vs_src, const char *fs_src);
 void pgraph_gl_download_dirty_surfaces(NV2AState *d);
+void pgraph_gl_queue_surface_downloads(NV2AState *d);
 void pgraph_gl_clear_report_value(NV2AState *d);
 void pgraph_gl_clear_surface(NV2AState *d, uint32_t parameter);
 void pgraph_gl_draw_begin(NV2AState *d);
@@ -256,8 +309,10 @@ void pgraph_gl_surface_flush(NV2AState *d);
 void pgraph_gl_surface_update(NV2AState *d, bool upload, bool color_write, bool zeta_write);
 void pgraph_gl_sync(NV2AState *d);
 void pgraph_gl_update_entire_memory_buffer(NV2AState *d);
+void pgraph_gl_fence_memory_buffer(PGRAPHState *pg);
 void pgraph_gl_init_display(NV2AState *d);
 void pgraph_gl_finalize_display(PGRAPHState *pg);
+void pgraph_gl_release_framebuffer_surface(NV2AState *d);
 void pgraph_gl_init_reports(NV2AState *d);
 void pgraph_gl_finalize_reports(PGRAPHState *pg);
 void pgraph_gl_init_shaders(PGRAPHState *pg);
@@ -268,13 +323,18 @@ void pgraph_gl_init_textures(NV2AState *d);
 void pgraph_gl_finalize_textures(PGRAPHState *pg);
 void pgraph_gl_init_buffers(NV2AState *d);
 void pgraph_gl_finalize_buffers(PGRAPHState *pg);
+void pgraph_gl_init_blit(PGRAPHState *pg);
+void pgraph_gl_finalize_blit(PGRAPHState *pg);
 void pgraph_gl_process_pending_downloads(NV2AState *d);
 void pgraph_gl_reload_surface_scale_factor(PGRAPHState *pg);
+void pgraph_gl_rescale_surface(NV2AState *d, SurfaceBinding *surface);
 void pgraph_gl_render_surface_to_texture(NV2AState *d, SurfaceBinding *surface, TextureBinding *texture, TextureShape *texture_shape, int texture_unit);
 void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 void pgraph_gl_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface);
 SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr);
 SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr);
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start,
+                                                  hwaddr size);
 void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *e);
 void pgraph_gl_unbind_surface(NV2AState *d, bool color);
 void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface, bool force);
@@ -283,6 +343,7 @@ bool pgraph_gl_shader_load_from_memory(ShaderBinding *snode);
 void pgraph_gl_shader_write_cache_reload_list(PGRAPHState *pg);
 void pgraph_gl_set_surface_scale_factor(NV2AState *d, unsigned int scale);
 unsigned int pgraph_gl_get_surface_scale_factor(NV2AState *d);
+void pgraph_gl_apply_surface_scale_factor(NV2AState *d, unsigned int scale);
 int pgraph_gl_get_framebuffer_surface(NV2AState *d);
 
 #endif
@@ -20,7 +20,6 @@
  */
 
 #include "qemu/osdep.h"
-#include "qemu/fast-hash.h"
 #include "qemu/mstring.h"
 #include <locale.h>
 
@@ -1015,8 +1014,7 @@ void pgraph_gl_bind_shaders(PGRAPHState *pg)
 
     qemu_mutex_lock(&r->shader_cache_lock);
 
-    uint64_t shader_state_hash =
-        fast_hash((uint8_t *)&state, sizeof(ShaderState));
+    uint64_t shader_state_hash = pgraph_hash_shader_state(&state);
 
     LruNode *node = lru_lookup(&r->shader_cache, shader_state_hash, &state);
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
@@ -69,7 +69,8 @@ void pgraph_gl_set_surface_scale_factor(NV2AState *d, unsigned int scale)
 
 unsigned int pgraph_gl_get_surface_scale_factor(NV2AState *d)
 {
-    return d->pgraph.surface_scale_factor;
+    /* The dynamic scale may be lower, see dynamic_scale.c */
+    return MAX(g_config.display.quality.surface_scale, 1);
 }
 
 void pgraph_gl_reload_surface_scale_factor(PGRAPHState *pg)
@@ -175,6 +176,100 @@ static void finalize_render_to_texture(PGRAPHState *pg)
     r->s2t_rndr.fbo = 0;
 }
 
+static void init_download_resolve(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    const char *vs =
+        "#version 330\n"
+        "void main()\n"
+        "{\n"
+        "    float x = -1.0 + float((gl_VertexID & 1) << 2);\n"
+        "    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
+        "    gl_Position = vec4(x, y, 0, 1);\n"
+        "}\n";
+    /*
+     * Each output pixel is one guest pixel in download (top-down) order. The
+     * texel picked matches a flipped glReadPixels followed by
+     * surface_copy_shrink_row: the first column and top row of each block.
+     */
+    const char *fs =
+        "#version 330\n"
+        "uniform sampler2D tex;\n"
+        "uniform int scale;\n"
+        "uniform ivec2 surface_size;\n"
+        "uniform bool swizzle;\n"
+        "layout(location = 0) out vec4 out_Color;\n"
+        "ivec2 get_unswizzled_pos(int idx)\n"
+        "{\n"
+        "    ivec2 pos = ivec2(0);\n"
+        "    int bit = 0, x_bit = 0, y_bit = 0;\n"
+        "    while (((1 << x_bit) < surface_size.x) ||\n"
+        "           ((1 << y_bit) < surface_size.y)) {\n"
+        "        if ((1 << x_bit) < surface_size.x) {\n"
+        "            pos.x |= ((idx >> bit++) & 1) << x_bit++;\n"
+        "        }\n"
+        "        if ((1 << y_bit) < surface_size.y) {\n"
+        "            pos.y |= ((idx >> bit++) & 1) << y_bit++;\n"
+        "        }\n"
+        "    }\n"
+        "    return pos;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "    ivec2 pos = ivec2(gl_FragCoord.xy);\n"
+        "    if (swizzle) {\n"
+        "        pos = get_unswizzled_pos(pos.y * surface_size.x + pos.x);\n"
+        "    }\n"
+        "    ivec2 src = ivec2(pos.x * scale,\n"
+        "                      surface_size.y * scale - 1 - pos.y * scale);\n"
+        "    out_Color = texelFetch(tex, src, 0);\n"
+        "}\n";
+
+    r->down_rndr.prog = pgraph_gl_compile_shader(vs, fs);
+    r->down_rndr.tex_loc = glGetUniformLocation(r->down_rndr.prog, "tex");
+    r->down_rndr.scale_loc = glGetUniformLocation(r->down_rndr.prog, "scale");
+    r->down_rndr.surface_size_loc = glGetUniformLocation(r->down_rndr.prog,
+                                                         "surface_size");
+    r->down_rndr.swizzle_loc = glGetUniformLocation(r->down_rndr.prog,
+                                                    "swizzle");
+
+    glGenVertexArrays(1, &r->down_rndr.vao);
+    glBindVertexArray(r->down_rndr.vao);
+    glGenBuffers(1, &r->down_rndr.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->down_rndr.vbo);
+    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+    glGenFramebuffers(1, &r->down_rndr.fbo);
+    glGenTextures(1, &r->down_rndr.tex);
+    glBindTexture(GL_TEXTURE_2D, r->down_rndr.tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    r->down_rndr.tex_internal_format = 0;
+    r->down_rndr.tex_width = 0;
+    r->down_rndr.tex_height = 0;
+}
+
+static void finalize_download_resolve(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    glDeleteProgram(r->down_rndr.prog);
+    r->down_rndr.prog = 0;
+
+    glDeleteVertexArrays(1, &r->down_rndr.vao);
+    r->down_rndr.vao = 0;
+
+    glDeleteBuffers(1, &r->down_rndr.vbo);
+    r->down_rndr.vbo = 0;
+
+    glDeleteFramebuffers(1, &r->down_rndr.fbo);
+    r->down_rndr.fbo = 0;
+
+    glDeleteTextures(1, &r->down_rndr.tex);
+    r->down_rndr.tex = 0;
+}
+
 static bool surface_to_texture_can_fastpath(SurfaceBinding *surface,
                                             TextureShape *shape)
 {
@@ -453,6 +548,27 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     }
 }
 
+static hwaddr surface_range_last(SurfaceBinding *surface)
+{
+    return surface->vram_addr + MAX(surface->size, 1) - 1;
+}
+
+static SurfaceBinding *surface_range_first(PGRAPHGLState *r, hwaddr start,
+                                           hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_first(&r->surface_ranges, start, last);
+    return node ? container_of(node, SurfaceBinding, range) : NULL;
+}
+
+static SurfaceBinding *surface_range_next(SurfaceBinding *surface,
+                                          hwaddr start, hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_next(&surface->range, start, last);
+    return node ? container_of(node, SurfaceBinding, range) : NULL;
+}
+
 static SurfaceBinding *surface_put(NV2AState *d, hwaddr addr,
                                    SurfaceBinding *surface_in)
 {
@@ -461,19 +577,16 @@ static SurfaceBinding *surface_put(NV2AState *d, hwaddr addr,
 
     assert(pgraph_gl_surface_get(d, addr) == NULL);
 
-    SurfaceBinding *surface, *next;
-    uintptr_t e_end = surface_in->vram_addr + surface_in->size - 1;
-    QTAILQ_FOREACH_SAFE(surface, &r->surfaces, entry, next) {
-        uintptr_t s_end = surface->vram_addr + surface->size - 1;
-        bool overlapping = !(surface->vram_addr > e_end
-                             || surface_in->vram_addr > s_end);
-        if (overlapping) {
-            trace_nv2a_pgraph_surface_evict_overlapping(
-                surface->vram_addr, surface->width, surface->height,
-                surface->pitch);
-            pgraph_gl_surface_download_if_dirty(d, surface);
-            pgraph_gl_surface_invalidate(d, surface);
-        }
+    /* Invalidation removes the surface from the index, so restart lookup */
+    SurfaceBinding *surface;
+    hwaddr e_last = surface_range_last(surface_in);
+    while ((surface = surface_range_first(r, surface_in->vram_addr,
+                                          e_last))) {
+        trace_nv2a_pgraph_surface_evict_overlapping(
+            surface->vram_addr, surface->width, surface->height,
+            surface->pitch);
+        pgraph_gl_surface_download_if_dirty(d, surface);
+        pgraph_gl_surface_invalidate(d, surface);
     }
 
     SurfaceBinding *surface_out = g_malloc(sizeof(SurfaceBinding));
@@ -492,6 +605,9 @@ static SurfaceBinding *surface_put(NV2AState *d, hwaddr addr,
     }
 
     QTAILQ_INSERT_TAIL(&r->surfaces, surface_out, entry);
+    surface_out->range.start = surface_out->vram_addr;
+    surface_out->range.last = surface_range_last(surface_out);
+    interval_tree_insert(&surface_out->range, &r->surface_ranges);
 
     return surface_out;
 }
@@ -502,7 +618,8 @@ SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (surface = surface_range_first(r, addr, addr); surface;
+         surface = surface_range_next(surface, addr, addr)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -517,9 +634,9 @@ SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
-        if (addr >= surface->vram_addr &&
-            addr < (surface->vram_addr + surface->size)) {
+    for (surface = surface_range_first(r, addr, addr); surface;
+         surface = surface_range_next(surface, addr, addr)) {
+        if (addr < surface->vram_addr + surface->size) {
             return surface;
         }
     }
@@ -527,6 +644,38 @@ SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr)
     return NULL;
 }
 
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start,
+                                                  hwaddr size)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+
+    hwaddr last = start + MAX(size, 1) - 1;
+
+    SurfaceBinding *surface;
+    for (surface = surface_range_first(r, start, last); surface;
+         surface = surface_range_next(surface, start, last)) {
+        pgraph_gl_surface_download_if_dirty(d, surface);
+    }
+}
+
+static void destroy_readback_fence(SurfaceBinding *surface)
+{
+    if (surface->readback_fence) {
+        glDeleteSync(surface->readback_fence);
+        surface->readback_fence = NULL;
+    }
+    surface->readback_queued = false;
+}
+
+static void destroy_readback_buffer(SurfaceBinding *surface)
+{
+    destroy_readback_fence(surface);
+    if (surface->readback_pbo) {
+        glDeleteBuffers(1, &surface->readback_pbo);
+        surface->readback_pbo = 0;
+    }
+}
+
 void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -552,8 +701,10 @@ void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
     }
 
     glDeleteTextures(1, &surface->gl_buffer);
+    destroy_readback_buffer(surface);
 
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
+    interval_tree_remove(&surface->range, &r->surface_ranges);
     g_free(surface);
 }
 
@@ -651,12 +802,146 @@ static void surface_copy_shrink_row(uint8_t *out, uint8_t *in,
     }
 }
 
+static void bind_surface_for_read(SurfaceBinding *surface)
+{
+    /*  Bind destination surface to framebuffer */
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+}
+
+static bool can_resolve_on_gpu(SurfaceBinding *surface, bool swizzle,
+                               bool flip, bool downscale)
+{
+    /* FIXME: Support zeta surfaces */
+    return surface->color && flip && (swizzle || downscale);
+}
+
+/*
+ * Shrink an upscaled surface back to guest resolution and/or swizzle it with
+ * a draw, then read back only the guest sized result. pixels is an offset
+ * into the bound pixel pack buffer if there is one.
+ */
+static void resolve_surface_for_download(NV2AState *d, SurfaceBinding *surface,
+                                         bool swizzle, bool downscale,
+                                         void *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_RESOLVE);
+
+    unsigned int width = surface->width, height = surface->height;
+
+    GLint active_texture, last_texture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+
+    if (r->down_rndr.tex_internal_format != surface->fmt.gl_internal_format ||
+        r->down_rndr.tex_width != width || r->down_rndr.tex_height != height) {
+        glBindTexture(GL_TEXTURE_2D, r->down_rndr.tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                     height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                     NULL);
+        r->down_rndr.tex_internal_format = surface->fmt.gl_internal_format;
+        r->down_rndr.tex_width = width;
+        r->down_rndr.tex_height = height;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->down_rndr.fbo);
+    GLenum draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           r->down_rndr.tex, 0);
+    glDrawBuffers(1, draw_buffers);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
+    glBindVertexArray(r->down_rndr.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, r->down_rndr.vbo);
+    glUseProgram(r->down_rndr.prog);
+    glProgramUniform1i(r->down_rndr.prog, r->down_rndr.tex_loc,
+                       active_texture - GL_TEXTURE0);
+    glProgramUniform1i(r->down_rndr.prog, r->down_rndr.scale_loc,
+                       downscale ? pg->surface_scale_factor : 1);
+    glProgramUniform2i(r->down_rndr.prog, r->down_rndr.surface_size_loc,
+                       width, height);
+    glProgramUniform1i(r->down_rndr.prog, r->down_rndr.swizzle_loc, swizzle);
+
+    glViewport(0, 0, width, height);
+    glColorMask(true, true, true, true);
+    glDisable(GL_DITHER);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    /* Swizzled output is tightly packed, linear output keeps guest pitch */
+    int rl, pa;
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &rl);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pa);
+    glPixelStorei(GL_PACK_ROW_LENGTH,
+                  swizzle ? width :
+                            surface->pitch / surface->fmt.bytes_per_pixel);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, surface->fmt.gl_format,
+                 surface->fmt.gl_type, pixels);
+    glPixelStorei(GL_PACK_ROW_LENGTH, rl);
+    glPixelStorei(GL_PACK_ALIGNMENT, pa);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
+    glBindVertexArray(r->gl_vertex_array);
+    glBindTexture(GL_TEXTURE_2D, last_texture);
+    glUseProgram(
+        r->shader_binding ? r->shader_binding->gl_program : 0);
+}
+
+static void read_queued_download(SurfaceBinding *surface, uint8_t *pixels)
+{
+    unsigned int stride = surface->readback_stride;
+    unsigned int height = surface->readback_height;
+    size_t row_size = surface->readback_row_size;
+
+    glClientWaitSync(surface->readback_fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+    destroy_readback_fence(surface);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+    const uint8_t *src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                          surface->readback_size,
+                                          GL_MAP_READ_BIT);
+    assert(src);
+
+    /* Unresolved copies come straight from glReadPixels, rows bottom-up */
+    for (unsigned int y = 0; y < height; y++) {
+        unsigned int src_y = surface->readback_resolved ? y :
+                                                          height - 1 - y;
+        memcpy(pixels + y * stride, src + src_y * stride, row_size);
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
 static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        bool swizzle, bool flip, bool downscale,
                                        uint8_t *pixels)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    pgraph_gl_rescale_surface(d, surface);
+
     swizzle &= surface->swizzle;
     downscale &= (pg->surface_scale_factor != 1);
 
@@ -666,26 +951,28 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         surface->width, surface->height, surface->pitch,
         surface->fmt.bytes_per_pixel);
 
-    /*  Bind destination surface to framebuffer */
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                           GL_TEXTURE_2D, 0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
-                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+    if (surface->readback_queued &&
+        surface->readback_draw_time != surface->draw_time) {
+        destroy_readback_fence(surface);
+    }
 
-    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    if (can_resolve_on_gpu(surface, swizzle, flip, downscale)) {
+        if (surface->readback_queued && surface->readback_resolved) {
+            read_queued_download(surface, pixels);
+            nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_QUEUED_HIT);
+        } else {
+            resolve_surface_for_download(d, surface, swizzle, downscale,
+                                         pixels);
+        }
+        return;
+    }
 
     /* Read surface into memory */
     uint8_t *gl_read_buf = pixels;
 
     uint8_t *swizzle_buf = pixels;
     if (swizzle) {
-        /* FIXME: Allocate big buffer up front and re-alloc if necessary.
-         * FIXME: Consider swizzle in shader
-         */
+        /* FIXME: Allocate big buffer up front and re-alloc if necessary. */
         assert(pg->surface_scale_factor == 1 || downscale);
         swizzle_buf = (uint8_t *)g_malloc(surface->size);
         gl_read_buf = swizzle_buf;
@@ -698,13 +985,24 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         gl_read_buf = pg->scale_buf;
     }
 
-    glo_readpixels(
-        surface->fmt.gl_format, surface->fmt.gl_type, surface->fmt.bytes_per_pixel,
-        pg->surface_scale_factor * surface->pitch,
-        pg->surface_scale_factor * surface->width,
-        pg->surface_scale_factor * surface->height, flip, gl_read_buf);
+    if (flip && surface->readback_queued && !surface->readback_resolved) {
+        read_queued_download(surface, gl_read_buf);
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_QUEUED_HIT);
+    } else {
+        bind_surface_for_read(surface);
+        glo_readpixels(surface->fmt.gl_format, surface->fmt.gl_type,
+                       surface->fmt.bytes_per_pixel,
+                       pg->surface_scale_factor * surface->pitch,
+                       pg->surface_scale_factor * surface->width,
+                       pg->surface_scale_factor * surface->height, flip,
+                       gl_read_buf);
+
+        /* Re-bind original framebuffer target */
+        glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        bind_current_surface(d);
+    }
 
-    /* FIXME: Replace this with a hw accelerated version */
     if (downscale) {
         assert(surface->pitch >= (surface->width * surface->fmt.bytes_per_pixel));
         uint8_t *out = swizzle_buf, *in = pg->scale_buf;
@@ -723,11 +1021,6 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                      surface->pitch, surface->fmt.bytes_per_pixel);
         g_free(swizzle_buf);
     }
-
-    /* Re-bind original framebuffer target */
-    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
-                           GL_TEXTURE_2D, 0, 0);
-    bind_current_surface(d);
 }
 
 static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
@@ -740,6 +1033,11 @@ static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
 
+    if (surface->download_pending) {
+        /* The CPU reads this surface, start fetching it ahead of time */
+        surface->readback_hint = true;
+    }
+
     surface_download_to_buffer(d, surface, true, true, true,
                                d->vram_ptr + surface->vram_addr);
 
@@ -782,6 +1080,120 @@ void pgraph_gl_download_dirty_surfaces(NV2AState *d)
     qemu_event_set(&r->dirty_surfaces_download_complete);
 }
 
+static void get_queued_download_layout(PGRAPHState *pg,
+                                       SurfaceBinding *surface, bool *resolve,
+                                       unsigned int *stride,
+                                       unsigned int *height, size_t *row_size)
+{
+    bool downscale = pg->surface_scale_factor != 1;
+
+    *resolve = can_resolve_on_gpu(surface, surface->swizzle, true, downscale);
+    if (*resolve) {
+        *row_size = surface->width * surface->fmt.bytes_per_pixel;
+        *stride = surface->swizzle ? *row_size : surface->pitch;
+        *height = surface->height;
+    } else {
+        *row_size = pg->surface_scale_factor * surface->width *
+                    surface->fmt.bytes_per_pixel;
+        *stride = pg->surface_scale_factor * surface->pitch;
+        *height = pg->surface_scale_factor * surface->height;
+    }
+}
+
+static void queue_surface_download(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    bool resolve;
+    unsigned int stride, height;
+    size_t row_size;
+    get_queued_download_layout(pg, surface, &resolve, &stride, &height,
+                               &row_size);
+    size_t size = (size_t)stride * height;
+
+    if (!surface->readback_pbo) {
+        glGenBuffers(1, &surface->readback_pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        surface->readback_size = size;
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_pbo);
+    }
+
+    if (resolve) {
+        /* Only guest sized data crosses the bus */
+        resolve_surface_for_download(d, surface, surface->swizzle,
+                                     pg->surface_scale_factor != 1, NULL);
+    } else {
+        bind_surface_for_read(surface);
+
+        int rl, pa;
+        glGetIntegerv(GL_PACK_ROW_LENGTH, &rl);
+        glGetIntegerv(GL_PACK_ALIGNMENT, &pa);
+        glPixelStorei(GL_PACK_ROW_LENGTH,
+                      stride / surface->fmt.bytes_per_pixel);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+        glReadPixels(0, 0, pg->surface_scale_factor * surface->width, height,
+                     surface->fmt.gl_format, surface->fmt.gl_type, NULL);
+
+        glPixelStorei(GL_PACK_ROW_LENGTH, rl);
+        glPixelStorei(GL_PACK_ALIGNMENT, pa);
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        bind_current_surface(d);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    surface->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    surface->readback_queued = true;
+    surface->readback_resolved = resolve;
+    surface->readback_draw_time = surface->draw_time;
+    surface->readback_stride = stride;
+    surface->readback_height = height;
+    surface->readback_row_size = row_size;
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_QUEUED);
+}
+
+void pgraph_gl_queue_surface_downloads(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (!surface->readback_hint || !surface->draw_dirty ||
+            surface->scale != pg->surface_scale_factor) {
+            continue;
+        }
+
+        if (surface->readback_queued) {
+            if (surface->readback_draw_time == surface->draw_time) {
+                continue;
+            }
+
+            /* Surface was drawn again before the CPU got to the last copy */
+            surface->readback_hint = false;
+            destroy_readback_fence(surface);
+            continue;
+        }
+
+        bool resolve;
+        unsigned int stride, height;
+        size_t row_size;
+        get_queued_download_layout(pg, surface, &resolve, &stride, &height,
+                                   &row_size);
+        if (surface->readback_pbo &&
+            surface->readback_size != (size_t)stride * height) {
+            destroy_readback_buffer(surface);
+        }
+
+        queue_surface_download(d, surface);
+    }
+}
+
 static void surface_copy_expand_row(uint8_t *out, uint8_t *in,
                                     unsigned int width,
                                     unsigned int bytes_per_pixel,
@@ -851,6 +1263,7 @@ void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     PGRAPHState *pg = &d->pgraph;
 
     surface->upload_pending = false;
+    destroy_readback_fence(surface);
     surface->draw_time = pg->draw_time;
 
     // FIXME: Don't query GL for texture binding
@@ -1016,6 +1429,7 @@ static void populate_surface_binding_entry_sized(NV2AState *d, bool color,
     entry->width = width;
     entry->height = height;
     entry->pitch = surface->pitch;
+    entry->scale = pg->surface_scale_factor;
     entry->size = height * MAX(surface->pitch, width * fmt.bytes_per_pixel);
     entry->upload_pending = true;
     entry->download_pending = false;
@@ -1025,6 +1439,12 @@ static void populate_surface_binding_entry_sized(NV2AState *d, bool color,
     entry->frame_time = pg->frame_time;
     entry->draw_time = pg->draw_time;
     entry->cleared = false;
+    entry->readback_pbo = 0;
+    entry->readback_fence = NULL;
+    entry->readback_hint = false;
+    entry->readback_queued = false;
+    entry->readback_resolved = false;
+    entry->readback_size = 0;
 }
 
 static void populate_surface_binding_entry(NV2AState *d, bool color,
@@ -1054,6 +1474,28 @@ static void populate_surface_binding_entry(NV2AState *d, bool color,
     populate_surface_binding_entry_sized(d, color, width, height, entry);
 }
 
+static void create_surface_texture(PGRAPHState *pg, SurfaceBinding *surface)
+{
+    glGenTextures(1, &surface->gl_buffer);
+    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
+    NV2A_GL_DLABEL(GL_TEXTURE, surface->gl_buffer,
+                   "%s format: %0X, width: %d, height: %d "
+                   "(addr %" HWADDR_PRIx ")",
+                   surface->color ? "color" : "zeta",
+                   surface->color ? surface->shape.color_format
+                                  : surface->shape.zeta_format,
+                   surface->width, surface->height, surface->vram_addr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    unsigned int width = surface->width, height = surface->height;
+    pgraph_apply_scaling_factor(pg, &width, &height);
+    glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                 height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                 NULL);
+    surface->scale = pg->surface_scale_factor;
+}
+
 static void update_surface_part(NV2AState *d, bool upload, bool color)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -1154,6 +1596,7 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
                 pg->surface_binding_dim.clip_height = found->shape.clip_height;
                 found->upload_pending |= mem_dirty;
                 pg->surface_zeta.buffer_dirty |= color;
+                pgraph_gl_rescale_surface(d, found);
                 should_create = false;
             } else {
                 trace_nv2a_pgraph_surface_evict_reason(
@@ -1165,23 +1608,7 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
         }
 
         if (should_create) {
-            glGenTextures(1, &entry.gl_buffer);
-            glBindTexture(GL_TEXTURE_2D, entry.gl_buffer);
-            NV2A_GL_DLABEL(GL_TEXTURE, entry.gl_buffer,
-                           "%s format: %0X, width: %d, height: %d "
-                           "(addr %" HWADDR_PRIx ")",
-                           color ? "color" : "zeta",
-                           color ? pg->surface_shape.color_format
-                                 : pg->surface_shape.zeta_format,
-                           entry.width, entry.height, surface->offset);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            unsigned int width = entry.width, height = entry.height;
-            pgraph_apply_scaling_factor(pg, &width, &height);
-            glTexImage2D(GL_TEXTURE_2D, 0, entry.fmt.gl_internal_format, width,
-                         height, 0, entry.fmt.gl_format, entry.fmt.gl_type,
-                         NULL);
+            create_surface_texture(pg, &entry);
             found = surface_put(d, entry.vram_addr, &entry);
 
             /* FIXME: Refactor */
@@ -1267,6 +1694,89 @@ void pgraph_gl_unbind_surface(NV2AState *d, bool color)
     }
 }
 
+void pgraph_gl_apply_surface_scale_factor(NV2AState *d, unsigned int scale)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    /* Rebind at the next draw, which rescales the bound surfaces */
+    pg->surface_color.draw_dirty = false;
+    pg->surface_zeta.draw_dirty = false;
+    memset(&pg->last_surface_shape, 0, sizeof(pg->last_surface_shape));
+    pgraph_gl_unbind_surface(d, true);
+    pgraph_gl_unbind_surface(d, false);
+
+    pg->surface_scale_factor = MAX(scale, 1);
+}
+
+/*
+ * Surfaces drawn before a scale change (see dynamic_scale.c) are brought to the
+ * current scale when they are next bound, sampled, blitted or displayed.
+ */
+void pgraph_gl_rescale_surface(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    if (surface->scale == pg->surface_scale_factor) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_RESCALE);
+
+    /* An unresolved readback would be shrunk by the wrong factor */
+    destroy_readback_fence(surface);
+
+    GLint texture_binding;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture_binding);
+
+    unsigned int old_scale = surface->scale;
+    GLuint old_buffer = surface->gl_buffer;
+    create_surface_texture(pg, surface);
+
+    if (!surface->upload_pending) {
+        GLbitfield mask = GL_COLOR_BUFFER_BIT;
+        if (!surface->color) {
+            mask = GL_DEPTH_BUFFER_BIT;
+            if (surface->fmt.gl_attachment == GL_DEPTH_STENCIL_ATTACHMENT) {
+                mask |= GL_STENCIL_BUFFER_BIT;
+            }
+        }
+
+        unsigned int width = surface->width, height = surface->height;
+        pgraph_apply_scaling_factor(pg, &width, &height);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, r->blit_fbo[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, old_buffer, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->blit_fbo[1]);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, surface->gl_buffer, 0);
+        assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+        assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+
+        glDisable(GL_SCISSOR_TEST);
+        glBlitFramebuffer(0, 0, surface->width * old_scale,
+                          surface->height * old_scale, 0, 0, width, height,
+                          mask, surface->color ? GL_LINEAR : GL_NEAREST);
+
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
+    }
+
+    glDeleteTextures(1, &old_buffer);
+    glBindTexture(GL_TEXTURE_2D, texture_binding);
+
+    if (surface == r->color_binding || surface == r->zeta_binding) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, surface->gl_buffer, 0);
+    }
+}
+
 void pgraph_gl_surface_update(NV2AState *d, bool upload, bool color_write,
                            bool zeta_write)
 {
@@ -1371,11 +1881,13 @@ void pgraph_gl_init_surfaces(PGRAPHState *pg)
     glGenFramebuffers(1, &r->gl_framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
     QTAILQ_INIT(&r->surfaces);
+    r->surface_ranges = (IntervalTreeRoot){ 0 };
     r->downloads_pending = false;
     qemu_event_init(&r->downloads_complete, false);
     qemu_event_init(&r->dirty_surfaces_download_complete, false);
 
     init_render_to_texture(pg);
+    init_download_resolve(pg);
 }
 
 static void flush_surfaces(NV2AState *d)
@@ -1409,6 +1921,7 @@ void pgraph_gl_finalize_surfaces(PGRAPHState *pg)
     r->gl_framebuffer = 0;
 
     finalize_render_to_texture(pg);
+    finalize_download_resolve(pg);
 }
 
 void pgraph_gl_surface_flush(NV2AState *d)
@@ -30,31 +30,38 @@
 static TextureBinding* generate_texture(const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data);
 static void texture_binding_destroy(gpointer data);
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
-static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
+static void texture_ranges_insert(PGRAPHGLState *r, TextureLruNode *tnode)
 {
-    struct pgraph_texture_possibly_dirty_struct *test =
-        (struct pgraph_texture_possibly_dirty_struct *)opaque;
-
-    struct TextureLruNode *tnode = container_of(node, TextureLruNode, node);
-    if (tnode->binding == NULL || tnode->possibly_dirty) {
-        return;
+    if (tnode->key.texture_length > 0) {
+        tnode->texture_range.start = tnode->key.texture_vram_offset;
+        tnode->texture_range.last =
+            tnode->key.texture_vram_offset + tnode->key.texture_length - 1;
+        interval_tree_insert(&tnode->texture_range, &r->texture_ranges);
     }
+    if (tnode->key.palette_length > 0) {
+        tnode->palette_range.start = tnode->key.palette_vram_offset;
+        tnode->palette_range.last =
+            tnode->key.palette_vram_offset + tnode->key.palette_length - 1;
+        interval_tree_insert(&tnode->palette_range, &r->palette_ranges);
+    }
+}
 
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
-
+static void texture_ranges_remove(PGRAPHGLState *r, TextureLruNode *tnode)
+{
+    if (tnode->key.texture_length > 0) {
+        interval_tree_remove(&tnode->texture_range, &r->texture_ranges);
+    }
     if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
+        interval_tree_remove(&tnode->palette_range, &r->palette_ranges);
     }
+}
 
-    tnode->possibly_dirty |= overlapping;
+static void mark_texture_possibly_dirty(TextureLruNode *tnode)
+{
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_INVALIDATE_VISITED);
+    if (tnode->binding != NULL) {
+        tnode->possibly_dirty = true;
+    }
 }
 
 void pgraph_gl_mark_textures_possibly_dirty(NV2AState *d,
@@ -62,19 +69,24 @@ void pgraph_gl_mark_textures_possibly_dirty(NV2AState *d,
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
+    IntervalTreeNode *n;
 
     hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
     addr &= TARGET_PAGE_MASK;
     assert(end <= memory_region_size(d->vram));
 
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_INVALIDATE);
 
-    lru_visit_active(&r->texture_cache,
-                     mark_textures_possibly_dirty_visitor,
-                     &test);
+    for (n = interval_tree_iter_first(&r->texture_ranges, addr, end); n;
+         n = interval_tree_iter_next(n, addr, end)) {
+        mark_texture_possibly_dirty(
+            container_of(n, TextureLruNode, texture_range));
+    }
+    for (n = interval_tree_iter_first(&r->palette_ranges, addr, end); n;
+         n = interval_tree_iter_next(n, addr, end)) {
+        mark_texture_possibly_dirty(
+            container_of(n, TextureLruNode, palette_range));
+    }
 }
 
 static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
@@ -274,6 +286,10 @@ void pgraph_gl_bind_textures(NV2AState *d)
             surf_to_tex = pgraph_gl_check_surface_to_texture_compatibility(
                     surface, &state);
 
+            if (surf_to_tex) {
+                pgraph_gl_rescale_surface(d, surface);
+            }
+
             if (surf_to_tex && surface->upload_pending) {
                 pgraph_gl_upload_surface_data(d, surface, false);
             }
@@ -283,15 +299,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
             // FIXME: Restructure to support rendering surfaces to cubemap faces
 
             // Writeback any surfaces which this texture may index
-            hwaddr tex_vram_end = texture_vram_offset + length - 1;
-            QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-                hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
-                bool overlapping = !(surface->vram_addr >= tex_vram_end
-                                     || texture_vram_offset >= surf_vram_end);
-                if (overlapping) {
-                    pgraph_gl_surface_download_if_dirty(d, surface);
-                }
-            }
+            pgraph_gl_download_surfaces_in_range_if_dirty(
+                d, texture_vram_offset, length);
         }
 
         TextureKey key;
@@ -400,10 +409,83 @@ gl_internal_format_to_s3tc_enum(GLint gl_internal_format)
     }
 }
 
+/* Queue decode of each level of a swizzled texture or cubemap face */
+static void submit_gl_texture_decode(const TextureShape s,
+                                     const uint8_t *texture_data,
+                                     const uint8_t *palette_data,
+                                     TextureDecodeJob *jobs)
+{
+    ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
+    bool compressed = f.gl_format == 0;
+    unsigned int block_size =
+        f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+
+    assert(!f.linear);
+
+    unsigned int width = s.width;
+    unsigned int height = s.height;
+    unsigned int depth = s.depth;
+    if (s.border) {
+        width = MAX(16, width * 2);
+        height = MAX(16, height * 2);
+        depth = MAX(16, depth * 2);
+    }
+
+    for (int level = 0; level < s.levels; level++) {
+        TextureDecodeJob *job = &jobs[level];
+        *job = (TextureDecodeJob){
+            .shape = s,
+            .data = texture_data,
+            .palette_data = palette_data,
+            .compressed = compressed,
+            .depth = 1,
+        };
+
+        if (s.dimensionality == 3) {
+            if (compressed) {
+                assert(width % 4 == 0 && height % 4 == 0 &&
+                       "Compressed 3D texture virtual size");
+                width = MAX(width, 4);
+                height = MAX(height, 4);
+            }
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            depth = MAX(depth, 1);
+            job->width = width;
+            job->height = height;
+            job->depth = depth;
+        } else {
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
+            job->width = compressed ? (width + 3) & ~3 : width;
+            job->height = compressed ? (height + 3) & ~3 : height;
+        }
+
+        if (compressed) {
+            job->s3tc_format =
+                gl_internal_format_to_s3tc_enum(f.gl_internal_format);
+            texture_data +=
+                job->width / 4 * job->height / 4 * job->depth * block_size;
+        } else {
+            job->bytes_per_pixel = f.bytes_per_pixel;
+            texture_data +=
+                job->width * job->height * job->depth * f.bytes_per_pixel;
+        }
+
+        pgraph_texture_decode_submit(job);
+
+        width /= 2;
+        height /= 2;
+        depth /= 2;
+    }
+}
+
 static void upload_gl_texture(GLenum gl_target,
                               const TextureShape s,
                               const uint8_t *texture_data,
-                              const uint8_t *palette_data)
+                              const uint8_t *palette_data,
+                              TextureDecodeJob *jobs)
 {
     ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
     nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
@@ -411,12 +493,10 @@ static void upload_gl_texture(GLenum gl_target,
     unsigned int adjusted_width = s.width;
     unsigned int adjusted_height = s.height;
     unsigned int adjusted_pitch = s.pitch;
-    unsigned int adjusted_depth = s.depth;
     if (!f.linear && s.border) {
         adjusted_width = MAX(16, adjusted_width * 2);
         adjusted_height = MAX(16, adjusted_height * 2);
         adjusted_pitch = adjusted_width * (s.pitch / s.width);
-        adjusted_depth = MAX(16, s.depth * 2);
     }
 
     switch(gl_target) {
@@ -460,19 +540,14 @@ static void upload_gl_texture(GLenum gl_target,
             width = MAX(width, 1);
             height = MAX(height, 1);
 
+            TextureDecodeJob *job = &jobs[level];
+            pgraph_texture_decode_wait(job);
+
             if (f.gl_format == 0) { /* compressed */
-                 // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                unsigned int block_size =
-                    f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
-                        8 : 16;
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
+                unsigned int physical_width = job->width;
                 if (physical_width != width) {
                     glPixelStorei(GL_UNPACK_ROW_LENGTH, physical_width);
                 }
-                uint8_t *converted = s3tc_decompress_2d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, physical_width, physical_height);
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -490,8 +565,8 @@ static void upload_gl_texture(GLenum gl_target,
                 }
 
                 glTexImage2D(gl_target, level, GL_RGBA, tex_width, tex_height, 0,
-                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, converted);
-                g_free(converted);
+                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                             job->decoded_data);
                 if (physical_width != width) {
                     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                 }
@@ -502,17 +577,9 @@ static void upload_gl_texture(GLenum gl_target,
                         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                     }
                 }
-                texture_data +=
-                    physical_width / 4 * physical_height / 4 * block_size;
             } else {
                 unsigned int pitch = width * f.bytes_per_pixel;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                unswizzle_rect(texture_data, width, height,
-                               unswizzled, pitch, f.bytes_per_pixel);
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, 1, pitch, 0,
-                    NULL);
-                uint8_t *pixel_data = converted ? converted : unswizzled;
+                uint8_t *pixel_data = job->decoded_data;
                 unsigned int tex_width = width;
                 unsigned int tex_height = height;
 
@@ -532,14 +599,11 @@ static void upload_gl_texture(GLenum gl_target,
                 if (s.cubemap && s.border) {
                     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                 }
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * f.bytes_per_pixel;
             }
 
+            g_free(job->decoded_data);
+            job->decoded_data = NULL;
+
             width /= 2;
             height /= 2;
         }
@@ -547,74 +611,27 @@ static void upload_gl_texture(GLenum gl_target,
         break;
     }
     case GL_TEXTURE_3D: {
-
-        unsigned int width = adjusted_width;
-        unsigned int height = adjusted_height;
-        unsigned int depth = adjusted_depth;
-
         assert(f.linear == false);
 
         int level;
         for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) { /* compressed */
-                assert(width % 4 == 0 && height % 4 == 0 &&
-                       "Compressed 3D texture virtual size");
-                width = MAX(width, 4);
-                height = MAX(height, 4);
-                depth = MAX(depth, 1);
-
-                unsigned int block_size;
-                if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                    block_size = 8;
-                } else {
-                    block_size = 16;
-                }
-
-                size_t texture_size = width/4 * height/4 * depth * block_size;
-
-                uint8_t *converted = s3tc_decompress_3d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, width, height, depth);
+            TextureDecodeJob *job = &jobs[level];
+            pgraph_texture_decode_wait(job);
 
+            if (f.gl_format == 0) { /* compressed */
                 glTexImage3D(gl_target, level,  GL_RGBA8,
-                             width, height, depth, 0,
+                             job->width, job->height, job->depth, 0,
                              GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                             converted);
-
-                g_free(converted);
-
-                texture_data += texture_size;
+                             job->decoded_data);
             } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
-
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(slice_pitch * depth);
-                unswizzle_box(texture_data, width, height, depth, unswizzled,
-                               row_pitch, slice_pitch, f.bytes_per_pixel);
-
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, depth,
-                    row_pitch, slice_pitch, NULL);
-
                 glTexImage3D(gl_target, level, f.gl_internal_format,
-                             width, height, depth, 0,
+                             job->width, job->height, job->depth, 0,
                              f.gl_format, f.gl_type,
-                             converted ? converted : unswizzled);
-
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * depth * f.bytes_per_pixel;
+                             job->decoded_data);
             }
 
-            width /= 2;
-            height /= 2;
-            depth /= 2;
+            g_free(job->decoded_data);
+            job->decoded_data = NULL;
         }
         break;
     }
@@ -695,20 +712,30 @@ static TextureBinding* generate_texture(const TextureShape s,
 
         length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
 
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-                          s, texture_data + 0 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-                          s, texture_data + 1 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-                          s, texture_data + 2 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-                          s, texture_data + 3 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-                          s, texture_data + 4 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-                          s, texture_data + 5 * length, palette_data);
+        static const GLenum face_targets[6] = {
+            GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+            GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+        };
+
+        /* Decode all faces up front so they are processed in parallel */
+        g_autofree TextureDecodeJob *jobs =
+            g_new0(TextureDecodeJob, 6 * s.levels);
+        for (int face = 0; face < 6; face++) {
+            submit_gl_texture_decode(s, texture_data + face * length,
+                                     palette_data, &jobs[face * s.levels]);
+        }
+        for (int face = 0; face < 6; face++) {
+            upload_gl_texture(face_targets[face], s,
+                              texture_data + face * length, palette_data,
+                              &jobs[face * s.levels]);
+        }
+    } else if (f.linear) {
+        upload_gl_texture(gl_target, s, texture_data, palette_data, NULL);
     } else {
-        upload_gl_texture(gl_target, s, texture_data, palette_data);
+        g_autofree TextureDecodeJob *jobs = g_new0(TextureDecodeJob, s.levels);
+        submit_gl_texture_decode(s, texture_data, palette_data, jobs);
+        upload_gl_texture(gl_target, s, texture_data, palette_data, jobs);
     }
 
     /* Linear textures don't support mipmapping */
@@ -754,16 +781,20 @@ static void texture_binding_destroy(gpointer data)
 /* functions for texture LRU cache */
 static void texture_cache_entry_init(Lru *lru, LruNode *node, void *key)
 {
+    PGRAPHGLState *r = container_of(lru, PGRAPHGLState, texture_cache);
     TextureLruNode *tnode = container_of(node, TextureLruNode, node);
     memcpy(&tnode->key, key, sizeof(TextureKey));
 
     tnode->binding = NULL;
     tnode->possibly_dirty = false;
+    texture_ranges_insert(r, tnode);
 }
 
 static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
+    PGRAPHGLState *r = container_of(lru, PGRAPHGLState, texture_cache);
     TextureLruNode *tnode = container_of(node, TextureLruNode, node);
+    texture_ranges_remove(r, tnode);
     if (tnode->binding) {
         texture_binding_destroy(tnode->binding);
         tnode->binding = NULL;
@@ -783,6 +814,8 @@ void pgraph_gl_init_textures(NV2AState *d)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     const size_t texture_cache_size = 512;
+    r->texture_ranges = (IntervalTreeRoot){ 0 };
+    r->palette_ranges = (IntervalTreeRoot){ 0 };
     lru_init(&r->texture_cache);
     r->texture_cache_entries = malloc(texture_cache_size * sizeof(TextureLruNode));
     assert(r->texture_cache_entries != NULL);
@@ -21,9 +21,132 @@
 
 #include "hw/xbox/nv2a/nv2a_regs.h"
 #include <hw/xbox/nv2a/nv2a_int.h>
+#include "exec/ram_addr.h"
 #include "debug.h"
 #include "renderer.h"
 
+static bool retire_memory_buffer_fence(PGRAPHGLState *r, bool wait)
+{
+    assert(r->memory_buffer_num_fences > 0);
+
+    unsigned int idx = r->memory_buffer_fence_tail;
+    GLsync fence = r->memory_buffer_fences[idx].fence;
+    GLenum result = glClientWaitSync(fence,
+                                     wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? GL_TIMEOUT_IGNORED : 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+    assert(result != GL_WAIT_FAILED);
+    glDeleteSync(fence);
+
+    r->memory_buffer_completed_serial = r->memory_buffer_fences[idx].serial;
+    r->memory_buffer_fence_tail = (idx + 1) % MEMORY_BUFFER_MAX_FENCES;
+    r->memory_buffer_num_fences--;
+    return true;
+}
+
+/*
+ * Close the current batch of draws reading from the memory buffer, so pages
+ * they read can be reused once the GPU is done with them. This happens once
+ * per frame, or earlier when a write overlaps pages read by the open batch.
+ */
+void pgraph_gl_fence_memory_buffer(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    if (!r->gl_memory_buffer_mapped || !r->memory_buffer_used) {
+        return;
+    }
+
+    while (r->memory_buffer_num_fences &&
+           retire_memory_buffer_fence(r, false)) {
+    }
+    if (r->memory_buffer_num_fences == MEMORY_BUFFER_MAX_FENCES) {
+        retire_memory_buffer_fence(r, true);
+    }
+
+    unsigned int idx = (r->memory_buffer_fence_tail +
+                        r->memory_buffer_num_fences) % MEMORY_BUFFER_MAX_FENCES;
+    r->memory_buffer_fences[idx].fence =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->memory_buffer_fences[idx].serial = r->memory_buffer_serial++;
+    r->memory_buffer_num_fences++;
+    r->memory_buffer_used = false;
+}
+
+static void wait_for_memory_buffer_serial(PGRAPHState *pg, uint64_t serial)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    if (serial == r->memory_buffer_serial && !r->memory_buffer_used) {
+        /* Nothing has read from the buffer since the last fence */
+        serial--;
+    }
+    if (serial <= r->memory_buffer_completed_serial) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1_STALL);
+
+    if (serial == r->memory_buffer_serial) {
+        pgraph_gl_fence_memory_buffer(pg);
+    }
+    while (r->memory_buffer_completed_serial < serial) {
+        retire_memory_buffer_fence(r, true);
+    }
+}
+
+static void write_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    uint64_t serial = 0;
+    for (hwaddr page = addr; page < addr + size; page += TARGET_PAGE_SIZE) {
+        serial = MAX(serial,
+                     r->memory_buffer_page_serials[page >> TARGET_PAGE_BITS]);
+    }
+    wait_for_memory_buffer_serial(pg, serial);
+
+    memcpy(r->gl_memory_buffer_mapped + addr, d->vram_ptr + addr, size);
+    nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
+}
+
+static void update_mapped_memory_buffer(NV2AState *d, hwaddr addr, hwaddr end)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+    ram_addr_t ram_base = memory_region_get_ram_addr(d->vram);
+
+    if (cpu_physical_memory_get_dirty(ram_base + addr, end - addr,
+                                      DIRTY_MEMORY_NV2A)) {
+        /* Copy runs of dirty pages */
+        hwaddr run_start = 0;
+        bool in_run = false;
+        for (hwaddr page = addr; page <= end; page += TARGET_PAGE_SIZE) {
+            bool dirty = page < end &&
+                         cpu_physical_memory_get_dirty(ram_base + page,
+                                                       TARGET_PAGE_SIZE,
+                                                       DIRTY_MEMORY_NV2A);
+            if (dirty && !in_run) {
+                run_start = page;
+                in_run = true;
+            } else if (!dirty && in_run) {
+                memory_region_reset_dirty(d->vram, run_start, page - run_start,
+                                          DIRTY_MEMORY_NV2A);
+                write_memory_buffer(d, run_start, page - run_start);
+                in_run = false;
+            }
+        }
+    }
+
+    for (hwaddr page = addr; page < end; page += TARGET_PAGE_SIZE) {
+        r->memory_buffer_page_serials[page >> TARGET_PAGE_BITS] =
+            r->memory_buffer_serial;
+    }
+    r->memory_buffer_used = true;
+}
+
 static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
                                  bool quick)
 {
@@ -36,12 +159,17 @@ static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
     addr &= TARGET_PAGE_MASK;
     assert(end < memory_region_size(d->vram));
 
-    static hwaddr last_addr, last_end;
-    if (quick && (addr >= last_addr) && (end <= last_end)) {
+    if (quick && (addr >= r->memory_buffer_last_addr) &&
+        (end <= r->memory_buffer_last_end)) {
+        return;
+    }
+    r->memory_buffer_last_addr = addr;
+    r->memory_buffer_last_end = end;
+
+    if (r->gl_memory_buffer_mapped) {
+        update_mapped_memory_buffer(d, addr, end);
         return;
     }
-    last_addr = addr;
-    last_end = end;
 
     size = end - addr;
     if (memory_region_test_and_clear_dirty(d->vram, addr, size,
@@ -57,6 +185,13 @@ void pgraph_gl_update_entire_memory_buffer(NV2AState *d)
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
+    if (r->gl_memory_buffer_mapped) {
+        wait_for_memory_buffer_serial(pg, r->memory_buffer_serial);
+        memcpy(r->gl_memory_buffer_mapped, d->vram_ptr,
+               memory_region_size(d->vram));
+        return;
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
     glBufferSubData(GL_ARRAY_BUFFER, 0, memory_region_size(d->vram), d->vram_ptr);
 }
@@ -274,8 +409,22 @@ void pgraph_gl_init_buffers(NV2AState *d)
 
     glGenBuffers(1, &r->gl_memory_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
-    glBufferData(GL_ARRAY_BUFFER, memory_region_size(d->vram),
-                 NULL, GL_DYNAMIC_DRAW);
+    size_t vram_size = memory_region_size(d->vram);
+    if (glo_check_extension("GL_ARB_buffer_storage")) {
+        /* Vertex fetch reads the guest data in place, no driver copies */
+        GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, vram_size, NULL, flags);
+        r->gl_memory_buffer_mapped =
+            glMapBufferRange(GL_ARRAY_BUFFER, 0, vram_size, flags);
+        assert(r->gl_memory_buffer_mapped);
+        r->memory_buffer_page_serials =
+            g_new0(uint64_t, vram_size >> TARGET_PAGE_BITS);
+        r->memory_buffer_serial = 1;
+        r->memory_buffer_completed_serial = 0;
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, vram_size, NULL, GL_DYNAMIC_DRAW);
+    }
 
     glGenVertexArrays(1, &r->gl_vertex_array);
     glBindVertexArray(r->gl_vertex_array);
@@ -303,6 +452,16 @@ void pgraph_gl_finalize_buffers(PGRAPHState *pg)
     glDeleteBuffers(1, &r->gl_inline_array_buffer);
     r->gl_inline_array_buffer = 0;
 
+    if (r->gl_memory_buffer_mapped) {
+        while (r->memory_buffer_num_fences) {
+            retire_memory_buffer_fence(r, true);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        r->gl_memory_buffer_mapped = NULL;
+        g_free(r->memory_buffer_page_serials);
+        r->memory_buffer_page_serials = NULL;
+    }
     glDeleteBuffers(1, &r->gl_memory_buffer);
     r->gl_memory_buffer = 0;
 
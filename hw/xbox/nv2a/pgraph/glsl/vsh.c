@@ -27,6 +27,67 @@
 #include "vsh-prog.h"
 #include <stdbool.h>
 
+static void append_vertex_fetch(MString *body, const ShaderState *state,
+                                int attr)
+{
+    static const char *component[] = { "x", "y", "z", "w" };
+    int format = state->fetch_attr[attr].format;
+    int count = state->fetch_attr[attr].count;
+
+    mstring_append_fmt(body,
+                       "vec4 v%d = vec4(0.0, 0.0, 0.0, 1.0);\n"
+                       "{\n"
+                       "  int addr = vertexFetch[%d].x + "
+                       "gl_VertexIndex * vertexFetch[%d].y;\n",
+                       attr, attr, attr);
+
+    switch (format) {
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D:
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL:
+        for (int c = 0; c < count; c++) {
+            mstring_append_fmt(body,
+                               "  v%d.%s = float(fetchU8(addr + %d)) / 255.0;\n",
+                               attr, component[c], c);
+        }
+        if (format == NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D) {
+            mstring_append_fmt(body, "  v%d = v%d.bgra;\n", attr, attr);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1:
+        for (int c = 0; c < count; c++) {
+            mstring_append_fmt(body,
+                               "  v%d.%s = max(float(fetchS16(addr + %d)) / "
+                               "32767.0, -1.0);\n",
+                               attr, component[c], c * 2);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K:
+        for (int c = 0; c < count; c++) {
+            mstring_append_fmt(body,
+                               "  v%d.%s = float(fetchS16(addr + %d));\n",
+                               attr, component[c], c * 2);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_F:
+        for (int c = 0; c < count; c++) {
+            mstring_append_fmt(body,
+                               "  v%d.%s = uintBitsToFloat(fetchU32(addr + %d));\n",
+                               attr, component[c], c * 4);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_CMP:
+        mstring_append_fmt(body,
+                           "  v%d = decompress_11_11_10(int(fetchU32(addr)));\n",
+                           attr);
+        break;
+    default:
+        assert(!"Unsupported vertex fetch format");
+        break;
+    }
+
+    mstring_append(body, "}\n");
+}
+
 MString *pgraph_gen_vsh_glsl(const ShaderState *state, bool prefix_outputs)
 {
     int i;
@@ -94,17 +155,55 @@ MString *pgraph_gen_vsh_glsl(const ShaderState *state, bool prefix_outputs)
     }
     mstring_append(header, "\n");
 
+    if (state->fetch_attrs) {
+        /* Unaligned attributes are decoded from the VRAM mirror directly */
+        assert(state->vulkan);
+        mstring_append_fmt(uniforms, "    ivec4 vertexFetch[%d];\n",
+                           NV2A_VERTEXSHADER_ATTRIBUTES);
+        mstring_append_fmt(header,
+            "layout(binding = %d, std430) readonly buffer VertexRam {\n"
+            "    uint vram[];\n"
+            "};\n"
+            "\n"
+            /* VRAM size is a power of two, wrap rather than read past it */
+            "uint fetchWord(int idx) {\n"
+            "    return vram[idx & (vram.length() - 1)];\n"
+            "}\n"
+            "uint fetchU8(int addr) {\n"
+            "    return bitfieldExtract(fetchWord(addr >> 2), (addr & 3) * 8, 8);\n"
+            "}\n"
+            "int fetchS16(int addr) {\n"
+            "    return bitfieldExtract(int(fetchU8(addr) | "
+            "(fetchU8(addr + 1) << 8)), 0, 16);\n"
+            "}\n"
+            "uint fetchU32(int addr) {\n"
+            "    int shift = (addr & 3) * 8;\n"
+            "    uint lo = fetchWord(addr >> 2);\n"
+            "    if (shift == 0) {\n"
+            "        return lo;\n"
+            "    }\n"
+            "    return (lo >> shift) |\n"
+            "           (fetchWord((addr >> 2) + 1) << (32 - shift));\n"
+            "}\n"
+            "\n",
+            VSH_VRAM_BINDING);
+    }
+
     int num_uniform_attrs = 0;
 
     for (i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
         bool is_uniform = state->uniform_attrs & (1 << i);
         bool is_swizzled = state->swizzle_attrs & (1 << i);
         bool is_compressed = state->compressed_attrs & (1 << i);
+        bool is_fetched = state->fetch_attrs & (1 << i);
 
         assert(!(is_uniform && is_compressed));
         assert(!(is_uniform && is_swizzled));
+        assert(!(is_fetched && (is_uniform || is_compressed || is_swizzled)));
 
-        if (is_uniform) {
+        if (is_fetched) {
+            continue;
+        } else if (is_uniform) {
             mstring_append_fmt(header, "vec4 v%d = inlineValue[%d];\n", i,
                                num_uniform_attrs);
             num_uniform_attrs += 1;
@@ -126,6 +225,10 @@ MString *pgraph_gen_vsh_glsl(const ShaderState *state, bool prefix_outputs)
     MString *body = mstring_from_str("void main() {\n");
 
     for (i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        if (state->fetch_attrs & (1 << i)) {
+            append_vertex_fetch(body, state, i);
+        }
+
         if (state->compressed_attrs & (1 << i)) {
             mstring_append_fmt(
                 body, "vec4 v%d = decompress_11_11_10(v%d_cmp);\n", i, i);
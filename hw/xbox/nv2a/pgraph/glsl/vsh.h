@@ -27,6 +27,7 @@
 
 // FIXME: Move to struct
 #define VSH_UBO_BINDING 0
+#define VSH_VRAM_BINDING 6 /* Follows the PSH_TEX_BINDING samplers */
 
 MString *pgraph_gen_vsh_glsl(const ShaderState *state, bool prefix_outputs);
 
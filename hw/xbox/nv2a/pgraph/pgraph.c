@@ -24,6 +24,7 @@
 #include "ui/xemu-settings.h"
 #include "util.h"
 #include "swizzle.h"
+#include "texture.h"
 #include "nv2a_vsh_emulator.h"
 
 #define PG_GET_MASK(reg, mask) GET_MASK(pgraph_reg_r(pg, reg), mask)
@@ -231,6 +232,7 @@ void pgraph_init(NV2AState *d)
     PG_SET_MASK(NV_PGRAPH_CONTROL_3, NV_PGRAPH_CONTROL_3_SHADEMODE,
          NV_PGRAPH_CONTROL_3_SHADEMODE_SMOOTH);
     pg->primitive_mode = PRIM_TYPE_INVALID;
+    pg->program_cache_start = -1;
 
     for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
         VertexAttribute *attribute = &pg->vertex_attributes[i];
@@ -240,6 +242,8 @@ void pgraph_init(NV2AState *d)
     }
 
     pgraph_clear_dirty_reg_map(pg);
+    pgraph_texture_decode_init();
+    pgraph_cull_init(pg);
 }
 
 void pgraph_clear_dirty_reg_map(PGRAPHState *pg)
@@ -347,6 +351,8 @@ void pgraph_destroy(PGRAPHState *pg)
        pg->renderer->ops.finalize(d);
     }
 
+    pgraph_texture_decode_finalize();
+    pgraph_cull_finalize(pg);
     qemu_mutex_destroy(&pg->lock);
 }
 
@@ -372,6 +378,9 @@ void nv2a_release_framebuffer_surface(void)
     NV2AState *d = g_nv2a;
     PGRAPHState *pg = &d->pgraph;
     qemu_mutex_lock(&pg->renderer_lock);
+    if (pg->renderer->ops.release_framebuffer_surface) {
+        pg->renderer->ops.release_framebuffer_surface(d);
+    }
     pg->framebuffer_in_use = false;
     qemu_cond_broadcast(&pg->framebuffer_released);
     qemu_mutex_unlock(&pg->renderer_lock);
@@ -591,6 +600,53 @@ static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
     *num_words_consumed = num_words_available;
 }
 
+static void pgraph_method_log_run(unsigned int subchannel, unsigned int method,
+                                  uint32_t *parameters, size_t count,
+                                  bool inc)
+{
+    if (!trace_event_get_state_backends(TRACE_NV2A_PGRAPH_METHOD)) {
+        return;
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        pgraph_method_log(subchannel, NV_KELVIN_PRIMITIVE,
+                          inc ? method + 4 * i : method,
+                          ldl_le_p(parameters + i));
+    }
+}
+
+/*
+ * Bulk variants of pgraph_method_inc and pgraph_method_non_inc. The handler
+ * is called once for the whole run, with num_words_available limited to the
+ * run length, and must consume every word of it.
+ */
+static void pgraph_method_inc_bulk(MethodFunc handler, uint32_t end,
+                                   METHOD_HANDLER_ARG_DECL)
+{
+    if (inc) {
+        num_words_available =
+            MIN(num_words_available, (end - method) / 4);
+    } else {
+        num_words_available = 1;
+    }
+    pgraph_method_log_run(subchannel, method, parameters, num_words_available,
+                          true);
+    handler(METHOD_HANDLER_ARGS);
+    assert(*num_words_consumed == num_words_available);
+}
+
+static void pgraph_method_non_inc_bulk(MethodFunc handler,
+                                       METHOD_HANDLER_ARG_DECL)
+{
+    if (inc) {
+        num_words_available = 1;
+    }
+    pgraph_method_log_run(subchannel, method, parameters, num_words_available,
+                          false);
+    handler(METHOD_HANDLER_ARGS);
+    assert(*num_words_consumed == num_words_available);
+}
+
 #define METHOD_FUNC_NAME_INT(gclass, name) METHOD_FUNC_NAME(gclass, name##_int)
 #define DEF_METHOD_INT(gclass, name) DEF_METHOD(gclass, name##_int)
 #define DEF_METHOD(gclass, name) DEF_METHOD_PROTO(gclass, name)
@@ -614,6 +670,119 @@ static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
     }                                                             \
     DEF_METHOD_INT(gclass, name)
 
+#define DEF_METHOD_INC_BULK(gclass, name)                           \
+    DEF_METHOD_INT(gclass, name);                                   \
+    DEF_METHOD(gclass, name)                                        \
+    {                                                               \
+        pgraph_method_inc_bulk(METHOD_FUNC_NAME_INT(gclass, name),  \
+                               METHOD_RANGE_END_NAME(gclass, name), \
+                               METHOD_HANDLER_ARGS);                \
+    }                                                               \
+    DEF_METHOD_INT(gclass, name)
+
+#define DEF_METHOD_NON_INC_BULK(gclass, name)                          \
+    DEF_METHOD_INT(gclass, name);                                      \
+    DEF_METHOD(gclass, name)                                           \
+    {                                                                  \
+        pgraph_method_non_inc_bulk(METHOD_FUNC_NAME_INT(gclass, name), \
+                                   METHOD_HANDLER_ARGS);               \
+    }                                                                  \
+    DEF_METHOD_INT(gclass, name)
+
+#define PUSH_HDR_IS_METHOD(hdr) (((hdr) & 0xa0000003) == 0)
+#define PUSH_HDR_METHOD(hdr) ((hdr) & 0x31fff)
+#define PUSH_HDR_SUBCHANNEL(hdr) (((hdr) >> 13) & 7)
+#define PUSH_HDR_COUNT(hdr) (((hdr) >> 18) & 0x7ff)
+
+static unsigned int get_list_primitive_vertex_count(unsigned int primitive_mode)
+{
+    switch (primitive_mode) {
+    case PRIM_TYPE_POINTS:
+        return 1;
+    case PRIM_TYPE_LINES:
+        return 2;
+    case PRIM_TYPE_TRIANGLES:
+        return 3;
+    case PRIM_TYPE_QUADS:
+        return 4;
+    default:
+        /* Concatenating strips, loops, fans and polygons would connect them */
+        return 0;
+    }
+}
+
+static bool is_array_element_method(unsigned int method)
+{
+    return method == NV097_ARRAY_ELEMENT16 || method == NV097_ARRAY_ELEMENT32;
+}
+
+/*
+ * Check whether the vertex data method just processed is followed by END,
+ * BEGIN with the same primitive mode, and more vertex data of the same kind.
+ * No state can change in between, so the next block can be appended to the
+ * current batch and drawn together with it.
+ *
+ * next points to the header of the method following the current one.
+ */
+static bool pgraph_can_merge_next_begin_end(PGRAPHState *pg,
+                                            unsigned int subchannel,
+                                            unsigned int method,
+                                            const uint32_t *next)
+{
+    uint32_t end_hdr = ldl_le_p(next), end_param = ldl_le_p(next + 1);
+    uint32_t begin_hdr = ldl_le_p(next + 2), begin_param = ldl_le_p(next + 3);
+    uint32_t data_hdr = ldl_le_p(next + 4);
+
+    if (!PUSH_HDR_IS_METHOD(end_hdr) || !PUSH_HDR_IS_METHOD(begin_hdr) ||
+        !PUSH_HDR_IS_METHOD(data_hdr) ||
+        PUSH_HDR_METHOD(end_hdr) != NV097_SET_BEGIN_END ||
+        PUSH_HDR_COUNT(end_hdr) != 1 ||
+        PUSH_HDR_SUBCHANNEL(end_hdr) != subchannel ||
+        end_param != NV097_SET_BEGIN_END_OP_END ||
+        PUSH_HDR_METHOD(begin_hdr) != NV097_SET_BEGIN_END ||
+        PUSH_HDR_COUNT(begin_hdr) != 1 ||
+        PUSH_HDR_SUBCHANNEL(begin_hdr) != subchannel ||
+        begin_param != pg->primitive_mode ||
+        PUSH_HDR_SUBCHANNEL(data_hdr) != subchannel) {
+        return false;
+    }
+
+    unsigned int data_method = PUSH_HDR_METHOD(data_hdr);
+    size_t data_words = PUSH_HDR_COUNT(data_hdr);
+
+    if (method == NV097_DRAW_ARRAYS) {
+        return data_method == NV097_DRAW_ARRAYS &&
+               pg->inline_elements_length == 0 &&
+               pg->draw_arrays_length <
+                   (ARRAY_SIZE(pg->draw_arrays_start) - 1);
+    }
+
+    /* Index and vertex lists can only be concatenated for list primitives */
+    unsigned int primitive_vertices =
+        get_list_primitive_vertex_count(pg->primitive_mode);
+    if (!primitive_vertices) {
+        return false;
+    }
+
+    if (is_array_element_method(method)) {
+        return is_array_element_method(data_method) &&
+               pg->draw_arrays_length == 0 &&
+               pg->inline_elements_length % primitive_vertices == 0 &&
+               pg->inline_elements_length + 2 * data_words <=
+                   NV2A_MAX_BATCH_LENGTH;
+    }
+
+    if (method == NV097_INLINE_ARRAY) {
+        unsigned int vertex_size = pgraph_get_inline_array_vertex_size(pg);
+        return data_method == NV097_INLINE_ARRAY && vertex_size &&
+               (pg->inline_array_length * 4) %
+                       (vertex_size * primitive_vertices) == 0 &&
+               pg->inline_array_length + data_words <= NV2A_MAX_BATCH_LENGTH;
+    }
+
+    return false;
+}
+
 int pgraph_method(NV2AState *d, unsigned int subchannel,
                    unsigned int method, uint32_t parameter,
                    uint32_t *parameters, size_t num_words_available,
@@ -776,26 +945,22 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
         handler(d, pg, subchannel, method, parameter, parameters,
                 num_words_available, &num_words_consumed, inc);
 
-        /* Squash repeated BEGIN,DRAW_ARRAYS,END */
-        #define LAM(i, mthd) ((parameters[i*2+1] & 0x31fff) == (mthd))
-        #define LAP(i, prm) (parameters[i*2+2] == (prm))
-        #define LAMP(i, mthd, prm) (LAM(i, mthd) && LAP(i, prm))
-
-        if (method == NV097_DRAW_ARRAYS && (max_lookahead_words >= 7) &&
-            pg->inline_elements_length == 0 &&
-            pg->draw_arrays_length <
-                (ARRAY_SIZE(pg->draw_arrays_start) - 1) &&
-            LAMP(0, NV097_SET_BEGIN_END, NV097_SET_BEGIN_END_OP_END) &&
-            LAMP(1, NV097_SET_BEGIN_END, pg->primitive_mode) &&
-            LAM(2, NV097_DRAW_ARRAYS)) {
+        /* Squash repeated BEGIN,<vertex data>,END */
+        if (num_words_consumed == num_words_available &&
+            max_lookahead_words >= num_words_consumed + 5 &&
+            pgraph_can_merge_next_begin_end(pg, subchannel, method,
+                                            parameters + num_words_consumed)) {
+            nv2a_profile_inc_counter(NV2A_PROF_BEGIN_ENDS_MERGED);
             num_words_consumed += 4;
-            pg->draw_arrays_prevent_connect = true;
+            if (method == NV097_DRAW_ARRAYS) {
+                pg->draw_arrays_prevent_connect = true;
+            } else if (method == NV097_INLINE_ARRAY) {
+                pg->inline_merged_length = pg->inline_array_length;
+            } else {
+                pg->inline_merged_length = pg->inline_elements_length;
+            }
         }
 
-        #undef LAM
-        #undef LAP
-        #undef LAMP
-
         num_processed = num_words_consumed;
         break;
     }
@@ -900,6 +1065,7 @@ DEF_METHOD(NV097, FLIP_STALL)
     d->pgraph.renderer->ops.surface_update(d, false, true, true);
     d->pgraph.renderer->ops.flip_stall(d);
     nv2a_profile_flip_stall();
+    pgraph_dynamic_scale_flip(d);
     pg->waiting_for_flip = true;
 }
 
@@ -1845,39 +2011,47 @@ DEF_METHOD_INC(NV097, SET_VIEWPORT_SCALE)
     pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_VPSCL] = true;
 }
 
-DEF_METHOD_INC(NV097, SET_TRANSFORM_PROGRAM)
+DEF_METHOD_INC_BULK(NV097, SET_TRANSFORM_PROGRAM)
 {
     int slot = (method - NV097_SET_TRANSFORM_PROGRAM) / 4;
 
     int program_load = PG_GET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
                                 NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR);
 
-    assert(program_load < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
-    pg->program_data[program_load][slot%4] = parameter;
+    for (size_t i = 0; i < num_words_available; i++, slot++) {
+        assert(program_load < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+        pg->program_data[program_load][slot%4] = ldl_le_p(parameters + i);
+        if (slot % 4 == 3) {
+            program_load++;
+        }
+    }
     pg->program_data_dirty = true;
 
-    if (slot % 4 == 3) {
-        PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
-                 NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, program_load+1);
-    }
+    PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
+             NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, program_load);
+    *num_words_consumed = num_words_available;
 }
 
-DEF_METHOD_INC(NV097, SET_TRANSFORM_CONSTANT)
+DEF_METHOD_INC_BULK(NV097, SET_TRANSFORM_CONSTANT)
 {
     int slot = (method - NV097_SET_TRANSFORM_CONSTANT) / 4;
     int const_load = PG_GET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
                               NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR);
 
-    assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
-    // VertexShaderConstant *constant = &pg->constants[const_load];
-    pg->vsh_constants_dirty[const_load] |=
-        (parameter != pg->vsh_constants[const_load][slot%4]);
-    pg->vsh_constants[const_load][slot%4] = parameter;
-
-    if (slot % 4 == 3) {
-        PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
-                 NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load+1);
+    for (size_t i = 0; i < num_words_available; i++, slot++) {
+        assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
+        uint32_t value = ldl_le_p(parameters + i);
+        uint32_t *constant = &pg->vsh_constants[const_load][slot%4];
+        pg->vsh_constants_dirty[const_load] |= (value != *constant);
+        *constant = value;
+        if (slot % 4 == 3) {
+            const_load++;
+        }
     }
+
+    PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
+             NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load);
+    *num_words_consumed = num_words_available;
 }
 
 DEF_METHOD_INC(NV097, SET_VERTEX3F)
@@ -2311,7 +2485,9 @@ DEF_METHOD(NV097, SET_BEGIN_END)
             NV2A_DPRINTF("End without Begin!\n");
         }
         nv2a_profile_inc_counter(NV2A_PROF_BEGIN_ENDS);
-        d->pgraph.renderer->ops.draw_end(d);
+        if (!pgraph_cull_batch(d)) {
+            d->pgraph.renderer->ops.draw_end(d);
+        }
         pgraph_reset_inline_buffers(pg);
         pg->primitive_mode = PRIM_TYPE_INVALID;
     } else {
@@ -2481,6 +2657,30 @@ static void pgraph_expand_draw_arrays(NV2AState *d)
     pgraph_reset_draw_arrays(pg);
 }
 
+/*
+ * Only the first data method of a merged block is checked against the batch
+ * limit, the rest of the block may not fit. In that case, draw the blocks
+ * merged so far and move the current block to the start of the buffer.
+ */
+static void pgraph_split_merged_batch(NV2AState *d, uint32_t *buffer,
+                                      unsigned int *length, size_t count)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned int merged = pg->inline_merged_length;
+
+    if (!merged || *length + count <= NV2A_MAX_BATCH_LENGTH) {
+        return;
+    }
+
+    unsigned int current = *length - merged;
+    *length = merged;
+    d->pgraph.renderer->ops.flush_draw(d);
+
+    memmove(buffer, buffer + merged, current * sizeof(*buffer));
+    *length = current;
+    pg->inline_merged_length = 0;
+}
+
 void pgraph_check_within_begin_end_block(PGRAPHState *pg)
 {
     if (pg->primitive_mode == PRIM_TYPE_INVALID) {
@@ -2488,7 +2688,7 @@ void pgraph_check_within_begin_end_block(PGRAPHState *pg)
     }
 }
 
-DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
+DEF_METHOD_NON_INC_BULK(NV097, ARRAY_ELEMENT16)
 {
     pgraph_check_within_begin_end_block(pg);
 
@@ -2496,12 +2696,22 @@ DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
         pgraph_expand_draw_arrays(d);
     }
 
-    assert(pg->inline_elements_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_elements[pg->inline_elements_length++] = parameter & 0xFFFF;
-    pg->inline_elements[pg->inline_elements_length++] = parameter >> 16;
+    pgraph_split_merged_batch(d, pg->inline_elements,
+                              &pg->inline_elements_length,
+                              2 * num_words_available);
+    assert(pg->inline_elements_length + 2 * num_words_available <=
+           NV2A_MAX_BATCH_LENGTH);
+    uint32_t *elements = &pg->inline_elements[pg->inline_elements_length];
+    for (size_t i = 0; i < num_words_available; i++) {
+        uint32_t value = ldl_le_p(parameters + i);
+        elements[i * 2] = value & 0xFFFF;
+        elements[i * 2 + 1] = value >> 16;
+    }
+    pg->inline_elements_length += 2 * num_words_available;
+    *num_words_consumed = num_words_available;
 }
 
-DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT32)
+DEF_METHOD_NON_INC_BULK(NV097, ARRAY_ELEMENT32)
 {
     pgraph_check_within_begin_end_block(pg);
 
@@ -2509,8 +2719,17 @@ DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT32)
         pgraph_expand_draw_arrays(d);
     }
 
-    assert(pg->inline_elements_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_elements[pg->inline_elements_length++] = parameter;
+    pgraph_split_merged_batch(d, pg->inline_elements,
+                              &pg->inline_elements_length,
+                              num_words_available);
+    assert(pg->inline_elements_length + num_words_available <=
+           NV2A_MAX_BATCH_LENGTH);
+    uint32_t *elements = &pg->inline_elements[pg->inline_elements_length];
+    for (size_t i = 0; i < num_words_available; i++) {
+        elements[i] = ldl_le_p(parameters + i);
+    }
+    pg->inline_elements_length += num_words_available;
+    *num_words_consumed = num_words_available;
 }
 
 DEF_METHOD(NV097, DRAW_ARRAYS)
@@ -2522,7 +2741,9 @@ DEF_METHOD(NV097, DRAW_ARRAYS)
 
     if (pg->inline_elements_length) {
         /* FIXME: Determine HW behavior for overflow case. */
-        assert((pg->inline_elements_length + count) < NV2A_MAX_BATCH_LENGTH);
+        pgraph_split_merged_batch(d, pg->inline_elements,
+                                  &pg->inline_elements_length, count);
+        assert((pg->inline_elements_length + count) <= NV2A_MAX_BATCH_LENGTH);
         assert(!pg->draw_arrays_prevent_connect);
 
         for (unsigned int i = 0; i < count; i++) {
@@ -2554,11 +2775,19 @@ DEF_METHOD(NV097, DRAW_ARRAYS)
     pg->draw_arrays_prevent_connect = false;
 }
 
-DEF_METHOD_NON_INC(NV097, INLINE_ARRAY)
+DEF_METHOD_NON_INC_BULK(NV097, INLINE_ARRAY)
 {
     pgraph_check_within_begin_end_block(pg);
-    assert(pg->inline_array_length < NV2A_MAX_BATCH_LENGTH);
-    pg->inline_array[pg->inline_array_length++] = parameter;
+    pgraph_split_merged_batch(d, pg->inline_array, &pg->inline_array_length,
+                              num_words_available);
+    assert(pg->inline_array_length + num_words_available <=
+           NV2A_MAX_BATCH_LENGTH);
+    uint32_t *dest = &pg->inline_array[pg->inline_array_length];
+    for (size_t i = 0; i < num_words_available; i++) {
+        dest[i] = ldl_le_p(parameters + i);
+    }
+    pg->inline_array_length += num_words_available;
+    *num_words_consumed = num_words_available;
 }
 
 DEF_METHOD_INC(NV097, SET_EYE_VECTOR)
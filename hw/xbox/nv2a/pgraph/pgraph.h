@@ -36,6 +36,7 @@
 typedef struct NV2AState NV2AState;
 typedef struct PGRAPHNullState PGRAPHNullState;
 typedef struct PGRAPHGLState PGRAPHGLState;
+typedef struct PGRAPHSwState PGRAPHSwState;
 typedef struct PGRAPHVkState PGRAPHVkState;
 
 typedef struct VertexAttribute {
@@ -59,6 +60,23 @@ typedef struct VertexAttribute {
     bool inline_buffer_populated;
 } VertexAttribute;
 
+/* Where the attributes of the current draw are read from on the CPU */
+typedef struct PGRAPHVertexSource {
+    /* NULL if the attribute is constant for the whole draw */
+    const uint8_t *data;
+    const float *floats;
+    unsigned int stride;
+    size_t length;
+    bool bgra;
+} PGRAPHVertexSource;
+
+typedef struct PGRAPHVertexFetch {
+    PGRAPHVertexSource attrs[NV2A_VERTEXSHADER_ATTRIBUTES];
+    float constants[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+    /* Number of vertices of an inline array draw, zero otherwise */
+    unsigned int inline_array_vertices;
+} PGRAPHVertexFetch;
+
 typedef struct Surface {
     bool draw_dirty;
     bool buffer_dirty;
@@ -120,7 +138,12 @@ typedef struct PGRAPHRenderer {
         void (*surface_update)(NV2AState *d, bool upload, bool color_write, bool zeta_write);
         void (*set_surface_scale_factor)(NV2AState *d, unsigned int scale);
         unsigned int (*get_surface_scale_factor)(NV2AState *d);
+        /* Between frames on the PGRAPH thread, see dynamic_scale.c */
+        void (*apply_surface_scale_factor)(NV2AState *d, unsigned int scale);
+        /* Total us the GPU spent executing submitted work */
+        uint64_t (*get_gpu_time)(NV2AState *d);
         int (*get_framebuffer_surface)(NV2AState *d);
+        void (*release_framebuffer_surface)(NV2AState *d);
     } ops;
 } PGRAPHRenderer;
 
@@ -177,6 +200,15 @@ typedef struct PGRAPHState {
     uint32_t vertex_state_shader_v0[4];
     uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
     bool program_data_dirty;
+    int program_cache_start;
+    int program_cache_length;
+    uint64_t program_cache_hash;
+
+    /* CPU translated vertex programs by hash, see cull.c */
+    GHashTable *cull_programs;
+    struct VshCpuProgram *cull_fixed_function;
+    struct CullVertex *cull_vertices;
+    unsigned int cull_vertices_capacity;
 
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4];
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS];
@@ -203,6 +235,7 @@ typedef struct PGRAPHState {
     uint16_t compressed_attrs;
     uint16_t uniform_attrs;
     uint16_t swizzle_attrs;
+    uint16_t fetch_attrs;
 
     unsigned int inline_array_length;
     uint32_t inline_array[NV2A_MAX_BATCH_LENGTH];
@@ -210,6 +243,9 @@ typedef struct PGRAPHState {
     unsigned int inline_elements_length;
     uint32_t inline_elements[NV2A_MAX_BATCH_LENGTH];
 
+    /* Leading part of inline_elements/inline_array from merged blocks */
+    unsigned int inline_merged_length;
+
     unsigned int inline_buffer_length;
 
     unsigned int draw_arrays_length;
@@ -241,11 +277,27 @@ typedef struct PGRAPHState {
     unsigned int surface_scale_factor;
     uint8_t *scale_buf;
 
+    /* Frame load tracking, see dynamic_scale.c */
+    struct {
+        int64_t last_flip;
+        int64_t idle_start;
+        int64_t idle_time;
+        uint64_t last_gpu_time;
+        unsigned int scale;
+        float load;
+        int cooldown;
+        int frames_since_change;
+        int frames_over_budget;
+        int frames_under_budget;
+        int step_up_backoff;
+    } dynamic_scale;
+
     const PGRAPHRenderer *renderer;
     union {
         PGRAPHNullState *null_renderer_state;
         PGRAPHGLState *gl_renderer_state;
         PGRAPHVkState *vk_renderer_state;
+        PGRAPHSwState *sw_renderer_state;
     };
 } PGRAPHState;
 
@@ -371,11 +423,30 @@ void pgraph_get_clear_depth_stencil_value(PGRAPHState *pg, float *depth, int *st
 void pgraph_allocate_inline_buffer_vertices(PGRAPHState *pg, unsigned int attr);
 void pgraph_finish_inline_buffer_vertex(PGRAPHState *pg);
 void pgraph_reset_inline_buffers(PGRAPHState *pg);
+unsigned int pgraph_get_inline_array_vertex_size(PGRAPHState *pg);
 void pgraph_reset_draw_arrays(PGRAPHState *pg);
 void pgraph_update_inline_value(VertexAttribute *attr, const uint8_t *data);
 void pgraph_get_inline_values(PGRAPHState *pg, uint16_t attrs,
                                float values[NV2A_VERTEXSHADER_ATTRIBUTES][4],
                                int *count);
+void pgraph_setup_vertex_fetch(NV2AState *d, PGRAPHVertexFetch *f);
+void pgraph_fetch_vertex(PGRAPHState *pg, const PGRAPHVertexFetch *f,
+                         unsigned int index,
+                         float in[NV2A_VERTEXSHADER_ATTRIBUTES][4]);
+void pgraph_update_inline_values_from_vertex(PGRAPHState *pg,
+                                             const PGRAPHVertexFetch *f,
+                                             unsigned int provoking_element);
+
+/* Culling */
+void pgraph_cull_init(PGRAPHState *pg);
+void pgraph_cull_finalize(PGRAPHState *pg);
+bool pgraph_cull_batch(NV2AState *d);
+const struct VshCpuProgram *pgraph_get_vsh_cpu_program(PGRAPHState *pg);
+
+/* Dynamic resolution scaling */
+void pgraph_dynamic_scale_begin_idle(PGRAPHState *pg);
+void pgraph_dynamic_scale_end_idle(PGRAPHState *pg);
+void pgraph_dynamic_scale_flip(NV2AState *d);
 
 /* RDI */
 uint32_t pgraph_rdi_read(PGRAPHState *pg, unsigned int select,
@@ -25,10 +25,31 @@
 #include "qemu/osdep.h"
 #include "s3tc.h"
 
-static void decode_bc1_colors(uint16_t c0, uint16_t c1, uint8_t r[4],
-                              uint8_t g[4], uint8_t b[4], uint8_t a[16],
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#define S3TC_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define S3TC_HAVE_NEON 1
+#endif
+
+/*
+ * A decoded block: a four entry RGBA8 color palette selected by the 2-bit
+ * per-texel indices and, for DXT3/5, an explicit alpha value per texel.
+ */
+typedef struct S3TCBlock {
+    uint32_t colors[4];
+    uint32_t indices;
+    bool separate_alpha;
+    uint8_t alpha[16];
+} S3TCBlock;
+
+static void decode_bc1_colors(uint16_t c0, uint16_t c1, uint32_t colors[4],
                               bool transparent)
 {
+    uint8_t r[4], g[4], b[4], a[4];
+
     r[0] = ((c0 & 0xF800) >> 8) * 0xFF / 0xF8,
     g[0] = ((c0 & 0x07E0) >> 3) * 0xFF / 0xFC,
     b[0] = ((c0 & 0x001F) << 3) * 0xFF / 0xF8,
@@ -60,83 +81,43 @@ static void decode_bc1_colors(uint16_t c0, uint16_t c1, uint8_t r[4],
         b[3] = (b[0]+2*b[1])/3;
         a[3] = 255;
     }
-}
 
-static void write_block_to_texture(uint8_t *converted_data, uint32_t indices,
-                                   int i, int j, int width, int z_pos_factor,
-                                   uint8_t r[4], uint8_t g[4], uint8_t b[4],
-                                   uint8_t a[16], bool separate_alpha)
-{
-    int x0 = i * 4,
-        y0 = j * 4;
-
-    int x1 = x0 + 4,
-        y1 = y0 + 4;
-
-    for (int y = y0; y < y1; y++) {
-        int y_index = 4 * (y - y0);
-        int z_plus_y_pos_factor = z_pos_factor + y * width;
-        for (int x = x0; x < x1; x++) {
-            int xy_index = y_index + x - x0;
-            uint8_t index = (indices >> 2 * xy_index) & 0x03;
-            uint8_t alpha_index = separate_alpha ? xy_index : index;
-            uint8_t *p = converted_data + (z_plus_y_pos_factor + x) * 4;
-            *p++ = r[index];
-            *p++ = g[index];
-            *p++ = b[index];
-            *p++ = a[alpha_index];
-        }
+    for (int i = 0; i < 4; i++) {
+        colors[i] = r[i] | (g[i] << 8) | (b[i] << 16) | ((uint32_t)a[i] << 24);
     }
 }
 
-static void decompress_dxt1_block(const uint8_t block_data[8],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int z_pos_factor)
+static void decode_dxt1_block(const uint8_t block_data[8], S3TCBlock *block)
 {
     uint16_t c0 = ((uint16_t*)block_data)[0],
              c1 = ((uint16_t*)block_data)[1];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, c0 <= c1);
+    decode_bc1_colors(c0, c1, block->colors, c0 <= c1);
 
-    uint32_t indices = ((uint32_t*)block_data)[1];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, false);
+    block->indices = ((uint32_t*)block_data)[1];
+    block->separate_alpha = false;
 }
 
-static void decompress_dxt3_block(const uint8_t block_data[16],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int z_pos_factor)
+static void decode_dxt35_block(const uint8_t block_data[16], S3TCBlock *block)
 {
     uint16_t c0 = ((uint16_t*)block_data)[4],
              c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
+    decode_bc1_colors(c0, c1, block->colors, false);
 
+    block->indices = ((uint32_t*)block_data)[3];
+    block->separate_alpha = true;
+}
+
+static void decode_dxt3_alpha(const uint8_t block_data[16], uint8_t a[16])
+{
     uint64_t alpha = ((uint64_t*)block_data)[0];
     for (int a_i=0; a_i < 16; a_i++) {
         a[a_i] = (((alpha >> 4*a_i) & 0x0F) << 4) * 0xFF / 0xF0;
     }
-
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, true);
 }
 
-static void decompress_dxt5_block(const uint8_t block_data[16],
-                                  uint8_t *converted_data, int i, int j,
-                                  int width, int z_pos_factor)
+static void get_dxt5_alpha_palette(uint8_t a0, uint8_t a1,
+                                   uint8_t a_palette[8])
 {
-    uint16_t c0 = ((uint16_t*)block_data)[4],
-             c1 = ((uint16_t*)block_data)[5];
-    uint8_t r[4], g[4], b[4], a[16];
-    decode_bc1_colors(c0, c1, r, g, b, a, false);
-
-    uint64_t alpha = ((uint64_t*)block_data)[0];
-    uint8_t a0 = block_data[0];
-    uint8_t a1 = block_data[1];
-    uint8_t a_palette[8];
     a_palette[0] = a0;
     a_palette[1] = a1;
     if (a0 > a1) {
@@ -154,14 +135,226 @@ static void decompress_dxt5_block(const uint8_t block_data[16],
         a_palette[6] = 0;
         a_palette[7] = 255;
     }
+}
+
+static void decode_dxt5_alpha(const uint8_t block_data[16], uint8_t a[16])
+{
+    uint64_t alpha = ((uint64_t*)block_data)[0];
+    uint8_t a_palette[8];
+    get_dxt5_alpha_palette(block_data[0], block_data[1], a_palette);
     for (int a_i = 0; a_i < 16; a_i++) {
         a[a_i] = a_palette[(alpha >> (16+3*a_i)) & 0x07];
     }
+}
+
+static inline void decode_block_colors(enum S3TC_DECOMPRESS_FORMAT color_format,
+                                       const uint8_t *block_data,
+                                       S3TCBlock *block)
+{
+    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
+        decode_dxt1_block(block_data, block);
+    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3 ||
+               color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+        decode_dxt35_block(block_data, block);
+    } else {
+        assert(false);
+    }
+}
+
+static inline void decode_block(enum S3TC_DECOMPRESS_FORMAT color_format,
+                                const uint8_t *block_data, S3TCBlock *block)
+{
+    decode_block_colors(color_format, block_data, block);
+
+    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+        decode_dxt3_alpha(block_data, block->alpha);
+    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
+        decode_dxt5_alpha(block_data, block->alpha);
+    }
+}
+
+/*
+ * Decompress a horizontal row of num_blocks blocks, spaced block_stride bytes
+ * apart, into four rows of RGBA8 texels starting at dst.
+ */
+#define S3TC_ROW_PARAMS                                                     \
+    enum S3TC_DECOMPRESS_FORMAT color_format, const uint8_t *data,          \
+        unsigned int num_blocks, size_t block_stride, uint8_t *dst,         \
+        size_t dst_pitch
+#define S3TC_ROW_ARGS \
+    color_format, data, num_blocks, block_stride, dst, dst_pitch
+
+typedef void (*S3TCRowFunc)(S3TC_ROW_PARAMS);
+
+static void decompress_row_generic(S3TC_ROW_PARAMS)
+{
+    for (unsigned int i = 0; i < num_blocks; i++) {
+        S3TCBlock block;
+        decode_block(color_format, data + i * block_stride, &block);
+
+        for (int y = 0; y < 4; y++) {
+            uint8_t *p = dst + y * dst_pitch + i * 16;
+            for (int x = 0; x < 4; x++, p += 4) {
+                int xy_index = 4 * y + x;
+                uint32_t texel =
+                    block.colors[(block.indices >> 2 * xy_index) & 0x03];
+                if (block.separate_alpha) {
+                    texel = (texel & 0x00FFFFFF) |
+                            ((uint32_t)block.alpha[xy_index] << 24);
+                }
+                memcpy(p, &texel, sizeof(texel));
+            }
+        }
+    }
+}
+
+#if defined(S3TC_HAVE_X86) || defined(S3TC_HAVE_NEON)
+
+/*
+ * Byte shuffles for the SIMD kernels. index_shuffle[i] gathers the four
+ * palette entries selected by one row of color indices i, alpha_shuffle[y]
+ * moves the alpha values of row y into the top byte of each texel. Lanes
+ * with the high bit set are zeroed.
+ */
+static uint8_t index_shuffle[256][16] __attribute__((aligned(16)));
+static uint8_t alpha_shuffle[4][16] __attribute__((aligned(16)));
+
+static void init_shuffles(void)
+{
+    for (int i = 0; i < 256; i++) {
+        for (int x = 0; x < 4; x++) {
+            int index = (i >> (2 * x)) & 0x03;
+            for (int c = 0; c < 4; c++) {
+                index_shuffle[i][4 * x + c] = 4 * index + c;
+            }
+        }
+    }
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            for (int c = 0; c < 3; c++) {
+                alpha_shuffle[y][4 * x + c] = 0x80;
+            }
+            alpha_shuffle[y][4 * x + 3] = 4 * y + x;
+        }
+    }
+}
+
+#endif
+
+#ifdef S3TC_HAVE_X86
+
+static inline __attribute__((always_inline, target("avx,bmi2"))) __m128i
+decode_alpha_avx(enum S3TC_DECOMPRESS_FORMAT color_format,
+                 const uint8_t *block_data)
+{
+    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
+        /* Expand 4-bit alpha to 8 bits, v * 0xFF / 0xF == v * 0x11 */
+        const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+        __m128i v = _mm_loadl_epi64((const __m128i *)block_data);
+        __m128i lo = _mm_and_si128(v, nibble_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask);
+        __m128i a = _mm_unpacklo_epi8(lo, hi);
+        return _mm_or_si128(a, _mm_slli_epi16(a, 4));
+    }
+
+    /* Spread the 3-bit DXT5 alpha indices into bytes and look them up */
+    uint8_t a_palette[16] = { 0 };
+    get_dxt5_alpha_palette(block_data[0], block_data[1], a_palette);
+    uint64_t bits;
+    memcpy(&bits, block_data, sizeof(bits));
+    bits >>= 16;
+    __m128i indices = _mm_setr_epi32(
+        _pdep_u32(bits & 0xFFF, 0x07070707),
+        _pdep_u32((bits >> 12) & 0xFFF, 0x07070707),
+        _pdep_u32((bits >> 24) & 0xFFF, 0x07070707),
+        _pdep_u32((bits >> 36) & 0xFFF, 0x07070707));
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)a_palette),
+                            indices);
+}
+
+static __attribute__((target("avx,bmi2"))) void
+decompress_row_avx(S3TC_ROW_PARAMS)
+{
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+
+    for (unsigned int i = 0; i < num_blocks; i++) {
+        const uint8_t *block_data = data + i * block_stride;
+        S3TCBlock block;
+        decode_block_colors(color_format, block_data, &block);
+
+        __m128i palette = _mm_loadu_si128((const __m128i *)block.colors);
+        __m128i alpha = _mm_setzero_si128();
+        if (block.separate_alpha) {
+            palette = _mm_and_si128(palette, rgb_mask);
+            alpha = decode_alpha_avx(color_format, block_data);
+        }
+
+        for (int y = 0; y < 4; y++) {
+            __m128i shuffle = _mm_load_si128(
+                (const __m128i *)index_shuffle[(block.indices >> 8 * y) & 0xFF]);
+            __m128i texels = _mm_shuffle_epi8(palette, shuffle);
+            if (block.separate_alpha) {
+                texels = _mm_or_si128(
+                    texels,
+                    _mm_shuffle_epi8(
+                        alpha,
+                        _mm_load_si128((const __m128i *)alpha_shuffle[y])));
+            }
+            _mm_storeu_si128((__m128i *)(dst + y * dst_pitch + i * 16),
+                             texels);
+        }
+    }
+}
+
+#endif /* S3TC_HAVE_X86 */
+
+#ifdef S3TC_HAVE_NEON
+
+static void decompress_row_neon(S3TC_ROW_PARAMS)
+{
+    const uint8x16_t rgb_mask = vreinterpretq_u8_u32(vdupq_n_u32(0x00FFFFFF));
+
+    for (unsigned int i = 0; i < num_blocks; i++) {
+        S3TCBlock block;
+        decode_block(color_format, data + i * block_stride, &block);
+
+        uint8x16_t palette = vld1q_u8((const uint8_t *)block.colors);
+        uint8x16_t alpha = vdupq_n_u8(0);
+        if (block.separate_alpha) {
+            palette = vandq_u8(palette, rgb_mask);
+            alpha = vld1q_u8(block.alpha);
+        }
+
+        for (int y = 0; y < 4; y++) {
+            uint8x16_t texels = vqtbl1q_u8(
+                palette,
+                vld1q_u8(index_shuffle[(block.indices >> 8 * y) & 0xFF]));
+            if (block.separate_alpha) {
+                texels = vorrq_u8(
+                    texels, vqtbl1q_u8(alpha, vld1q_u8(alpha_shuffle[y])));
+            }
+            vst1q_u8(dst + y * dst_pitch + i * 16, texels);
+        }
+    }
+}
+
+#endif /* S3TC_HAVE_NEON */
+
+static S3TCRowFunc decompress_row = decompress_row_generic;
 
-    uint32_t indices = ((uint32_t*)block_data)[3];
-    write_block_to_texture(converted_data, indices,
-                           i, j, width, z_pos_factor,
-                           r, g, b, a, true);
+static void __attribute__((constructor)) init_accel(void)
+{
+#ifdef S3TC_HAVE_X86
+    unsigned info = cpuinfo_init();
+
+    if ((info & CPUINFO_AVX1) && (info & CPUINFO_BMI2)) {
+        init_shuffles();
+        decompress_row = decompress_row_avx;
+    }
+#elif defined(S3TC_HAVE_NEON)
+    init_shuffles();
+    decompress_row = decompress_row_neon;
+#endif
 }
 
 uint8_t *s3tc_decompress_3d(enum S3TC_DECOMPRESS_FORMAT color_format,
@@ -175,30 +368,25 @@ uint8_t *s3tc_decompress_3d(enum S3TC_DECOMPRESS_FORMAT color_format,
     int num_blocks_x = width/4,
         num_blocks_y = height/4,
         num_blocks_z = depth/block_depth;
+    size_t block_size = color_format == S3TC_DECOMPRESS_FORMAT_DXT1 ? 8 : 16;
+    size_t row_pitch = width * 4;
     uint8_t *converted_data = (uint8_t*)g_malloc(width * height * depth * 4);
-    for (int k = 0; k < num_blocks_z; k++) {
-        for (int j = 0; j < num_blocks_y; j++) {
-            for (int i = 0; i < num_blocks_x; i++) {
-                for (int slice = 0; slice < block_depth; slice++) {
-
-                    int block_index = k * num_blocks_y * num_blocks_x + j * num_blocks_x + i;
-                    int sub_block_index = block_index * block_depth + slice;
-                    int z_pos_factor = (k * block_depth + slice) * width * height;
-
-                    if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
-                        decompress_dxt1_block(data + 8 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
-                        decompress_dxt3_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
-                        decompress_dxt5_block(data + 16 * sub_block_index, converted_data,
-                                              i, j, width, z_pos_factor);
-                    } else {
-                        assert(false);
-                    }
 
-                }
+    /*
+     * Blocks of block_depth slices are stored together, so the blocks of a
+     * single slice are block_depth blocks apart.
+     */
+    for (int k = 0; k < num_blocks_z; k++) {
+        for (int slice = 0; slice < block_depth; slice++) {
+            int z = k * block_depth + slice;
+            for (int j = 0; j < num_blocks_y; j++) {
+                int block_index = (k * num_blocks_y + j) * num_blocks_x;
+                int sub_block_index = block_index * block_depth + slice;
+                decompress_row(color_format, data + block_size * sub_block_index,
+                               num_blocks_x, block_size * block_depth,
+                               converted_data +
+                                   (z * height + j * 4) * row_pitch,
+                               row_pitch);
             }
         }
     }
@@ -209,26 +397,5 @@ uint8_t *s3tc_decompress_2d(enum S3TC_DECOMPRESS_FORMAT color_format,
                             const uint8_t *data, unsigned int width,
                             unsigned int height)
 {
-    assert((width > 0) && (width % 4 == 0));
-    assert((height > 0) && (height % 4 == 0));
-    int num_blocks_x = width / 4, num_blocks_y = height / 4;
-    uint8_t *converted_data = (uint8_t *)g_malloc(width * height * 4);
-    for (int j = 0; j < num_blocks_y; j++) {
-        for (int i = 0; i < num_blocks_x; i++) {
-            int block_index = j * num_blocks_x + i;
-            if (color_format == S3TC_DECOMPRESS_FORMAT_DXT1) {
-                decompress_dxt1_block(data + 8 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT3) {
-                decompress_dxt3_block(data + 16 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else if (color_format == S3TC_DECOMPRESS_FORMAT_DXT5) {
-                decompress_dxt5_block(data + 16 * block_index,
-                                      converted_data, i, j, width, 0);
-            } else {
-                assert(false);
-            }
-        }
-    }
-    return converted_data;
+    return s3tc_decompress_3d(color_format, data, width, height, 1);
 }
@@ -19,11 +19,62 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/debug.h"
 #include "texture.h"
 #include "pgraph.h"
 #include "shaders.h"
 
+/*
+ * Find the extent of the vertex program starting at program_start and hash its
+ * tokens. This is only repeated when the program is modified or the start
+ * offset moves.
+ */
+static void update_program_cache(PGRAPHState *pg, int program_start)
+{
+    int length = 0;
+
+    for (int i = program_start; i < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH; i++) {
+        length++;
+        if (vsh_get_field(pg->program_data[i], FLD_FINAL)) {
+            break;
+        }
+    }
+
+    pg->program_cache_start = program_start;
+    pg->program_cache_length = length;
+    pg->program_cache_hash =
+        fast_hash((const uint8_t *)&pg->program_data[program_start],
+                  length * VSH_TOKEN_SIZE * sizeof(uint32_t));
+}
+
+/*
+ * Bring the program cache up to date for program_start without consuming
+ * program_data_dirty, which the renderers use to decide whether the shader
+ * state has to be recomputed.
+ */
+void pgraph_update_vertex_program_cache(PGRAPHState *pg, int program_start)
+{
+    if (pg->program_data_dirty || program_start != pg->program_cache_start) {
+        update_program_cache(pg, program_start);
+    }
+}
+
+uint64_t pgraph_hash_shader_state(const ShaderState *state)
+{
+    /*
+     * Unused program tokens are zeroed, so the cached program hash stands in
+     * for the program_data array.
+     */
+    const uint8_t *p = (const uint8_t *)state;
+    size_t head = offsetof(ShaderState, program_data);
+    size_t tail = offsetof(ShaderState, program_length);
+
+    uint64_t hash = fast_hash(p, head);
+    hash = hash * 31 + fast_hash(p + tail, sizeof(ShaderState) - tail);
+    return hash;
+}
+
 ShaderState pgraph_get_shader_state(PGRAPHState *pg)
 {
     bool vertex_program = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_D),
@@ -35,6 +86,8 @@ ShaderState pgraph_get_shader_state(PGRAPHState *pg)
     int program_start = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_C),
                                  NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
 
+    bool program_changed = pg->program_data_dirty ||
+                           program_start != pg->program_cache_start;
     pg->program_data_dirty = false;
 
     ShaderState state;
@@ -47,6 +100,14 @@ ShaderState pgraph_get_shader_state(PGRAPHState *pg)
     state.compressed_attrs = pg->compressed_attrs;
     state.uniform_attrs = pg->uniform_attrs;
     state.swizzle_attrs = pg->swizzle_attrs;
+    state.fetch_attrs = pg->fetch_attrs;
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        if (pg->fetch_attrs & (1 << i)) {
+            state.fetch_attr[i].format = pg->vertex_attributes[i].format;
+            state.fetch_attr[i].count = pg->vertex_attributes[i].count;
+        }
+    }
 
     /* register combiner stuff */
     state.psh.window_clip_exclusive =
@@ -120,18 +181,20 @@ ShaderState pgraph_get_shader_state(PGRAPHState *pg)
     state.program_length = 0;
 
     if (vertex_program) {
-        // copy in vertex program tokens
-        for (int i = program_start; i < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH;
-             i++) {
-            uint32_t *cur_token = (uint32_t *)&pg->program_data[i];
-            memcpy(&state.program_data[state.program_length], cur_token,
-                   VSH_TOKEN_SIZE * sizeof(uint32_t));
-            state.program_length++;
-
-            if (vsh_get_field(cur_token, FLD_FINAL)) {
-                break;
-            }
+        if (program_changed) {
+            update_program_cache(pg, program_start);
         }
+        // copy in vertex program tokens
+        state.program_length = pg->program_cache_length;
+        memcpy(state.program_data, &pg->program_data[program_start],
+               state.program_length * VSH_TOKEN_SIZE * sizeof(uint32_t));
+        state.program_hash = pg->program_cache_hash;
+    } else if (program_changed) {
+        /*
+         * program_data_dirty was consumed above, so a later switch back to a
+         * vertex program at the same start must not trust the cache.
+         */
+        pg->program_cache_start = -1;
     }
 
     /* Texgen */
@@ -63,6 +63,13 @@ typedef struct ShaderState {
     uint16_t uniform_attrs;
     uint16_t swizzle_attrs;
 
+    /* Attributes decoded by the vertex shader from raw VRAM */
+    uint16_t fetch_attrs;
+    struct {
+        uint8_t format;
+        uint8_t count;
+    } fetch_attr[NV2A_VERTEXSHADER_ATTRIBUTES];
+
     bool texture_matrix_enable[4];
     enum VshTexgen texgen[4][4];
 
@@ -86,6 +93,7 @@ typedef struct ShaderState {
 
     /* vertex program */
     bool vertex_program;
+    uint64_t program_hash; /* Hash of the first program_length tokens */
     uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
     int program_length;
     bool z_perspective;
@@ -105,5 +113,7 @@ typedef struct ShaderState {
 typedef struct PGRAPHState PGRAPHState;
 
 ShaderState pgraph_get_shader_state(PGRAPHState *pg);
+void pgraph_update_vertex_program_cache(PGRAPHState *pg, int program_start);
+uint64_t pgraph_hash_shader_state(const ShaderState *state);
 
 #endif
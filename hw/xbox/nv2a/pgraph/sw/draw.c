@@ -0,0 +1,1050 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/fast-hash.h"
+#include "hw/xbox/nv2a/pgraph/swizzle.h"
+#include "hw/xbox/nv2a/pgraph/texture.h"
+#include "hw/xbox/nv2a/pgraph/vsh-cpu.h"
+#include "renderer.h"
+
+/* Guard band in surface pixels, keeps snapped coordinates within 32 bits */
+#define SW_GUARD_BAND 16384.0f
+#define SW_CLIP_MIN_W 1e-6f
+#define SW_CLIP_PLANES 5
+#define SW_MAX_CLIP_VERTICES (3 + SW_CLIP_PLANES)
+#define SW_VERTEX_CHUNK_SIZE 32
+
+typedef struct SwVertexFetch {
+    PGRAPHVertexFetch fetch;
+    /* NULL if the program has to be interpreted */
+    const VshCpuProgram *prog;
+    bool vertex_program;
+    bool z_perspective;
+    float scale_x, scale_y;
+} SwVertexFetch;
+
+static unsigned int get_color_bytes_per_pixel(unsigned int format)
+{
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 2;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return 1;
+    default:
+        return 4;
+    }
+}
+
+static void mark_surface_dirty(NV2AState *d, SwSurface *s)
+{
+    memory_region_set_client_dirty(d->vram, s->vram_addr, s->size,
+                                   DIRTY_MEMORY_VGA);
+    memory_region_set_client_dirty(d->vram, s->vram_addr, s->size,
+                                   DIRTY_MEMORY_NV2A_TEX);
+}
+
+static void writeback_surface(NV2AState *d, SwSurface *s)
+{
+    if (!s->linear_dirty) {
+        return;
+    }
+    swizzle_rect(s->swizzle_buf, s->width, s->height,
+                 d->vram_ptr + s->vram_addr, s->pitch, s->bytes_per_pixel);
+    mark_surface_dirty(d, s);
+    s->linear_dirty = false;
+}
+
+static void invalidate_surface(NV2AState *d, SwSurface *s, bool writeback)
+{
+    if (writeback) {
+        writeback_surface(d, s);
+    }
+    s->linear_valid = false;
+    s->linear_dirty = false;
+}
+
+/* Swizzled surfaces overlapping the range are written back to VRAM */
+static void writeback_surfaces_in_range(NV2AState *d, hwaddr addr,
+                                        hwaddr size)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+    SwSurface *surfaces[] = { &r->color, &r->zeta };
+
+    for (int i = 0; i < ARRAY_SIZE(surfaces); i++) {
+        SwSurface *s = surfaces[i];
+        if (s->linear_dirty && addr < s->vram_addr + s->size &&
+            s->vram_addr < addr + size) {
+            writeback_surface(d, s);
+        }
+    }
+}
+
+void pgraph_sw_writeback_surfaces(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    writeback_surface(d, &r->color);
+    writeback_surface(d, &r->zeta);
+}
+
+void pgraph_sw_invalidate_surfaces(NV2AState *d, bool writeback)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    invalidate_surface(d, &r->color, writeback);
+    invalidate_surface(d, &r->zeta, writeback);
+}
+
+static bool bind_surface(NV2AState *d, bool color)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+    SwSurface *s = color ? &r->color : &r->zeta;
+    Surface *surface = color ? &pg->surface_color : &pg->surface_zeta;
+    unsigned int format = color ? pg->surface_shape.color_format :
+                                  pg->surface_shape.zeta_format;
+
+    s->bound = false;
+    if (!format || !surface->pitch) {
+        invalidate_surface(d, s, true);
+        return false;
+    }
+
+    SwSurface n = *s;
+    n.format = format;
+    n.bytes_per_pixel =
+        color ? get_color_bytes_per_pixel(format) :
+                (format == NV097_SET_SURFACE_FORMAT_ZETA_Z16 ? 2 : 4);
+    n.swizzle = pg->surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE;
+    n.pitch = surface->pitch;
+
+    if (n.swizzle) {
+        n.width = 1 << pg->surface_shape.log_width;
+        n.height = 1 << pg->surface_shape.log_height;
+        pgraph_apply_anti_aliasing_factor(pg, &n.width, &n.height);
+    } else {
+        n.width = pg->surface_shape.clip_width;
+        n.height = pg->surface_shape.clip_height;
+        pgraph_apply_anti_aliasing_factor(pg, &n.width, &n.height);
+        n.width += pg->surface_shape.clip_x;
+        n.height += pg->surface_shape.clip_y;
+    }
+    n.width = MIN(n.width, n.pitch / n.bytes_per_pixel);
+
+    hwaddr dma_len;
+    uint8_t *base = (uint8_t *)nv_dma_map(d, color ? pg->dma_color :
+                                                     pg->dma_zeta,
+                                          &dma_len);
+    if (surface->offset >= dma_len) {
+        NV2A_DPRINTF("%s surface outside of its DMA object\n",
+                     color ? "Color" : "Zeta");
+        invalidate_surface(d, s, true);
+        return false;
+    }
+    n.vram_addr = base + surface->offset - d->vram_ptr;
+
+    hwaddr avail = MIN(dma_len - surface->offset,
+                       memory_region_size(d->vram) - n.vram_addr);
+    n.height = MIN(n.height, avail / n.pitch);
+    if (!n.width || !n.height) {
+        invalidate_surface(d, s, true);
+        return false;
+    }
+    n.size = n.pitch * n.height;
+
+    bool same = s->linear_valid && n.swizzle && n.format == s->format &&
+                n.bytes_per_pixel == s->bytes_per_pixel &&
+                n.width == s->width && n.height == s->height &&
+                n.pitch == s->pitch && n.vram_addr == s->vram_addr;
+    if (!same) {
+        invalidate_surface(d, s, true);
+    }
+    *s = n;
+
+    if (!s->swizzle) {
+        s->data = d->vram_ptr + s->vram_addr;
+        s->bound = true;
+        return true;
+    }
+
+    /* As in the GL backend, CPU writes win over unflushed draws */
+    bool mem_dirty = memory_region_test_and_clear_dirty(
+        d->vram, s->vram_addr, s->size, DIRTY_MEMORY_NV2A);
+    if (!s->linear_valid || mem_dirty) {
+        if (s->swizzle_buf_size < s->size) {
+            g_free(s->swizzle_buf);
+            s->swizzle_buf = g_malloc(s->size);
+            s->swizzle_buf_size = s->size;
+        }
+        unswizzle_rect(d->vram_ptr + s->vram_addr, s->width, s->height,
+                       s->swizzle_buf, s->pitch, s->bytes_per_pixel);
+        s->linear_valid = true;
+        s->linear_dirty = false;
+    }
+    s->data = s->swizzle_buf;
+
+    s->bound = true;
+    return true;
+}
+
+static void unbind_surface(NV2AState *d, SwSurface *s, bool written)
+{
+    if (!s->bound) {
+        return;
+    }
+    s->bound = false;
+    if (!written) {
+        return;
+    }
+
+    if (s->swizzle) {
+        s->linear_dirty = true;
+    } else {
+        mark_surface_dirty(d, s);
+    }
+}
+
+static bool bind_surfaces(NV2AState *d, bool color, bool zeta)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    if (color) {
+        bind_surface(d, true);
+    }
+    if (zeta) {
+        bind_surface(d, false);
+    }
+    return r->color.bound || r->zeta.bound;
+}
+
+static void unbind_surfaces(NV2AState *d, bool color_written,
+                            bool zeta_written)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    unbind_surface(d, &r->color, color_written);
+    unbind_surface(d, &r->zeta, zeta_written);
+}
+
+static void generate_swizzle_masks(unsigned int width, unsigned int height,
+                                   uint32_t *mask_x, uint32_t *mask_y)
+{
+    uint32_t x = 0, y = 0;
+    uint32_t bit = 1;
+    uint32_t mask_bit = 1;
+    bool done;
+    do {
+        done = true;
+        if (bit < width) { x |= mask_bit; mask_bit <<= 1; done = false; }
+        if (bit < height) { y |= mask_bit; mask_bit <<= 1; done = false; }
+        bit <<= 1;
+    } while (!done);
+    *mask_x = x;
+    *mask_y = y;
+}
+
+static bool setup_texture(NV2AState *d, int stage, SwTexture *t)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!pgraph_is_texture_enabled(pg, stage)) {
+        return false;
+    }
+
+    TextureShape s = pgraph_get_texture_shape(pg, stage);
+    if (s.cubemap || s.dimensionality != 2) {
+        NV2A_UNIMPLEMENTED("Software renderer: texture dimensionality %d",
+                           s.dimensionality);
+        return false;
+    }
+
+    switch (s.color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R5G6B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_R5G6B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A4R4G4B4:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A4R4G4B4:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_Y8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_Y8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8:
+        break;
+    default:
+        NV2A_UNIMPLEMENTED("Software renderer: texture format 0x%x",
+                           s.color_format);
+        return false;
+    }
+
+    const BasicColorFormatInfo *f =
+        &kelvin_color_format_info_map[s.color_format];
+    t->color_format = s.color_format;
+    t->bytes_per_pixel = f->bytes_per_pixel;
+    t->width = s.width;
+    t->height = s.height;
+    t->linear = f->linear;
+    t->pitch = f->linear ? s.pitch : s.width * f->bytes_per_pixel;
+    if (!t->width || !t->height) {
+        return false;
+    }
+
+    hwaddr addr = pgraph_get_texture_phys_addr(pg, stage);
+    size_t length = (size_t)t->pitch * t->height;
+    if (addr + length > memory_region_size(d->vram)) {
+        return false;
+    }
+    writeback_surfaces_in_range(d, addr, length);
+    t->data = d->vram_ptr + addr;
+
+    uint32_t address = pgraph_reg_r(pg, NV_PGRAPH_TEXADDRESS0 + stage * 4);
+    t->addr_u = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
+    t->addr_v = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
+
+    if (!t->linear) {
+        generate_swizzle_masks(t->width, t->height, &t->swizzle_mask_x,
+                               &t->swizzle_mask_y);
+    }
+
+    return true;
+}
+
+static void setup_textures(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+    SwRasterState *rs = &r->rs;
+    uint32_t shaderprog = pgraph_reg_r(pg, NV_PGRAPH_SHADERPROG);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        unsigned int mode = (shaderprog >> (i * 5)) & 0x1F;
+        switch (mode) {
+        case SW_TEXTURE_MODE_PROJECT2D:
+            rs->tex_valid[i] = setup_texture(d, i, &rs->tex[i]);
+            break;
+        case SW_TEXTURE_MODE_NONE:
+        case SW_TEXTURE_MODE_PASSTHRU:
+            rs->tex_valid[i] = false;
+            break;
+        default:
+            NV2A_UNIMPLEMENTED("Software renderer: texture mode 0x%x", mode);
+            mode = SW_TEXTURE_MODE_NONE;
+            rs->tex_valid[i] = false;
+            break;
+        }
+        rs->tex_mode[i] = mode;
+    }
+}
+
+static void setup_combiners(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+    SwRasterState *rs = &r->rs;
+    uint32_t control = pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL);
+    uint32_t flags = control >> 8;
+
+    /* Flags as in psh.c: bit 0 MUX_MSB, bit 4 UNIQUE_C0, bit 8 UNIQUE_C1 */
+    rs->num_stages = MIN(control & 0xFF, ARRAY_SIZE(rs->stages));
+    rs->mux_msb = flags & 0x1;
+    for (unsigned int i = 0; i < rs->num_stages; i++) {
+        SwCombinerStage *st = &rs->stages[i];
+        unsigned int c0 = (flags & 0x10) ? i : 0;
+        unsigned int c1 = (flags & 0x100) ? i : 0;
+        st->rgb_inputs = pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORI0 + i * 4);
+        st->rgb_outputs = pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORO0 + i * 4);
+        st->alpha_inputs = pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4);
+        st->alpha_outputs = pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAO0 + i * 4);
+        pgraph_argb_pack32_to_rgba_float(
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINEFACTOR0 + c0 * 4), st->c0);
+        pgraph_argb_pack32_to_rgba_float(
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINEFACTOR1 + c1 * 4), st->c1);
+    }
+
+    rs->final_inputs_0 = pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG0);
+    rs->final_inputs_1 = pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG1);
+    rs->final_enabled = rs->final_inputs_0 || rs->final_inputs_1;
+    pgraph_argb_pack32_to_rgba_float(
+        pgraph_reg_r(pg, NV_PGRAPH_SPECFOGFACTOR0), rs->final_c0);
+    pgraph_argb_pack32_to_rgba_float(
+        pgraph_reg_r(pg, NV_PGRAPH_SPECFOGFACTOR1), rs->final_c1);
+
+    /* Fog is not implemented, the fog register has a factor of 1 */
+    uint32_t fog_color = pgraph_reg_r(pg, NV_PGRAPH_FOGCOLOR);
+    rs->fog[0] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_RED) / 255.0f;
+    rs->fog[1] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_GREEN) / 255.0f;
+    rs->fog[2] = GET_MASK(fog_color, NV_PGRAPH_FOGCOLOR_BLUE) / 255.0f;
+    rs->fog[3] = 1.0f;
+}
+
+/* Reports state that the renderer draws as if it were disabled */
+static void check_unimplemented_state(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3) &
+        NV_PGRAPH_CONTROL_3_FOGENABLE) {
+        NV2A_UNIMPLEMENTED("Software renderer: fog");
+    }
+    if (pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1) &
+        NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE) {
+        NV2A_UNIMPLEMENTED("Software renderer: stencil test");
+    }
+
+    if (GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_D), NV_PGRAPH_CSV0_D_MODE) ==
+        2) {
+        return;
+    }
+
+    /* The fixed function program only transforms the position */
+    if (pgraph_reg_r(pg, NV_PGRAPH_CSV0_C) & NV_PGRAPH_CSV0_C_LIGHTING) {
+        NV2A_UNIMPLEMENTED("Software renderer: fixed function lighting");
+    }
+    uint32_t texgen_mask = NV_PGRAPH_CSV1_A_T0_S | NV_PGRAPH_CSV1_A_T0_T |
+                           NV_PGRAPH_CSV1_A_T0_R | NV_PGRAPH_CSV1_A_T0_Q |
+                           NV_PGRAPH_CSV1_A_T1_S | NV_PGRAPH_CSV1_A_T1_T |
+                           NV_PGRAPH_CSV1_A_T1_R | NV_PGRAPH_CSV1_A_T1_Q;
+    if ((pgraph_reg_r(pg, NV_PGRAPH_CSV1_A) |
+         pgraph_reg_r(pg, NV_PGRAPH_CSV1_B)) & texgen_mask) {
+        NV2A_UNIMPLEMENTED("Software renderer: texture coordinate generation");
+    }
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (pg->texture_matrix_enable[i]) {
+            NV2A_UNIMPLEMENTED("Software renderer: texture matrices");
+            break;
+        }
+    }
+}
+
+static float reg_float(PGRAPHState *pg, unsigned int reg)
+{
+    uint32_t v = pgraph_reg_r(pg, reg);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static void setup_raster_state(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+    SwRasterState *rs = &r->rs;
+
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    uint32_t control_3 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3);
+    uint32_t setupraster = pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER);
+    uint32_t blend = pgraph_reg_r(pg, NV_PGRAPH_BLEND);
+
+    /* Scissor to the surface clip rectangle */
+    unsigned int xmin = pg->surface_shape.clip_x;
+    unsigned int ymin = pg->surface_shape.clip_y;
+    unsigned int width = pg->surface_shape.clip_width;
+    unsigned int height = pg->surface_shape.clip_height;
+    pgraph_apply_anti_aliasing_factor(pg, &xmin, &ymin);
+    pgraph_apply_anti_aliasing_factor(pg, &width, &height);
+
+    int max_x = xmin + width - 1, max_y = ymin + height - 1;
+    if (r->color.bound) {
+        max_x = MIN(max_x, (int)r->color.width - 1);
+        max_y = MIN(max_y, (int)r->color.height - 1);
+    }
+    if (r->zeta.bound) {
+        max_x = MIN(max_x, (int)r->zeta.width - 1);
+        max_y = MIN(max_y, (int)r->zeta.height - 1);
+    }
+    rs->scissor_min_x = xmin;
+    rs->scissor_min_y = ymin;
+    rs->scissor_max_x = max_x;
+    rs->scissor_max_y = max_y;
+
+    rs->write_r = control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE;
+    rs->write_g = control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE;
+    rs->write_b = control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE;
+    rs->write_a = control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE;
+    rs->color_write = rs->write_r || rs->write_g || rs->write_b || rs->write_a;
+
+    /* As with GL, depth writes only happen with the depth test enabled */
+    rs->depth_test = control_0 & NV_PGRAPH_CONTROL_0_ZENABLE;
+    rs->depth_write =
+        rs->depth_test && (control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE);
+    rs->depth_func = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ZFUNC);
+    if (pg->surface_shape.z_format) {
+        NV2A_UNIMPLEMENTED("Software renderer: floating point depth");
+    }
+    rs->zmax = pg->surface_shape.zeta_format ==
+                       NV097_SET_SURFACE_FORMAT_ZETA_Z16 ?
+                   0xFFFF :
+                   0xFFFFFF;
+    rs->z_clamp = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_ZCOMPRESSOCCLUDE),
+                           NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN) ==
+                  NV_PGRAPH_ZCOMPRESSOCCLUDE_ZCLAMP_EN_CLAMP;
+    rs->zclip_min = reg_float(pg, NV_PGRAPH_ZCLIPMIN);
+    rs->zclip_max = reg_float(pg, NV_PGRAPH_ZCLIPMAX);
+
+    rs->alpha_test = control_0 & NV_PGRAPH_CONTROL_0_ALPHATESTENABLE;
+    rs->alpha_func = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ALPHAFUNC);
+    rs->alpha_ref = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ALPHAREF) / 255.0f;
+
+    rs->blend = blend & NV_PGRAPH_BLEND_EN;
+    rs->blend_sfactor = GET_MASK(blend, NV_PGRAPH_BLEND_SFACTOR);
+    rs->blend_dfactor = GET_MASK(blend, NV_PGRAPH_BLEND_DFACTOR);
+    rs->blend_equation = GET_MASK(blend, NV_PGRAPH_BLEND_EQN);
+    pgraph_argb_pack32_to_rgba_float(pgraph_reg_r(pg, NV_PGRAPH_BLENDCOLOR),
+                                     rs->blend_color);
+
+    rs->cull = setupraster & NV_PGRAPH_SETUPRASTER_CULLENABLE;
+    rs->cull_face = GET_MASK(setupraster, NV_PGRAPH_SETUPRASTER_CULLCTRL);
+    rs->front_ccw = setupraster & NV_PGRAPH_SETUPRASTER_FRONTFACE;
+    rs->flat = GET_MASK(control_3, NV_PGRAPH_CONTROL_3_SHADEMODE) ==
+               NV_PGRAPH_CONTROL_3_SHADEMODE_FLAT;
+
+    setup_textures(d);
+    setup_combiners(d);
+    check_unimplemented_state(d);
+}
+
+static bool update_vertex_program(NV2AState *d, SwVertexFetch *f)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+
+    f->prog = pgraph_get_vsh_cpu_program(pg);
+    if (f->prog) {
+        return true;
+    }
+
+    /* Fall back to interpreting the program, the cache above is up to date */
+    int program_start = pg->program_cache_start;
+    uint64_t hash = pg->program_cache_hash;
+
+    if (r->program_valid && r->program_hash == hash) {
+        return true;
+    }
+
+    if (r->program_valid) {
+        nv2a_vsh_program_destroy(&r->program);
+    }
+    Nv2aVshParseResult result = nv2a_vsh_parse_program(
+        &r->program, pg->program_data[program_start],
+        NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - program_start);
+    r->program_valid = result == NV2AVPR_SUCCESS;
+    r->program_hash = hash;
+    if (!r->program_valid) {
+        NV2A_DPRINTF("Failed to parse vertex program at %d\n", program_start);
+    }
+
+    return r->program_valid;
+}
+
+static void setup_vertex_fetch(NV2AState *d, SwVertexFetch *f)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    f->vertex_program = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_D),
+                                 NV_PGRAPH_CSV0_D_MODE) == 2;
+    f->z_perspective = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0) &
+                       NV_PGRAPH_CONTROL_0_Z_PERSPECTIVE_ENABLE;
+    f->prog = f->vertex_program ? NULL : pg->cull_fixed_function;
+
+    unsigned int scale_x = 1, scale_y = 1;
+    pgraph_apply_anti_aliasing_factor(pg, &scale_x, &scale_y);
+    f->scale_x = scale_x;
+    f->scale_y = scale_y;
+
+    pgraph_setup_vertex_fetch(d, &f->fetch);
+}
+
+/* texcoord points at NV2A_MAX_TEXTURES consecutive registers */
+static void convert_vertex(const SwVertexFetch *f, const float *pos,
+                           const float *diffuse, const float *specular,
+                           const float *texcoord, SwVertex *out)
+{
+    if (f->vertex_program) {
+        /* Programs output screen space positions, undo the divide that the
+         * rasterizer performs so attributes stay perspective correct */
+        float z = f->z_perspective ? pos[3] : pos[2];
+        float w = pos[3];
+        if (w == 0.0f || isinf(w)) {
+            w = 1.0f;
+        }
+        out->pos[0] = pos[0] * w;
+        out->pos[1] = pos[1] * w;
+        out->pos[2] = z * w;
+        out->pos[3] = w;
+    } else {
+        memcpy(out->pos, pos, sizeof(out->pos));
+    }
+    memcpy(out->diffuse, diffuse, sizeof(out->diffuse));
+    memcpy(out->specular, specular, sizeof(out->specular));
+    memcpy(out->texcoord, texcoord, sizeof(out->texcoord));
+
+    out->pos[0] *= f->scale_x;
+    out->pos[1] *= f->scale_y;
+}
+
+/* Interpreter path, for programs vsh-cpu.c cannot translate */
+static void transform_vertex(NV2AState *d, const SwVertexFetch *f,
+                             float in[NV2A_VERTEXSHADER_ATTRIBUTES][4],
+                             SwVertex *out)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+
+    if (f->vertex_program) {
+        Nv2aVshCPUXVSSExecutionState regs;
+        Nv2aVshExecutionState state =
+            nv2a_vsh_emu_initialize_xss_execution_state(
+                &regs, (float *)pg->vsh_constants);
+        memcpy(regs.input_regs, in, sizeof(regs.input_regs));
+        nv2a_vsh_emu_execute(&state, &r->program);
+        convert_vertex(f, &regs.output_regs[0 * 4], &regs.output_regs[3 * 4],
+                       &regs.output_regs[4 * 4], &regs.output_regs[9 * 4],
+                       out);
+    } else {
+        /* Fixed function without lighting or texture transforms */
+        float pos[4];
+        for (int i = 0; i < 4; i++) {
+            const float *row =
+                (const float *)pg->vsh_constants[NV_IGRAPH_XF_XFCTX_CMAT0 + i];
+            pos[i] = in[0][0] * row[0] + in[0][1] * row[1] +
+                     in[0][2] * row[2] + in[0][3] * row[3];
+        }
+        convert_vertex(f, pos, in[3], in[4], in[9], out);
+    }
+}
+
+/*
+ * Vertices are transformed SW_VERTEX_CHUNK_SIZE at a time by the SIMD
+ * executor. Indices that miss the vertex cache are gathered first, with a
+ * cache slot reused within a chunk taking its vertex from the chunk.
+ */
+static void process_vertices(NV2AState *d, const SwVertexFetch *f,
+                             const uint32_t *elements, unsigned int start,
+                             unsigned int count, SwVertex *out)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+    float inputs[SW_VERTEX_CHUNK_SIZE][VSH_CPU_INPUTS][4];
+    float outputs[SW_VERTEX_CHUNK_SIZE][VSH_CPU_OUTPUTS][4];
+    SwVertex transformed[SW_VERTEX_CHUNK_SIZE];
+    unsigned int miss_slot[SW_VERTEX_CHUNK_SIZE];
+    int source[SW_VERTEX_CHUNK_SIZE];
+
+    for (unsigned int base = 0; base < count; base += SW_VERTEX_CHUNK_SIZE) {
+        unsigned int n = MIN(count - base, SW_VERTEX_CHUNK_SIZE);
+        unsigned int misses = 0;
+
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int index =
+                elements ? elements[base + i] : start + base + i;
+            unsigned int slot = index % SW_VERTEX_CACHE_SIZE;
+
+            source[i] = -1;
+            if (r->vertex_cache_tag[slot] == index) {
+                for (int m = (int)misses - 1; m >= 0; m--) {
+                    if (miss_slot[m] == slot) {
+                        source[i] = m;
+                        break;
+                    }
+                }
+                if (source[i] < 0) {
+                    out[base + i] = r->vertex_cache[slot];
+                }
+                continue;
+            }
+
+            pgraph_fetch_vertex(pg, &f->fetch, index, inputs[misses]);
+            r->vertex_cache_tag[slot] = index;
+            miss_slot[misses] = slot;
+            source[i] = misses++;
+        }
+
+        if (f->prog) {
+            vsh_cpu_execute(f->prog, (const float (*)[4])pg->vsh_constants,
+                            (const float (*)[VSH_CPU_INPUTS][4])inputs,
+                            outputs, misses);
+            for (unsigned int m = 0; m < misses; m++) {
+                convert_vertex(f, outputs[m][VSH_CPU_OUT_POS],
+                               outputs[m][VSH_CPU_OUT_D0],
+                               outputs[m][VSH_CPU_OUT_D1],
+                               outputs[m][VSH_CPU_OUT_T0], &transformed[m]);
+            }
+        } else {
+            for (unsigned int m = 0; m < misses; m++) {
+                transform_vertex(d, f, inputs[m], &transformed[m]);
+            }
+        }
+
+        for (unsigned int m = 0; m < misses; m++) {
+            r->vertex_cache[miss_slot[m]] = transformed[m];
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            if (source[i] >= 0) {
+                out[base + i] = transformed[source[i]];
+            }
+        }
+    }
+}
+
+static SwVertex *reserve_vertices(PGRAPHSwState *r, unsigned int count)
+{
+    if (count > r->vertices_capacity) {
+        r->vertices_capacity = MAX(count, r->vertices_capacity * 2);
+        r->vertices = g_renew(SwVertex, r->vertices, r->vertices_capacity);
+    }
+    return r->vertices;
+}
+
+static float clip_distance(const SwVertex *v, int plane)
+{
+    switch (plane) {
+    case 0:
+        return v->pos[3] - SW_CLIP_MIN_W;
+    case 1:
+        return SW_GUARD_BAND * v->pos[3] - v->pos[0];
+    case 2:
+        return SW_GUARD_BAND * v->pos[3] + v->pos[0];
+    case 3:
+        return SW_GUARD_BAND * v->pos[3] - v->pos[1];
+    default:
+        return SW_GUARD_BAND * v->pos[3] + v->pos[1];
+    }
+}
+
+static unsigned int clip_code(const SwVertex *v)
+{
+    unsigned int code = 0;
+    for (int i = 0; i < SW_CLIP_PLANES; i++) {
+        if (clip_distance(v, i) < 0.0f) {
+            code |= 1 << i;
+        }
+    }
+    return code;
+}
+
+static void lerp_vertex(SwVertex *out, const SwVertex *a, const SwVertex *b,
+                        float t)
+{
+    const float *fa = (const float *)a, *fb = (const float *)b;
+    float *fo = (float *)out;
+
+    for (size_t i = 0; i < sizeof(SwVertex) / sizeof(float); i++) {
+        fo[i] = fa[i] + (fb[i] - fa[i]) * t;
+    }
+}
+
+static void draw_triangle(PGRAPHSwState *r, const SwVertex *a,
+                          const SwVertex *b, const SwVertex *c,
+                          const SwVertex *provoking)
+{
+    unsigned int ca = clip_code(a), cb = clip_code(b), cc = clip_code(c);
+
+    if (ca & cb & cc) {
+        return;
+    }
+    if (!(ca | cb | cc)) {
+        pgraph_sw_raster_add_triangle(r, a, b, c, provoking);
+        return;
+    }
+
+    SwVertex poly[2][SW_MAX_CLIP_VERTICES];
+    unsigned int n = 3, cur = 0;
+    poly[0][0] = *a;
+    poly[0][1] = *b;
+    poly[0][2] = *c;
+
+    for (int plane = 0; plane < SW_CLIP_PLANES; plane++) {
+        if (!((ca | cb | cc) & (1 << plane))) {
+            continue;
+        }
+        const SwVertex *in = poly[cur];
+        SwVertex *out = poly[cur ^ 1];
+        unsigned int m = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            const SwVertex *p = &in[i], *q = &in[(i + 1) % n];
+            float dp = clip_distance(p, plane), dq = clip_distance(q, plane);
+            if (dp >= 0.0f) {
+                out[m++] = *p;
+            }
+            if ((dp >= 0.0f) != (dq >= 0.0f)) {
+                lerp_vertex(&out[m++], p, q, dp / (dp - dq));
+            }
+        }
+        n = m;
+        cur ^= 1;
+        if (n < 3) {
+            return;
+        }
+    }
+
+    for (unsigned int i = 1; i + 1 < n; i++) {
+        pgraph_sw_raster_add_triangle(r, &poly[cur][0], &poly[cur][i],
+                                      &poly[cur][i + 1], provoking);
+    }
+}
+
+static void draw_primitives(NV2AState *d, const SwVertex *v,
+                            unsigned int count)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+
+    switch (pg->primitive_mode) {
+    case PRIM_TYPE_TRIANGLES:
+        for (unsigned int i = 0; i + 2 < count; i += 3) {
+            draw_triangle(r, &v[i], &v[i + 1], &v[i + 2], &v[i]);
+        }
+        break;
+    case PRIM_TYPE_TRIANGLE_STRIP:
+        for (unsigned int i = 0; i + 2 < count; i++) {
+            if (i & 1) {
+                draw_triangle(r, &v[i + 1], &v[i], &v[i + 2], &v[i]);
+            } else {
+                draw_triangle(r, &v[i], &v[i + 1], &v[i + 2], &v[i]);
+            }
+        }
+        break;
+    case PRIM_TYPE_TRIANGLE_FAN:
+        for (unsigned int i = 1; i + 1 < count; i++) {
+            draw_triangle(r, &v[0], &v[i], &v[i + 1], &v[i]);
+        }
+        break;
+    case PRIM_TYPE_POLYGON:
+        for (unsigned int i = 1; i + 1 < count; i++) {
+            draw_triangle(r, &v[0], &v[i], &v[i + 1], &v[0]);
+        }
+        break;
+    case PRIM_TYPE_QUADS:
+        for (unsigned int i = 0; i + 3 < count; i += 4) {
+            draw_triangle(r, &v[i], &v[i + 1], &v[i + 2], &v[i]);
+            draw_triangle(r, &v[i], &v[i + 2], &v[i + 3], &v[i]);
+        }
+        break;
+    case PRIM_TYPE_QUAD_STRIP:
+        for (unsigned int i = 0; i + 3 < count; i += 2) {
+            draw_triangle(r, &v[i], &v[i + 1], &v[i + 3], &v[i]);
+            draw_triangle(r, &v[i], &v[i + 3], &v[i + 2], &v[i]);
+        }
+        break;
+    default:
+        NV2A_UNIMPLEMENTED("Software renderer: primitive mode %d",
+                           pg->primitive_mode);
+        break;
+    }
+}
+
+static void draw_range(NV2AState *d, const SwVertexFetch *f,
+                       unsigned int start, unsigned int count)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+    SwVertex *v = reserve_vertices(r, count);
+
+    process_vertices(d, f, NULL, start, count, v);
+    draw_primitives(d, v, count);
+}
+
+static void draw_elements(NV2AState *d, const SwVertexFetch *f,
+                          const uint32_t *elements, unsigned int count)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+    SwVertex *v = reserve_vertices(r, count);
+
+    process_vertices(d, f, elements, 0, count, v);
+    draw_primitives(d, v, count);
+}
+
+void pgraph_sw_flush_draw(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+
+    if (!bind_surfaces(d, true, true)) {
+        return;
+    }
+
+    setup_raster_state(d);
+
+    SwVertexFetch f;
+    setup_vertex_fetch(d, &f);
+
+    if (f.vertex_program && !update_vertex_program(d, &f)) {
+        unbind_surfaces(d, false, false);
+        return;
+    }
+
+    memset(r->vertex_cache_tag, 0xff, sizeof(r->vertex_cache_tag));
+    uint32_t zpass_pixel_count = r->zpass_pixel_count;
+    pgraph_sw_raster_begin(r);
+
+    if (pg->draw_arrays_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
+        for (unsigned int i = 0; i < pg->draw_arrays_length; i++) {
+            draw_range(d, &f, pg->draw_arrays_start[i],
+                       pg->draw_arrays_count[i]);
+        }
+        pgraph_update_inline_values_from_vertex(pg, &f.fetch,
+                                                pg->draw_arrays_max_count - 1);
+    } else if (pg->inline_elements_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS);
+        draw_elements(d, &f, pg->inline_elements, pg->inline_elements_length);
+        pgraph_update_inline_values_from_vertex(
+            pg, &f.fetch, pg->inline_elements[pg->inline_elements_length - 1]);
+    } else if (pg->inline_buffer_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_BUFFERS);
+        draw_range(d, &f, 0, pg->inline_buffer_length);
+        pgraph_update_inline_values_from_vertex(pg, &f.fetch,
+                                                pg->inline_buffer_length - 1);
+    } else if (pg->inline_array_length) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_ARRAYS);
+        unsigned int index_count = f.fetch.inline_array_vertices;
+        if (index_count) {
+            draw_range(d, &f, 0, index_count);
+            pgraph_update_inline_values_from_vertex(pg, &f.fetch,
+                                                    index_count - 1);
+        }
+    } else {
+        NV2A_UNCONFIRMED("EMPTY NV097_SET_BEGIN_END");
+    }
+
+    pgraph_sw_raster_end(r);
+
+    if (!pg->zpass_pixel_count_enable) {
+        r->zpass_pixel_count = zpass_pixel_count;
+    }
+
+    unbind_surfaces(d, r->rs.color_write, r->rs.depth_write);
+}
+
+void pgraph_sw_draw_end(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
+    bool color_write = pgraph_color_write_enabled(pg);
+    bool depth_test = control_0 & NV_PGRAPH_CONTROL_0_ZENABLE;
+    bool stencil_test = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1) &
+                        NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
+
+    if (!(color_write || depth_test || stencil_test)) {
+        /* Nothing can be modified, see pgraph_gl_draw_end */
+        return;
+    }
+
+    pgraph_sw_flush_draw(d);
+    pg->draw_time++;
+}
+
+void pgraph_sw_clear_surface(NV2AState *d, uint32_t parameter)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHSwState *r = pg->sw_renderer_state;
+
+    bool write_color = parameter & NV097_CLEAR_SURFACE_COLOR;
+    bool write_zeta =
+        parameter & (NV097_CLEAR_SURFACE_Z | NV097_CLEAR_SURFACE_STENCIL);
+
+    pg->clearing = true;
+
+    if (!bind_surfaces(d, write_color, write_zeta)) {
+        pg->clearing = false;
+        return;
+    }
+
+    /* FIXME: Needs confirmation, same rectangle as the GL backend */
+    unsigned int xmin = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTX),
+                                 NV_PGRAPH_CLEARRECTX_XMIN);
+    unsigned int xmax = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTX),
+                                 NV_PGRAPH_CLEARRECTX_XMAX);
+    unsigned int ymin = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTY),
+                                 NV_PGRAPH_CLEARRECTY_YMIN);
+    unsigned int ymax = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTY),
+                                 NV_PGRAPH_CLEARRECTY_YMAX);
+    unsigned int width = xmax - xmin + 1, height = ymax - ymin + 1;
+    pgraph_apply_anti_aliasing_factor(pg, &xmin, &ymin);
+    pgraph_apply_anti_aliasing_factor(pg, &width, &height);
+
+    if (r->color.bound) {
+        SwSurface *s = &r->color;
+        float rgba[4];
+        pgraph_get_clear_color(pg, rgba);
+
+        unsigned int x1 = MIN(xmin + width, s->width);
+        unsigned int y1 = MIN(ymin + height, s->height);
+        for (unsigned int y = ymin; y < y1; y++) {
+            uint8_t *row = s->data + y * s->pitch;
+            for (unsigned int x = xmin; x < x1; x++) {
+                pgraph_sw_pack_color(s->format, row + x * s->bytes_per_pixel,
+                                     rgba, parameter & NV097_CLEAR_SURFACE_R,
+                                     parameter & NV097_CLEAR_SURFACE_G,
+                                     parameter & NV097_CLEAR_SURFACE_B,
+                                     parameter & NV097_CLEAR_SURFACE_A);
+            }
+        }
+    }
+
+    if (r->zeta.bound) {
+        SwSurface *s = &r->zeta;
+        uint32_t value = pgraph_reg_r(pg, NV_PGRAPH_ZSTENCILCLEARVALUE);
+        uint32_t mask;
+        if (s->bytes_per_pixel == 2) {
+            mask = (parameter & NV097_CLEAR_SURFACE_Z) ? 0xFFFF : 0;
+        } else {
+            mask = ((parameter & NV097_CLEAR_SURFACE_Z) ? 0xFFFFFF00 : 0) |
+                   ((parameter & NV097_CLEAR_SURFACE_STENCIL) ? 0xFF : 0);
+        }
+
+        unsigned int x1 = MIN(xmin + width, s->width);
+        unsigned int y1 = MIN(ymin + height, s->height);
+        for (unsigned int y = ymin; y < y1; y++) {
+            uint8_t *row = s->data + y * s->pitch;
+            for (unsigned int x = xmin; x < x1; x++) {
+                uint8_t *p = row + x * s->bytes_per_pixel;
+                if (s->bytes_per_pixel == 2) {
+                    stw_le_p(p, (lduw_le_p(p) & ~mask) | (value & mask));
+                } else {
+                    stl_le_p(p, (ldl_le_p(p) & ~mask) | (value & mask));
+                }
+            }
+        }
+    }
+
+    unbind_surfaces(d, write_color, write_zeta);
+    pg->clearing = false;
+}
+
+void pgraph_sw_finalize_draw(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    if (r->program_valid) {
+        nv2a_vsh_program_destroy(&r->program);
+        r->program_valid = false;
+    }
+    g_free(r->vertices);
+    g_free(r->color.swizzle_buf);
+    g_free(r->zeta.swizzle_buf);
+}
@@ -0,0 +1,1044 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/host-utils.h"
+#include "renderer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SW_HAVE_SSE2 1
+#endif
+
+/* Below this many binned triangles the pool is not worth waking up */
+#define SW_MIN_PARALLEL_TRIANGLES 16
+
+static inline float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline uint8_t unorm8(float v)
+{
+    return (uint8_t)(clampf(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+static inline unsigned int unorm_bits(float v, unsigned int max)
+{
+    return (unsigned int)(clampf(v, 0.0f, 1.0f) * max + 0.5f);
+}
+
+static void unpack_color(unsigned int format, const uint8_t *p, float rgba[4])
+{
+    uint32_t v;
+
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        v = lduw_le_p(p);
+        rgba[0] = ((v >> 10) & 0x1F) / 31.0f;
+        rgba[1] = ((v >> 5) & 0x1F) / 31.0f;
+        rgba[2] = (v & 0x1F) / 31.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        v = lduw_le_p(p);
+        rgba[0] = ((v >> 11) & 0x1F) / 31.0f;
+        rgba[1] = ((v >> 5) & 0x3F) / 63.0f;
+        rgba[2] = (v & 0x1F) / 31.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        rgba[0] = rgba[1] = 0.0f;
+        rgba[2] = p[0] / 255.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        rgba[0] = 0.0f;
+        rgba[1] = p[1] / 255.0f;
+        rgba[2] = p[0] / 255.0f;
+        rgba[3] = 1.0f;
+        break;
+    default:
+        v = ldl_le_p(p);
+        pgraph_argb_pack32_to_rgba_float(v, rgba);
+        if (format != NV097_SET_SURFACE_FORMAT_COLOR_LE_A8R8G8B8) {
+            rgba[3] = 1.0f;
+        }
+        break;
+    }
+}
+
+void pgraph_sw_pack_color(unsigned int format, uint8_t *p, const float rgba[4],
+                          bool r, bool g, bool b, bool a)
+{
+    uint32_t v, mask;
+
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        v = (unorm_bits(rgba[0], 31) << 10) | (unorm_bits(rgba[1], 31) << 5) |
+            unorm_bits(rgba[2], 31);
+        if (format == NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5) {
+            v |= 0x8000;
+        }
+        mask = (r ? 0x7C00 : 0) | (g ? 0x03E0 : 0) | (b ? 0x001F : 0) | 0x8000;
+        stw_le_p(p, (lduw_le_p(p) & ~mask) | (v & mask));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        v = (unorm_bits(rgba[0], 31) << 11) | (unorm_bits(rgba[1], 63) << 5) |
+            unorm_bits(rgba[2], 31);
+        mask = (r ? 0xF800 : 0) | (g ? 0x07E0 : 0) | (b ? 0x001F : 0);
+        stw_le_p(p, (lduw_le_p(p) & ~mask) | (v & mask));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        if (b) {
+            p[0] = unorm8(rgba[2]);
+        }
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        if (b) {
+            p[0] = unorm8(rgba[2]);
+        }
+        if (g) {
+            p[1] = unorm8(rgba[1]);
+        }
+        break;
+    default:
+        v = ((uint32_t)unorm8(rgba[3]) << 24) | (unorm8(rgba[0]) << 16) |
+            (unorm8(rgba[1]) << 8) | unorm8(rgba[2]);
+        mask = (a ? 0xFF000000 : 0) | (r ? 0x00FF0000 : 0) |
+               (g ? 0x0000FF00 : 0) | (b ? 0x000000FF : 0);
+        switch (format) {
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+            v &= 0x00FFFFFF;
+            mask |= 0xFF000000;
+            break;
+        case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+            v |= 0xFF000000;
+            mask |= 0xFF000000;
+            break;
+        default:
+            break;
+        }
+        stl_le_p(p, (ldl_le_p(p) & ~mask) | (v & mask));
+        break;
+    }
+}
+
+static inline bool compare(unsigned int func, uint32_t a, uint32_t b)
+{
+    switch (func) {
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NEVER: return false;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LESS: return a < b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_EQUAL: return a == b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LEQUAL: return a <= b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GREATER: return a > b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NOTEQUAL: return a != b;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GEQUAL: return a >= b;
+    default: return true;
+    }
+}
+
+static void blend_factor(unsigned int factor, const float src[4],
+                         const float dst[4], const float constant[4],
+                         float out[4])
+{
+    for (int i = 0; i < 4; i++) {
+        switch (factor) {
+        case NV_PGRAPH_BLEND_SFACTOR_ZERO: out[i] = 0.0f; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE: out[i] = 1.0f; break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_COLOR: out[i] = src[i]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_COLOR:
+            out[i] = 1.0f - src[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA: out[i] = src[3]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_ALPHA:
+            out[i] = 1.0f - src[3];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_DST_ALPHA: out[i] = dst[3]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_ALPHA:
+            out[i] = 1.0f - dst[3];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_DST_COLOR: out[i] = dst[i]; break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_COLOR:
+            out[i] = 1.0f - dst[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA_SATURATE:
+            out[i] = i < 3 ? MIN(src[3], 1.0f - dst[3]) : 1.0f;
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_COLOR:
+            out[i] = constant[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_COLOR:
+            out[i] = 1.0f - constant[i];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_ALPHA:
+            out[i] = constant[3];
+            break;
+        case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_ALPHA:
+            out[i] = 1.0f - constant[3];
+            break;
+        default:
+            out[i] = 0.0f;
+            break;
+        }
+    }
+}
+
+static void blend(const SwRasterState *rs, const float src[4],
+                  const float dst[4], float out[4])
+{
+    float sf[4], df[4];
+    blend_factor(rs->blend_sfactor, src, dst, rs->blend_color, sf);
+    blend_factor(rs->blend_dfactor, src, dst, rs->blend_color, df);
+
+    for (int i = 0; i < 4; i++) {
+        float s = src[i] * sf[i], d = dst[i] * df[i];
+        switch (rs->blend_equation) {
+        case 0: /* Subtract */
+            out[i] = s - d;
+            break;
+        case 1: /* Reverse subtract */
+        case 5: /* Reverse subtract, signed */
+            out[i] = d - s;
+            break;
+        case 3: /* Min */
+            out[i] = MIN(src[i], dst[i]);
+            break;
+        case 4: /* Max */
+            out[i] = MAX(src[i], dst[i]);
+            break;
+        default: /* Add, signed add */
+            out[i] = s + d;
+            break;
+        }
+    }
+}
+
+static inline uint32_t deposit_bits(uint32_t v, uint32_t mask)
+{
+    uint32_t r = 0;
+    for (uint32_t bit = 1; mask; bit <<= 1) {
+        if (v & bit) {
+            r |= mask & -mask;
+        }
+        mask &= mask - 1;
+    }
+    return r;
+}
+
+static inline int wrap_coord(int c, unsigned int size, unsigned int mode)
+{
+    switch (mode) {
+    case NV_PGRAPH_TEXADDRESS0_ADDRU_WRAP:
+        c %= (int)size;
+        return c < 0 ? c + size : c;
+    case NV_PGRAPH_TEXADDRESS0_ADDRU_MIRROR: {
+        int period = 2 * size;
+        c %= period;
+        if (c < 0) {
+            c += period;
+        }
+        return c < (int)size ? c : period - 1 - c;
+    }
+    default:
+        return c < 0 ? 0 : (c >= (int)size ? (int)size - 1 : c);
+    }
+}
+
+/* Nearest sampling of the base level */
+static void sample_texture(const SwTexture *t, float s, float tc,
+                           float rgba[4])
+{
+    if (!t->linear) {
+        s *= t->width;
+        tc *= t->height;
+    }
+
+    int u = wrap_coord((int)floorf(s), t->width, t->addr_u);
+    int v = wrap_coord((int)floorf(tc), t->height, t->addr_v);
+
+    const uint8_t *p;
+    if (t->linear) {
+        p = t->data + v * t->pitch + u * t->bytes_per_pixel;
+    } else {
+        p = t->data + (deposit_bits(u, t->swizzle_mask_x) |
+                       deposit_bits(v, t->swizzle_mask_y)) *
+                          t->bytes_per_pixel;
+    }
+
+    uint32_t c;
+    switch (t->color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8R8G8B8:
+        pgraph_argb_pack32_to_rgba_float(ldl_le_p(p), rgba);
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X8R8G8B8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X8R8G8B8:
+        pgraph_argb_pack32_to_rgba_float(ldl_le_p(p), rgba);
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R5G6B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_R5G6B5:
+        c = lduw_le_p(p);
+        rgba[0] = ((c >> 11) & 0x1F) / 31.0f;
+        rgba[1] = ((c >> 5) & 0x3F) / 63.0f;
+        rgba[2] = (c & 0x1F) / 31.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_X1R5G5B5:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_X1R5G5B5:
+        c = lduw_le_p(p);
+        rgba[0] = ((c >> 10) & 0x1F) / 31.0f;
+        rgba[1] = ((c >> 5) & 0x1F) / 31.0f;
+        rgba[2] = (c & 0x1F) / 31.0f;
+        rgba[3] = (t->color_format ==
+                       NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A1R5G5B5 ||
+                   t->color_format ==
+                       NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A1R5G5B5) ?
+                      (float)(c >> 15) : 1.0f;
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A4R4G4B4:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A4R4G4B4:
+        c = lduw_le_p(p);
+        rgba[0] = ((c >> 8) & 0xF) / 15.0f;
+        rgba[1] = ((c >> 4) & 0xF) / 15.0f;
+        rgba[2] = (c & 0xF) / 15.0f;
+        rgba[3] = (c >> 12) / 15.0f;
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_Y8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_Y8:
+        rgba[0] = rgba[1] = rgba[2] = p[0] / 255.0f;
+        rgba[3] = 1.0f;
+        break;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_A8:
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LU_IMAGE_A8:
+        rgba[0] = rgba[1] = rgba[2] = 1.0f;
+        rgba[3] = p[0] / 255.0f;
+        break;
+    default:
+        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 1.0f;
+        break;
+    }
+}
+
+static inline float interpolate(const SwTriangle *tri, int i, float fx,
+                                float fy)
+{
+    return tri->plane[i][0] + tri->plane[i][1] * fx + tri->plane[i][2] * fy;
+}
+
+/* Combiner registers, as numbered in the input and output fields */
+enum SwCombinerReg {
+    SW_REG_ZERO,
+    SW_REG_C0,
+    SW_REG_C1,
+    SW_REG_FOG,
+    SW_REG_V0,
+    SW_REG_V1,
+    SW_REG_T0 = 8,
+    SW_REG_R0 = 12,
+    SW_REG_R1,
+    SW_REG_V1R0_SUM,
+    SW_REG_EF_PROD,
+    SW_REG_COUNT,
+};
+
+#define SW_COMBINER_MUX (1 << 2)
+#define SW_COMBINER_AB_DOT (1 << 1)
+#define SW_COMBINER_CD_DOT (1 << 0)
+#define SW_COMBINER_CD_BLUE_TO_ALPHA (1 << 6)
+#define SW_COMBINER_AB_BLUE_TO_ALPHA (1 << 7)
+
+#define SW_FINAL_CLAMP_SUM (1 << 7)
+#define SW_FINAL_COMPLEMENT_V1 (1 << 6)
+#define SW_FINAL_COMPLEMENT_R0 (1 << 5)
+
+/* Fetches an 8-bit combiner input into out[0..2], or out[0] for alpha */
+static void combiner_input(float regs[SW_REG_COUNT][4], uint32_t input,
+                           bool alpha, float out[3])
+{
+    const float *reg = regs[input & 0xF];
+    bool alpha_chan = input & 0x10;
+    unsigned int n = alpha ? 1 : 3;
+
+    for (unsigned int i = 0; i < n; i++) {
+        float v = alpha_chan ? reg[3] : (alpha ? reg[2] : reg[i]);
+        switch (input & 0xE0) {
+        case 0x00: v = MAX(v, 0.0f); break;
+        case 0x20: v = 1.0f - clampf(v, 0.0f, 1.0f); break;
+        case 0x40: v = 2.0f * MAX(v, 0.0f) - 1.0f; break;
+        case 0x60: v = 1.0f - 2.0f * MAX(v, 0.0f); break;
+        case 0x80: v = MAX(v, 0.0f) - 0.5f; break;
+        case 0xA0: v = 0.5f - MAX(v, 0.0f); break;
+        case 0xC0: break;
+        default: v = -v; break;
+        }
+        out[i] = v;
+    }
+}
+
+static inline float combiner_output(float v, unsigned int mapping)
+{
+    switch (mapping) {
+    case 0x08: v = v - 0.5f; break;
+    case 0x10: v = v * 2.0f; break;
+    case 0x18: v = (v - 0.5f) * 2.0f; break;
+    case 0x20: v = v * 4.0f; break;
+    case 0x30: v = v * 0.5f; break;
+    default: break;
+    }
+    return clampf(v, -1.0f, 1.0f);
+}
+
+/* Evaluates one half of a general combiner stage, writes are deferred */
+static void combiner_half(float regs[SW_REG_COUNT][4], uint32_t inputs,
+                          uint32_t outputs, bool alpha, bool mux_msb,
+                          float ab[3], float cd[3], float muxsum[3])
+{
+    unsigned int n = alpha ? 1 : 3;
+    unsigned int flags = outputs >> 12;
+    unsigned int mapping = flags & 0x38;
+    float a[3], b[3], c[3], d[3];
+
+    combiner_input(regs, inputs >> 24, alpha, a);
+    combiner_input(regs, (inputs >> 16) & 0xFF, alpha, b);
+    combiner_input(regs, (inputs >> 8) & 0xFF, alpha, c);
+    combiner_input(regs, inputs & 0xFF, alpha, d);
+
+    float ab_dot = 0.0f, cd_dot = 0.0f;
+    for (unsigned int i = 0; i < n; i++) {
+        ab_dot += a[i] * b[i];
+        cd_dot += c[i] * d[i];
+    }
+
+    float r0_a = MAX(regs[SW_REG_R0][3], 0.0f);
+    bool mux_cd = mux_msb ? r0_a >= 0.5f : ((unsigned int)(r0_a * 255.0f) & 1);
+    for (unsigned int i = 0; i < n; i++) {
+        float ab_raw = (flags & SW_COMBINER_AB_DOT) ? ab_dot : a[i] * b[i];
+        float cd_raw = (flags & SW_COMBINER_CD_DOT) ? cd_dot : c[i] * d[i];
+        float sum = (flags & SW_COMBINER_MUX) ? (mux_cd ? cd_raw : ab_raw) :
+                                                ab_raw + cd_raw;
+        ab[i] = combiner_output(ab_raw, mapping);
+        cd[i] = combiner_output(cd_raw, mapping);
+        muxsum[i] = combiner_output(sum, mapping);
+    }
+}
+
+static inline bool combiner_writable(unsigned int reg)
+{
+    return reg == SW_REG_V0 || reg == SW_REG_V1 ||
+           (reg >= SW_REG_T0 && reg <= SW_REG_R1);
+}
+
+static void combiner_write(float regs[SW_REG_COUNT][4], unsigned int reg,
+                           const float v[3], bool alpha)
+{
+    if (!combiner_writable(reg)) {
+        return;
+    }
+    if (alpha) {
+        regs[reg][3] = v[0];
+    } else {
+        memcpy(regs[reg], v, 3 * sizeof(float));
+    }
+}
+
+static void combiner_stage(const SwRasterState *rs, const SwCombinerStage *st,
+                           float regs[SW_REG_COUNT][4])
+{
+    float rgb[3][3], alpha[3][3];
+
+    memcpy(regs[SW_REG_C0], st->c0, sizeof(regs[SW_REG_C0]));
+    memcpy(regs[SW_REG_C1], st->c1, sizeof(regs[SW_REG_C1]));
+
+    /* Both halves read the registers before either writes them */
+    combiner_half(regs, st->rgb_inputs, st->rgb_outputs, false, rs->mux_msb,
+                  rgb[0], rgb[1], rgb[2]);
+    combiner_half(regs, st->alpha_inputs, st->alpha_outputs, true, rs->mux_msb,
+                  alpha[0], alpha[1], alpha[2]);
+
+    unsigned int cd_reg = st->rgb_outputs & 0xF;
+    unsigned int ab_reg = (st->rgb_outputs >> 4) & 0xF;
+    unsigned int sum_reg = (st->rgb_outputs >> 8) & 0xF;
+    unsigned int flags = st->rgb_outputs >> 12;
+    combiner_write(regs, ab_reg, rgb[0], false);
+    if ((flags & SW_COMBINER_AB_BLUE_TO_ALPHA) && combiner_writable(ab_reg)) {
+        regs[ab_reg][3] = rgb[0][2];
+    }
+    combiner_write(regs, cd_reg, rgb[1], false);
+    if ((flags & SW_COMBINER_CD_BLUE_TO_ALPHA) && combiner_writable(cd_reg)) {
+        regs[cd_reg][3] = rgb[1][2];
+    }
+    combiner_write(regs, sum_reg, rgb[2], false);
+
+    combiner_write(regs, (st->alpha_outputs >> 4) & 0xF, alpha[0], true);
+    combiner_write(regs, st->alpha_outputs & 0xF, alpha[1], true);
+    combiner_write(regs, (st->alpha_outputs >> 8) & 0xF, alpha[2], true);
+}
+
+static void combiner_final(const SwRasterState *rs,
+                           float regs[SW_REG_COUNT][4], float out[4])
+{
+    uint32_t in0 = rs->final_inputs_0, in1 = rs->final_inputs_1;
+    float a[3], b[3], c[3], d[3], e[3], f[3], g[3];
+
+    memcpy(regs[SW_REG_C0], rs->final_c0, sizeof(regs[SW_REG_C0]));
+    memcpy(regs[SW_REG_C1], rs->final_c1, sizeof(regs[SW_REG_C1]));
+
+    unsigned int flags = in1 & 0xFF;
+    for (int i = 0; i < 3; i++) {
+        float v1 = regs[SW_REG_V1][i], r0 = regs[SW_REG_R0][i];
+        float sum = ((flags & SW_FINAL_COMPLEMENT_V1) ? 1.0f - v1 : v1) +
+                    ((flags & SW_FINAL_COMPLEMENT_R0) ? 1.0f - r0 : r0);
+        regs[SW_REG_V1R0_SUM][i] =
+            (flags & SW_FINAL_CLAMP_SUM) ? clampf(sum, 0.0f, 1.0f) : sum;
+    }
+    regs[SW_REG_V1R0_SUM][3] = 0.0f;
+
+    combiner_input(regs, in1 >> 24, false, e);
+    combiner_input(regs, (in1 >> 16) & 0xFF, false, f);
+    for (int i = 0; i < 3; i++) {
+        regs[SW_REG_EF_PROD][i] = e[i] * f[i];
+    }
+    regs[SW_REG_EF_PROD][3] = 0.0f;
+
+    combiner_input(regs, in0 >> 24, false, a);
+    combiner_input(regs, (in0 >> 16) & 0xFF, false, b);
+    combiner_input(regs, (in0 >> 8) & 0xFF, false, c);
+    combiner_input(regs, in0 & 0xFF, false, d);
+    combiner_input(regs, (in1 >> 8) & 0xFF, true, g);
+
+    for (int i = 0; i < 3; i++) {
+        out[i] = d[i] + c[i] + (b[i] - c[i]) * a[i];
+    }
+    out[3] = g[0];
+}
+
+static void interpolate_color(const SwTriangle *tri, int base,
+                              const float *flat_color, float fx, float fy,
+                              float w, float out[4])
+{
+    if (tri->flat) {
+        memcpy(out, flat_color, 4 * sizeof(float));
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        out[i] = clampf(interpolate(tri, base + i, fx, fy) * w, 0.0f, 1.0f);
+    }
+}
+
+static void texture_stage(const SwRasterState *rs, const SwTriangle *tri,
+                          int stage, float fx, float fy, float w, float out[4])
+{
+    float tc[4];
+
+    if (rs->tex_mode[stage] == SW_TEXTURE_MODE_NONE) {
+        out[0] = out[1] = out[2] = out[3] = 0.0f;
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        tc[i] = interpolate(tri, SW_INTERP_TEXCOORD + stage * 4 + i, fx, fy) *
+                w;
+    }
+    if (rs->tex_mode[stage] == SW_TEXTURE_MODE_PASSTHRU) {
+        memcpy(out, tc, sizeof(tc));
+        return;
+    }
+
+    if (!rs->tex_valid[stage]) {
+        out[0] = out[1] = out[2] = out[3] = 1.0f;
+        return;
+    }
+    if (tc[3] != 0.0f && tc[3] != 1.0f) {
+        tc[0] /= tc[3];
+        tc[1] /= tc[3];
+    }
+    sample_texture(&rs->tex[stage], tc[0], tc[1], out);
+}
+
+/* Returns true if the sample passed the alpha and depth tests */
+static bool shade_pixel(PGRAPHSwState *r, const SwTriangle *tri, int px,
+                        int py)
+{
+    const SwRasterState *rs = &r->rs;
+    float fx = px + 0.5f, fy = py + 0.5f;
+    float w = 1.0f / interpolate(tri, SW_INTERP_INV_W, fx, fy);
+    float regs[SW_REG_COUNT][4] = { 0 };
+
+    memcpy(regs[SW_REG_FOG], rs->fog, sizeof(regs[SW_REG_FOG]));
+    interpolate_color(tri, SW_INTERP_DIFFUSE, tri->flat_diffuse, fx, fy, w,
+                      regs[SW_REG_V0]);
+    interpolate_color(tri, SW_INTERP_SPECULAR, tri->flat_specular, fx, fy, w,
+                      regs[SW_REG_V1]);
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        texture_stage(rs, tri, i, fx, fy, w, regs[SW_REG_T0 + i]);
+    }
+    regs[SW_REG_R0][3] = rs->tex_mode[0] != SW_TEXTURE_MODE_NONE ?
+                             regs[SW_REG_T0][3] :
+                             1.0f;
+
+    for (unsigned int i = 0; i < rs->num_stages; i++) {
+        combiner_stage(rs, &rs->stages[i], regs);
+    }
+
+    float color[4];
+    if (rs->final_enabled) {
+        combiner_final(rs, regs, color);
+    } else {
+        memcpy(color, regs[SW_REG_R0], sizeof(color));
+    }
+    for (int i = 0; i < 4; i++) {
+        color[i] = clampf(color[i], 0.0f, 1.0f);
+    }
+
+    if (rs->alpha_test &&
+        !compare(rs->alpha_func, unorm8(color[3]), unorm8(rs->alpha_ref))) {
+        return false;
+    }
+
+    if (r->zeta.bound && (rs->depth_test || rs->depth_write)) {
+        float z = interpolate(tri, SW_INTERP_Z, fx, fy);
+        if (rs->z_clamp) {
+            z = clampf(z, rs->zclip_min, rs->zclip_max);
+        } else if (z < rs->zclip_min || z > rs->zclip_max) {
+            return false;
+        }
+        uint32_t depth = (uint32_t)clampf(z, 0.0f, rs->zmax);
+
+        uint8_t *zp = r->zeta.data + py * r->zeta.pitch +
+                      px * r->zeta.bytes_per_pixel;
+        bool z16 = r->zeta.bytes_per_pixel == 2;
+        uint32_t stored = z16 ? lduw_le_p(zp) : ldl_le_p(zp) >> 8;
+
+        if (rs->depth_test && !compare(rs->depth_func, depth, stored)) {
+            return false;
+        }
+        if (rs->depth_write) {
+            if (z16) {
+                stw_le_p(zp, depth);
+            } else {
+                stl_le_p(zp, (depth << 8) | (ldl_le_p(zp) & 0xFF));
+            }
+        }
+    }
+
+    if (rs->color_write && r->color.bound) {
+        uint8_t *cp = r->color.data + py * r->color.pitch +
+                      px * r->color.bytes_per_pixel;
+        if (rs->blend) {
+            float dst[4], out[4];
+            unpack_color(r->color.format, cp, dst);
+            blend(rs, color, dst, out);
+            memcpy(color, out, sizeof(color));
+        }
+        pgraph_sw_pack_color(r->color.format, cp, color, rs->write_r,
+                             rs->write_g, rs->write_b, rs->write_a);
+    }
+
+    return true;
+}
+
+static inline int64_t edge_at(const SwTriangle *tri, int k, int px, int py)
+{
+    int n = (k + 1) % 3;
+    int64_t dx = tri->x[n] - tri->x[k], dy = tri->y[n] - tri->y[k];
+    int64_t sx = px * 16 + 8, sy = py * 16 + 8;
+    return dx * (sy - tri->y[k]) - dy * (sx - tri->x[k]) + tri->bias[k];
+}
+
+/*
+ * Edges that do not cross the rectangle are either resolved for the whole
+ * rectangle or reject the triangle outright. The remaining edges cross the
+ * rectangle, which bounds their values within a tile well inside 32 bits.
+ */
+static uint32_t rasterize_triangle(PGRAPHSwState *r, const SwTriangle *tri,
+                                   int x0, int y0, int x1, int y1)
+{
+    int32_t e_row[3], step_x[3], step_y[3];
+
+    for (int k = 0; k < 3; k++) {
+        int64_t c00 = edge_at(tri, k, x0, y0), c10 = edge_at(tri, k, x1, y0),
+                c01 = edge_at(tri, k, x0, y1), c11 = edge_at(tri, k, x1, y1);
+        int64_t lo = MIN(MIN(c00, c10), MIN(c01, c11));
+        int64_t hi = MAX(MAX(c00, c10), MAX(c01, c11));
+        if (hi < 0) {
+            return 0;
+        }
+        if (lo >= 0) {
+            e_row[k] = step_x[k] = step_y[k] = 0;
+            continue;
+        }
+        int n = (k + 1) % 3;
+        e_row[k] = c00;
+        step_x[k] = -(tri->y[n] - tri->y[k]) * 16;
+        step_y[k] = (tri->x[n] - tri->x[k]) * 16;
+    }
+
+    uint32_t passed = 0;
+
+#if defined(SW_HAVE_SSE2)
+    __m128i step4[3], lane[3];
+    for (int k = 0; k < 3; k++) {
+        step4[k] = _mm_set1_epi32(step_x[k] * 4);
+        lane[k] = _mm_setr_epi32(0, step_x[k], step_x[k] * 2, step_x[k] * 3);
+    }
+#endif
+
+    for (int py = y0; py <= y1; py++) {
+#if defined(SW_HAVE_SSE2)
+        __m128i e[3];
+        for (int k = 0; k < 3; k++) {
+            e[k] = _mm_add_epi32(_mm_set1_epi32(e_row[k]), lane[k]);
+        }
+#else
+        int32_t e[3] = { e_row[0], e_row[1], e_row[2] };
+#endif
+        for (int px = x0; px <= x1; px += 4) {
+            unsigned int covered;
+#if defined(SW_HAVE_SSE2)
+            __m128i outside = _mm_or_si128(_mm_or_si128(e[0], e[1]), e[2]);
+            covered = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF;
+            for (int k = 0; k < 3; k++) {
+                e[k] = _mm_add_epi32(e[k], step4[k]);
+            }
+#else
+            covered = 0;
+            for (int i = 0; i < 4; i++) {
+                if ((e[0] | e[1] | e[2]) >= 0) {
+                    covered |= 1 << i;
+                }
+                for (int k = 0; k < 3; k++) {
+                    e[k] += step_x[k];
+                }
+            }
+#endif
+            if (x1 - px < 3) {
+                covered &= (1 << (x1 - px + 1)) - 1;
+            }
+            while (covered) {
+                int i = ctz32(covered);
+                covered &= covered - 1;
+                passed += shade_pixel(r, tri, px + i, py);
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            e_row[k] += step_y[k];
+        }
+    }
+
+    return passed;
+}
+
+static void shade_tile(PGRAPHSwState *r, unsigned int tile)
+{
+    const SwBin *bin = &r->bins[tile];
+    int tx0 = (tile % r->bins_x) * SW_TILE_SIZE;
+    int ty0 = (tile / r->bins_x) * SW_TILE_SIZE;
+    int tx1 = tx0 + SW_TILE_SIZE - 1, ty1 = ty0 + SW_TILE_SIZE - 1;
+    uint32_t passed = 0;
+
+    for (unsigned int i = 0; i < bin->count; i++) {
+        const SwTriangle *tri = &r->tris[bin->tris[i]];
+        passed += rasterize_triangle(r, tri, MAX(tx0, tri->min_x),
+                                     MAX(ty0, tri->min_y),
+                                     MIN(tx1, tri->max_x),
+                                     MIN(ty1, tri->max_y));
+    }
+
+    if (passed) {
+        qatomic_add(&r->zpass_pixel_count, passed);
+    }
+}
+
+static void shade_tiles(PGRAPHSwState *r)
+{
+    unsigned int i;
+    while ((i = qatomic_fetch_inc(&r->next_tile)) < r->num_active_tiles) {
+        shade_tile(r, r->active_tiles[i]);
+    }
+}
+
+static void *raster_worker(void *opaque)
+{
+    PGRAPHSwState *r = opaque;
+    unsigned int generation = 0;
+
+    qemu_mutex_lock(&r->pool_lock);
+    while (true) {
+        while (r->pool_generation == generation && !r->pool_shutdown) {
+            qemu_cond_wait(&r->pool_work_cond, &r->pool_lock);
+        }
+        if (r->pool_shutdown) {
+            break;
+        }
+        generation = r->pool_generation;
+        qemu_mutex_unlock(&r->pool_lock);
+
+        shade_tiles(r);
+
+        qemu_mutex_lock(&r->pool_lock);
+        if (--r->pool_busy == 0) {
+            qemu_cond_signal(&r->pool_done_cond);
+        }
+    }
+    qemu_mutex_unlock(&r->pool_lock);
+
+    return NULL;
+}
+
+void pgraph_sw_raster_begin(PGRAPHSwState *r)
+{
+    const SwRasterState *rs = &r->rs;
+
+    r->num_tris = 0;
+    r->bins_x = DIV_ROUND_UP(rs->scissor_max_x + 1, SW_TILE_SIZE);
+    r->bins_y = DIV_ROUND_UP(rs->scissor_max_y + 1, SW_TILE_SIZE);
+
+    unsigned int num_bins = r->bins_x * r->bins_y;
+    if (num_bins > r->num_bins_allocated) {
+        r->bins = g_renew(SwBin, r->bins, num_bins);
+        memset(&r->bins[r->num_bins_allocated], 0,
+               (num_bins - r->num_bins_allocated) * sizeof(SwBin));
+        r->active_tiles = g_renew(uint32_t, r->active_tiles, num_bins);
+        r->num_bins_allocated = num_bins;
+    }
+    for (unsigned int i = 0; i < num_bins; i++) {
+        r->bins[i].count = 0;
+    }
+}
+
+static void bin_triangle(PGRAPHSwState *r, uint32_t index)
+{
+    const SwTriangle *tri = &r->tris[index];
+
+    for (int ty = tri->min_y / SW_TILE_SIZE; ty <= tri->max_y / SW_TILE_SIZE;
+         ty++) {
+        for (int tx = tri->min_x / SW_TILE_SIZE;
+             tx <= tri->max_x / SW_TILE_SIZE; tx++) {
+            SwBin *bin = &r->bins[ty * r->bins_x + tx];
+            if (bin->count == bin->capacity) {
+                bin->capacity = MAX(64, bin->capacity * 2);
+                bin->tris = g_renew(uint32_t, bin->tris, bin->capacity);
+            }
+            bin->tris[bin->count++] = index;
+        }
+    }
+}
+
+static void setup_plane(float plane[3], const float x[3], const float y[3],
+                        const float q[3])
+{
+    double x10 = x[1] - x[0], y10 = y[1] - y[0];
+    double x20 = x[2] - x[0], y20 = y[2] - y[0];
+    double det = x10 * y20 - x20 * y10;
+    double q10 = q[1] - q[0], q20 = q[2] - q[0];
+    double dqdx = (q10 * y20 - q20 * y10) / det;
+    double dqdy = (q20 * x10 - q10 * x20) / det;
+
+    plane[0] = q[0] - dqdx * x[0] - dqdy * y[0];
+    plane[1] = dqdx;
+    plane[2] = dqdy;
+}
+
+void pgraph_sw_raster_add_triangle(PGRAPHSwState *r, const SwVertex *v0,
+                                   const SwVertex *v1, const SwVertex *v2,
+                                   const SwVertex *provoking)
+{
+    const SwRasterState *rs = &r->rs;
+    const SwVertex *v[3] = { v0, v1, v2 };
+    int32_t x[3], y[3];
+
+    for (int i = 0; i < 3; i++) {
+        float inv_w = 1.0f / v[i]->pos[3];
+        x[i] = lrintf(v[i]->pos[0] * inv_w * 16.0f);
+        y[i] = lrintf(v[i]->pos[1] * inv_w * 16.0f);
+    }
+
+    int64_t area = (int64_t)(x[1] - x[0]) * (y[2] - y[0]) -
+                   (int64_t)(x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) {
+        return;
+    }
+
+    /* Surface Y points down, so a positive area is clockwise on screen */
+    bool front = rs->front_ccw ? area < 0 : area > 0;
+    if (rs->cull) {
+        if ((rs->cull_face & NV_PGRAPH_SETUPRASTER_CULLCTRL_FRONT) && front) {
+            return;
+        }
+        if ((rs->cull_face & NV_PGRAPH_SETUPRASTER_CULLCTRL_BACK) && !front) {
+            return;
+        }
+    }
+
+    if (area < 0) {
+        const SwVertex *tv = v[1];
+        v[1] = v[2];
+        v[2] = tv;
+        int32_t t = x[1];
+        x[1] = x[2];
+        x[2] = t;
+        t = y[1];
+        y[1] = y[2];
+        y[2] = t;
+    }
+
+    int min_x = MIN(MIN(x[0], x[1]), x[2]) >> 4;
+    int min_y = MIN(MIN(y[0], y[1]), y[2]) >> 4;
+    int max_x = MAX(MAX(x[0], x[1]), x[2]) >> 4;
+    int max_y = MAX(MAX(y[0], y[1]), y[2]) >> 4;
+    min_x = MAX(min_x, rs->scissor_min_x);
+    min_y = MAX(min_y, rs->scissor_min_y);
+    max_x = MIN(max_x, rs->scissor_max_x);
+    max_y = MIN(max_y, rs->scissor_max_y);
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+
+    if (r->num_tris == r->tris_capacity) {
+        r->tris_capacity = MAX(256, r->tris_capacity * 2);
+        r->tris = g_renew(SwTriangle, r->tris, r->tris_capacity);
+    }
+    SwTriangle *tri = &r->tris[r->num_tris];
+
+    memcpy(tri->x, x, sizeof(x));
+    memcpy(tri->y, y, sizeof(y));
+    tri->min_x = min_x;
+    tri->min_y = min_y;
+    tri->max_x = max_x;
+    tri->max_y = max_y;
+
+    for (int k = 0; k < 3; k++) {
+        int n = (k + 1) % 3;
+        int32_t dx = x[n] - x[k], dy = y[n] - y[k];
+        bool top_left = (dy == 0 && dx > 0) || dy < 0;
+        tri->bias[k] = top_left ? 0 : -1;
+    }
+
+    float fx[3], fy[3], q[SW_INTERP_COUNT][3];
+    for (int i = 0; i < 3; i++) {
+        float inv_w = 1.0f / v[i]->pos[3];
+        fx[i] = x[i] / 16.0f;
+        fy[i] = y[i] / 16.0f;
+        q[SW_INTERP_Z][i] = v[i]->pos[2] * inv_w;
+        q[SW_INTERP_INV_W][i] = inv_w;
+        for (int c = 0; c < 4; c++) {
+            q[SW_INTERP_DIFFUSE + c][i] = v[i]->diffuse[c] * inv_w;
+            q[SW_INTERP_SPECULAR + c][i] = v[i]->specular[c] * inv_w;
+        }
+        for (int t = 0; t < NV2A_MAX_TEXTURES; t++) {
+            for (int c = 0; c < 4; c++) {
+                q[SW_INTERP_TEXCOORD + t * 4 + c][i] =
+                    v[i]->texcoord[t][c] * inv_w;
+            }
+        }
+    }
+    for (int i = 0; i < SW_INTERP_COUNT; i++) {
+        setup_plane(tri->plane[i], fx, fy, q[i]);
+    }
+
+    tri->flat = rs->flat;
+    for (int c = 0; c < 4; c++) {
+        tri->flat_diffuse[c] = clampf(provoking->diffuse[c], 0.0f, 1.0f);
+        tri->flat_specular[c] = clampf(provoking->specular[c], 0.0f, 1.0f);
+    }
+
+    bin_triangle(r, r->num_tris++);
+}
+
+void pgraph_sw_raster_end(PGRAPHSwState *r)
+{
+    if (!r->num_tris) {
+        return;
+    }
+
+    r->num_active_tiles = 0;
+    for (unsigned int i = 0; i < r->bins_x * r->bins_y; i++) {
+        if (r->bins[i].count) {
+            r->active_tiles[r->num_active_tiles++] = i;
+        }
+    }
+    qatomic_set(&r->next_tile, 0);
+
+    bool parallel = r->num_workers && r->num_active_tiles > 1 &&
+                    r->num_tris >= SW_MIN_PARALLEL_TRIANGLES;
+    if (parallel) {
+        qemu_mutex_lock(&r->pool_lock);
+        r->pool_busy = r->num_workers;
+        r->pool_generation++;
+        qemu_cond_broadcast(&r->pool_work_cond);
+        qemu_mutex_unlock(&r->pool_lock);
+    }
+
+    shade_tiles(r);
+
+    if (parallel) {
+        qemu_mutex_lock(&r->pool_lock);
+        while (r->pool_busy) {
+            qemu_cond_wait(&r->pool_done_cond, &r->pool_lock);
+        }
+        qemu_mutex_unlock(&r->pool_lock);
+    }
+
+    r->num_tris = 0;
+}
+
+void pgraph_sw_init_raster(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    qemu_mutex_init(&r->pool_lock);
+    qemu_cond_init(&r->pool_work_cond);
+    qemu_cond_init(&r->pool_done_cond);
+
+    unsigned int num_threads = MIN(g_get_num_processors(), SW_MAX_THREADS);
+    r->num_workers = num_threads > 1 ? num_threads - 1 : 0;
+    for (unsigned int i = 0; i < r->num_workers; i++) {
+        qemu_thread_create(&r->threads[i], "pgraph.sw.raster", raster_worker,
+                           r, QEMU_THREAD_JOINABLE);
+    }
+}
+
+void pgraph_sw_finalize_raster(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    qemu_mutex_lock(&r->pool_lock);
+    r->pool_shutdown = true;
+    qemu_cond_broadcast(&r->pool_work_cond);
+    qemu_mutex_unlock(&r->pool_lock);
+    for (unsigned int i = 0; i < r->num_workers; i++) {
+        qemu_thread_join(&r->threads[i]);
+    }
+
+    qemu_cond_destroy(&r->pool_done_cond);
+    qemu_cond_destroy(&r->pool_work_cond);
+    qemu_mutex_destroy(&r->pool_lock);
+
+    for (unsigned int i = 0; i < r->num_bins_allocated; i++) {
+        g_free(r->bins[i].tris);
+    }
+    g_free(r->bins);
+    g_free(r->active_tiles);
+    g_free(r->tris);
+}
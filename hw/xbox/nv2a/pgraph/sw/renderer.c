@@ -0,0 +1,294 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hw/xbox/nv2a/pgraph/blit.h"
+#include "renderer.h"
+
+static void pgraph_sw_sync(NV2AState *d)
+{
+    pgraph_sw_writeback_surfaces(d);
+    qatomic_set(&d->pgraph.sync_pending, false);
+    qemu_event_set(&d->pgraph.sync_complete);
+}
+
+static void pgraph_sw_flush(NV2AState *d)
+{
+    /* VRAM may have been reloaded, drop the linear copies as GL does */
+    pgraph_sw_invalidate_surfaces(d, false);
+    qatomic_set(&d->pgraph.flush_pending, false);
+    qemu_event_set(&d->pgraph.flush_complete);
+}
+
+static void pgraph_sw_writeback(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    pgraph_sw_writeback_surfaces(d);
+    qatomic_set(&r->writeback_pending, false);
+    qemu_event_set(&r->writeback_complete);
+}
+
+static void pgraph_sw_process_pending(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    if (
+        qatomic_read(&r->writeback_pending) ||
+        qatomic_read(&d->pgraph.sync_pending) ||
+        qatomic_read(&d->pgraph.flush_pending)
+        ) {
+        qemu_mutex_unlock(&d->pfifo.lock);
+        qemu_mutex_lock(&d->pgraph.lock);
+        if (qatomic_read(&r->writeback_pending)) {
+            pgraph_sw_writeback(d);
+        }
+        if (qatomic_read(&d->pgraph.sync_pending)) {
+            pgraph_sw_sync(d);
+        }
+        if (qatomic_read(&d->pgraph.flush_pending)) {
+            pgraph_sw_flush(d);
+        }
+        qemu_mutex_unlock(&d->pgraph.lock);
+        qemu_mutex_lock(&d->pfifo.lock);
+    }
+}
+
+static void pgraph_sw_clear_report_value(NV2AState *d)
+{
+    d->pgraph.sw_renderer_state->zpass_pixel_count = 0;
+}
+
+static void pgraph_sw_draw_begin(NV2AState *d)
+{
+}
+
+static void pgraph_sw_flip_stall(NV2AState *d)
+{
+}
+
+static void pgraph_sw_get_report(NV2AState *d, uint32_t parameter)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    pgraph_write_zpass_pixel_cnt_report(d, parameter, r->zpass_pixel_count);
+}
+
+static void pgraph_sw_image_blit(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+    BetaState *beta = &pg->beta;
+
+    assert(context_surfaces->object_instance == image_blit->context_surfaces);
+
+    unsigned int bytes_per_pixel;
+    switch (context_surfaces->color_format) {
+        case NV062_SET_COLOR_FORMAT_LE_Y8:
+            bytes_per_pixel = 1;
+            break;
+        case NV062_SET_COLOR_FORMAT_LE_R5G6B5:
+            bytes_per_pixel = 2;
+            break;
+        case NV062_SET_COLOR_FORMAT_LE_A8R8G8B8:
+        case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+        case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        case NV062_SET_COLOR_FORMAT_LE_Y32:
+            bytes_per_pixel = 4;
+            break;
+        default:
+            fprintf(stderr, "Unknown blit surface format: 0x%x\n",
+                    context_surfaces->color_format);
+            assert(false);
+            break;
+    }
+
+    ImageBlitOperation operation;
+    switch (image_blit->operation) {
+    case NV09F_SET_OPERATION_SRCCOPY:
+        operation = IMAGE_BLIT_SRCCOPY;
+        break;
+    case NV09F_SET_OPERATION_BLEND_AND:
+        operation = IMAGE_BLIT_BLEND_AND;
+        break;
+    default:
+        fprintf(stderr, "Unknown blit operation: 0x%x\n",
+                image_blit->operation);
+        assert(false && "Unknown blit operation");
+        return;
+    }
+
+    bool needs_alpha_patching;
+    uint8_t alpha_override;
+    switch (context_surfaces->color_format) {
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0xff;
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0;
+        break;
+    default:
+        needs_alpha_patching = false;
+        alpha_override = 0;
+    }
+
+    hwaddr source_dma_len, dest_dma_len;
+
+    uint8_t *source = (uint8_t *)nv_dma_map(
+        d, context_surfaces->dma_image_source, &source_dma_len);
+    assert(context_surfaces->source_offset < source_dma_len);
+    source += context_surfaces->source_offset;
+
+    uint8_t *dest = (uint8_t *)nv_dma_map(d, context_surfaces->dma_image_dest,
+                                          &dest_dma_len);
+    assert(context_surfaces->dest_offset < dest_dma_len);
+    dest += context_surfaces->dest_offset;
+
+    hwaddr source_addr = source - d->vram_ptr;
+    hwaddr dest_addr = dest - d->vram_ptr;
+
+    /* The blit may read from or write to a swizzled surface */
+    pgraph_sw_invalidate_surfaces(d, true);
+
+    nv2a_profile_inc_counter(NV2A_PROF_IMAGE_BLIT_CPU);
+
+    hwaddr source_offset = image_blit->in_y * context_surfaces->source_pitch +
+                           image_blit->in_x * bytes_per_pixel;
+    hwaddr dest_offset = image_blit->out_y * context_surfaces->dest_pitch +
+                         image_blit->out_x * bytes_per_pixel;
+
+    hwaddr source_size =
+        (image_blit->height - 1) * context_surfaces->source_pitch +
+        image_blit->width * bytes_per_pixel;
+    hwaddr dest_size = (image_blit->height - 1) * context_surfaces->dest_pitch +
+                       image_blit->width * bytes_per_pixel;
+
+    /* FIXME: What does hardware do in this case? */
+    assert(source_addr + source_offset + source_size <=
+           memory_region_size(d->vram));
+    assert(dest_addr + dest_offset + dest_size <= memory_region_size(d->vram));
+
+    image_blit_rect(dest + dest_offset, context_surfaces->dest_pitch,
+                    source + source_offset, context_surfaces->source_pitch,
+                    image_blit->width, image_blit->height, bytes_per_pixel,
+                    operation, beta->beta, needs_alpha_patching,
+                    alpha_override);
+
+    dest_addr += dest_offset;
+    memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
+                                   DIRTY_MEMORY_VGA);
+    memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
+                                   DIRTY_MEMORY_NV2A_TEX);
+}
+
+static void pgraph_sw_pre_savevm_trigger(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    qatomic_set(&r->writeback_pending, true);
+    qemu_event_reset(&r->writeback_complete);
+}
+
+static void pgraph_sw_pre_savevm_wait(NV2AState *d)
+{
+    PGRAPHSwState *r = d->pgraph.sw_renderer_state;
+
+    qemu_event_wait(&r->writeback_complete);
+}
+
+static void pgraph_sw_pre_shutdown_trigger(NV2AState *d)
+{
+}
+
+static void pgraph_sw_pre_shutdown_wait(NV2AState *d)
+{
+}
+
+static void pgraph_sw_process_pending_reports(NV2AState *d)
+{
+}
+
+/* Linear surfaces are rendered in place, swizzled ones are written back */
+static void pgraph_sw_surface_update(NV2AState *d, bool upload,
+                                     bool color_write, bool zeta_write)
+{
+    if (!upload) {
+        pgraph_sw_writeback_surfaces(d);
+    }
+}
+
+static unsigned int pgraph_sw_get_surface_scale_factor(NV2AState *d)
+{
+    return 1;
+}
+
+static void pgraph_sw_init(NV2AState *d, Error **errp)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    pg->sw_renderer_state = g_malloc0(sizeof(PGRAPHSwState));
+    pg->surface_scale_factor = 1;
+    qemu_event_init(&pg->sw_renderer_state->writeback_complete, false);
+
+    pgraph_sw_init_raster(d);
+}
+
+static void pgraph_sw_finalize(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    pgraph_sw_finalize_raster(d);
+    pgraph_sw_finalize_draw(d);
+    qemu_event_destroy(&pg->sw_renderer_state->writeback_complete);
+
+    g_free(pg->sw_renderer_state);
+    pg->sw_renderer_state = NULL;
+}
+
+static PGRAPHRenderer pgraph_sw_renderer = {
+    .type = CONFIG_DISPLAY_RENDERER_SOFTWARE,
+    .name = "Software",
+    .ops = {
+        .init = pgraph_sw_init,
+        .finalize = pgraph_sw_finalize,
+        .clear_report_value = pgraph_sw_clear_report_value,
+        .clear_surface = pgraph_sw_clear_surface,
+        .draw_begin = pgraph_sw_draw_begin,
+        .draw_end = pgraph_sw_draw_end,
+        .flip_stall = pgraph_sw_flip_stall,
+        .flush_draw = pgraph_sw_flush_draw,
+        .get_report = pgraph_sw_get_report,
+        .image_blit = pgraph_sw_image_blit,
+        .pre_savevm_trigger = pgraph_sw_pre_savevm_trigger,
+        .pre_savevm_wait = pgraph_sw_pre_savevm_wait,
+        .pre_shutdown_trigger = pgraph_sw_pre_shutdown_trigger,
+        .pre_shutdown_wait = pgraph_sw_pre_shutdown_wait,
+        .process_pending = pgraph_sw_process_pending,
+        .process_pending_reports = pgraph_sw_process_pending_reports,
+        .surface_update = pgraph_sw_surface_update,
+        .get_surface_scale_factor = pgraph_sw_get_surface_scale_factor,
+    }
+};
+
+static void __attribute__((constructor)) register_renderer(void)
+{
+    pgraph_renderer_register(&pgraph_sw_renderer);
+}
@@ -0,0 +1,230 @@
+/*
+ * Geforce NV2A PGRAPH Software Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_SW_RENDERER_H
+#define HW_XBOX_NV2A_PGRAPH_SW_RENDERER_H
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+
+#include "hw/hw.h"
+
+#include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/nv2a_regs.h"
+
+#include "nv2a_vsh_emulator.h"
+
+/*
+ * The software renderer rasterizes linear surfaces directly in VRAM. Swizzled
+ * surfaces are drawn into a linear copy, which is kept across draws and only
+ * swizzled back when VRAM has to be up to date: when the surface changes, is
+ * sampled or blitted, and on syncs and savevm. CPU writes to the surface
+ * discard the copy. Primitives
+ * are set up on the PGRAPH thread, binned into screen tiles and the tiles are
+ * then shaded in parallel. Every pixel belongs to exactly one tile and each
+ * tile processes its primitives in submission order, so the result does not
+ * depend on the number of threads.
+ */
+
+#define SW_TILE_SIZE 32
+#define SW_MAX_THREADS 16
+#define SW_VERTEX_CACHE_SIZE 256
+
+/*
+ * Clip-space vertex, X and Y are in (anti-aliased) surface pixels times W.
+ * Only floats, clipping interpolates it as an array.
+ */
+typedef struct SwVertex {
+    float pos[4];
+    float diffuse[4];
+    float specular[4];
+    float texcoord[NV2A_MAX_TEXTURES][4];
+} SwVertex;
+
+enum SwInterpolant {
+    SW_INTERP_Z,
+    SW_INTERP_INV_W,
+    SW_INTERP_DIFFUSE,
+    SW_INTERP_SPECULAR = SW_INTERP_DIFFUSE + 4,
+    SW_INTERP_TEXCOORD = SW_INTERP_SPECULAR + 4,
+    SW_INTERP_COUNT = SW_INTERP_TEXCOORD + NV2A_MAX_TEXTURES * 4,
+};
+
+/* Texture shader modes (NV_PGRAPH_SHADERPROG) the renderer implements */
+enum SwTextureMode {
+    SW_TEXTURE_MODE_NONE = 0,
+    SW_TEXTURE_MODE_PROJECT2D = 1,
+    SW_TEXTURE_MODE_PASSTHRU = 4,
+};
+
+typedef struct SwTriangle {
+    /* Vertex positions in 28.4 fixed point */
+    int32_t x[3], y[3];
+    /* Top-left fill rule bias of each edge */
+    int32_t bias[3];
+    /* Inclusive pixel bounds, already clipped to the scissor rectangle */
+    int min_x, min_y, max_x, max_y;
+    /* q(px, py) = plane[0] + plane[1] * px + plane[2] * py at pixel centers */
+    float plane[SW_INTERP_COUNT][3];
+    float flat_diffuse[4];
+    float flat_specular[4];
+    bool flat;
+} SwTriangle;
+
+typedef struct SwBin {
+    uint32_t *tris;
+    unsigned int count;
+    unsigned int capacity;
+} SwBin;
+
+typedef struct SwSurface {
+    bool bound;
+    bool swizzle;
+    unsigned int format;
+    unsigned int bytes_per_pixel;
+    unsigned int width, height, pitch;
+    hwaddr vram_addr;
+    size_t size;
+    /* Points into VRAM, or at swizzle_buf for swizzled surfaces */
+    uint8_t *data;
+    uint8_t *swizzle_buf;
+    size_t swizzle_buf_size;
+    /* swizzle_buf holds the surface, and is newer than VRAM if dirty */
+    bool linear_valid;
+    bool linear_dirty;
+} SwSurface;
+
+typedef struct SwTexture {
+    const uint8_t *data;
+    unsigned int color_format;
+    unsigned int bytes_per_pixel;
+    unsigned int width, height, pitch;
+    bool linear;
+    unsigned int addr_u, addr_v;
+    uint32_t swizzle_mask_x, swizzle_mask_y;
+} SwTexture;
+
+/* One general combiner stage, see glsl/psh.c for the reference semantics */
+typedef struct SwCombinerStage {
+    uint32_t rgb_inputs, alpha_inputs;
+    uint32_t rgb_outputs, alpha_outputs;
+    float c0[4], c1[4];
+} SwCombinerStage;
+
+/* Fragment state, captured before the tiles are dispatched */
+typedef struct SwRasterState {
+    int scissor_min_x, scissor_min_y, scissor_max_x, scissor_max_y;
+
+    bool color_write;
+    bool write_r, write_g, write_b, write_a;
+
+    bool depth_test;
+    bool depth_write;
+    unsigned int depth_func;
+    uint32_t zmax;
+    bool z_clamp;
+    float zclip_min, zclip_max;
+
+    bool alpha_test;
+    unsigned int alpha_func;
+    float alpha_ref;
+
+    bool blend;
+    unsigned int blend_sfactor, blend_dfactor, blend_equation;
+    float blend_color[4];
+
+    bool cull;
+    unsigned int cull_face;
+    bool front_ccw;
+    bool flat;
+
+    /* Mode of each texture stage, PROJECT2D stages without a valid texture
+     * sample white */
+    unsigned int tex_mode[NV2A_MAX_TEXTURES];
+    bool tex_valid[NV2A_MAX_TEXTURES];
+    SwTexture tex[NV2A_MAX_TEXTURES];
+
+    unsigned int num_stages;
+    bool mux_msb;
+    SwCombinerStage stages[8];
+    bool final_enabled;
+    uint32_t final_inputs_0, final_inputs_1;
+    float final_c0[4], final_c1[4];
+    float fog[4];
+} SwRasterState;
+
+typedef struct PGRAPHSwState {
+    SwSurface color, zeta;
+    SwRasterState rs;
+
+    /* Binned primitives of the current flush */
+    SwTriangle *tris;
+    unsigned int num_tris, tris_capacity;
+    SwBin *bins;
+    unsigned int bins_x, bins_y, num_bins_allocated;
+    uint32_t *active_tiles;
+    unsigned int num_active_tiles;
+    unsigned int next_tile;
+
+    /* Tile shading pool, the PGRAPH thread always takes part too */
+    QemuThread threads[SW_MAX_THREADS];
+    unsigned int num_workers;
+    QemuMutex pool_lock;
+    QemuCond pool_work_cond;
+    QemuCond pool_done_cond;
+    unsigned int pool_generation;
+    unsigned int pool_busy;
+    bool pool_shutdown;
+
+    uint32_t zpass_pixel_count;
+
+    /* Set by pre_savevm_trigger, swizzled surfaces are written back */
+    bool writeback_pending;
+    QemuEvent writeback_complete;
+
+    /* Vertex processing, for programs that vsh-cpu.c cannot translate */
+    Nv2aVshProgram program;
+    bool program_valid;
+    uint64_t program_hash;
+    uint32_t vertex_cache_tag[SW_VERTEX_CACHE_SIZE];
+    SwVertex vertex_cache[SW_VERTEX_CACHE_SIZE];
+    SwVertex *vertices;
+    unsigned int vertices_capacity;
+} PGRAPHSwState;
+
+/* draw.c */
+void pgraph_sw_clear_surface(NV2AState *d, uint32_t parameter);
+void pgraph_sw_draw_end(NV2AState *d);
+void pgraph_sw_flush_draw(NV2AState *d);
+void pgraph_sw_finalize_draw(NV2AState *d);
+void pgraph_sw_writeback_surfaces(NV2AState *d);
+void pgraph_sw_invalidate_surfaces(NV2AState *d, bool writeback);
+
+/* raster.c */
+void pgraph_sw_init_raster(NV2AState *d);
+void pgraph_sw_finalize_raster(NV2AState *d);
+void pgraph_sw_raster_begin(PGRAPHSwState *r);
+void pgraph_sw_raster_add_triangle(PGRAPHSwState *r, const SwVertex *v0,
+                                   const SwVertex *v1, const SwVertex *v2,
+                                   const SwVertex *provoking);
+void pgraph_sw_raster_end(PGRAPHSwState *r);
+void pgraph_sw_pack_color(unsigned int format, uint8_t *p, const float rgba[4],
+                          bool r, bool g, bool b, bool a);
+
+#endif
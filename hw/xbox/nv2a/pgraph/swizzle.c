@@ -27,6 +27,15 @@
 
 #include "swizzle.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#define SWIZZLE_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SWIZZLE_HAVE_NEON 1
+#endif
+
 /*
  * Helpers for converting to and from swizzled (Z-ordered) texture formats.
  * Swizzled textures store pixels in a more cache-friendly layout for rendering
@@ -69,15 +78,18 @@ static void generate_swizzle_masks(unsigned int width,
     *mask_z = z;
 }
 
-static inline void swizzle_box_internal(
-    const uint8_t *src_buf,
-    unsigned int width,
-    unsigned int height,
-    unsigned int depth,
-    uint8_t *dst_buf,
-    unsigned int row_pitch,
-    unsigned int slice_pitch,
-    unsigned int bytes_per_pixel)
+#define SWIZZLE_BOX_PARAMS                                                \
+    const uint8_t *src_buf, unsigned int width, unsigned int height,      \
+        unsigned int depth, uint8_t *dst_buf, unsigned int row_pitch,     \
+        unsigned int slice_pitch
+#define SWIZZLE_BOX_ARGS \
+    src_buf, width, height, depth, dst_buf, row_pitch, slice_pitch
+
+typedef void (*SwizzleBoxFunc)(SWIZZLE_BOX_PARAMS,
+                               unsigned int bytes_per_pixel);
+
+static inline __attribute__((always_inline)) void swizzle_box_generic_internal(
+    SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel)
 {
     uint32_t mask_x, mask_y, mask_z;
     generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
@@ -87,12 +99,12 @@ static inline void swizzle_box_internal(
      * https://fgiesen.wordpress.com/2011/01/17/texture-tiling-and-swizzling/
      */
 
-    int x, y, z;
-    int off_z = 0;
+    unsigned int x, y, z;
+    uint32_t off_z = 0;
     for (z = 0; z < depth; z++) {
-        int off_y = 0;
+        uint32_t off_y = 0;
         for (y = 0; y < height; y++) {
-            int off_x = 0;
+            uint32_t off_x = 0;
             const uint8_t *src_tmp = src_buf + y * row_pitch;
             uint8_t *dst_tmp = dst_buf + (off_y + off_z) * bytes_per_pixel;
             for (x = 0; x < width; x++) {
@@ -115,25 +127,19 @@ static inline void swizzle_box_internal(
     }
 }
 
-static inline void unswizzle_box_internal(
-    const uint8_t *src_buf,
-    unsigned int width,
-    unsigned int height,
-    unsigned int depth,
-    uint8_t *dst_buf,
-    unsigned int row_pitch,
-    unsigned int slice_pitch,
-    unsigned int bytes_per_pixel)
+static inline __attribute__((always_inline)) void
+unswizzle_box_generic_internal(SWIZZLE_BOX_PARAMS,
+                               unsigned int bytes_per_pixel)
 {
     uint32_t mask_x, mask_y, mask_z;
     generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
 
-    int x, y, z;
-    int off_z = 0;
+    unsigned int x, y, z;
+    uint32_t off_z = 0;
     for (z = 0; z < depth; z++) {
-        int off_y = 0;
+        uint32_t off_y = 0;
         for (y = 0; y < height; y++) {
-            int off_x = 0;
+            uint32_t off_x = 0;
             const uint8_t *src_tmp = src_buf + (off_y + off_z) * bytes_per_pixel;
             uint8_t *dst_tmp = dst_buf + y * row_pitch;
             for (x = 0; x < width; x++) {
@@ -150,35 +156,461 @@ static inline void unswizzle_box_internal(
     }
 }
 
-/* Multiversioned to optimize for common bytes_per_pixel */         \
-#define C(m, bpp)                                                   \
-    m##_internal(src_buf, width, height, depth, dst_buf, row_pitch, \
-                 slice_pitch, bpp)
-#define MULTIVERSION(m)                                                     \
-    void m(const uint8_t *src_buf, unsigned int width, unsigned int height, \
-           unsigned int depth, uint8_t *dst_buf, unsigned int row_pitch,    \
-           unsigned int slice_pitch, unsigned int bytes_per_pixel)          \
+/* Multiversioned to optimize for common bytes_per_pixel */
+#define C(m, bpp) m##_internal(SWIZZLE_BOX_ARGS, bpp)
+#define MULTIVERSION(m, attr)                                        \
+    static void attr m(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel) \
+    {                                                                \
+        switch (bytes_per_pixel) {                                   \
+        case 1:                                                      \
+            C(m, 1);                                                 \
+            break;                                                   \
+        case 2:                                                      \
+            C(m, 2);                                                 \
+            break;                                                   \
+        case 3:                                                      \
+            C(m, 3);                                                 \
+            break;                                                   \
+        case 4:                                                      \
+            C(m, 4);                                                 \
+            break;                                                   \
+        default:                                                     \
+            C(m, bytes_per_pixel);                                   \
+        }                                                            \
+    }
+
+MULTIVERSION(swizzle_box_generic, )
+MULTIVERSION(unswizzle_box_generic, )
+
+/*
+ * Tiled kernels.
+ *
+ * When a 2D texture is at least 4x4 texels, the low four bits of the
+ * swizzled offset are always x0 y0 x1 y1, so the texture is made of
+ * contiguous 16 texel tiles, each in Z order:
+ *
+ *    0  1  4  5
+ *    2  3  6  7
+ *    8  9 12 13
+ *   10 11 14 15
+ *
+ * Tile kernels move one such tile between the swizzled buffer and four
+ * linear rows at once. Tiles themselves are walked with the usual mask
+ * ripple, using masks with the in-tile bits removed.
+ */
+
+static inline bool can_tile_4x4(unsigned int width, unsigned int height,
+                                unsigned int depth,
+                                unsigned int bytes_per_pixel)
+{
+    return depth == 1 && width >= 4 && height >= 4 &&
+           (bytes_per_pixel == 1 || bytes_per_pixel == 2 ||
+            bytes_per_pixel == 4);
+}
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Defines a kernel calling tile(swizzled, linear, row_pitch, bpp) for every
+ * tile of a tileable texture, and fallback otherwise.
+ */
+#define DEF_TILED_KERNEL(name, attr, tile, swizzling, fallback)              \
+    static inline __attribute__((always_inline)) attr void name##_internal( \
+        SWIZZLE_BOX_PARAMS, unsigned int bpp)                               \
     {                                                                       \
+        uint32_t mask_x, mask_y, mask_z;                                    \
+        generate_swizzle_masks(width, height, 1, &mask_x, &mask_y, &mask_z); \
+        uint32_t tile_mask_x = mask_x & ~0x5u;                              \
+        uint32_t tile_mask_y = mask_y & ~0xau;                              \
+        uint32_t off_y = 0;                                                 \
+        assert(depth == 1); /* See can_tile_4x4 */                          \
+        (void)slice_pitch;                                                  \
+        for (unsigned int y = 0; y < height; y += 4) {                      \
+            uint32_t off_x = 0;                                             \
+            for (unsigned int x = 0; x < width; x += 4) {                   \
+                size_t lin = y * row_pitch + x * bpp;                       \
+                size_t swz = (off_x + off_y) * bpp;                         \
+                if (swizzling) {                                            \
+                    tile(dst_buf + swz, (uint8_t *)src_buf + lin, row_pitch, \
+                         bpp);                                              \
+                } else {                                                    \
+                    tile((uint8_t *)src_buf + swz, dst_buf + lin, row_pitch, \
+                         bpp);                                              \
+                }                                                           \
+                off_x = (off_x - tile_mask_x) & tile_mask_x;                \
+            }                                                               \
+            off_y = (off_y - tile_mask_y) & tile_mask_y;                    \
+        }                                                                   \
+    }                                                                       \
+    static void attr name(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel) \
+    {                                                                       \
+        if (!can_tile_4x4(width, height, depth, bytes_per_pixel)) {         \
+            fallback(SWIZZLE_BOX_ARGS, bytes_per_pixel);                    \
+            return;                                                         \
+        }                                                                   \
         switch (bytes_per_pixel) {                                          \
         case 1:                                                             \
-            C(m, 1);                                                        \
+            C(name, 1);                                                     \
             break;                                                          \
         case 2:                                                             \
-            C(m, 2);                                                        \
-            break;                                                          \
-        case 3:                                                             \
-            C(m, 3);                                                        \
+            C(name, 2);                                                     \
             break;                                                          \
         case 4:                                                             \
-            C(m, 4);                                                        \
+            C(name, 4);                                                     \
             break;                                                          \
-        default:                                                            \
-            C(m, bytes_per_pixel);                                          \
         }                                                                   \
     }
 
-MULTIVERSION(swizzle_box)
-MULTIVERSION(unswizzle_box)
+#ifdef SWIZZLE_HAVE_X86
+
+/*
+ * BMI2 kernels compute every texel offset independently with PDEP rather
+ * than rippling from the previous texel, which removes the loop carried
+ * dependency and lets the copies be unrolled. Used for shapes the tiled
+ * kernels can't handle (3D textures, 24bpp, tiny levels).
+ */
+static inline __attribute__((always_inline, target("bmi2"))) void
+swizzle_box_bmi2_internal(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
+
+    for (unsigned int z = 0; z < depth; z++) {
+        uint32_t off_z = _pdep_u32(z, mask_z);
+        for (unsigned int y = 0; y < height; y++) {
+            const uint8_t *src_tmp = src_buf + y * row_pitch;
+            uint8_t *dst_tmp =
+                dst_buf + (_pdep_u32(y, mask_y) | off_z) * bytes_per_pixel;
+            for (unsigned int x = 0; x < width; x++) {
+                memcpy(dst_tmp + _pdep_u32(x, mask_x) * bytes_per_pixel,
+                       src_tmp + x * bytes_per_pixel, bytes_per_pixel);
+            }
+        }
+        src_buf += slice_pitch;
+    }
+}
+
+static inline __attribute__((always_inline, target("bmi2"))) void
+unswizzle_box_bmi2_internal(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    generate_swizzle_masks(width, height, depth, &mask_x, &mask_y, &mask_z);
+
+    for (unsigned int z = 0; z < depth; z++) {
+        uint32_t off_z = _pdep_u32(z, mask_z);
+        for (unsigned int y = 0; y < height; y++) {
+            const uint8_t *src_tmp =
+                src_buf + (_pdep_u32(y, mask_y) | off_z) * bytes_per_pixel;
+            uint8_t *dst_tmp = dst_buf + y * row_pitch;
+            for (unsigned int x = 0; x < width; x++) {
+                memcpy(dst_tmp + x * bytes_per_pixel,
+                       src_tmp + _pdep_u32(x, mask_x) * bytes_per_pixel,
+                       bytes_per_pixel);
+            }
+        }
+        dst_buf += slice_pitch;
+    }
+}
+
+MULTIVERSION(swizzle_box_bmi2, __attribute__((target("bmi2"))))
+MULTIVERSION(unswizzle_box_bmi2, __attribute__((target("bmi2"))))
+
+static inline __attribute__((always_inline, target("sse2"))) void
+swizzle_tile_sse2(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                  unsigned int bpp)
+{
+    __m128i v, r0, r1, r2, r3;
+
+    switch (bpp) {
+    case 1:
+        /* Rows are 16-bit pairs {0,2}, {1,3}, {4,6}, {5,7} of the tile */
+        v = _mm_setr_epi32(load32(lin), load32(lin + pitch),
+                           load32(lin + 2 * pitch), load32(lin + 3 * pitch));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)swz, v);
+        break;
+    case 2:
+        for (int i = 0; i < 2; i++) {
+            v = _mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i *)(lin + 2 * i * pitch)),
+                _mm_loadl_epi64((const __m128i *)(lin + (2 * i + 1) * pitch)));
+            v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(swz + 16 * i), v);
+        }
+        break;
+    case 4:
+        r0 = _mm_loadu_si128((const __m128i *)lin);
+        r1 = _mm_loadu_si128((const __m128i *)(lin + pitch));
+        r2 = _mm_loadu_si128((const __m128i *)(lin + 2 * pitch));
+        r3 = _mm_loadu_si128((const __m128i *)(lin + 3 * pitch));
+        _mm_storeu_si128((__m128i *)swz, _mm_unpacklo_epi64(r0, r1));
+        _mm_storeu_si128((__m128i *)(swz + 16), _mm_unpackhi_epi64(r0, r1));
+        _mm_storeu_si128((__m128i *)(swz + 32), _mm_unpacklo_epi64(r2, r3));
+        _mm_storeu_si128((__m128i *)(swz + 48), _mm_unpackhi_epi64(r2, r3));
+        break;
+    }
+}
+
+static inline __attribute__((always_inline, target("sse2"))) void
+unswizzle_tile_sse2(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                    unsigned int bpp)
+{
+    __m128i v, q0, q1, q2, q3;
+
+    switch (bpp) {
+    case 1:
+        v = _mm_loadu_si128((const __m128i *)swz);
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        store32(lin, _mm_cvtsi128_si32(v));
+        store32(lin + pitch, _mm_cvtsi128_si32(_mm_srli_si128(v, 4)));
+        store32(lin + 2 * pitch, _mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+        store32(lin + 3 * pitch, _mm_cvtsi128_si32(_mm_srli_si128(v, 12)));
+        break;
+    case 2:
+        for (int i = 0; i < 2; i++) {
+            v = _mm_loadu_si128((const __m128i *)(swz + 16 * i));
+            v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storel_epi64((__m128i *)(lin + 2 * i * pitch), v);
+            _mm_storel_epi64((__m128i *)(lin + (2 * i + 1) * pitch),
+                             _mm_srli_si128(v, 8));
+        }
+        break;
+    case 4:
+        q0 = _mm_loadu_si128((const __m128i *)swz);
+        q1 = _mm_loadu_si128((const __m128i *)(swz + 16));
+        q2 = _mm_loadu_si128((const __m128i *)(swz + 32));
+        q3 = _mm_loadu_si128((const __m128i *)(swz + 48));
+        _mm_storeu_si128((__m128i *)lin, _mm_unpacklo_epi64(q0, q1));
+        _mm_storeu_si128((__m128i *)(lin + pitch), _mm_unpackhi_epi64(q0, q1));
+        _mm_storeu_si128((__m128i *)(lin + 2 * pitch),
+                         _mm_unpacklo_epi64(q2, q3));
+        _mm_storeu_si128((__m128i *)(lin + 3 * pitch),
+                         _mm_unpackhi_epi64(q2, q3));
+        break;
+    }
+}
+
+DEF_TILED_KERNEL(swizzle_box_sse2, __attribute__((target("sse2"))),
+                 swizzle_tile_sse2, true, swizzle_box_generic)
+DEF_TILED_KERNEL(unswizzle_box_sse2, __attribute__((target("sse2"))),
+                 unswizzle_tile_sse2, false, unswizzle_box_generic)
+
+/* 32bpp tiles are handled as two 256-bit halves, other formats as SSE2 */
+static inline __attribute__((always_inline, target("avx2"))) void
+swizzle_tile_avx2(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                  unsigned int bpp)
+{
+    if (bpp != 4) {
+        swizzle_tile_sse2(swz, lin, pitch, bpp);
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *)(lin + 2 * i * pitch))),
+            _mm_loadu_si128((const __m128i *)(lin + (2 * i + 1) * pitch)), 1);
+        v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(swz + 32 * i), v);
+    }
+}
+
+static inline __attribute__((always_inline, target("avx2"))) void
+unswizzle_tile_avx2(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                    unsigned int bpp)
+{
+    if (bpp != 4) {
+        unswizzle_tile_sse2(swz, lin, pitch, bpp);
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(swz + 32 * i));
+        v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)(lin + 2 * i * pitch),
+                         _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(lin + (2 * i + 1) * pitch),
+                         _mm256_extracti128_si256(v, 1));
+    }
+}
+
+DEF_TILED_KERNEL(swizzle_box_avx2, __attribute__((target("avx2,bmi2"))),
+                 swizzle_tile_avx2, true, swizzle_box_bmi2)
+DEF_TILED_KERNEL(unswizzle_box_avx2, __attribute__((target("avx2,bmi2"))),
+                 unswizzle_tile_avx2, false, unswizzle_box_bmi2)
+
+#endif /* SWIZZLE_HAVE_X86 */
+
+#ifdef SWIZZLE_HAVE_NEON
+
+static inline __attribute__((always_inline)) void
+swizzle_tile_neon(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                  unsigned int bpp)
+{
+    switch (bpp) {
+    case 1: {
+        /* Rows are 16-bit pairs {0,2}, {1,3}, {4,6}, {5,7} of the tile */
+        uint16x4_t even = vreinterpret_u16_u32(vset_lane_u32(
+            load32(lin + 2 * pitch), vdup_n_u32(load32(lin)), 1));
+        uint16x4_t odd = vreinterpret_u16_u32(vset_lane_u32(
+            load32(lin + 3 * pitch), vdup_n_u32(load32(lin + pitch)), 1));
+        uint16x8_t v = vcombine_u16(vzip1_u16(even, odd), vzip2_u16(even, odd));
+        vst1q_u8(swz, vreinterpretq_u8_u16(v));
+        break;
+    }
+    case 2:
+        for (int i = 0; i < 2; i++) {
+            uint32x2_t r0 =
+                vreinterpret_u32_u8(vld1_u8(lin + 2 * i * pitch));
+            uint32x2_t r1 =
+                vreinterpret_u32_u8(vld1_u8(lin + (2 * i + 1) * pitch));
+            uint32x4_t v = vcombine_u32(vzip1_u32(r0, r1), vzip2_u32(r0, r1));
+            vst1q_u8(swz + 16 * i, vreinterpretq_u8_u32(v));
+        }
+        break;
+    case 4:
+        for (int i = 0; i < 2; i++) {
+            uint64x2_t r0 =
+                vreinterpretq_u64_u8(vld1q_u8(lin + 2 * i * pitch));
+            uint64x2_t r1 =
+                vreinterpretq_u64_u8(vld1q_u8(lin + (2 * i + 1) * pitch));
+            vst1q_u8(swz + 32 * i,
+                     vreinterpretq_u8_u64(vcombine_u64(vget_low_u64(r0),
+                                                       vget_low_u64(r1))));
+            vst1q_u8(swz + 32 * i + 16,
+                     vreinterpretq_u8_u64(vcombine_u64(vget_high_u64(r0),
+                                                       vget_high_u64(r1))));
+        }
+        break;
+    }
+}
+
+static inline __attribute__((always_inline)) void
+unswizzle_tile_neon(uint8_t *swz, uint8_t *lin, unsigned int pitch,
+                    unsigned int bpp)
+{
+    switch (bpp) {
+    case 1: {
+        uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(swz));
+        uint32x4_t even = vreinterpretq_u32_u16(vuzp1q_u16(v, v));
+        uint32x4_t odd = vreinterpretq_u32_u16(vuzp2q_u16(v, v));
+        store32(lin, vgetq_lane_u32(even, 0));
+        store32(lin + pitch, vgetq_lane_u32(odd, 0));
+        store32(lin + 2 * pitch, vgetq_lane_u32(even, 1));
+        store32(lin + 3 * pitch, vgetq_lane_u32(odd, 1));
+        break;
+    }
+    case 2:
+        for (int i = 0; i < 2; i++) {
+            uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(swz + 16 * i));
+            vst1_u8(lin + 2 * i * pitch,
+                    vreinterpret_u8_u32(vget_low_u32(vuzp1q_u32(v, v))));
+            vst1_u8(lin + (2 * i + 1) * pitch,
+                    vreinterpret_u8_u32(vget_low_u32(vuzp2q_u32(v, v))));
+        }
+        break;
+    case 4:
+        for (int i = 0; i < 2; i++) {
+            uint64x2_t q0 = vreinterpretq_u64_u8(vld1q_u8(swz + 32 * i));
+            uint64x2_t q1 = vreinterpretq_u64_u8(vld1q_u8(swz + 32 * i + 16));
+            vst1q_u8(lin + 2 * i * pitch,
+                     vreinterpretq_u8_u64(vcombine_u64(vget_low_u64(q0),
+                                                       vget_low_u64(q1))));
+            vst1q_u8(lin + (2 * i + 1) * pitch,
+                     vreinterpretq_u8_u64(vcombine_u64(vget_high_u64(q0),
+                                                       vget_high_u64(q1))));
+        }
+        break;
+    }
+}
+
+DEF_TILED_KERNEL(swizzle_box_neon, , swizzle_tile_neon, true,
+                 swizzle_box_generic)
+DEF_TILED_KERNEL(unswizzle_box_neon, , unswizzle_tile_neon, false,
+                 unswizzle_box_generic)
+
+#endif /* SWIZZLE_HAVE_NEON */
 
 #undef C
 #undef MULTIVERSION
+#undef DEF_TILED_KERNEL
+
+typedef struct SwizzleAccel {
+    const char *name;
+    unsigned required_cpuinfo; /* CPUINFO_* bits the kernel needs */
+    SwizzleBoxFunc swizzle_box;
+    SwizzleBoxFunc unswizzle_box;
+} SwizzleAccel;
+
+/* Ordered from slowest to fastest */
+static const SwizzleAccel accel_table[] = {
+    { "generic", 0, swizzle_box_generic, unswizzle_box_generic },
+#ifdef SWIZZLE_HAVE_X86
+    { "bmi2", CPUINFO_BMI2, swizzle_box_bmi2, unswizzle_box_bmi2 },
+    { "sse2", CPUINFO_SSE2, swizzle_box_sse2, unswizzle_box_sse2 },
+    /* The AVX2 kernel falls back to BMI2 for untileable shapes */
+    { "avx2", CPUINFO_AVX2 | CPUINFO_BMI2, swizzle_box_avx2,
+      unswizzle_box_avx2 },
+#endif
+#ifdef SWIZZLE_HAVE_NEON
+    /* NEON is baseline on aarch64 */
+    { "neon", 0, swizzle_box_neon, unswizzle_box_neon },
+#endif
+};
+
+static const SwizzleAccel *swizzle_accel = &accel_table[0];
+
+static unsigned get_host_cpuinfo(void)
+{
+#ifdef SWIZZLE_HAVE_X86
+    return cpuinfo_init();
+#else
+    return 0;
+#endif
+}
+
+static bool accel_supported(const SwizzleAccel *accel, unsigned info)
+{
+    return (accel->required_cpuinfo & info) == accel->required_cpuinfo;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    unsigned info = get_host_cpuinfo();
+
+    for (int i = sizeof(accel_table) / sizeof(accel_table[0]) - 1; i > 0;
+         i--) {
+        if (accel_supported(&accel_table[i], info)) {
+            swizzle_accel = &accel_table[i];
+            return;
+        }
+    }
+    swizzle_accel = &accel_table[0];
+}
+
+const char *swizzle_accel_name(void)
+{
+    return swizzle_accel->name;
+}
+
+void swizzle_box(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel)
+{
+    swizzle_accel->swizzle_box(SWIZZLE_BOX_ARGS, bytes_per_pixel);
+}
+
+void unswizzle_box(SWIZZLE_BOX_PARAMS, unsigned int bytes_per_pixel)
+{
+    swizzle_accel->unswizzle_box(SWIZZLE_BOX_ARGS, bytes_per_pixel);
+}
@@ -21,6 +21,7 @@
 #ifndef HW_XBOX_NV2A_PGRAPH_SWIZZLE_H
 #define HW_XBOX_NV2A_PGRAPH_SWIZZLE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void swizzle_box(
@@ -43,6 +44,9 @@ void unswizzle_box(
     unsigned int slice_pitch,
     unsigned int bytes_per_pixel);
 
+/* The fastest kernel supported by the host is selected at startup */
+const char *swizzle_accel_name(void);
+
 static inline void unswizzle_rect(
     const uint8_t *src_buf,
     unsigned int width,
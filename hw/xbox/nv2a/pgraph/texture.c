@@ -20,9 +20,17 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "s3tc.h"
+#include "swizzle.h"
 #include "texture.h"
 #include "util.h"
 
+/* Levels smaller than this many texels are cheaper to decode in place */
+#define TEXTURE_DECODE_ASYNC_MIN_TEXELS (64 * 64)
+#define TEXTURE_DECODE_MAX_THREADS 4
+
+static GThreadPool *texture_decode_pool;
+
 const BasicColorFormatInfo kelvin_color_format_info_map[66] = {
     [NV097_SET_TEXTURE_FORMAT_COLOR_SZ_Y8] = { 1, false },
     [NV097_SET_TEXTURE_FORMAT_COLOR_SZ_AY8] = { 1, false },
@@ -403,3 +411,104 @@ uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
     }
     return converted_data;
 }
+
+static void texture_decode(TextureDecodeJob *job)
+{
+    if (job->compressed) {
+        if (job->shape.dimensionality == 3) {
+            job->decoded_data =
+                s3tc_decompress_3d(job->s3tc_format, job->data, job->width,
+                                   job->height, job->depth);
+        } else {
+            job->decoded_data = s3tc_decompress_2d(job->s3tc_format, job->data,
+                                                   job->width, job->height);
+        }
+        assert(job->decoded_data);
+        job->decoded_size = job->width * job->height * job->depth * 4;
+        return;
+    }
+
+    unsigned int row_pitch = job->width * job->bytes_per_pixel;
+    unsigned int slice_pitch = row_pitch * job->height;
+    size_t unswizzled_size = slice_pitch * job->depth;
+    uint8_t *unswizzled = g_malloc(unswizzled_size);
+
+    if (job->shape.dimensionality == 3) {
+        unswizzle_box(job->data, job->width, job->height, job->depth,
+                      unswizzled, row_pitch, slice_pitch,
+                      job->bytes_per_pixel);
+    } else {
+        unswizzle_rect(job->data, job->width, job->height, unswizzled,
+                       row_pitch, job->bytes_per_pixel);
+    }
+
+    size_t converted_size;
+    uint8_t *converted = pgraph_convert_texture_data(
+        job->shape, unswizzled, job->palette_data, job->width, job->height,
+        job->depth, row_pitch, slice_pitch, &converted_size);
+
+    if (converted) {
+        g_free(unswizzled);
+        job->decoded_data = converted;
+        job->decoded_size = converted_size;
+    } else {
+        job->decoded_data = unswizzled;
+        job->decoded_size = unswizzled_size;
+    }
+}
+
+static void texture_decode_worker(gpointer data, gpointer user_data)
+{
+    TextureDecodeJob *job = data;
+    texture_decode(job);
+    qemu_event_set(&job->complete);
+}
+
+void pgraph_texture_decode_init(void)
+{
+    int num_threads =
+        MIN(MAX((int)g_get_num_processors() - 2, 1), TEXTURE_DECODE_MAX_THREADS);
+
+    texture_decode_pool = g_thread_pool_new(texture_decode_worker, NULL,
+                                            num_threads, TRUE, NULL);
+    if (!texture_decode_pool) {
+        warn_report("nv2a: Failed to create texture decode pool, textures "
+                    "will be decoded serially");
+    }
+}
+
+void pgraph_texture_decode_finalize(void)
+{
+    if (texture_decode_pool) {
+        g_thread_pool_free(texture_decode_pool, FALSE, TRUE);
+        texture_decode_pool = NULL;
+    }
+}
+
+void pgraph_texture_decode_submit(TextureDecodeJob *job)
+{
+    size_t texels = (size_t)job->width * job->height * job->depth;
+
+    job->decoded_data = NULL;
+    job->decoded_size = 0;
+    job->async = texture_decode_pool != NULL &&
+                 texels >= TEXTURE_DECODE_ASYNC_MIN_TEXELS;
+
+    if (!job->async) {
+        texture_decode(job);
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_DECODE_ASYNC);
+    qemu_event_init(&job->complete, false);
+    g_thread_pool_push(texture_decode_pool, job, NULL);
+}
+
+void pgraph_texture_decode_wait(TextureDecodeJob *job)
+{
+    if (job->async) {
+        qemu_event_wait(&job->complete);
+        qemu_event_destroy(&job->complete);
+        job->async = false;
+    }
+}
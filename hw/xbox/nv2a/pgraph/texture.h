@@ -28,7 +28,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "qemu/thread.h"
 #include "hw/xbox/nv2a/nv2a_regs.h"
+#include "s3tc.h"
 
 typedef struct PGRAPHState PGRAPHState;
 
@@ -59,6 +61,33 @@ uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
                                      unsigned int slice_pitch,
                                      size_t *converted_size);
 
+/*
+ * Decode of a single swizzled or compressed texture level (or cubemap face
+ * level) into a tightly packed buffer. Large levels are decoded on a worker
+ * thread; the result must not be accessed before pgraph_texture_decode_wait()
+ * returns, after which the caller owns decoded_data.
+ */
+typedef struct TextureDecodeJob {
+    TextureShape shape;
+    const uint8_t *data;
+    const uint8_t *palette_data;
+    unsigned int width, height, depth;
+    unsigned int bytes_per_pixel;
+    bool compressed;
+    enum S3TC_DECOMPRESS_FORMAT s3tc_format;
+
+    uint8_t *decoded_data;
+    size_t decoded_size;
+
+    bool async;
+    QemuEvent complete;
+} TextureDecodeJob;
+
+void pgraph_texture_decode_init(void);
+void pgraph_texture_decode_finalize(void);
+void pgraph_texture_decode_submit(TextureDecodeJob *job);
+void pgraph_texture_decode_wait(TextureDecodeJob *job);
+
 hwaddr pgraph_get_texture_phys_addr(PGRAPHState *pg, int texture_idx);
 hwaddr pgraph_get_texture_palette_phys_addr_length(PGRAPHState *pg, int texture_idx, size_t *length);
 TextureShape pgraph_get_texture_shape(PGRAPHState *pg, int texture_idx);
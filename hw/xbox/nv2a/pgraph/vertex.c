@@ -134,11 +134,27 @@ void pgraph_finish_inline_buffer_vertex(PGRAPHState *pg)
     pg->inline_buffer_length++;
 }
 
+unsigned int pgraph_get_inline_array_vertex_size(PGRAPHState *pg)
+{
+    unsigned int offset = 0;
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        if (attr->count == 0) {
+            continue;
+        }
+        offset = ROUND_UP(offset, attr->size);
+        offset += attr->size * attr->count;
+        offset = ROUND_UP(offset, attr->size);
+    }
+    return offset;
+}
+
 void pgraph_reset_inline_buffers(PGRAPHState *pg)
 {
     pg->inline_elements_length = 0;
     pg->inline_array_length = 0;
     pg->inline_buffer_length = 0;
+    pg->inline_merged_length = 0;
     pgraph_reset_draw_arrays(pg);
 }
 
@@ -149,3 +165,134 @@ void pgraph_reset_draw_arrays(PGRAPHState *pg)
     pg->draw_arrays_max_count = 0;
     pg->draw_arrays_prevent_connect = false;
 }
+
+/* Only reads PGRAPH state, so batches can be inspected before drawing */
+void pgraph_setup_vertex_fetch(NV2AState *d, PGRAPHVertexFetch *f)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    bool inline_array = !pg->draw_arrays_length &&
+                        !pg->inline_elements_length &&
+                        !pg->inline_buffer_length &&
+                        pg->inline_array_length;
+    unsigned int vertex_size = 0;
+    unsigned int inline_array_offset[NV2A_VERTEXSHADER_ATTRIBUTES] = { 0 };
+    if (inline_array) {
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            VertexAttribute *attr = &pg->vertex_attributes[i];
+            if (attr->count == 0) {
+                continue;
+            }
+            vertex_size = ROUND_UP(vertex_size, attr->size);
+            inline_array_offset[i] = vertex_size;
+            vertex_size += attr->size * attr->count;
+            vertex_size = ROUND_UP(vertex_size, attr->size);
+        }
+    }
+    f->inline_array_vertices =
+        vertex_size ? pg->inline_array_length * 4 / vertex_size : 0;
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        PGRAPHVertexSource *src = &f->attrs[i];
+
+        memset(src, 0, sizeof(*src));
+
+        if (pg->inline_buffer_length) {
+            if (attr->inline_buffer_populated) {
+                src->floats = attr->inline_buffer;
+            }
+        } else if (attr->count) {
+            src->bgra = attr->format ==
+                        NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D;
+            if (inline_array) {
+                src->data = (const uint8_t *)pg->inline_array +
+                            inline_array_offset[i];
+                src->stride = vertex_size;
+                src->length = pg->inline_array_length * 4 -
+                              MIN(inline_array_offset[i],
+                                  pg->inline_array_length * 4);
+            } else {
+                hwaddr dma_len;
+                const uint8_t *data = (const uint8_t *)nv_dma_map(
+                    d, attr->dma_select ? pg->dma_vertex_b : pg->dma_vertex_a,
+                    &dma_len);
+                assert(attr->offset < dma_len);
+                src->data = data + attr->offset;
+                src->stride = attr->stride;
+                src->length = dma_len - attr->offset;
+            }
+
+            if (!src->stride) {
+                /* Stride of 0 indicates that only the first element should
+                 * be used. */
+                VertexAttribute first = *attr;
+                pgraph_update_inline_value(&first, src->data);
+                memcpy(f->constants[i], first.inline_value,
+                       sizeof(f->constants[i]));
+                src->data = NULL;
+                continue;
+            }
+        }
+
+        memcpy(f->constants[i], attr->inline_value, sizeof(f->constants[i]));
+    }
+}
+
+void pgraph_fetch_vertex(PGRAPHState *pg, const PGRAPHVertexFetch *f,
+                         unsigned int index,
+                         float in[NV2A_VERTEXSHADER_ATTRIBUTES][4])
+{
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        const PGRAPHVertexSource *src = &f->attrs[i];
+
+        if (src->floats) {
+            memcpy(in[i], src->floats + index * 4, sizeof(in[i]));
+            continue;
+        }
+        if (!src->data) {
+            memcpy(in[i], f->constants[i], sizeof(in[i]));
+            continue;
+        }
+
+        VertexAttribute attr = pg->vertex_attributes[i];
+        size_t offset = (size_t)index * src->stride;
+        if (offset + attr.size * attr.count > src->length) {
+            in[i][0] = in[i][1] = in[i][2] = 0.0f;
+            in[i][3] = 1.0f;
+            continue;
+        }
+        pgraph_update_inline_value(&attr, src->data + offset);
+        memcpy(in[i], attr.inline_value, sizeof(in[i]));
+        if (src->bgra) {
+            float t = in[i][0];
+            in[i][0] = in[i][2];
+            in[i][2] = t;
+        }
+    }
+}
+
+/* Leave the provoking vertex in inline_value, as the GL backend does */
+void pgraph_update_inline_values_from_vertex(PGRAPHState *pg,
+                                             const PGRAPHVertexFetch *f,
+                                             unsigned int provoking_element)
+{
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        const PGRAPHVertexSource *src = &f->attrs[i];
+
+        if (src->floats) {
+            attr->inline_buffer_populated = false;
+            memcpy(attr->inline_value, src->floats + provoking_element * 4,
+                   sizeof(attr->inline_value));
+        } else if (src->data) {
+            size_t offset = (size_t)provoking_element * src->stride;
+            if (offset + attr->size * attr->count <= src->length) {
+                pgraph_update_inline_value(attr, src->data + offset);
+            }
+        } else {
+            memcpy(attr->inline_value, f->constants[i],
+                   sizeof(attr->inline_value));
+        }
+    }
+}
@@ -24,8 +24,337 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/blit.h"
 #include "renderer.h"
 
+void pgraph_vk_init_blit(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    };
+    VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
+                                    &r->blit_alpha_pipeline_layout));
+
+    r->blit_alpha_pipelines =
+        g_array_new(false, false, sizeof(BlitAlphaPipeline));
+}
+
+void pgraph_vk_finalize_blit(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    for (int i = 0; i < r->blit_alpha_pipelines->len; i++) {
+        BlitAlphaPipeline *p =
+            &g_array_index(r->blit_alpha_pipelines, BlitAlphaPipeline, i);
+        vkDestroyPipeline(r->device, p->pipeline, NULL);
+    }
+    g_array_free(r->blit_alpha_pipelines, true);
+    r->blit_alpha_pipelines = NULL;
+
+    vkDestroyPipelineLayout(r->device, r->blit_alpha_pipeline_layout, NULL);
+    r->blit_alpha_pipeline_layout = VK_NULL_HANDLE;
+}
+
+static VkPipeline create_alpha_pipeline(PGRAPHVkState *r,
+                                        VkRenderPass render_pass)
+{
+    VkPipelineShaderStageCreateInfo shader_stages[] = {
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = r->quad_vert_module->module,
+            .pName = "main",
+        },
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = r->solid_frag_module->module,
+            .pName = "main",
+        },
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE,
+    };
+
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .sampleShadingEnable = VK_FALSE,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    // Only alpha is written, taken from the blend constant
+    VkPipelineColorBlendAttachmentState color_blend_attachment = {
+        .colorWriteMask = VK_COLOR_COMPONENT_A_BIT,
+        .blendEnable = VK_TRUE,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_CONSTANT_COLOR,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_CONSTANT_ALPHA,
+    };
+
+    VkPipelineColorBlendStateCreateInfo color_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .logicOp = VK_LOGIC_OP_COPY,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attachment,
+    };
+
+    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT,
+                                        VK_DYNAMIC_STATE_SCISSOR,
+                                        VK_DYNAMIC_STATE_BLEND_CONSTANTS };
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = ARRAY_SIZE(dynamic_states),
+        .pDynamicStates = dynamic_states,
+    };
+
+    VkGraphicsPipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = ARRAY_SIZE(shader_stages),
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pColorBlendState = &color_blending,
+        .pDynamicState = &dynamic_state,
+        .layout = r->blit_alpha_pipeline_layout,
+        .renderPass = render_pass,
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+    };
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
+                                       &pipeline_info, NULL, &pipeline));
+    return pipeline;
+}
+
+static VkPipeline get_alpha_pipeline(PGRAPHVkState *r, VkFormat format,
+                                     VkRenderPass render_pass)
+{
+    for (int i = 0; i < r->blit_alpha_pipelines->len; i++) {
+        BlitAlphaPipeline *p =
+            &g_array_index(r->blit_alpha_pipelines, BlitAlphaPipeline, i);
+        if (p->format == format) {
+            return p->pipeline;
+        }
+    }
+
+    BlitAlphaPipeline new_pipeline = {
+        .format = format,
+        .pipeline = create_alpha_pipeline(r, render_pass),
+    };
+    g_array_append_vals(r->blit_alpha_pipelines, &new_pipeline, 1);
+    return new_pipeline.pipeline;
+}
+
+/*
+ * Overwrite the alpha channel of the blit destination rectangle, leaving color
+ * untouched. Image copies can't mask channels, so this is a masked draw.
+ */
+static void patch_alpha_on_gpu(PGRAPHState *pg, VkCommandBuffer cmd,
+                               SurfaceBinding *surface, VkRect2D rect,
+                               uint8_t alpha)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    RenderPassState state = {
+        .color_format = surface->host_fmt.vk_format,
+        .zeta_format = VK_FORMAT_UNDEFINED,
+    };
+    VkRenderPass render_pass = pgraph_vk_get_render_pass(r, &state);
+    VkPipeline pipeline =
+        get_alpha_pipeline(r, state.color_format, render_pass);
+
+    // Released with the draw framebuffers once the submit completes
+    assert(r->framebuffer_index < ARRAY_SIZE(r->framebuffers));
+    VkFramebuffer framebuffer;
+    VkFramebufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = render_pass,
+        .attachmentCount = 1,
+        .pAttachments = &surface->image_view,
+        .width = surface->width,
+        .height = surface->height,
+        .layers = 1,
+    };
+    pgraph_apply_scaling_factor(pg, &create_info.width, &create_info.height);
+    VK_CHECK(vkCreateFramebuffer(r->device, &create_info, NULL, &framebuffer));
+    r->framebuffers[r->framebuffer_index++] = framebuffer;
+
+    // The last framebuffer is assumed to be the bound surface's
+    r->framebuffer_dirty = true;
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = render_pass,
+        .framebuffer = framebuffer,
+        .renderArea.extent.width = create_info.width,
+        .renderArea.extent.height = create_info.height,
+    };
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    VkViewport viewport = {
+        .width = create_info.width,
+        .height = create_info.height,
+        .minDepth = 0.0,
+        .maxDepth = 1.0,
+    };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &rect);
+
+    float blend_constants[4] = { 0, 0, 0, alpha / 255.0f };
+    vkCmdSetBlendConstants(cmd, blend_constants);
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+
+    vkCmdEndRenderPass(cmd);
+}
+
+static bool blit_surface_contains(SurfaceBinding const *surface,
+                                  unsigned int bytes_per_pixel,
+                                  unsigned int pitch, unsigned int x,
+                                  unsigned int y, unsigned int width,
+                                  unsigned int height)
+{
+    return surface->color && !surface->swizzle &&
+           surface->fmt.bytes_per_pixel == bytes_per_pixel &&
+           surface->pitch == pitch && x + width <= surface->width &&
+           y + height <= surface->height;
+}
+
+/*
+ * Copy between two resident surfaces without touching VRAM. The destination
+ * becomes draw dirty and is written back like any other rendered surface.
+ */
+static bool blit_surfaces_on_gpu(NV2AState *d, SurfaceBinding *surf_src,
+                                 SurfaceBinding *surf_dest,
+                                 unsigned int bytes_per_pixel,
+                                 bool patch_alpha, uint8_t alpha)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+
+    if (image_blit->operation != NV09F_SET_OPERATION_SRCCOPY ||
+        !surf_src || !surf_dest || surf_src == surf_dest ||
+        surf_src->host_fmt.vk_format != surf_dest->host_fmt.vk_format ||
+        !blit_surface_contains(surf_src, bytes_per_pixel,
+                               context_surfaces->source_pitch,
+                               image_blit->in_x, image_blit->in_y,
+                               image_blit->width, image_blit->height) ||
+        !blit_surface_contains(surf_dest, bytes_per_pixel,
+                               context_surfaces->dest_pitch,
+                               image_blit->out_x, image_blit->out_y,
+                               image_blit->width, image_blit->height)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_IMAGE_BLIT_GPU);
+
+    pgraph_vk_rescale_surface(d, surf_src);
+    pgraph_vk_rescale_surface(d, surf_dest);
+    pgraph_vk_upload_surface_data(d, surf_src, false);
+    pgraph_vk_upload_surface_data(d, surf_dest, false);
+    assert(surf_src->initialized && surf_dest->initialized);
+
+    if (patch_alpha &&
+        r->framebuffer_index >= ARRAY_SIZE(r->framebuffers)) {
+        pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
+    }
+
+    VkCommandBuffer cmd = pgraph_vk_begin_nondraw_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_BLUE, __func__);
+
+    pgraph_vk_transition_image_layout(pg, cmd, surf_src->image,
+                                      surf_src->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, surf_dest->image,
+                                      surf_dest->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    unsigned int scale = pg->surface_scale_factor;
+    VkImageCopy copy_region = {
+        .srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .srcSubresource.layerCount = 1,
+        .srcOffset = (VkOffset3D){ image_blit->in_x * scale,
+                                   image_blit->in_y * scale, 0 },
+        .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .dstSubresource.layerCount = 1,
+        .dstOffset = (VkOffset3D){ image_blit->out_x * scale,
+                                   image_blit->out_y * scale, 0 },
+        .extent = (VkExtent3D){ image_blit->width * scale,
+                                image_blit->height * scale, 1 },
+    };
+    vkCmdCopyImage(cmd, surf_src->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   surf_dest->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                   &copy_region);
+
+    pgraph_vk_transition_image_layout(pg, cmd, surf_src->image,
+                                      surf_src->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, surf_dest->image,
+                                      surf_dest->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    if (patch_alpha) {
+        VkRect2D rect = {
+            .offset = { copy_region.dstOffset.x, copy_region.dstOffset.y },
+            .extent = { copy_region.extent.width, copy_region.extent.height },
+        };
+        patch_alpha_on_gpu(pg, cmd, surf_dest, rect, alpha);
+    }
+
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_nondraw_commands(pg, cmd);
+
+    pg->draw_time++;
+    surf_dest->draw_time = pg->draw_time;
+    surf_dest->frame_time = pg->frame_time;
+    surf_dest->draw_dirty = true;
+    surf_dest->cleared = false;
+
+    return true;
+}
+
 void pgraph_vk_image_blit(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -58,6 +387,37 @@ void pgraph_vk_image_blit(NV2AState *d)
             break;
     }
 
+    ImageBlitOperation operation;
+    switch (image_blit->operation) {
+    case NV09F_SET_OPERATION_SRCCOPY:
+        operation = IMAGE_BLIT_SRCCOPY;
+        break;
+    case NV09F_SET_OPERATION_BLEND_AND:
+        operation = IMAGE_BLIT_BLEND_AND;
+        break;
+    default:
+        fprintf(stderr, "Unknown blit operation: 0x%x\n",
+                image_blit->operation);
+        assert(false && "Unknown blit operation");
+        return;
+    }
+
+    bool needs_alpha_patching;
+    uint8_t alpha_override;
+    switch (context_surfaces->color_format) {
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0xff;
+        break;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        needs_alpha_patching = true;
+        alpha_override = 0;
+        break;
+    default:
+        needs_alpha_patching = false;
+        alpha_override = 0;
+    }
+
     hwaddr source_dma_len, dest_dma_len;
 
     uint8_t *source = (uint8_t *)nv_dma_map(
@@ -74,11 +434,21 @@ void pgraph_vk_image_blit(NV2AState *d)
     hwaddr dest_addr = dest - d->vram_ptr;
 
     SurfaceBinding *surf_src = pgraph_vk_surface_get(d, source_addr);
+    SurfaceBinding *surf_dest = pgraph_vk_surface_get(d, dest_addr);
+
+    NV2A_DPRINTF("  - 0x%tx -> 0x%tx\n", source_addr, dest_addr);
+
+    if (blit_surfaces_on_gpu(d, surf_src, surf_dest, bytes_per_pixel,
+                             needs_alpha_patching, alpha_override)) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_IMAGE_BLIT_CPU);
+
     if (surf_src) {
         pgraph_vk_surface_download_if_dirty(d, surf_src);
     }
 
-    SurfaceBinding *surf_dest = pgraph_vk_surface_get(d, dest_addr);
     if (surf_dest) {
         if (image_blit->height < surf_dest->height ||
             image_blit->width < surf_dest->width) {
@@ -109,65 +479,11 @@ void pgraph_vk_image_blit(NV2AState *d)
            memory_region_size(d->vram));
     assert(dest_addr + dest_offset + dest_size <= memory_region_size(d->vram));
 
-    uint8_t *source_row = source + source_offset;
-    uint8_t *dest_row = dest + dest_offset;
-
-    if (image_blit->operation == NV09F_SET_OPERATION_SRCCOPY) {
-        // NV2A_GL_DPRINTF(false, "NV09F_SET_OPERATION_SRCCOPY");
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            memmove(dest_row, source_row, image_blit->width * bytes_per_pixel);
-            source_row += context_surfaces->source_pitch;
-            dest_row += context_surfaces->dest_pitch;
-        }
-    } else if (image_blit->operation == NV09F_SET_OPERATION_BLEND_AND) {
-        // NV2A_GL_DPRINTF(false, "NV09F_SET_OPERATION_BLEND_AND");
-        uint32_t max_beta_mult = 0x7f80;
-        uint32_t beta_mult = beta->beta >> 16;
-        uint32_t inv_beta_mult = max_beta_mult - beta_mult;
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            for (unsigned int x = 0; x < image_blit->width; x++) {
-                for (unsigned int ch = 0; ch < 3; ch++) {
-                    uint32_t a = source_row[x * 4 + ch] * beta_mult;
-                    uint32_t b = dest_row[x * 4 + ch] * inv_beta_mult;
-                    dest_row[x * 4 + ch] = (a + b) / max_beta_mult;
-                }
-            }
-            source_row += context_surfaces->source_pitch;
-            dest_row += context_surfaces->dest_pitch;
-        }
-    } else {
-        fprintf(stderr, "Unknown blit operation: 0x%x\n",
-                image_blit->operation);
-        assert(false && "Unknown blit operation");
-    }
-
-    NV2A_DPRINTF("  - 0x%tx -> 0x%tx\n", source_addr, dest_addr);
-
-    bool needs_alpha_patching;
-    uint8_t alpha_override;
-    switch (context_surfaces->color_format) {
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0xff;
-        break;
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0;
-        break;
-    default:
-        needs_alpha_patching = false;
-        alpha_override = 0;
-    }
-
-    if (needs_alpha_patching) {
-        dest_row = dest + dest_offset;
-        for (unsigned int y = 0; y < image_blit->height; y++) {
-            for (unsigned int x = 0; x < image_blit->width; x++) {
-                dest_row[x * 4 + 3] = alpha_override;
-            }
-            dest_row += context_surfaces->dest_pitch;
-        }
-    }
+    image_blit_rect(dest + dest_offset, context_surfaces->dest_pitch,
+                    source + source_offset, context_surfaces->source_pitch,
+                    image_blit->width, image_blit->height, bytes_per_pixel,
+                    operation, beta->beta, needs_alpha_patching,
+                    alpha_override);
 
     dest_addr += dest_offset;
     memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
@@ -63,7 +63,8 @@ void pgraph_vk_init_buffers(NV2AState *d)
 
     r->storage_buffers[BUFFER_STAGING_DST] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
-        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         .buffer_size = 4096 * 4096 * 4,
     };
 
@@ -90,7 +91,8 @@ void pgraph_vk_init_buffers(NV2AState *d)
     r->storage_buffers[BUFFER_INDEX] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
         .buffer_size = sizeof(pg->inline_elements) * 100,
     };
 
@@ -103,10 +105,16 @@ void pgraph_vk_init_buffers(NV2AState *d)
     // FIXME: Don't assume that we can render with host mapped buffer
     r->storage_buffers[BUFFER_VERTEX_RAM] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         .buffer_size = memory_region_size(d->vram),
     };
 
+    /* Vertex shaders can only fetch from VRAM if all of it can be bound */
+    r->vertex_fetch_supported =
+        memory_region_size(d->vram) <=
+        r->device_props.limits.maxStorageBufferRange;
+
     r->bitmap_size = memory_region_size(d->vram) / 4096;
     r->uploaded_bitmap = bitmap_new(r->bitmap_size);
     bitmap_clear(r->uploaded_bitmap, 0, r->bitmap_size);
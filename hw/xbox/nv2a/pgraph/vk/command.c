@@ -75,6 +75,7 @@ VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     assert(!r->in_aux_command_buffer);
+    pgraph_vk_ensure_submit_complete(pg);
     r->in_aux_command_buffer = true;
 
     VkCommandBufferBeginInfo begin_info = {
@@ -99,21 +100,39 @@ void pgraph_vk_end_single_time_commands(PGRAPHState *pg, VkCommandBuffer cmd)
         .commandBufferCount = 1,
         .pCommandBuffers = &cmd,
     };
-    VK_CHECK(vkQueueSubmit(r->queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    // No submission is in flight, see pgraph_vk_begin_single_time_commands.
+    // Wait on its fence rather than the queue, so the UI isn't kept from
+    // presenting on a shared queue meanwhile.
+    VK_CHECK(vkResetFences(r->device, 1, &r->command_buffer_fence));
+    qemu_mutex_lock(&r->queue_lock);
+    VK_CHECK(vkQueueSubmit(r->queue, 1, &submit_info,
+                           r->command_buffer_fence));
+    qemu_mutex_unlock(&r->queue_lock);
     nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_AUX);
-    VK_CHECK(vkQueueWaitIdle(r->queue));
+    VK_CHECK(vkWaitForFences(r->device, 1, &r->command_buffer_fence, VK_TRUE,
+                             UINT64_MAX));
 
     r->in_aux_command_buffer = false;
 }
 
 void pgraph_vk_init_command_buffers(PGRAPHState *pg)
 {
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
     create_command_pool(pg);
     create_command_buffers(pg);
+
+    qemu_mutex_init(&r->queue_lock);
+    r->gpu_time = 0;
 }
 
 void pgraph_vk_finalize_command_buffers(PGRAPHState *pg)
 {
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    qemu_mutex_destroy(&r->queue_lock);
+
     destroy_command_buffers(pg);
     destroy_command_pool(pg);
 }
\ No newline at end of file
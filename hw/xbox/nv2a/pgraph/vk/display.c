@@ -542,16 +542,18 @@ static void destroy_current_display_image(PGRAPHState *pg)
     destroy_frame_buffer(pg);
 
 #if HAVE_EXTERNAL_MEMORY
-    glDeleteTextures(1, &d->gl_texture_id);
-    d->gl_texture_id = 0;
+    if (!d->direct_present) {
+        glDeleteTextures(1, &d->gl_texture_id);
+        d->gl_texture_id = 0;
 
-    glDeleteMemoryObjectsEXT(1, &d->gl_memory_obj);
-    d->gl_memory_obj = 0;
+        glDeleteMemoryObjectsEXT(1, &d->gl_memory_obj);
+        d->gl_memory_obj = 0;
 
 #ifdef WIN32
-    CloseHandle(d->handle);
-    d->handle = 0;
+        CloseHandle(d->handle);
+        d->handle = 0;
 #endif
+    }
 #endif
 
     vkDestroyImageView(r->device, d->image_view, NULL);
@@ -578,24 +580,31 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
         destroy_current_display_image(pg);
     }
 
+#if HAVE_EXTERNAL_MEMORY
+    // Not shared with GL when the UI presents it directly
+    const bool use_external_memory = !d->direct_present;
+#endif
     const GLint gl_internal_format = GL_RGBA8;
     bool use_optimal_tiling = true;
 
 #if HAVE_EXTERNAL_MEMORY
-    GLint num_tiling_types;
-    glGetInternalformativ(GL_TEXTURE_2D, gl_internal_format,
-                          GL_NUM_TILING_TYPES_EXT, 1, &num_tiling_types);
-    // XXX: Apparently on AMD GL_OPTIMAL_TILING_EXT is reported to be
-    // supported, but doesn't work? On nVidia, GL_LINEAR_TILING_EXT may not
-    // be supported so we must use optimal. Default to optimal unless
-    // linear is explicitly specified...
-    GLint tiling_types[num_tiling_types];
-    glGetInternalformativ(GL_TEXTURE_2D, gl_internal_format,
-                          GL_TILING_TYPES_EXT, num_tiling_types, tiling_types);
-    for (int i = 0; i < num_tiling_types; i++) {
-        if (tiling_types[i] == GL_LINEAR_TILING_EXT) {
-            use_optimal_tiling = false;
-            break;
+    if (use_external_memory) {
+        GLint num_tiling_types;
+        glGetInternalformativ(GL_TEXTURE_2D, gl_internal_format,
+                              GL_NUM_TILING_TYPES_EXT, 1, &num_tiling_types);
+        // XXX: Apparently on AMD GL_OPTIMAL_TILING_EXT is reported to be
+        // supported, but doesn't work? On nVidia, GL_LINEAR_TILING_EXT may not
+        // be supported so we must use optimal. Default to optimal unless
+        // linear is explicitly specified...
+        GLint tiling_types[num_tiling_types];
+        glGetInternalformativ(GL_TEXTURE_2D, gl_internal_format,
+                              GL_TILING_TYPES_EXT, num_tiling_types,
+                              tiling_types);
+        for (int i = 0; i < num_tiling_types; i++) {
+            if (tiling_types[i] == GL_LINEAR_TILING_EXT) {
+                use_optimal_tiling = false;
+                break;
+            }
         }
     }
 #endif
@@ -617,6 +626,7 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
 
+#if HAVE_EXTERNAL_MEMORY
     VkExternalMemoryImageCreateInfo external_memory_image_create_info = {
         .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
 #ifdef WIN32
@@ -625,7 +635,10 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
         .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
 #endif
     };
-    image_create_info.pNext = &external_memory_image_create_info;
+    if (use_external_memory) {
+        image_create_info.pNext = &external_memory_image_create_info;
+    }
+#endif
 
     VK_CHECK(vkCreateImage(r->device, &image_create_info, NULL, &d->image));
 
@@ -641,6 +654,7 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
     };
 
+#if HAVE_EXTERNAL_MEMORY
     VkExportMemoryAllocateInfo export_memory_alloc_info = {
         .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
         .handleTypes =
@@ -651,7 +665,10 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
 #endif
             ,
     };
-    alloc_info.pNext = &export_memory_alloc_info;
+    if (use_external_memory) {
+        alloc_info.pNext = &export_memory_alloc_info;
+    }
+#endif
 
     VK_CHECK(vkAllocateMemory(r->device, &alloc_info, NULL, &d->memory));
     VK_CHECK(vkBindImageMemory(r->device, d->image, d->memory, 0));
@@ -670,49 +687,50 @@ static void create_display_image(PGRAPHState *pg, int width, int height)
                                &d->image_view));
 
 #if HAVE_EXTERNAL_MEMORY
-
+    if (use_external_memory) {
 #ifdef WIN32
 
-    VkMemoryGetWin32HandleInfoKHR handle_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR,
-        .memory = d->memory,
-        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT_KHR
-    };
-    VK_CHECK(vkGetMemoryWin32HandleKHR(r->device, &handle_info, &d->handle));
+        VkMemoryGetWin32HandleInfoKHR handle_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR,
+            .memory = d->memory,
+            .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT_KHR
+        };
+        VK_CHECK(vkGetMemoryWin32HandleKHR(r->device, &handle_info, &d->handle));
 
-    glCreateMemoryObjectsEXT(1, &d->gl_memory_obj);
-    glImportMemoryWin32HandleEXT(d->gl_memory_obj, memory_requirements.size, GL_HANDLE_TYPE_OPAQUE_WIN32_EXT, d->handle);
-    assert(glGetError() == GL_NO_ERROR);
+        glCreateMemoryObjectsEXT(1, &d->gl_memory_obj);
+        glImportMemoryWin32HandleEXT(d->gl_memory_obj, memory_requirements.size, GL_HANDLE_TYPE_OPAQUE_WIN32_EXT, d->handle);
+        assert(glGetError() == GL_NO_ERROR);
 
 #else
 
-    VkMemoryGetFdInfoKHR fd_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
-        .memory = d->memory,
-        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
-    };
-    VK_CHECK(vkGetMemoryFdKHR(r->device, &fd_info, &d->fd));
+        VkMemoryGetFdInfoKHR fd_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+            .memory = d->memory,
+            .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
+        };
+        VK_CHECK(vkGetMemoryFdKHR(r->device, &fd_info, &d->fd));
 
-    glCreateMemoryObjectsEXT(1, &d->gl_memory_obj);
-    glImportMemoryFdEXT(d->gl_memory_obj, memory_requirements.size,
-                        GL_HANDLE_TYPE_OPAQUE_FD_EXT, d->fd);
-    assert(glIsMemoryObjectEXT(d->gl_memory_obj));
-    assert(glGetError() == GL_NO_ERROR);
+        glCreateMemoryObjectsEXT(1, &d->gl_memory_obj);
+        glImportMemoryFdEXT(d->gl_memory_obj, memory_requirements.size,
+                            GL_HANDLE_TYPE_OPAQUE_FD_EXT, d->fd);
+        assert(glIsMemoryObjectEXT(d->gl_memory_obj));
+        assert(glGetError() == GL_NO_ERROR);
 
 #endif // WIN32
 
-    glGenTextures(1, &d->gl_texture_id);
-    glBindTexture(GL_TEXTURE_2D, d->gl_texture_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_TILING_EXT,
-                    use_optimal_tiling ? GL_OPTIMAL_TILING_EXT :
-                                         GL_LINEAR_TILING_EXT);
-    glTexStorageMem2DEXT(GL_TEXTURE_2D, 1, gl_internal_format,
-                         image_create_info.extent.width,
-                         image_create_info.extent.height, d->gl_memory_obj, 0);
-    assert(glGetError() == GL_NO_ERROR);
-
+        glGenTextures(1, &d->gl_texture_id);
+        glBindTexture(GL_TEXTURE_2D, d->gl_texture_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_TILING_EXT,
+                        use_optimal_tiling ? GL_OPTIMAL_TILING_EXT :
+                                             GL_LINEAR_TILING_EXT);
+        glTexStorageMem2DEXT(GL_TEXTURE_2D, 1, gl_internal_format,
+                             image_create_info.extent.width,
+                             image_create_info.extent.height, d->gl_memory_obj,
+                             0);
+        assert(glGetError() == GL_NO_ERROR);
+    }
 #endif // HAVE_EXTERNAL_MEMORY
 
     d->width = image_create_info.extent.width;
@@ -1076,6 +1094,8 @@ void pgraph_vk_render_display(PGRAPHState *pg)
         return;
     }
 
+    pgraph_vk_rescale_surface(d, surface);
+
     unsigned int width = 0, height = 0;
     d->vga.get_resolution(&d->vga, (int *)&width, (int *)&height);
 
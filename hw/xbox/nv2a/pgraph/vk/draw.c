@@ -19,6 +19,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/fast-hash.h"
+#include "xemu-version.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 
 void pgraph_vk_draw_begin(NV2AState *d)
@@ -122,6 +124,182 @@ static bool pipeline_cache_entry_compare(Lru *lru, LruNode *node, void *key)
     return memcmp(&snode->key, key, sizeof(PipelineKey));
 }
 
+static char *pipeline_cache_get_path(void)
+{
+    return g_strdup_printf("%s/vk_pipeline_cache",
+                           xemu_settings_get_base_path());
+}
+
+static bool pipeline_cache_data_matches_device(PGRAPHVkState *r,
+                                               const void *data, size_t size)
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == r->device_props.vendorID &&
+           header.deviceID == r->device_props.deviceID &&
+           !memcmp(header.pipelineCacheUUID,
+                   r->device_props.pipelineCacheUUID, VK_UUID_SIZE);
+}
+
+static void *pipeline_cache_load_from_disk(void *arg)
+{
+    PGRAPHVkState *r = arg;
+
+    char *path = pipeline_cache_get_path();
+    char *cached_xemu_version = NULL;
+    void *data = NULL;
+    uint64_t cached_xemu_version_len;
+    uint64_t data_size;
+
+    FILE *file = qemu_fopen(path, "rb");
+    if (!file) {
+        goto done;
+    }
+
+    size_t nread;
+    #define READ_OR_ERR(data, data_len) \
+        do { \
+            nread = fread(data, data_len, 1, file); \
+            if (nread != 1) { \
+                fclose(file); \
+                goto error; \
+            } \
+        } while (0)
+
+    READ_OR_ERR(&cached_xemu_version_len, sizeof(cached_xemu_version_len));
+    if (cached_xemu_version_len == 0 || cached_xemu_version_len > 1024) {
+        fclose(file);
+        goto error;
+    }
+
+    cached_xemu_version = g_malloc0(cached_xemu_version_len + 1);
+    READ_OR_ERR(cached_xemu_version, cached_xemu_version_len);
+    if (strcmp(cached_xemu_version, xemu_version) != 0) {
+        fclose(file);
+        goto error;
+    }
+
+    READ_OR_ERR(&data_size, sizeof(data_size));
+    if (data_size == 0 || data_size > 512 * MiB) {
+        fclose(file);
+        goto error;
+    }
+    data = g_malloc(data_size);
+    READ_OR_ERR(data, data_size);
+
+    #undef READ_OR_ERR
+
+    fclose(file);
+
+    if (!pipeline_cache_data_matches_device(r, data, data_size)) {
+        goto error;
+    }
+
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data_size,
+        .pInitialData = data,
+    };
+    if (vkCreatePipelineCache(r->device, &cache_info, NULL,
+                              &r->vk_pipeline_cache_loaded) != VK_SUCCESS) {
+        r->vk_pipeline_cache_loaded = VK_NULL_HANDLE;
+    }
+    goto done;
+
+error:
+    /* Stale or corrupt, delete it so it won't be loaded again */
+    qemu_unlink(path);
+
+done:
+    g_free(path);
+    g_free(cached_xemu_version);
+    g_free(data);
+    qatomic_store_release(&r->pipeline_cache_load_complete, true);
+    return NULL;
+}
+
+/*
+ * The on-disk cache is loaded on a background thread, then merged into the
+ * live cache by the renderer before creating pipelines once it's ready.
+ */
+static void merge_loaded_pipeline_cache(PGRAPHVkState *r, bool wait)
+{
+    if (!r->pipeline_cache_load_pending ||
+        (!wait && !qatomic_load_acquire(&r->pipeline_cache_load_complete))) {
+        return;
+    }
+
+    qemu_thread_join(&r->pipeline_cache_load_thread);
+    r->pipeline_cache_load_pending = false;
+
+    if (r->vk_pipeline_cache_loaded != VK_NULL_HANDLE) {
+        VK_CHECK(vkMergePipelineCaches(r->device, r->vk_pipeline_cache, 1,
+                                       &r->vk_pipeline_cache_loaded));
+        vkDestroyPipelineCache(r->device, r->vk_pipeline_cache_loaded, NULL);
+        r->vk_pipeline_cache_loaded = VK_NULL_HANDLE;
+    }
+}
+
+static void pipeline_cache_write_to_disk(PGRAPHVkState *r)
+{
+    size_t data_size = 0;
+    if (vkGetPipelineCacheData(r->device, r->vk_pipeline_cache, &data_size,
+                               NULL) != VK_SUCCESS ||
+        data_size == 0) {
+        return;
+    }
+
+    void *data = g_malloc(data_size);
+    if (vkGetPipelineCacheData(r->device, r->vk_pipeline_cache, &data_size,
+                               data) != VK_SUCCESS) {
+        g_free(data);
+        return;
+    }
+
+    char *path = pipeline_cache_get_path();
+    uint64_t xemu_version_len = strlen(xemu_version) + 1;
+    uint64_t data_size_u64 = data_size;
+
+    FILE *file = qemu_fopen(path, "wb");
+    if (!file) {
+        goto error;
+    }
+
+    size_t written;
+    #define WRITE_OR_ERR(data, data_size) \
+        do { \
+            written = fwrite(data, data_size, 1, file); \
+            if (written != 1) { \
+                fclose(file); \
+                goto error; \
+            } \
+        } while (0)
+
+    WRITE_OR_ERR(&xemu_version_len, sizeof(xemu_version_len));
+    WRITE_OR_ERR(xemu_version, xemu_version_len);
+    WRITE_OR_ERR(&data_size_u64, sizeof(data_size_u64));
+    WRITE_OR_ERR(data, data_size);
+
+    #undef WRITE_OR_ERR
+
+    fclose(file);
+    g_free(path);
+    g_free(data);
+    return;
+
+error:
+    fprintf(stderr, "nv2a: Failed to write pipeline cache to %s\n", path);
+    qemu_unlink(path);
+    g_free(path);
+    g_free(data);
+}
+
 static void init_pipeline_cache(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -136,6 +314,16 @@ static void init_pipeline_cache(PGRAPHState *pg)
     VK_CHECK(vkCreatePipelineCache(r->device, &cache_info, NULL,
                                    &r->vk_pipeline_cache));
 
+    r->vk_pipeline_cache_loaded = VK_NULL_HANDLE;
+    r->pipeline_cache_load_complete = false;
+    r->pipeline_cache_load_pending = g_config.perf.cache_shaders;
+    if (r->pipeline_cache_load_pending) {
+        qemu_thread_create(&r->pipeline_cache_load_thread,
+                           "pgraph.vk.pipeline_cache",
+                           pipeline_cache_load_from_disk, r,
+                           QEMU_THREAD_JOINABLE);
+    }
+
     const size_t pipeline_cache_size = 2048;
     lru_init(&r->pipeline_cache);
     r->pipeline_cache_entries =
@@ -158,6 +346,11 @@ static void finalize_pipeline_cache(PGRAPHState *pg)
     g_free(r->pipeline_cache_entries);
     r->pipeline_cache_entries = NULL;
 
+    merge_loaded_pipeline_cache(r, true);
+    if (g_config.perf.cache_shaders) {
+        pipeline_cache_write_to_disk(r);
+    }
+
     vkDestroyPipelineCache(r->device, r->vk_pipeline_cache, NULL);
 }
 
@@ -361,7 +554,8 @@ static VkRenderPass add_new_render_pass(PGRAPHVkState *r, RenderPassState *state
     return new_pass.render_pass;
 }
 
-static VkRenderPass get_render_pass(PGRAPHVkState *r, RenderPassState *state)
+VkRenderPass pgraph_vk_get_render_pass(PGRAPHVkState *r,
+                                       RenderPassState *state)
 {
     for (int i = 0; i < r->render_passes->len; i++) {
         RenderPass *p = &g_array_index(r->render_passes, RenderPass, i);
@@ -592,11 +786,13 @@ static void create_clear_pipeline(PGRAPHState *pg)
         .pColorBlendState = &color_blending,
         .pDynamicState = &dynamic_state,
         .layout = layout,
-        .renderPass = get_render_pass(r, &key.render_pass_state),
+        .renderPass = pgraph_vk_get_render_pass(r, &key.render_pass_state),
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
     };
 
+    merge_loaded_pipeline_cache(r, false);
+
     VkPipeline pipeline;
     VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
                                        &pipeline_info, NULL, &pipeline));
@@ -694,7 +890,7 @@ static void init_pipeline_key(PGRAPHState *pg, PipelineKey *key)
     }
 }
 
-static void create_pipeline(PGRAPHState *pg)
+static bool create_pipeline(PGRAPHState *pg)
 {
     NV2A_VK_DGROUP_BEGIN("Creating pipeline");
 
@@ -702,7 +898,11 @@ static void create_pipeline(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     pgraph_vk_bind_textures(d);
-    pgraph_vk_bind_shaders(pg);
+    if (!pgraph_vk_bind_shaders(pg)) {
+        NV2A_VK_DPRINTF("Shaders not ready, skipping draw");
+        NV2A_VK_DGROUP_END();
+        return false;
+    }
 
     // FIXME: If nothing was dirty, don't even try creating the key or hashing.
     //        Just use the same pipeline.
@@ -714,7 +914,7 @@ static void create_pipeline(PGRAPHState *pg)
     if (r->pipeline_binding && !pipeline_dirty) {
         NV2A_VK_DPRINTF("Cache hit");
         NV2A_VK_DGROUP_END();
-        return;
+        return true;
     }
 
     PipelineKey key;
@@ -728,7 +928,7 @@ static void create_pipeline(PGRAPHState *pg)
         r->pipeline_binding_changed = r->pipeline_binding != snode;
         r->pipeline_binding = snode;
         NV2A_VK_DGROUP_END();
-        return;
+        return true;
     }
 
     NV2A_VK_DPRINTF("Cache miss");
@@ -1046,10 +1246,12 @@ static void create_pipeline(PGRAPHState *pg)
         .pColorBlendState = &color_blending,
         .pDynamicState = &dynamic_state,
         .layout = layout,
-        .renderPass = get_render_pass(r, &key.render_pass_state),
+        .renderPass = pgraph_vk_get_render_pass(r, &key.render_pass_state),
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
     };
+    merge_loaded_pipeline_cache(r, false);
+
     VkPipeline pipeline;
     VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
                                        &pipeline_create_info, NULL, &pipeline));
@@ -1063,6 +1265,8 @@ static void create_pipeline(PGRAPHState *pg)
     r->pipeline_binding_changed = true;
 
     NV2A_VK_DGROUP_END();
+
+    return true;
 }
 
 static void push_vertex_attr_values(PGRAPHState *pg)
@@ -1151,8 +1355,11 @@ static void sync_staging_buffer(PGRAPHState *pg, VkCommandBuffer cmd,
 
     switch (index_dst) {
     case BUFFER_INDEX:
-        dst_access_mask = VK_ACCESS_INDEX_READ_BIT;
-        dst_stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        /* Also holds the parameters of batched indirect draws */
+        dst_access_mask =
+            VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        dst_stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
         break;
     case BUFFER_VERTEX_INLINE:
         dst_access_mask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
@@ -1193,7 +1400,8 @@ static void flush_memory_buffer(PGRAPHState *pg, VkCommandBuffer cmd)
     VkBufferMemoryBarrier barrier = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
         .srcAccessMask = VK_ACCESS_HOST_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                         VK_ACCESS_SHADER_READ_BIT,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .buffer = r->storage_buffers[BUFFER_VERTEX_RAM].buffer,
@@ -1201,9 +1409,11 @@ static void flush_memory_buffer(PGRAPHState *pg, VkCommandBuffer cmd)
         .size = VK_WHOLE_SIZE,
     };
 
+    /* Unaligned attributes are read by the vertex shader */
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
-                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, NULL, 1,
-                         &barrier, 0, NULL);
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0, 0, NULL, 1, &barrier, 0, NULL);
 }
 
 static void begin_render_pass(PGRAPHState *pg)
@@ -1256,6 +1466,72 @@ const enum NV2A_PROF_COUNTERS_ENUM finish_reason_to_counter_enum[] = {
     [VK_FINISH_REASON_STALLED] = NV2A_PROF_FINISH_STALLED,
 };
 
+/*
+ * Accumulate the time the GPU spent on the submission just waited for, from
+ * the timestamps written around it in pgraph_vk_finish. Without timestamp
+ * support, fall back to the time since submission, which is an upper bound.
+ */
+static void update_gpu_time(PGRAPHVkState *r)
+{
+    uint64_t timestamps[2];
+
+    if (r->timestamp_query_pool &&
+        vkGetQueryPoolResults(r->device, r->timestamp_query_pool, 0, 2,
+                              sizeof(timestamps), timestamps,
+                              sizeof(timestamps[0]),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        r->gpu_time += (timestamps[1] - timestamps[0]) *
+                       r->device_props.limits.timestampPeriod / 1000;
+        return;
+    }
+
+    r->gpu_time += qemu_clock_get_us(QEMU_CLOCK_REALTIME) - r->submit_start_us;
+}
+
+static void complete_submit(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    VK_CHECK(vkWaitForFences(r->device, 1, &r->command_buffer_fence,
+                             VK_TRUE, UINT64_MAX));
+    r->submit_pending = false;
+
+    update_gpu_time(r);
+
+    r->descriptor_set_index = 0;
+    destroy_framebuffers(pg);
+
+    if (r->submit_check_budget) {
+        pgraph_vk_check_memory_budget(pg);
+        r->submit_check_budget = false;
+    }
+
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    pgraph_vk_process_pending_reports_internal(d);
+
+    pgraph_vk_compute_finish_complete(r);
+}
+
+/*
+ * Waits for a submission left in flight by pgraph_vk_finish. Must be called
+ * before recording new commands or touching any resource the submission may
+ * still be using (staging buffers, descriptor sets, the vertex RAM buffer,
+ * cached images and pipelines).
+ */
+void pgraph_vk_ensure_submit_complete(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->submit_pending) {
+        complete_submit(pg);
+    }
+}
+
+uint64_t pgraph_vk_get_gpu_time(NV2AState *d)
+{
+    return d->pgraph.vk_renderer_state->gpu_time;
+}
+
 void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -1263,6 +1539,8 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
     assert(!r->in_draw);
     assert(r->debug_depth == 0);
 
+    pgraph_vk_ensure_submit_complete(pg);
+
     if (r->in_command_buffer) {
         nv2a_profile_inc_counter(finish_reason_to_counter_enum[finish_reason]);
 
@@ -1272,9 +1550,20 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
         if (r->query_in_flight) {
             end_query(r);
         }
+        if (r->timestamp_query_pool) {
+            vkCmdWriteTimestamp(r->command_buffer,
+                                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                r->timestamp_query_pool, 1);
+        }
         VK_CHECK(vkEndCommandBuffer(r->command_buffer));
 
         VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg); // FIXME: Cleanup
+        if (r->timestamp_query_pool) {
+            /* The aux command buffer executes first, see submit_infos */
+            vkCmdResetQueryPool(cmd, r->timestamp_query_pool, 0, 2);
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                r->timestamp_query_pool, 0);
+        }
         sync_staging_buffer(pg, cmd, BUFFER_INDEX_STAGING, BUFFER_INDEX);
         sync_staging_buffer(pg, cmd, BUFFER_VERTEX_INLINE_STAGING,
                                 BUFFER_VERTEX_INLINE);
@@ -1305,11 +1594,14 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
         };
         nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT);
         vkResetFences(r->device, 1, &r->command_buffer_fence);
+        r->submit_start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        qemu_mutex_lock(&r->queue_lock);
         VK_CHECK(vkQueueSubmit(r->queue, ARRAY_SIZE(submit_infos), submit_infos,
                                r->command_buffer_fence));
+        qemu_mutex_unlock(&r->queue_lock);
         r->submit_count += 1;
-
-        bool check_budget = false;
+        r->in_command_buffer = false;
+        r->submit_pending = true;
 
         // Periodically check memory budget
         const int max_num_submits_before_budget_update = 5;
@@ -1320,19 +1612,21 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
             // VMA queries budget via vmaSetCurrentFrameIndex
             vmaSetCurrentFrameIndex(r->allocator, r->submit_count);
             r->allocator_last_submit_index = r->submit_count;
-            check_budget = true;
+            r->submit_check_budget = true;
         }
 
-        VK_CHECK(vkWaitForFences(r->device, 1, &r->command_buffer_fence,
-                                 VK_TRUE, UINT64_MAX));
-
-        r->descriptor_set_index = 0;
-        r->in_command_buffer = false;
-        destroy_framebuffers(pg);
-
-        if (check_budget) {
-            pgraph_vk_check_memory_budget(pg);
+        /*
+         * At the end of a frame nothing needs the results right away, so
+         * let the GPU run while PGRAPH waits for the flip. The next
+         * operation touching renderer resources waits for the fence.
+         */
+        if (finish_reason == VK_FINISH_REASON_FLIP_STALL) {
+            nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_DEFERRED);
+            return;
         }
+
+        complete_submit(pg);
+        return;
     }
 
     NV2AState *d = container_of(pg, NV2AState, pgraph);
@@ -1346,6 +1640,8 @@ void pgraph_vk_begin_command_buffer(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
     assert(!r->in_command_buffer);
 
+    pgraph_vk_ensure_submit_complete(pg);
+
     VkCommandBufferBeginInfo command_buffer_begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
@@ -1398,7 +1694,7 @@ void pgraph_vk_end_nondraw_commands(PGRAPHState *pg, VkCommandBuffer cmd)
 // buffer. For other reasons though (like descriptor set amount, surface
 // changes, etc) we do flush often.
 
-static void begin_pre_draw(PGRAPHState *pg)
+static bool begin_pre_draw(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
@@ -1408,8 +1704,8 @@ static void begin_pre_draw(PGRAPHState *pg)
 
     if (pg->clearing) {
         create_clear_pipeline(pg);
-    } else {
-        create_pipeline(pg);
+    } else if (!create_pipeline(pg)) {
+        return false;
     }
 
     bool render_pass_dirty = r->pipeline_binding->render_pass != r->render_pass;
@@ -1432,6 +1728,8 @@ static void begin_pre_draw(PGRAPHState *pg)
     }
 
     pgraph_vk_ensure_command_buffer(pg);
+
+    return true;
 }
 
 static void begin_draw(PGRAPHState *pg)
@@ -1676,6 +1974,8 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
 
     nv2a_profile_inc_counter(NV2A_PROF_CLEAR);
 
+    pgraph_vk_ensure_submit_complete(pg);
+
     bool write_color = (parameter & NV097_CLEAR_SURFACE_COLOR);
     bool write_zeta =
         (parameter & (NV097_CLEAR_SURFACE_Z | NV097_CLEAR_SURFACE_STENCIL));
@@ -2058,6 +2358,8 @@ void pgraph_vk_flush_draw(NV2AState *d)
         return;
     }
 
+    pgraph_vk_ensure_submit_complete(pg);
+
     r->num_vertex_ram_buffer_syncs = 0;
 
     if (pg->draw_arrays_length) {
@@ -2068,6 +2370,17 @@ void pgraph_vk_flush_draw(NV2AState *d)
         assert(pg->inline_buffer_length == 0);
         assert(pg->inline_array_length == 0);
 
+        /* Batched ranges are issued as a single indirect multi-draw */
+        bool draw_indirect =
+            r->multi_draw_indirect_enabled && pg->draw_arrays_length > 1 &&
+            pg->draw_arrays_length <=
+                r->device_props.limits.maxDrawIndirectCount;
+        VkDeviceSize indirect_data_size =
+            pg->draw_arrays_length * sizeof(VkDrawIndirectCommand);
+        if (draw_indirect) {
+            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, indirect_data_size);
+        }
+
         pgraph_vk_bind_vertex_attributes(d, pg->draw_arrays_min_start,
                                          pg->draw_arrays_max_count - 1, false,
                                          0, pg->draw_arrays_max_count - 1);
@@ -2080,17 +2393,43 @@ void pgraph_vk_flush_draw(NV2AState *d)
         sync_vertex_ram_buffer(pg);
         VertexBufferRemap remap = remap_unaligned_attributes(pg, max_element);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element);
+        VkDeviceSize indirect_offset = 0;
+        if (draw_indirect) {
+            VkDrawIndirectCommand cmds[ARRAY_SIZE(pg->draw_arrays_start)];
+            for (int i = 0; i < pg->draw_arrays_length; i++) {
+                cmds[i] = (VkDrawIndirectCommand){
+                    .vertexCount = pg->draw_arrays_count[i],
+                    .instanceCount = 1,
+                    .firstVertex = pg->draw_arrays_start[i],
+                    .firstInstance = 0,
+                };
+            }
+            void *data = cmds;
+            indirect_offset = pgraph_vk_append_to_buffer(
+                pg, BUFFER_INDEX_STAGING, &data, &indirect_data_size, 1, 4);
+        }
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
                                      "Draw Arrays");
         begin_draw(pg);
         bind_vertex_buffer(pg, remap.attributes, 0);
-        for (int i = 0; i < pg->draw_arrays_length; i++) {
-            uint32_t start = pg->draw_arrays_start[i],
-                     count = pg->draw_arrays_count[i];
-            NV2A_VK_DPRINTF("- [%d] Start:%d Count:%d", i, start, count);
-            vkCmdDraw(r->command_buffer, count, 1, start, 0);
+        if (draw_indirect) {
+            nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS_INDIRECT);
+            vkCmdDrawIndirect(r->command_buffer,
+                              r->storage_buffers[BUFFER_INDEX].buffer,
+                              indirect_offset, pg->draw_arrays_length,
+                              sizeof(VkDrawIndirectCommand));
+        } else {
+            for (int i = 0; i < pg->draw_arrays_length; i++) {
+                uint32_t start = pg->draw_arrays_start[i],
+                         count = pg->draw_arrays_count[i];
+                NV2A_VK_DPRINTF("- [%d] Start:%d Count:%d", i, start, count);
+                vkCmdDraw(r->command_buffer, count, 1, start, 0);
+            }
         }
         end_draw(pg);
         pgraph_vk_end_debug_marker(r, r->command_buffer);
@@ -2120,7 +2459,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         sync_vertex_ram_buffer(pg);
         VertexBufferRemap remap = remap_unaligned_attributes(pg, max_element + 1);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element + 1);
         VkDeviceSize buffer_offset = pgraph_vk_update_index_buffer(
             pg, pg->inline_elements, index_data_size);
@@ -2162,7 +2504,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         }
         ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING, offset);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, data, sizes, r->num_active_vertex_attribute_descriptions);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
@@ -2205,7 +2550,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
         pgraph_vk_bind_vertex_attributes(d, 0, index_count - 1, true,
                                          vertex_size, index_count - 1);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         void *inline_array_data = pg->inline_array;
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, &inline_array_data, &inline_array_data_size, 1);
@@ -17,6 +17,9 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "xemu-version.h"
 #include "ui/xemu-settings.h"
 #include "renderer.h"
 
@@ -130,13 +133,369 @@ static const glslang_resource_t
                             .general_constant_matrix_vector_indexing = 1,
                         } };
 
+/*
+ * Compiled SPIR-V is cached on disk, keyed by a hash of the generated GLSL.
+ * Hashes of the modules used in a session are saved to a reload list, which
+ * is read back on a background thread when the next session starts.
+ */
+typedef struct SpvCacheEntry {
+    glslang_stage_t stage;
+    char *glsl;
+    GByteArray *spv;
+} SpvCacheEntry;
+
+static struct {
+    bool enabled;
+    QemuMutex lock;
+    QemuThread reload_thread;
+    GHashTable *entries; // hash -> SpvCacheEntry, preloaded from disk
+    GHashTable *used; // Hashes of modules requested this session
+} spv_cache;
+
+static void spv_cache_entry_free(gpointer data)
+{
+    SpvCacheEntry *entry = data;
+    g_free(entry->glsl);
+    if (entry->spv) {
+        g_byte_array_unref(entry->spv);
+    }
+    g_free(entry);
+}
+
+static uint64_t spv_cache_hash(glslang_stage_t stage, const char *glsl)
+{
+    return fast_hash((const uint8_t *)glsl, strlen(glsl)) ^ stage;
+}
+
+static char *spv_cache_get_list_path(void)
+{
+    return g_strdup_printf("%s/spirv_cache_list",
+                           xemu_settings_get_base_path());
+}
+
+static char *spv_cache_get_bin_directory(uint64_t hash)
+{
+    return g_strdup_printf("%s/shaders/spirv/%04x",
+                           xemu_settings_get_base_path(),
+                           (uint32_t)(hash >> 48));
+}
+
+static char *spv_cache_get_binary_path(const char *bin_dir, uint64_t hash)
+{
+    uint64_t bin_mask = (uint64_t)0xffff << 48;
+    return g_strdup_printf("%s/%012" PRIx64, bin_dir, hash & ~bin_mask);
+}
+
+static void spv_cache_create_folder(void)
+{
+    char *path = g_strdup_printf("%s/shaders", xemu_settings_get_base_path());
+    qemu_mkdir(path);
+    g_free(path);
+
+    path = g_strdup_printf("%s/shaders/spirv", xemu_settings_get_base_path());
+    qemu_mkdir(path);
+    g_free(path);
+}
+
+static SpvCacheEntry *spv_cache_load_from_disk(uint64_t hash)
+{
+    char *bin_dir = spv_cache_get_bin_directory(hash);
+    char *path = spv_cache_get_binary_path(bin_dir, hash);
+    g_free(bin_dir);
+
+    SpvCacheEntry *entry = g_malloc0(sizeof(SpvCacheEntry));
+    char *cached_xemu_version = NULL;
+    uint64_t cached_xemu_version_len;
+    uint64_t glsl_len, spv_len;
+
+    FILE *file = qemu_fopen(path, "rb");
+    if (!file) {
+        g_free(path);
+        g_free(entry);
+        return NULL;
+    }
+
+    size_t nread;
+    #define READ_OR_ERR(data, data_len) \
+        do { \
+            nread = fread(data, data_len, 1, file); \
+            if (nread != 1) { \
+                fclose(file); \
+                goto error; \
+            } \
+        } while (0)
+
+    READ_OR_ERR(&cached_xemu_version_len, sizeof(cached_xemu_version_len));
+    if (cached_xemu_version_len == 0 || cached_xemu_version_len > 1024) {
+        fclose(file);
+        goto error;
+    }
+
+    cached_xemu_version = g_malloc0(cached_xemu_version_len + 1);
+    READ_OR_ERR(cached_xemu_version, cached_xemu_version_len);
+    if (strcmp(cached_xemu_version, xemu_version) != 0) {
+        fclose(file);
+        goto error;
+    }
+
+    READ_OR_ERR(&entry->stage, sizeof(entry->stage));
+
+    READ_OR_ERR(&glsl_len, sizeof(glsl_len));
+    if (glsl_len > 16 * MiB) {
+        fclose(file);
+        goto error;
+    }
+    entry->glsl = g_malloc(glsl_len + 1);
+    READ_OR_ERR(entry->glsl, glsl_len);
+    entry->glsl[glsl_len] = '\0';
+
+    READ_OR_ERR(&spv_len, sizeof(spv_len));
+    if (spv_len == 0 || spv_len > 16 * MiB || spv_len % sizeof(uint32_t)) {
+        fclose(file);
+        goto error;
+    }
+    entry->spv = g_byte_array_sized_new(spv_len);
+    g_byte_array_set_size(entry->spv, spv_len);
+    READ_OR_ERR(entry->spv->data, spv_len);
+
+    #undef READ_OR_ERR
+
+    fclose(file);
+    g_free(path);
+    g_free(cached_xemu_version);
+
+    return entry;
+
+error:
+    /* Delete the module so it won't be loaded again */
+    qemu_unlink(path);
+    g_free(path);
+    g_free(cached_xemu_version);
+    spv_cache_entry_free(entry);
+    return NULL;
+}
+
+static void spv_cache_write_to_disk(uint64_t hash, glslang_stage_t stage,
+                                    const char *glsl, GByteArray *spv)
+{
+    char *bin_dir = spv_cache_get_bin_directory(hash);
+    char *path = spv_cache_get_binary_path(bin_dir, hash);
+
+    uint64_t xemu_version_len = strlen(xemu_version) + 1;
+    uint64_t glsl_len = strlen(glsl);
+    uint64_t spv_len = spv->len;
+
+    qemu_mkdir(bin_dir);
+    g_free(bin_dir);
+
+    FILE *file = qemu_fopen(path, "wb");
+    if (!file) {
+        goto error;
+    }
+
+    size_t written;
+    #define WRITE_OR_ERR(data, data_size) \
+        do { \
+            written = fwrite(data, data_size, 1, file); \
+            if (written != 1) { \
+                fclose(file); \
+                goto error; \
+            } \
+        } while (0)
+
+    WRITE_OR_ERR(&xemu_version_len, sizeof(xemu_version_len));
+    WRITE_OR_ERR(xemu_version, xemu_version_len);
+    WRITE_OR_ERR(&stage, sizeof(stage));
+    WRITE_OR_ERR(&glsl_len, sizeof(glsl_len));
+    WRITE_OR_ERR(glsl, glsl_len);
+    WRITE_OR_ERR(&spv_len, sizeof(spv_len));
+    WRITE_OR_ERR(spv->data, spv_len);
+
+    #undef WRITE_OR_ERR
+
+    fclose(file);
+    g_free(path);
+    return;
+
+error:
+    fprintf(stderr, "nv2a: Failed to write SPIR-V file to %s\n", path);
+    qemu_unlink(path);
+    g_free(path);
+}
+
+static void *spv_cache_reload_from_disk(void *arg)
+{
+    char *list_path = spv_cache_get_list_path();
+    FILE *list = qemu_fopen(list_path, "rb");
+    g_free(list_path);
+    if (!list) {
+        return NULL;
+    }
+
+    uint64_t hash;
+    while (fread(&hash, sizeof(uint64_t), 1, list) == 1) {
+        qemu_mutex_lock(&spv_cache.lock);
+        bool present = g_hash_table_contains(spv_cache.used, &hash) ||
+                       g_hash_table_contains(spv_cache.entries, &hash);
+        qemu_mutex_unlock(&spv_cache.lock);
+        if (present) {
+            continue;
+        }
+
+        SpvCacheEntry *entry = spv_cache_load_from_disk(hash);
+        if (!entry) {
+            continue;
+        }
+
+        qemu_mutex_lock(&spv_cache.lock);
+        if (g_hash_table_contains(spv_cache.used, &hash)) {
+            /* Already compiled or loaded by the renderer in the meantime */
+            spv_cache_entry_free(entry);
+        } else {
+            g_hash_table_insert(spv_cache.entries, g_memdup2(&hash, sizeof(hash)),
+                                entry);
+        }
+        qemu_mutex_unlock(&spv_cache.lock);
+    }
+
+    fclose(list);
+    return NULL;
+}
+
+static void spv_cache_write_reload_list(void)
+{
+    char *list_path = spv_cache_get_list_path();
+    FILE *list = qemu_fopen(list_path, "wb");
+    g_free(list_path);
+    if (!list) {
+        fprintf(stderr, "nv2a: Failed to open SPIR-V cache list for writing\n");
+        return;
+    }
+
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, spv_cache.used);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (fwrite(key, sizeof(uint64_t), 1, list) != 1) {
+            fprintf(stderr, "nv2a: Failed to write SPIR-V cache list\n");
+            break;
+        }
+    }
+
+    fclose(list);
+}
+
+static void init_spv_cache(void)
+{
+    /*
+     * Debug builds of shaders embed source and skip optimization, don't mix
+     * them with the cache.
+     */
+    spv_cache.enabled = g_config.perf.cache_shaders &&
+                        !g_config.display.vulkan.debug_shaders;
+    if (!spv_cache.enabled) {
+        return;
+    }
+
+    qemu_mutex_init(&spv_cache.lock);
+    spv_cache.entries = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              g_free, spv_cache_entry_free);
+    spv_cache.used =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    spv_cache_create_folder();
+
+    qemu_thread_create(&spv_cache.reload_thread, "pgraph.vk.spv_cache",
+                       spv_cache_reload_from_disk, NULL, QEMU_THREAD_JOINABLE);
+}
+
+static void finalize_spv_cache(void)
+{
+    if (!spv_cache.enabled) {
+        return;
+    }
+
+    qemu_thread_join(&spv_cache.reload_thread);
+    spv_cache_write_reload_list();
+
+    g_hash_table_destroy(spv_cache.entries);
+    g_hash_table_destroy(spv_cache.used);
+    spv_cache.entries = NULL;
+    spv_cache.used = NULL;
+    qemu_mutex_destroy(&spv_cache.lock);
+    spv_cache.enabled = false;
+}
+
+/*
+ * Returns cached SPIR-V for the given source, or NULL if it must be compiled.
+ * Either way the hash is recorded in the reload list.
+ */
+static GByteArray *spv_cache_lookup(uint64_t hash, glslang_stage_t stage,
+                                    const char *glsl)
+{
+    SpvCacheEntry *entry = NULL;
+
+    qemu_mutex_lock(&spv_cache.lock);
+    if (!g_hash_table_contains(spv_cache.used, &hash)) {
+        g_hash_table_add(spv_cache.used, g_memdup2(&hash, sizeof(hash)));
+    }
+    gpointer key;
+    if (g_hash_table_steal_extended(spv_cache.entries, &hash, &key,
+                                    (gpointer *)&entry)) {
+        g_free(key);
+    }
+    qemu_mutex_unlock(&spv_cache.lock);
+
+    if (!entry) {
+        /* Not preloaded (yet), try reading it directly */
+        entry = spv_cache_load_from_disk(hash);
+    }
+    if (!entry) {
+        return NULL;
+    }
+
+    GByteArray *spv = NULL;
+    if (entry->stage == stage && !strcmp(entry->glsl, glsl)) {
+        spv = entry->spv;
+        entry->spv = NULL;
+    }
+    spv_cache_entry_free(entry);
+
+    return spv;
+}
+
+static GByteArray *get_spv_for_glsl(glslang_stage_t stage, const char *glsl,
+                                    bool *cache_hit)
+{
+    *cache_hit = false;
+    if (!spv_cache.enabled) {
+        return pgraph_vk_compile_glsl_to_spv(stage, glsl);
+    }
+
+    uint64_t hash = spv_cache_hash(stage, glsl);
+    GByteArray *spv = spv_cache_lookup(hash, stage, glsl);
+    if (spv) {
+        *cache_hit = true;
+        return spv;
+    }
+
+    spv = pgraph_vk_compile_glsl_to_spv(stage, glsl);
+    if (spv) {
+        spv_cache_write_to_disk(hash, stage, glsl, spv);
+    }
+
+    return spv;
+}
+
 void pgraph_vk_init_glsl_compiler(void)
 {
     glslang_initialize_process();
+    init_spv_cache();
 }
 
 void pgraph_vk_finalize_glsl_compiler(void)
 {
+    finalize_spv_cache();
     glslang_finalize_process();
 }
 
@@ -357,8 +716,8 @@ ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
 {
     ShaderModuleInfo *info = g_malloc0(sizeof(*info));
     info->glsl = strdup(glsl);
-    info->spirv = pgraph_vk_compile_glsl_to_spv(
-        vk_shader_stage_to_glslang_stage(stage), glsl);
+    info->spirv = get_spv_for_glsl(vk_shader_stage_to_glslang_stage(stage),
+                                   glsl, &info->spv_cache_hit);
     info->module = pgraph_vk_create_shader_module_from_spv(r, info->spirv);
     init_layout_from_spv(info);
     return info;
@@ -351,6 +351,7 @@ QueueFamilyIndices pgraph_vk_find_queue_families(VkPhysicalDevice device)
         int required_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
         if ((queueFamily.queueFlags & required_flags) == required_flags) {
             indices.queue_family = i;
+            indices.queue_count = queueFamily.queueCount;
         }
         if (is_queue_family_indicies_complete(indices)) {
             break;
@@ -408,6 +409,12 @@ static void add_optional_device_extension_names(
     r->memory_budget_extension_enabled = add_extension_if_available(
         available_extensions, enabled_extension_names,
         VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    if (r->display.direct_present) {
+        r->swapchain_extension_enabled = add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 }
 
 static bool check_device_support_required_extensions(VkPhysicalDevice device)
@@ -513,13 +520,17 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
                 g_array_index(enabled_extension_names, char *, i));
     }
 
-    float queuePriority = 1.0f;
+    // Presenting may block for vsync, so the UI gets its own queue if possible
+    bool separate_present_queue =
+        pgraph_vk_direct_present_enabled() && indices.queue_count > 1;
+
+    float queue_priorities[] = { 1.0f, 1.0f };
 
     VkDeviceQueueCreateInfo queue_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = indices.queue_family,
-        .queueCount = 1,
-        .pQueuePriorities = &queuePriority,
+        .queueCount = separate_present_queue ? 2 : 1,
+        .pQueuePriorities = queue_priorities,
     };
 
     // Ensure device supports required features
@@ -556,6 +567,17 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
         return false;
     }
 
+    // Optional, S3TC textures are decompressed on the CPU without it
+    r->texture_compression_bc_enabled =
+        available_features.textureCompressionBC == VK_TRUE;
+    enabled_features.textureCompressionBC =
+        r->texture_compression_bc_enabled;
+
+    // Optional, batched draws are issued one by one without it
+    r->multi_draw_indirect_enabled =
+        available_features.multiDrawIndirect == VK_TRUE;
+    enabled_features.multiDrawIndirect = r->multi_draw_indirect_enabled;
+
     void *next_struct = NULL;
 
     VkPhysicalDeviceProvokingVertexFeaturesEXT provoking_vertex_features;
@@ -604,6 +626,11 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
     }
 
     vkGetDeviceQueue(r->device, indices.queue_family, 0, &r->queue);
+    r->present_queue = r->queue;
+    if (separate_present_queue) {
+        vkGetDeviceQueue(r->device, indices.queue_family, 1,
+                         &r->present_queue);
+    }
     return true;
 }
 
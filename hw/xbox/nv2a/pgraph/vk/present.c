@@ -0,0 +1,152 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "renderer.h"
+
+static bool direct_present_enabled;
+
+void nv2a_vk_enable_direct_present(void)
+{
+    direct_present_enabled = true;
+}
+
+bool pgraph_vk_direct_present_enabled(void)
+{
+    return direct_present_enabled;
+}
+
+static PGRAPHVkState *get_direct_present_renderer_state(void)
+{
+    PGRAPHState *pg = &g_nv2a->pgraph;
+
+    assert(pg->framebuffer_in_use);
+
+    if (pg->renderer->type != CONFIG_DISPLAY_RENDERER_VULKAN) {
+        return NULL;
+    }
+
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    if (!r || !r->display.direct_present) {
+        return NULL;
+    }
+
+    return r;
+}
+
+bool nv2a_vk_get_present_context(NV2AVkPresentContext *ctx)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    if (!r || !r->swapchain_extension_enabled) {
+        return false;
+    }
+
+    *ctx = (NV2AVkPresentContext){
+        .instance = r->instance,
+        .physical_device = r->physical_device,
+        .device = r->device,
+        .queue_family =
+            pgraph_vk_find_queue_families(r->physical_device).queue_family,
+        .queue = r->present_queue,
+    };
+
+    return true;
+}
+
+bool nv2a_vk_get_display_image(NV2AVkDisplayImage *image)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    if (!r || r->display.image == VK_NULL_HANDLE ||
+        r->display.draw_time == 0) {
+        return false;
+    }
+
+    *image = (NV2AVkDisplayImage){
+        .image = r->display.image,
+        .image_view = r->display.image_view,
+        .width = r->display.width,
+        .height = r->display.height,
+    };
+
+    return true;
+}
+
+void nv2a_vk_lock_queue(void)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    assert(r);
+    if (r->present_queue == r->queue) {
+        qemu_mutex_lock(&r->queue_lock);
+    }
+}
+
+void nv2a_vk_unlock_queue(void)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    assert(r);
+    if (r->present_queue == r->queue) {
+        qemu_mutex_unlock(&r->queue_lock);
+    }
+}
+
+void nv2a_vk_wait_queue_idle(void)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    assert(r);
+
+    if (r->present_queue != r->queue) {
+        VK_CHECK(vkQueueWaitIdle(r->present_queue));
+        return;
+    }
+
+    // Equivalent to vkQueueWaitIdle, without holding the lock while waiting
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    VkFence fence;
+    VK_CHECK(vkCreateFence(r->device, &fence_info, NULL, &fence));
+    qemu_mutex_lock(&r->queue_lock);
+    VK_CHECK(vkQueueSubmit(r->queue, 0, NULL, fence));
+    qemu_mutex_unlock(&r->queue_lock);
+    VK_CHECK(vkWaitForFences(r->device, 1, &fence, VK_TRUE, UINT64_MAX));
+    vkDestroyFence(r->device, fence, NULL);
+}
+
+void nv2a_vk_set_present_finalize(NV2AVkPresentFinalizeFunc func,
+                                  void *opaque)
+{
+    PGRAPHVkState *r = get_direct_present_renderer_state();
+    assert(r);
+    r->display.present_finalize = func;
+    r->display.present_finalize_opaque = opaque;
+}
+
+void pgraph_vk_finalize_present(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->display.present_finalize) {
+        // The UI stops using the present queue before it's waited on
+        r->display.present_finalize(r->display.present_finalize_opaque);
+        r->display.present_finalize = NULL;
+        r->display.present_finalize_opaque = NULL;
+        qemu_mutex_lock(&r->queue_lock);
+        VK_CHECK(vkDeviceWaitIdle(r->device));
+        qemu_mutex_unlock(&r->queue_lock);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_VK_PRESENT_H
+#define HW_XBOX_NV2A_PGRAPH_VK_PRESENT_H
+
+#include <stdbool.h>
+#include <volk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Direct presentation lets the UI put the display image on a swapchain of the
+ * main window itself, instead of sampling it through OpenGL interop.
+ *
+ * Except for nv2a_vk_enable_direct_present, these may only be called by the UI
+ * thread while it holds the framebuffer, i.e. between
+ * nv2a_get_framebuffer_surface and nv2a_release_framebuffer_surface.
+ */
+
+typedef struct NV2AVkPresentContext {
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    uint32_t queue_family;
+    VkQueue queue;
+} NV2AVkPresentContext;
+
+typedef struct NV2AVkDisplayImage {
+    VkImage image; // In VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    VkImageView image_view;
+    int width, height;
+} NV2AVkDisplayImage;
+
+typedef void (*NV2AVkPresentFinalizeFunc)(void *opaque);
+
+/* Must be called before the renderer is initialized */
+void nv2a_vk_enable_direct_present(void);
+
+/* Returns false if the active renderer doesn't present directly */
+bool nv2a_vk_get_present_context(NV2AVkPresentContext *ctx);
+
+/* Returns false if there is no display image yet */
+bool nv2a_vk_get_display_image(NV2AVkDisplayImage *image);
+
+/*
+ * The queue may be shared with the renderer, hold the lock to use it. Only
+ * hold it for the call itself, never while blocking (e.g. in a fence wait).
+ */
+void nv2a_vk_lock_queue(void);
+void nv2a_vk_unlock_queue(void);
+
+/* Like vkQueueWaitIdle, takes the lock itself and doesn't hold it to wait */
+void nv2a_vk_wait_queue_idle(void);
+
+/*
+ * Called before the renderer destroys the device, the UI must release all
+ * objects it created from the present context.
+ */
+void nv2a_vk_set_present_finalize(NV2AVkPresentFinalizeFunc func,
+                                  void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
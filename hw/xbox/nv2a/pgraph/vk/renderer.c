@@ -38,6 +38,8 @@ static void pgraph_vk_init(NV2AState *d, Error **errp)
     PGRAPHState *pg = &d->pgraph;
 
     pg->vk_renderer_state = (PGRAPHVkState *)g_malloc0(sizeof(PGRAPHVkState));
+    pg->vk_renderer_state->display.direct_present =
+        pgraph_vk_direct_present_enabled();
 
 #if HAVE_EXTERNAL_MEMORY
     glo_set_current(g_gl_context);
@@ -55,6 +57,7 @@ static void pgraph_vk_init(NV2AState *d, Error **errp)
     pgraph_vk_init_surfaces(pg);
     pgraph_vk_init_shaders(pg);
     pgraph_vk_init_pipelines(pg);
+    pgraph_vk_init_blit(pg);
     pgraph_vk_init_textures(pg);
     pgraph_vk_init_reports(pg);
     pgraph_vk_init_compute(pg);
@@ -68,10 +71,13 @@ static void pgraph_vk_finalize(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    pgraph_vk_ensure_submit_complete(pg);
+    pgraph_vk_finalize_present(pg);
     pgraph_vk_finalize_display(pg);
     pgraph_vk_finalize_compute(pg);
     pgraph_vk_finalize_reports(pg);
     pgraph_vk_finalize_textures(pg);
+    pgraph_vk_finalize_blit(pg);
     pgraph_vk_finalize_pipelines(pg);
     pgraph_vk_finalize_shaders(pg);
     pgraph_vk_finalize_surfaces(pg);
@@ -122,6 +128,7 @@ static void pgraph_vk_process_pending(NV2AState *d)
     ) {
         qemu_mutex_unlock(&d->pfifo.lock);
         qemu_mutex_lock(&d->pgraph.lock);
+        pgraph_vk_ensure_submit_complete(&d->pgraph);
         if (qatomic_read(&r->downloads_pending)) {
             pgraph_vk_process_pending_downloads(d);
         }
@@ -141,6 +148,7 @@ static void pgraph_vk_process_pending(NV2AState *d)
 
 static void pgraph_vk_flip_stall(NV2AState *d)
 {
+    pgraph_vk_queue_surface_downloads(d);
     pgraph_vk_finish(&d->pgraph, VK_FINISH_REASON_FLIP_STALL);
     pgraph_vk_debug_frame_terminator();
 }
@@ -194,7 +202,7 @@ static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
     pfifo_kick(d);
     qemu_mutex_unlock(&d->pfifo.lock);
     qemu_event_wait(&d->pgraph.sync_complete);
-    return r->display.gl_texture_id;
+    return r->display.direct_present ? 0 : r->display.gl_texture_id;
 #else
     qemu_mutex_unlock(&d->pfifo.lock);
     pgraph_vk_wait_for_surface_download(surface);
@@ -202,6 +210,21 @@ static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
 #endif
 }
 
+#if HAVE_EXTERNAL_MEMORY
+static void pgraph_vk_release_framebuffer_surface(NV2AState *d)
+{
+    if (d->pgraph.vk_renderer_state->display.direct_present) {
+        return;
+    }
+
+    /*
+     * The display image is shared with GL without semaphores, so it must not
+     * be rendered again until GL is done sampling it.
+     */
+    glFinish();
+}
+#endif
+
 static PGRAPHRenderer pgraph_vk_renderer = {
     .type = CONFIG_DISPLAY_RENDERER_VULKAN,
     .name = "Vulkan",
@@ -226,7 +249,12 @@ static PGRAPHRenderer pgraph_vk_renderer = {
         .surface_update = pgraph_vk_surface_update,
         .set_surface_scale_factor = pgraph_vk_set_surface_scale_factor,
         .get_surface_scale_factor = pgraph_vk_get_surface_scale_factor,
+        .apply_surface_scale_factor = pgraph_vk_apply_surface_scale_factor,
+        .get_gpu_time = pgraph_vk_get_gpu_time,
         .get_framebuffer_surface = pgraph_vk_get_framebuffer_surface,
+#if HAVE_EXTERNAL_MEMORY
+        .release_framebuffer_surface = pgraph_vk_release_framebuffer_surface,
+#endif
     }
 };
 
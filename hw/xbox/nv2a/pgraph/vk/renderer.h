@@ -24,6 +24,8 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/mstring.h"
+#include "qemu/interval-tree.h"
 #include "hw/hw.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "hw/xbox/nv2a/nv2a_regs.h"
@@ -40,11 +42,13 @@
 #include "debug.h"
 #include "constants.h"
 #include "glsl.h"
+#include "present.h"
 
 #define HAVE_EXTERNAL_MEMORY 1
 
 typedef struct QueueFamilyIndices {
     int queue_family;
+    uint32_t queue_count;
 } QueueFamilyIndices;
 
 typedef struct MemorySyncRequirement {
@@ -61,6 +65,11 @@ typedef struct RenderPass {
     VkRenderPass render_pass;
 } RenderPass;
 
+typedef struct BlitAlphaPipeline {
+    VkFormat format;
+    VkPipeline pipeline;
+} BlitAlphaPipeline;
+
 typedef struct PipelineKey {
     bool clear;
     RenderPassState render_pass_state;
@@ -107,6 +116,7 @@ typedef struct StorageBuffer {
 
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode range; /* [vram_addr, vram_addr + size) */
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -120,6 +130,7 @@ typedef struct SurfaceBinding {
     unsigned int width;
     unsigned int height;
     unsigned int pitch;
+    unsigned int scale; // Of the image, see pgraph_vk_rescale_surface
     size_t size;
 
     bool cleared;
@@ -141,12 +152,24 @@ typedef struct SurfaceBinding {
     VkImageLayout image_scratch_current_layout;
     VmaAllocation allocation_scratch;
 
+    // Readback queued at end of frame for surfaces the CPU reads
+    VkBuffer readback_buffer;
+    VmaAllocation readback_allocation;
+    void *readback_mapped;
+    bool readback_hint;
+    bool readback_queued;
+    bool readback_swizzled;
+    int readback_draw_time;
+    uint32_t readback_submit_index;
+
     bool initialized;
 } SurfaceBinding;
 
 typedef struct ShaderModuleInfo {
     char *glsl;
     GByteArray *spirv;
+    /* Counted on the PGRAPH thread, the module may be built on a worker */
+    bool spv_cache_hit;
     VkShaderModule module;
     SpvReflectShaderModule reflect_module;
     SpvReflectDescriptorSet **descriptor_sets;
@@ -154,9 +177,20 @@ typedef struct ShaderModuleInfo {
     ShaderUniformLayout push_constants;
 } ShaderModuleInfo;
 
+typedef struct ShaderModuleCompileJob {
+    VkShaderStageFlagBits stage;
+    MString *glsl;
+    ShaderModuleInfo *module;
+    bool async;
+    bool done;
+    QemuEvent complete;
+} ShaderModuleCompileJob;
+
 typedef struct ShaderBinding {
     LruNode node;
     bool initialized;
+    bool compiling;
+    ShaderModuleCompileJob compile_jobs[3]; // Geometry, vertex, fragment
 
     ShaderState state;
     ShaderModuleInfo *geometry;
@@ -194,6 +228,7 @@ typedef struct ShaderBinding {
     int material_alpha_loc;
 
     int uniform_attrs_loc;
+    int vertex_fetch_loc;
 } ShaderBinding;
 
 typedef struct TextureKey {
@@ -220,6 +255,8 @@ typedef struct TextureBinding {
     uint64_t hash;
     unsigned int draw_time;
     uint32_t submit_time;
+    IntervalTreeNode texture_range;
+    IntervalTreeNode palette_range;
 } TextureBinding;
 
 typedef struct QueryReport {
@@ -285,6 +322,11 @@ typedef struct PGRAPHVkDisplayState {
     int width, height;
     int draw_time;
 
+    // Presented by the UI on a swapchain instead of shared with OpenGL
+    bool direct_present;
+    NV2AVkPresentFinalizeFunc present_finalize;
+    void *present_finalize_opaque;
+
     // OpenGL Interop
 #ifdef WIN32
     HANDLE handle;
@@ -295,10 +337,32 @@ typedef struct PGRAPHVkDisplayState {
     GLuint gl_texture_id;
 } PGRAPHVkDisplayState;
 
+typedef enum ComputeTextureDecode {
+    COMPUTE_TEX_DECODE_NONE,
+    COMPUTE_TEX_DECODE_UNSWIZZLE_8,
+    COMPUTE_TEX_DECODE_UNSWIZZLE_16,
+    COMPUTE_TEX_DECODE_UNSWIZZLE_32,
+    COMPUTE_TEX_DECODE_I8_PALETTE,
+    COMPUTE_TEX_DECODE_R6G5B5,
+    COMPUTE_TEX_DECODE_YUY2,
+    COMPUTE_TEX_DECODE_UYVY,
+    // Linear to swizzled, used to download swizzled surfaces
+    COMPUTE_SURF_SWIZZLE_8,
+    COMPUTE_SURF_SWIZZLE_16,
+    COMPUTE_SURF_SWIZZLE_32,
+} ComputeTextureDecode;
+
+typedef struct ComputeTextureLevel {
+    unsigned int width, height, pitch;
+    VkDeviceSize in_offset; // Relative to the input buffer binding
+    VkDeviceSize out_offset; // Relative to the output buffer binding
+} ComputeTextureLevel;
+
 typedef struct ComputePipelineKey {
     VkFormat host_fmt;
     bool pack;
     int workgroup_size;
+    ComputeTextureDecode tex_decode;
 } ComputePipelineKey;
 
 typedef struct ComputePipeline {
@@ -327,6 +391,9 @@ typedef struct PGRAPHVkState {
     bool custom_border_color_extension_enabled;
     bool provoking_vertex_extension_enabled;
     bool memory_budget_extension_enabled;
+    bool swapchain_extension_enabled;
+    bool texture_compression_bc_enabled;
+    bool multi_draw_indirect_enabled;
 
     VkPhysicalDevice physical_device;
     VkPhysicalDeviceProperties device_props;
@@ -335,6 +402,8 @@ typedef struct PGRAPHVkState {
     uint32_t allocator_last_submit_index;
 
     VkQueue queue;
+    QemuMutex queue_lock; // Shared with the UI if present_queue is queue
+    VkQueue present_queue; // For the UI, see present.c
     VkCommandPool command_pool;
     VkCommandBuffer command_buffers[2];
 
@@ -344,6 +413,12 @@ typedef struct PGRAPHVkState {
     unsigned int command_buffer_start_time;
     bool in_command_buffer;
     uint32_t submit_count;
+    bool submit_pending; // Fence wait deferred, see pgraph_vk_finish
+    bool submit_check_budget;
+
+    VkQueryPool timestamp_query_pool; // Null if timestamps are unsupported
+    int64_t submit_start_us;
+    uint64_t gpu_time; // Total us spent executing submissions
 
     VkCommandBuffer aux_command_buffer;
     bool in_aux_command_buffer;
@@ -359,6 +434,10 @@ typedef struct PGRAPHVkState {
 
     Lru pipeline_cache;
     VkPipelineCache vk_pipeline_cache;
+    VkPipelineCache vk_pipeline_cache_loaded; // From disk, pending merge
+    QemuThread pipeline_cache_load_thread;
+    bool pipeline_cache_load_pending;
+    bool pipeline_cache_load_complete;
     PipelineBinding *pipeline_cache_entries;
     PipelineBinding *pipeline_binding;
     bool pipeline_binding_changed;
@@ -382,8 +461,10 @@ typedef struct PGRAPHVkState {
     VkVertexInputBindingDescription vertex_binding_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
     int num_active_vertex_binding_descriptions;
     hwaddr vertex_attribute_offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
+    bool vertex_fetch_supported;
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    IntervalTreeRoot surface_ranges; /* Index of valid surfaces by VRAM range */
     QTAILQ_HEAD(, SurfaceBinding) invalid_surfaces;
     SurfaceBinding *color_binding, *zeta_binding;
     bool downloads_pending;
@@ -393,17 +474,24 @@ typedef struct PGRAPHVkState {
 
     Lru texture_cache;
     TextureBinding *texture_cache_entries;
+    IntervalTreeRoot texture_ranges; /* Index of cache entries by VRAM range */
+    IntervalTreeRoot palette_ranges;
     TextureBinding *texture_bindings[NV2A_MAX_TEXTURES];
     TextureBinding dummy_texture;
     bool texture_bindings_changed;
     VkFormatProperties *texture_format_properties;
+    bool s3tc_format_supported[3]; // Indexed by S3TC_DECOMPRESS_FORMAT
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
+    GThreadPool *shader_compile_pool;
     ShaderBinding *shader_binding;
     ShaderModuleInfo *quad_vert_module, *solid_frag_module;
     bool shader_bindings_changed;
 
+    VkPipelineLayout blit_alpha_pipeline_layout;
+    GArray *blit_alpha_pipelines; // BlitAlphaPipeline
+
     // FIXME: Merge these into a structure
     uint64_t uniform_buffer_hashes[2];
     size_t uniform_buffer_offsets[2];
@@ -507,6 +595,7 @@ void pgraph_vk_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface);
 SurfaceBinding *pgraph_vk_surface_get_within(NV2AState *d, hwaddr addr);
 void pgraph_vk_wait_for_surface_download(SurfaceBinding *e);
 void pgraph_vk_download_dirty_surfaces(NV2AState *d);
+void pgraph_vk_queue_surface_downloads(NV2AState *d);
 void pgraph_vk_download_surfaces_in_range_if_dirty(PGRAPHState *pg, hwaddr start, hwaddr size);
 void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                                    bool force);
@@ -517,6 +606,8 @@ void pgraph_vk_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 void pgraph_vk_set_surface_scale_factor(NV2AState *d, unsigned int scale);
 unsigned int pgraph_vk_get_surface_scale_factor(NV2AState *d);
 void pgraph_vk_reload_surface_scale_factor(PGRAPHState *pg);
+void pgraph_vk_apply_surface_scale_factor(NV2AState *d, unsigned int scale);
+void pgraph_vk_rescale_surface(NV2AState *d, SurfaceBinding *surface);
 
 // surface-compute.c
 void pgraph_vk_init_compute(PGRAPHState *pg);
@@ -529,12 +620,24 @@ void pgraph_vk_pack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
 void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
                                     VkCommandBuffer cmd, VkBuffer src,
                                     VkBuffer dst);
+size_t pgraph_vk_get_texture_decode_output_size(ComputeTextureDecode decode,
+                                                unsigned int width,
+                                                unsigned int height);
+void pgraph_vk_decode_texture(PGRAPHState *pg, VkCommandBuffer cmd,
+                              ComputeTextureDecode decode,
+                              VkDescriptorBufferInfo *buffers,
+                              const ComputeTextureLevel *levels,
+                              int num_levels);
 
 // display.c
 void pgraph_vk_init_display(PGRAPHState *pg);
 void pgraph_vk_finalize_display(PGRAPHState *pg);
 void pgraph_vk_render_display(PGRAPHState *pg);
 
+// present.c
+bool pgraph_vk_direct_present_enabled(void);
+void pgraph_vk_finalize_present(PGRAPHState *pg);
+
 // texture.c
 void pgraph_vk_init_textures(PGRAPHState *pg);
 void pgraph_vk_finalize_textures(PGRAPHState *pg);
@@ -547,7 +650,7 @@ void pgraph_vk_trim_texture_cache(PGRAPHState *pg);
 void pgraph_vk_init_shaders(PGRAPHState *pg);
 void pgraph_vk_finalize_shaders(PGRAPHState *pg);
 void pgraph_vk_update_descriptor_sets(PGRAPHState *pg);
-void pgraph_vk_bind_shaders(PGRAPHState *pg);
+bool pgraph_vk_bind_shaders(PGRAPHState *pg);
 void pgraph_vk_update_shader_uniforms(PGRAPHState *pg);
 
 // reports.c
@@ -577,15 +680,21 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter);
 void pgraph_vk_draw_begin(NV2AState *d);
 void pgraph_vk_draw_end(NV2AState *d);
 void pgraph_vk_finish(PGRAPHState *pg, FinishReason why);
+void pgraph_vk_ensure_submit_complete(PGRAPHState *pg);
+uint64_t pgraph_vk_get_gpu_time(NV2AState *d);
 void pgraph_vk_flush_draw(NV2AState *d);
 void pgraph_vk_begin_command_buffer(PGRAPHState *pg);
 void pgraph_vk_ensure_command_buffer(PGRAPHState *pg);
 void pgraph_vk_ensure_not_in_render_pass(PGRAPHState *pg);
+VkRenderPass pgraph_vk_get_render_pass(PGRAPHVkState *r,
+                                       RenderPassState *state);
 
 VkCommandBuffer pgraph_vk_begin_nondraw_commands(PGRAPHState *pg);
 void pgraph_vk_end_nondraw_commands(PGRAPHState *pg, VkCommandBuffer cmd);
 
 // blit.c
+void pgraph_vk_init_blit(PGRAPHState *pg);
+void pgraph_vk_finalize_blit(PGRAPHState *pg);
 void pgraph_vk_image_blit(NV2AState *d);
 
 #endif
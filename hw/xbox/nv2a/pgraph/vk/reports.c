@@ -37,6 +37,17 @@ void pgraph_vk_init_reports(PGRAPHState *pg)
     };
     VK_CHECK(
         vkCreateQueryPool(r->device, &pool_create_info, NULL, &r->query_pool));
+
+    r->timestamp_query_pool = VK_NULL_HANDLE;
+    if (r->device_props.limits.timestampComputeAndGraphics) {
+        VkQueryPoolCreateInfo timestamp_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2,
+        };
+        VK_CHECK(vkCreateQueryPool(r->device, &timestamp_pool_create_info,
+                                   NULL, &r->timestamp_query_pool));
+    }
 }
 
 void pgraph_vk_finalize_reports(PGRAPHState *pg)
@@ -50,6 +61,9 @@ void pgraph_vk_finalize_reports(PGRAPHState *pg)
     }
 
     vkDestroyQueryPool(r->device, r->query_pool, NULL);
+    if (r->timestamp_query_pool) {
+        vkDestroyQueryPool(r->device, r->timestamp_query_pool, NULL);
+    }
 }
 
 void pgraph_vk_clear_report_value(NV2AState *d)
@@ -153,7 +167,12 @@ void pgraph_vk_process_pending_reports(NV2AState *d)
     uint32_t *dma_get = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
     uint32_t *dma_put = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
 
-    if (*dma_get == *dma_put && r->in_command_buffer) {
-        pgraph_vk_finish(pg, VK_FINISH_REASON_STALLED);
+    if (*dma_get == *dma_put) {
+        if (r->in_command_buffer) {
+            pgraph_vk_finish(pg, VK_FINISH_REASON_STALLED);
+        } else {
+            /* Guest may be polling for a report written on completion */
+            pgraph_vk_ensure_submit_complete(pg);
+        }
     }
 }
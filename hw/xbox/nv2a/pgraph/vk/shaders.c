@@ -24,6 +24,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/error-report.h"
 #include "hw/xbox/nv2a/pgraph/shaders.h"
 #include "hw/xbox/nv2a/pgraph/util.h"
 #include "hw/xbox/nv2a/pgraph/glsl/geom.h"
@@ -31,6 +32,7 @@
 #include "hw/xbox/nv2a/pgraph/glsl/psh.h"
 #include "qemu/fast-hash.h"
 #include "qemu/mstring.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 #include <locale.h>
 
@@ -50,6 +52,10 @@ static void create_descriptor_pool(PGRAPHState *pg)
         {
             .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .descriptorCount = NV2A_MAX_TEXTURES * num_sets,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = num_sets,
         }
     };
 
@@ -76,7 +82,7 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    VkDescriptorSetLayoutBinding bindings[2 + NV2A_MAX_TEXTURES];
+    VkDescriptorSetLayoutBinding bindings[3 + NV2A_MAX_TEXTURES];
 
     bindings[0] = (VkDescriptorSetLayoutBinding){
         .binding = VSH_UBO_BINDING,
@@ -98,6 +104,12 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
             .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
         };
     }
+    bindings[2 + NV2A_MAX_TEXTURES] = (VkDescriptorSetLayoutBinding){
+        .binding = VSH_VRAM_BINDING,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+    };
     VkDescriptorSetLayoutCreateInfo layout_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
         .bindingCount = ARRAY_SIZE(bindings),
@@ -179,7 +191,8 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         need_uniform_write = true;
     }
 
-    VkWriteDescriptorSet descriptor_writes[2 + NV2A_MAX_TEXTURES];
+    VkWriteDescriptorSet descriptor_writes[3 + NV2A_MAX_TEXTURES];
+    uint32_t num_descriptor_writes = 2 + NV2A_MAX_TEXTURES;
 
     assert(r->descriptor_set_index < ARRAY_SIZE(r->descriptor_sets));
 
@@ -231,7 +244,25 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         };
     }
 
-    vkUpdateDescriptorSets(r->device, 6, descriptor_writes, 0, NULL);
+    VkDescriptorBufferInfo vram_buffer_info = {
+        .buffer = r->storage_buffers[BUFFER_VERTEX_RAM].buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    if (r->vertex_fetch_supported) {
+        descriptor_writes[num_descriptor_writes++] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = r->descriptor_sets[r->descriptor_set_index],
+            .dstBinding = VSH_VRAM_BINDING,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .pBufferInfo = &vram_buffer_info,
+        };
+    }
+
+    vkUpdateDescriptorSets(r->device, num_descriptor_writes, descriptor_writes,
+                           0, NULL);
 
     r->descriptor_set_index++;
 }
@@ -309,6 +340,123 @@ static void update_shader_constant_locations(ShaderBinding *binding)
 
     binding->uniform_attrs_loc =
         uniform_index(&binding->vertex->uniforms, "inlineValue");
+    binding->vertex_fetch_loc =
+        uniform_index(&binding->vertex->uniforms, "vertexFetch");
+}
+
+static void shader_compile_worker(gpointer data, gpointer user_data)
+{
+    PGRAPHVkState *r = user_data;
+    ShaderModuleCompileJob *job = data;
+
+    job->module = pgraph_vk_create_shader_module_from_glsl(
+        r, job->stage, mstring_get_str(job->glsl));
+    qatomic_store_release(&job->done, true);
+    qemu_event_set(&job->complete);
+}
+
+static void init_shader_compile_pool(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    /*
+     * Generated GLSL needs a '.' radix and no grouping, both when it is
+     * printed here and when glslang parses it on the workers. The locale is
+     * process wide, so set it once before any worker exists rather than
+     * switching it around each cache miss while other threads use it.
+     */
+    setlocale(LC_NUMERIC, "C");
+
+    int num_threads = MIN(MAX((int)g_get_num_processors() - 2, 1), 4);
+    r->shader_compile_pool = g_thread_pool_new(shader_compile_worker, r,
+                                               num_threads, TRUE, NULL);
+    if (!r->shader_compile_pool) {
+        warn_report("nv2a: Failed to create shader compile pool, shaders "
+                    "will be compiled serially");
+    }
+}
+
+static void finalize_shader_compile_pool(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->shader_compile_pool) {
+        g_thread_pool_free(r->shader_compile_pool, FALSE, TRUE);
+        r->shader_compile_pool = NULL;
+    }
+}
+
+static void submit_shader_compile_job(PGRAPHVkState *r,
+                                      ShaderModuleCompileJob *job,
+                                      VkShaderStageFlagBits stage,
+                                      MString *glsl)
+{
+    job->stage = stage;
+    job->glsl = glsl;
+    job->module = NULL;
+    job->done = false;
+    job->async = r->shader_compile_pool != NULL;
+
+    if (!job->async) {
+        job->module = pgraph_vk_create_shader_module_from_glsl(
+            r, stage, mstring_get_str(glsl));
+        job->done = true;
+        return;
+    }
+
+    qemu_event_init(&job->complete, false);
+    g_thread_pool_push(r->shader_compile_pool, job, NULL);
+}
+
+/*
+ * Collects the modules of a binding whose stages are being compiled on the
+ * pool. Returns false without blocking if !wait and compilation is still in
+ * progress.
+ */
+static bool finish_shader_compile(PGRAPHVkState *r, ShaderBinding *snode,
+                                  bool wait)
+{
+    if (snode->initialized) {
+        return true;
+    }
+    assert(snode->compiling);
+
+    if (!wait) {
+        for (int i = 0; i < ARRAY_SIZE(snode->compile_jobs); i++) {
+            ShaderModuleCompileJob *job = &snode->compile_jobs[i];
+            if (job->glsl && !qatomic_load_acquire(&job->done)) {
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(snode->compile_jobs); i++) {
+        ShaderModuleCompileJob *job = &snode->compile_jobs[i];
+        if (!job->glsl) {
+            continue;
+        }
+        if (job->async) {
+            qemu_event_wait(&job->complete);
+            qemu_event_destroy(&job->complete);
+            job->async = false;
+        }
+        mstring_unref(job->glsl);
+        job->glsl = NULL;
+        if (job->module && job->module->spv_cache_hit) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_SPV_CACHE_HIT);
+        }
+    }
+
+    snode->geometry = snode->compile_jobs[0].module;
+    snode->vertex = snode->compile_jobs[1].module;
+    snode->fragment = snode->compile_jobs[2].module;
+
+    update_shader_constant_locations(snode);
+
+    snode->compiling = false;
+    snode->initialized = true;
+
+    return true;
 }
 
 static void shader_cache_entry_init(Lru *lru, LruNode *node, void *state)
@@ -316,6 +464,7 @@ static void shader_cache_entry_init(Lru *lru, LruNode *node, void *state)
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
     memcpy(&snode->state, state, sizeof(ShaderState));
     snode->initialized = false;
+    snode->compiling = false;
 }
 
 static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -323,6 +472,10 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
 
+    if (snode->compiling) {
+        finish_shader_compile(r, snode, true);
+    }
+
     ShaderModuleInfo *modules[] = {
         snode->geometry,
         snode->vertex,
@@ -372,23 +525,21 @@ static ShaderBinding *gen_shaders(PGRAPHState *pg, ShaderState *state)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    uint64_t hash = fast_hash((void *)state, sizeof(*state));
+    uint64_t hash = pgraph_hash_shader_state(state);
     LruNode *node = lru_lookup(&r->shader_cache, hash, state);
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
 
     NV2A_VK_DPRINTF("shader state hash: %016" PRIx64 " %p", hash, snode);
 
-    if (!snode->initialized) {
+    if (!snode->initialized && !snode->compiling) {
         NV2A_VK_DPRINTF("cache miss");
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
 
-        char *previous_numeric_locale = setlocale(LC_NUMERIC, NULL);
-        if (previous_numeric_locale) {
-            previous_numeric_locale = g_strdup(previous_numeric_locale);
-        }
-
-        /* Ensure numeric values are printed with '.' radix, no grouping */
-        setlocale(LC_NUMERIC, "C");
+        memset(snode->compile_jobs, 0, sizeof(snode->compile_jobs));
+        snode->geometry = NULL;
+        snode->vertex = NULL;
+        snode->fragment = NULL;
+        snode->compiling = true;
 
         MString *geometry_shader_code = pgraph_gen_geom_glsl(
             state->polygon_front_mode, state->polygon_back_mode,
@@ -396,39 +547,33 @@ static ShaderBinding *gen_shaders(PGRAPHState *pg, ShaderState *state)
         if (geometry_shader_code) {
             NV2A_VK_DPRINTF("geometry shader: \n%s",
                             mstring_get_str(geometry_shader_code));
-            snode->geometry = pgraph_vk_create_shader_module_from_glsl(
-                r, VK_SHADER_STAGE_GEOMETRY_BIT,
-                mstring_get_str(geometry_shader_code));
-            mstring_unref(geometry_shader_code);
-        } else {
-            snode->geometry = NULL;
         }
 
         MString *vertex_shader_code =
             pgraph_gen_vsh_glsl(state, geometry_shader_code != NULL);
         NV2A_VK_DPRINTF("vertex shader: \n%s",
                         mstring_get_str(vertex_shader_code));
-        snode->vertex = pgraph_vk_create_shader_module_from_glsl(
-            r, VK_SHADER_STAGE_VERTEX_BIT,
-            mstring_get_str(vertex_shader_code));
-        mstring_unref(vertex_shader_code);
 
         MString *fragment_shader_code = pgraph_gen_psh_glsl(state->psh);
         NV2A_VK_DPRINTF("fragment shader: \n%s",
                         mstring_get_str(fragment_shader_code));
-        snode->fragment = pgraph_vk_create_shader_module_from_glsl(
-            r, VK_SHADER_STAGE_FRAGMENT_BIT,
-            mstring_get_str(fragment_shader_code));
-        mstring_unref(fragment_shader_code);
-
-        if (previous_numeric_locale) {
-            setlocale(LC_NUMERIC, previous_numeric_locale);
-            g_free(previous_numeric_locale);
-        }
 
-        update_shader_constant_locations(snode);
+        /* Stages are compiled in parallel, the jobs take the references */
+        if (geometry_shader_code) {
+            submit_shader_compile_job(r, &snode->compile_jobs[0],
+                                      VK_SHADER_STAGE_GEOMETRY_BIT,
+                                      geometry_shader_code);
+        }
+        submit_shader_compile_job(r, &snode->compile_jobs[1],
+                                  VK_SHADER_STAGE_VERTEX_BIT,
+                                  vertex_shader_code);
+        submit_shader_compile_job(r, &snode->compile_jobs[2],
+                                  VK_SHADER_STAGE_FRAGMENT_BIT,
+                                  fragment_shader_code);
+    }
 
-        snode->initialized = true;
+    if (!g_config.perf.async_shader_compile) {
+        finish_shader_compile(r, snode, true);
     }
 
     return snode;
@@ -626,6 +771,19 @@ static void shader_update_constants(PGRAPHState *pg, ShaderBinding *binding,
         }
     }
 
+    if (binding->vertex_fetch_loc != -1) {
+        PGRAPHVkState *r = pg->vk_renderer_state;
+        int32_t fetch[NV2A_VERTEXSHADER_ATTRIBUTES][4] = { 0 };
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            if (state->fetch_attrs & (1 << i)) {
+                fetch[i][0] = r->vertex_attribute_offsets[i];
+                fetch[i][1] = pg->vertex_attributes[i].stride;
+            }
+        }
+        uniform1iv(&binding->vertex->uniforms, binding->vertex_fetch_loc,
+                   NV2A_VERTEXSHADER_ATTRIBUTES * 4, &fetch[0][0]);
+    }
+
     /* update vertex program constants */
     uniform1iv(&binding->vertex->uniforms, binding->vsh_constant_loc,
                NV2A_VERTEXSHADER_CONSTANTS * 4, (void *)pg->vsh_constants);
@@ -736,11 +894,20 @@ static bool check_shaders_dirty(PGRAPHState *pg)
     if (pg->uniform_attrs != state->uniform_attrs ||
         pg->swizzle_attrs != state->swizzle_attrs ||
         pg->compressed_attrs != state->compressed_attrs ||
+        pg->fetch_attrs != state->fetch_attrs ||
         pg->primitive_mode != state->primitive_mode ||
         pg->surface_scale_factor != state->surface_scale_factor) {
         return true;
     }
 
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        if ((pg->fetch_attrs & (1 << i)) &&
+            (pg->vertex_attributes[i].format != state->fetch_attr[i].format ||
+             pg->vertex_attributes[i].count != state->fetch_attr[i].count)) {
+            return true;
+        }
+    }
+
     // Textures
     for (int i = 0; i < 4; i++) {
         if (pg->texture_matrix_enable[i] != pg->vk_renderer_state->shader_binding->state.texture_matrix_enable[i] ||
@@ -756,7 +923,12 @@ static bool check_shaders_dirty(PGRAPHState *pg)
     return false;
 }
 
-void pgraph_vk_bind_shaders(PGRAPHState *pg)
+/*
+ * Returns false if asynchronous shader compilation is enabled and the shaders
+ * for the current state are not ready yet, in which case the draw should be
+ * skipped.
+ */
+bool pgraph_vk_bind_shaders(PGRAPHState *pg)
 {
     NV2A_VK_DGROUP_BEGIN("%s", __func__);
 
@@ -780,10 +952,21 @@ void pgraph_vk_bind_shaders(PGRAPHState *pg)
         }
     }
 
+    if (!r->shader_binding->initialized) {
+        if (!finish_shader_compile(r, r->shader_binding,
+                                   !g_config.perf.async_shader_compile)) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN_PENDING);
+            NV2A_VK_DGROUP_END();
+            return false;
+        }
+        r->shader_bindings_changed = true;
+    }
+
     // FIXME: Use dirty bits
     pgraph_vk_update_shader_uniforms(pg);
 
     NV2A_VK_DGROUP_END();
+    return true;
 }
 
 void pgraph_vk_update_shader_uniforms(PGRAPHState *pg)
@@ -819,12 +1002,14 @@ void pgraph_vk_init_shaders(PGRAPHState *pg)
     create_descriptor_pool(pg);
     create_descriptor_set_layout(pg);
     create_descriptor_sets(pg);
+    init_shader_compile_pool(pg);
     shader_cache_init(pg);
 }
 
 void pgraph_vk_finalize_shaders(PGRAPHState *pg)
 {
     shader_cache_finalize(pg);
+    finalize_shader_compile_pool(pg);
     destroy_descriptor_sets(pg);
     destroy_descriptor_set_layout(pg);
     destroy_descriptor_pool(pg);
@@ -117,6 +117,178 @@ const char *unpack_z24s8_to_d32_sfloat_s8_uint_glsl =
     "    }\n"
     "}\n";
 
+//
+// Texture decode shaders read raw guest texture bytes (binding 0) and write
+// linear, host-format texels (binding 2). Each invocation produces one 32-bit
+// output word. Offsets are passed as push constants so that all levels of a
+// texture can share a single descriptor set.
+//
+typedef struct TextureDecodePushConstants {
+    uint32_t width, height, pitch, count, in_offset, out_offset;
+} TextureDecodePushConstants;
+
+const char *texture_decode_common_glsl =
+    "layout(push_constant) uniform PushConstants {\n"
+    "    uint width, height, pitch, count, in_offset, out_offset;\n"
+    "};\n"
+    "layout(set = 0, binding = 0) buffer TextureIn { uint texture_in[]; };\n"
+    "layout(set = 0, binding = 1) buffer PaletteIn { uint palette_in[]; };\n"
+    "layout(set = 0, binding = 2) buffer TextureOut { uint texture_out[]; };\n"
+    "uint get_output_idx() {\n"
+    "    return gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x +\n"
+    "           gl_GlobalInvocationID.x;\n"
+    "}\n"
+    "uint read_byte(uint offset) {\n"
+    "    offset += in_offset;\n"
+    "    return (texture_in[offset / 4] >> ((offset % 4) * 8)) & 0xff;\n"
+    "}\n"
+    "uint get_swizzled_idx(uint x, uint y) {\n"
+    "    uint idx = 0, bit = 0;\n"
+    "    for (uint mask = 1; mask < width || mask < height; mask <<= 1) {\n"
+    "        if (mask < width) {\n"
+    "            idx |= ((x & mask) != 0 ? 1u : 0u) << bit++;\n"
+    "        }\n"
+    "        if (mask < height) {\n"
+    "            idx |= ((y & mask) != 0 ? 1u : 0u) << bit++;\n"
+    "        }\n"
+    "    }\n"
+    "    return idx;\n"
+    "}\n"
+    "uvec2 get_unswizzled_pos(uint idx) {\n"
+    "    uint x = 0, y = 0, bit = 0;\n"
+    "    for (uint mask = 1; mask < width || mask < height; mask <<= 1) {\n"
+    "        if (mask < width) {\n"
+    "            x |= ((idx >> bit++) & 1u) != 0 ? mask : 0u;\n"
+    "        }\n"
+    "        if (mask < height) {\n"
+    "            y |= ((idx >> bit++) & 1u) != 0 ? mask : 0u;\n"
+    "        }\n"
+    "    }\n"
+    "    return uvec2(x, y);\n"
+    "}\n";
+
+const char *unswizzle_texture_glsl =
+    "void main() {\n"
+    "    uint idx_out = get_output_idx();\n"
+    "    if (idx_out >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "#if BYTES_PER_PIXEL == 4\n"
+    "    uint offset = get_swizzled_idx(idx_out % width, idx_out / width) * 4;\n"
+    "    texture_out[out_offset + idx_out] = texture_in[(in_offset + offset) / 4];\n"
+    "#else\n"
+    "    uint size = width * height * BYTES_PER_PIXEL;\n"
+    "    uint value = 0;\n"
+    "    for (uint i = 0; i < 4; i++) {\n"
+    "        uint offset = idx_out * 4 + i;\n"
+    "        if (offset >= size) {\n"
+    "            break;\n"
+    "        }\n"
+    "        uint texel = offset / BYTES_PER_PIXEL;\n"
+    "        uint src = get_swizzled_idx(texel % width, texel / width) *\n"
+    "                   BYTES_PER_PIXEL + offset % BYTES_PER_PIXEL;\n"
+    "        value |= read_byte(src) << (i * 8);\n"
+    "    }\n"
+    "    texture_out[out_offset + idx_out] = value;\n"
+    "#endif\n"
+    "}\n";
+
+// Inverse of unswizzle_texture_glsl, used for surface downloads
+const char *swizzle_surface_glsl =
+    "void main() {\n"
+    "    uint idx_out = get_output_idx();\n"
+    "    if (idx_out >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "#if BYTES_PER_PIXEL == 4\n"
+    "    uvec2 pos = get_unswizzled_pos(idx_out);\n"
+    "    texture_out[out_offset + idx_out] =\n"
+    "        texture_in[(in_offset + pos.y * pitch + pos.x * 4) / 4];\n"
+    "#else\n"
+    "    uint size = width * height * BYTES_PER_PIXEL;\n"
+    "    uint value = 0;\n"
+    "    for (uint i = 0; i < 4; i++) {\n"
+    "        uint offset = idx_out * 4 + i;\n"
+    "        if (offset >= size) {\n"
+    "            break;\n"
+    "        }\n"
+    "        uvec2 pos = get_unswizzled_pos(offset / BYTES_PER_PIXEL);\n"
+    "        uint src = pos.y * pitch + pos.x * BYTES_PER_PIXEL +\n"
+    "                   offset % BYTES_PER_PIXEL;\n"
+    "        value |= read_byte(src) << (i * 8);\n"
+    "    }\n"
+    "    texture_out[out_offset + idx_out] = value;\n"
+    "#endif\n"
+    "}\n";
+
+const char *convert_i8_palette_texture_glsl =
+    "void main() {\n"
+    "    uint idx_out = get_output_idx();\n"
+    "    if (idx_out >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "    uint index = read_byte(get_swizzled_idx(idx_out % width, idx_out / width));\n"
+    "    texture_out[out_offset + idx_out] = palette_in[index];\n"
+    "}\n";
+
+// Matches pgraph_convert_texture_data, output is R8G8B8_SNORM
+const char *convert_r6g5b5_texture_glsl =
+    "uint get_converted_byte(uint offset) {\n"
+    "    uint texel = offset / 3;\n"
+    "    uint src = get_swizzled_idx(texel % width, texel / width) * 2;\n"
+    "    uint rgb655 = read_byte(src) | (read_byte(src + 1) << 8);\n"
+    "    rgb655 ^= (1u << 9) | (1u << 4);\n"
+    "    uint component = offset % 3;\n"
+    "    int value;\n"
+    "    if (component == 0) {\n"
+    "        value = int((rgb655 & 0xFC00u) >> 10) * 0x7F / 0x3F;\n"
+    "    } else if (component == 1) {\n"
+    "        value = int((rgb655 & 0x03E0u) >> 5) * 0xFF / 0x1F - 0x80;\n"
+    "    } else {\n"
+    "        value = int(rgb655 & 0x001Fu) * 0xFF / 0x1F - 0x80;\n"
+    "    }\n"
+    "    return uint(value) & 0xff;\n"
+    "}\n"
+    "void main() {\n"
+    "    uint idx_out = get_output_idx();\n"
+    "    if (idx_out >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "    uint size = width * height * 3;\n"
+    "    uint value = 0;\n"
+    "    for (uint i = 0; i < 4; i++) {\n"
+    "        uint offset = idx_out * 4 + i;\n"
+    "        if (offset >= size) {\n"
+    "            break;\n"
+    "        }\n"
+    "        value |= get_converted_byte(offset) << (i * 8);\n"
+    "    }\n"
+    "    texture_out[out_offset + idx_out] = value;\n"
+    "}\n";
+
+// Matches convert_yuy2_to_rgb/convert_uyvy_to_rgb, output is R8G8B8A8_UNORM
+const char *convert_yuv_texture_glsl =
+    "#if UYVY\n"
+    "const uint y_idx = 1, u_idx = 0, v_idx = 2;\n"
+    "#else\n"
+    "const uint y_idx = 0, u_idx = 1, v_idx = 3;\n"
+    "#endif\n"
+    "void main() {\n"
+    "    uint idx_out = get_output_idx();\n"
+    "    if (idx_out >= count) {\n"
+    "        return;\n"
+    "    }\n"
+    "    uint x = idx_out % width;\n"
+    "    uint base = (idx_out / width) * pitch + (x & ~1u) * 2;\n"
+    "    int c = int(read_byte(base + (x & 1u) * 2 + y_idx)) - 16;\n"
+    "    int d = int(read_byte(base + u_idx)) - 128;\n"
+    "    int e = int(read_byte(base + v_idx)) - 128;\n"
+    "    uint r = uint(clamp((298 * c + 409 * e + 128) >> 8, 0, 255));\n"
+    "    uint g = uint(clamp((298 * c - 100 * d - 208 * e + 128) >> 8, 0, 255));\n"
+    "    uint b = uint(clamp((298 * c + 516 * d + 128) >> 8, 0, 255));\n"
+    "    texture_out[out_offset + idx_out] = r | (g << 8) | (b << 16) | 0xff000000u;\n"
+    "}\n";
+
 static gchar *get_compute_shader_glsl(VkFormat host_fmt, bool pack,
                                       int workgroup_size)
 {
@@ -146,6 +318,67 @@ static gchar *get_compute_shader_glsl(VkFormat host_fmt, bool pack,
     return glsl;
 }
 
+static gchar *get_texture_decode_glsl(ComputeTextureDecode decode,
+                                     int workgroup_size)
+{
+    const char *defines = "";
+    const char *template = NULL;
+
+    switch (decode) {
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_8:
+        defines = "#define BYTES_PER_PIXEL 1\n";
+        template = unswizzle_texture_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_16:
+        defines = "#define BYTES_PER_PIXEL 2\n";
+        template = unswizzle_texture_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_32:
+        defines = "#define BYTES_PER_PIXEL 4\n";
+        template = unswizzle_texture_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_I8_PALETTE:
+        template = convert_i8_palette_texture_glsl;
+        break;
+    case COMPUTE_SURF_SWIZZLE_8:
+        defines = "#define BYTES_PER_PIXEL 1\n";
+        template = swizzle_surface_glsl;
+        break;
+    case COMPUTE_SURF_SWIZZLE_16:
+        defines = "#define BYTES_PER_PIXEL 2\n";
+        template = swizzle_surface_glsl;
+        break;
+    case COMPUTE_SURF_SWIZZLE_32:
+        defines = "#define BYTES_PER_PIXEL 4\n";
+        template = swizzle_surface_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_R6G5B5:
+        template = convert_r6g5b5_texture_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_YUY2:
+        defines = "#define UYVY 0\n";
+        template = convert_yuv_texture_glsl;
+        break;
+    case COMPUTE_TEX_DECODE_UYVY:
+        defines = "#define UYVY 1\n";
+        template = convert_yuv_texture_glsl;
+        break;
+    default:
+        assert(!"Unsupported texture decode");
+        break;
+    }
+    assert(template);
+
+    gchar *glsl = g_strdup_printf(
+        "#version 450\n"
+        "layout(local_size_x = %d, local_size_y = 1, local_size_z = 1) in;\n"
+        "%s%s%s", workgroup_size, defines, texture_decode_common_glsl,
+        template);
+    assert(glsl);
+
+    return glsl;
+}
+
 static void create_descriptor_pool(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -245,7 +478,7 @@ static void create_compute_pipeline_layout(PGRAPHState *pg)
 
     VkPushConstantRange push_constant_range = {
         .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-        .size = 2 * sizeof(uint32_t),
+        .size = sizeof(TextureDecodePushConstants),
     };
     VkPipelineLayoutCreateInfo pipeline_layout_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -352,6 +585,18 @@ static int get_workgroup_size_for_output_units(PGRAPHVkState *r, int output_unit
     return group_size;
 }
 
+static ComputePipeline *lookup_compute_pipeline(PGRAPHVkState *r,
+                                                ComputePipelineKey *key)
+{
+    LruNode *node = lru_lookup(&r->compute.pipeline_cache,
+                      fast_hash((void *)key, sizeof(*key)), key);
+    ComputePipeline *pipeline = container_of(node, ComputePipeline, node);
+
+    assert(pipeline);
+
+    return pipeline;
+}
+
 static ComputePipeline *get_compute_pipeline(PGRAPHVkState *r, VkFormat host_fmt, bool pack, int output_units)
 {
     int workgroup_size = get_workgroup_size_for_output_units(r, output_units);
@@ -363,13 +608,20 @@ static ComputePipeline *get_compute_pipeline(PGRAPHVkState *r, VkFormat host_fmt
     key.pack = pack;
     key.workgroup_size = workgroup_size;
 
-    LruNode *node = lru_lookup(&r->compute.pipeline_cache,
-                      fast_hash((void *)&key, sizeof(key)), &key);
-    ComputePipeline *pipeline = container_of(node, ComputePipeline, node);
+    return lookup_compute_pipeline(r, &key);
+}
 
-    assert(pipeline);
+static ComputePipeline *get_texture_decode_pipeline(PGRAPHVkState *r,
+                                                    ComputeTextureDecode decode,
+                                                    int workgroup_size)
+{
+    ComputePipelineKey key;
+    memset(&key, 0, sizeof(key));
 
-    return pipeline;
+    key.tex_decode = decode;
+    key.workgroup_size = workgroup_size;
+
+    return lookup_compute_pipeline(r, &key);
 }
 
 //
@@ -524,6 +776,99 @@ void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
     pgraph_vk_end_debug_marker(r, cmd);
 }
 
+size_t pgraph_vk_get_texture_decode_output_size(ComputeTextureDecode decode,
+                                                unsigned int width,
+                                                unsigned int height)
+{
+    switch (decode) {
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_8:
+    case COMPUTE_SURF_SWIZZLE_8:
+        return width * height;
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_16:
+    case COMPUTE_SURF_SWIZZLE_16:
+        return width * height * 2;
+    case COMPUTE_TEX_DECODE_R6G5B5:
+        return width * height * 3;
+    case COMPUTE_TEX_DECODE_UNSWIZZLE_32:
+    case COMPUTE_SURF_SWIZZLE_32:
+    case COMPUTE_TEX_DECODE_I8_PALETTE:
+    case COMPUTE_TEX_DECODE_YUY2:
+    case COMPUTE_TEX_DECODE_UYVY:
+        return width * height * 4;
+    default:
+        assert(!"Unsupported texture decode");
+        return 0;
+    }
+}
+
+//
+// Unswizzle and/or convert guest texture levels from src (buffers[0]) into
+// tightly packed host format levels in dst (buffers[2]). buffers[1] holds the
+// palette for I8 textures.
+//
+void pgraph_vk_decode_texture(PGRAPHState *pg, VkCommandBuffer cmd,
+                              ComputeTextureDecode decode,
+                              VkDescriptorBufferInfo *buffers,
+                              const ComputeTextureLevel *levels,
+                              int num_levels)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    // Levels are not evenly divisible, shaders check bounds instead
+    const int workgroup_size = 64;
+    assert(r->device_props.limits.maxComputeWorkGroupSize[0] >=
+           workgroup_size);
+
+    update_descriptor_sets(pg, buffers, 3);
+
+    ComputePipeline *pipeline =
+        get_texture_decode_pipeline(r, decode, workgroup_size);
+
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_PINK, __func__);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+    vkCmdBindDescriptorSets(
+        cmd, VK_PIPELINE_BIND_POINT_COMPUTE, r->compute.pipeline_layout, 0, 1,
+        &r->compute.descriptor_sets[r->compute.descriptor_set_index - 1], 0,
+        NULL);
+
+    for (int i = 0; i < num_levels; i++) {
+        const ComputeTextureLevel *level = &levels[i];
+
+        assert(level->out_offset % 4 == 0);
+        assert(decode != COMPUTE_TEX_DECODE_UNSWIZZLE_32 ||
+               level->in_offset % 4 == 0);
+
+        size_t output_units = DIV_ROUND_UP(
+            pgraph_vk_get_texture_decode_output_size(decode, level->width,
+                                                     level->height),
+            4);
+
+        TextureDecodePushConstants push_constants = {
+            .width = level->width,
+            .height = level->height,
+            .pitch = level->pitch,
+            .count = output_units,
+            .in_offset = level->in_offset,
+            .out_offset = level->out_offset / 4,
+        };
+        vkCmdPushConstants(cmd, r->compute.pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(push_constants), &push_constants);
+
+        // Large levels are split over the Y dimension to stay within limits
+        size_t group_count = DIV_ROUND_UP(output_units, workgroup_size);
+        uint32_t group_count_x = MIN(
+            group_count, r->device_props.limits.maxComputeWorkGroupCount[0]);
+        uint32_t group_count_y = DIV_ROUND_UP(group_count, group_count_x);
+        assert(r->device_props.limits.maxComputeWorkGroupCount[1] >=
+               group_count_y);
+
+        vkCmdDispatch(cmd, group_count_x, group_count_y, 1);
+    }
+
+    pgraph_vk_end_debug_marker(r, cmd);
+}
+
 static void pipeline_cache_entry_init(Lru *lru, LruNode *node, void *state)
 {
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, compute.pipeline_cache);
@@ -536,8 +881,14 @@ static void pipeline_cache_entry_init(Lru *lru, LruNode *node, void *state)
                 "Warning: Needed compute shader with workgroup size = 1\n");
     }
 
-    gchar *glsl = get_compute_shader_glsl(
-        snode->key.host_fmt, snode->key.pack, snode->key.workgroup_size);
+    gchar *glsl;
+    if (snode->key.tex_decode != COMPUTE_TEX_DECODE_NONE) {
+        glsl = get_texture_decode_glsl(snode->key.tex_decode,
+                                       snode->key.workgroup_size);
+    } else {
+        glsl = get_compute_shader_glsl(
+            snode->key.host_fmt, snode->key.pack, snode->key.workgroup_size);
+    }
     assert(glsl);
     snode->pipeline = create_compute_pipeline(r, glsl);
     g_free(glsl);
@@ -67,7 +67,8 @@ void pgraph_vk_set_surface_scale_factor(NV2AState *d, unsigned int scale)
 
 unsigned int pgraph_vk_get_surface_scale_factor(NV2AState *d)
 {
-    return d->pgraph.surface_scale_factor; // FIXME: Move internal to renderer
+    // The dynamic scale may be lower, see dynamic_scale.c
+    return MAX(g_config.display.quality.surface_scale, 1);
 }
 
 void pgraph_vk_reload_surface_scale_factor(PGRAPHState *pg)
@@ -122,77 +123,159 @@ static void memcpy_image(void *dst, void const *src, int dst_stride,
     }
 }
 
+static hwaddr surface_range_last(SurfaceBinding const *surface)
+{
+    return surface->vram_addr + MAX(surface->size, 1) - 1;
+}
+
+static SurfaceBinding *surface_range_first(PGRAPHVkState *r, hwaddr start,
+                                           hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_first(&r->surface_ranges, start, last);
+    return node ? container_of(node, SurfaceBinding, range) : NULL;
+}
+
+static SurfaceBinding *surface_range_next(SurfaceBinding *surface,
+                                          hwaddr start, hwaddr last)
+{
+    IntervalTreeNode *node =
+        interval_tree_iter_next(&surface->range, start, last);
+    return node ? container_of(node, SurfaceBinding, range) : NULL;
+}
+
 void pgraph_vk_download_surfaces_in_range_if_dirty(PGRAPHState *pg, hwaddr start, hwaddr size)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
     SurfaceBinding *surface;
 
-    hwaddr end = start + size - 1;
+    hwaddr last = start + MAX(size, 1) - 1;
 
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-        hwaddr surf_end = surface->vram_addr + surface->size - 1;
-        bool overlapping = !(surface->vram_addr >= end || start >= surf_end);
-        if (overlapping) {
-            pgraph_vk_surface_download_if_dirty(
-                container_of(pg, NV2AState, pgraph), surface);
-        }
+    for (surface = surface_range_first(r, start, last); surface;
+         surface = surface_range_next(surface, start, last)) {
+        pgraph_vk_surface_download_if_dirty(
+            container_of(pg, NV2AState, pgraph), surface);
     }
 }
 
-static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
-                                       uint8_t *pixels)
+static bool surface_download_uses_compute(SurfaceBinding const *surface)
 {
-    PGRAPHState *pg = &d->pgraph;
-    PGRAPHVkState *r = pg->vk_renderer_state;
+    return surface->host_fmt.vk_format == VK_FORMAT_D24_UNORM_S8_UINT ||
+           surface->host_fmt.vk_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
 
-    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
+static ComputeTextureDecode get_surface_swizzle_kernel(SurfaceBinding const *surface)
+{
+    switch (surface->fmt.bytes_per_pixel) {
+    case 1:
+        return COMPUTE_SURF_SWIZZLE_8;
+    case 2:
+        return COMPUTE_SURF_SWIZZLE_16;
+    case 4:
+        return COMPUTE_SURF_SWIZZLE_32;
+    default:
+        return COMPUTE_TEX_DECODE_NONE;
+    }
+}
 
-    bool use_compute_to_convert_depth_stencil_format =
-        surface->host_fmt.vk_format == VK_FORMAT_D24_UNORM_S8_UINT ||
-        surface->host_fmt.vk_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+/*
+ * Swizzled color and D16 surfaces can be swizzled by a compute pass ahead of
+ * the host copy. Packed depth-stencil formats already use the compute path
+ * and are swizzled on the CPU afterwards.
+ */
+static bool surface_download_can_swizzle_on_gpu(SurfaceBinding const *surface)
+{
+    return surface->swizzle && !surface_download_uses_compute(surface) &&
+           surface->host_fmt.host_bytes_per_pixel ==
+               surface->fmt.bytes_per_pixel &&
+           get_surface_swizzle_kernel(surface) != COMPUTE_TEX_DECODE_NONE;
+}
 
-    bool no_conversion_necessary =
-        surface->color || use_compute_to_convert_depth_stencil_format ||
-        surface->host_fmt.vk_format == VK_FORMAT_D16_UNORM;
+static void record_surface_swizzle(PGRAPHState *pg, SurfaceBinding *surface,
+                                   VkCommandBuffer cmd, VkBuffer src,
+                                   VkBuffer dst)
+{
+    size_t size = surface->width * surface->height *
+                  surface->fmt.bytes_per_pixel;
 
-    assert(no_conversion_necessary);
+    VkBufferMemoryBarrier pre_swizzle_barriers[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = src,
+            .size = VK_WHOLE_SIZE,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = dst,
+            .size = VK_WHOLE_SIZE,
+        },
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                         ARRAY_SIZE(pre_swizzle_barriers),
+                         pre_swizzle_barriers, 0, NULL);
+
+    VkDescriptorBufferInfo buffers[] = {
+        {
+            .buffer = src,
+            .offset = 0,
+            .range = ROUND_UP(size, 4),
+        },
+        {
+            .buffer = src, // Unused palette binding
+            .offset = 0,
+            .range = 4,
+        },
+        {
+            .buffer = dst,
+            .offset = 0,
+            .range = ROUND_UP(size, 4),
+        },
+    };
+    ComputeTextureLevel level = {
+        .width = surface->width,
+        .height = surface->height,
+        .pitch = surface->width * surface->fmt.bytes_per_pixel,
+    };
+    pgraph_vk_decode_texture(pg, cmd, get_surface_swizzle_kernel(surface),
+                             buffers, &level, 1);
 
-    bool compute_needs_finish = (use_compute_to_convert_depth_stencil_format &&
-                                 pgraph_vk_compute_needs_finish(r));
+    VkBufferMemoryBarrier post_swizzle_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = src,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &post_swizzle_barrier, 0, NULL);
+}
 
-    if (r->in_command_buffer &&
-        surface->draw_time >= r->command_buffer_start_time) {
-        pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_DOWN);
-    } else if (compute_needs_finish) {
-        pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
-    }
+static void record_surface_download(PGRAPHState *pg, SurfaceBinding *surface,
+                                    VkCommandBuffer cmd, VkBuffer dst_buffer,
+                                    bool gpu_swizzle)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
 
+    bool use_compute_to_convert_depth_stencil_format =
+        surface_download_uses_compute(surface);
     bool downscale = (pg->surface_scale_factor != 1);
 
-    trace_nv2a_pgraph_surface_download(
-        surface->color ? "COLOR" : "ZETA",
-        surface->swizzle ? "sz" : "lin", surface->vram_addr,
-        surface->width, surface->height, surface->pitch,
-        surface->fmt.bytes_per_pixel);
-
-    // Read surface into memory
-    uint8_t *gl_read_buf = pixels;
-
-    uint8_t *swizzle_buf = pixels;
-    if (surface->swizzle) {
-        // FIXME: Swizzle in shader
-        assert(pg->surface_scale_factor == 1 || downscale);
-        swizzle_buf = (uint8_t *)g_malloc(surface->size);
-        gl_read_buf = swizzle_buf;
-    }
-
     unsigned int scaled_width = surface->width,
                  scaled_height = surface->height;
     pgraph_apply_scaling_factor(pg, &scaled_width, &scaled_height);
 
-    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
-    pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
-
     pgraph_vk_transition_image_layout(
         pg, cmd, surface->image, surface->host_fmt.vk_format,
         surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
@@ -271,18 +354,14 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
     }
 
     //
-    // Copy image to staging buffer, or to compute_dst if we need to pack it
+    // Copy image to destination buffer, or to compute_dst if we need to pack
+    // it
     //
 
-    size_t downloaded_image_size = surface->host_fmt.host_bytes_per_pixel *
-                                   surface->width * surface->height;
-    assert((downloaded_image_size) <=
-           r->storage_buffers[BUFFER_STAGING_DST].buffer_size);
-
-    int copy_buffer_idx = use_compute_to_convert_depth_stencil_format ?
-                             BUFFER_COMPUTE_DST :
-                             BUFFER_STAGING_DST;
-    VkBuffer copy_buffer = r->storage_buffers[copy_buffer_idx].buffer;
+    VkBuffer copy_buffer = (use_compute_to_convert_depth_stencil_format ||
+                            gpu_swizzle) ?
+                               r->storage_buffers[BUFFER_COMPUTE_DST].buffer :
+                               dst_buffer;
 
     {
         VkBufferMemoryBarrier pre_copy_dst_barrier = {
@@ -379,10 +458,10 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                              &post_compute_dst_barrier, 0, NULL);
 
         //
-        // Copy packed image over to staging buffer for host download
+        // Copy packed image over to destination buffer for host download
         //
 
-        copy_buffer = r->storage_buffers[BUFFER_STAGING_DST].buffer;
+        copy_buffer = dst_buffer;
 
         VkBufferMemoryBarrier pre_copy_dst_barrier = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -414,24 +493,192 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
         vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
                              VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
                              &post_copy_src_barrier, 0, NULL);
+    } else if (gpu_swizzle) {
+        // The kernel writes straight into the host visible destination
+        record_surface_swizzle(pg, surface, cmd, copy_buffer, dst_buffer);
+        copy_buffer = dst_buffer;
     }
 
     //
-    // Download image data to host
+    // Make image data visible to host
     //
 
+    bool written_by_swizzle = gpu_swizzle &&
+                              !use_compute_to_convert_depth_stencil_format;
     VkBufferMemoryBarrier post_copy_dst_barrier = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .srcAccessMask = written_by_swizzle ? VK_ACCESS_SHADER_WRITE_BIT :
+                                              VK_ACCESS_TRANSFER_WRITE_BIT,
         .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .buffer = copy_buffer,
         .size = VK_WHOLE_SIZE
     };
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+    vkCmdPipelineBarrier(cmd,
+                         written_by_swizzle ?
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT :
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
                          &post_copy_dst_barrier, 0, NULL);
+}
+
+static void copy_downloaded_surface(SurfaceBinding const *surface,
+                                    void const *src, uint8_t *pixels,
+                                    bool swizzled)
+{
+    if (swizzled) {
+        memcpy(pixels, src,
+               surface->width * surface->height * surface->fmt.bytes_per_pixel);
+        return;
+    }
+
+    // Read surface into memory
+    uint8_t *gl_read_buf = pixels;
+
+    uint8_t *swizzle_buf = pixels;
+    if (surface->swizzle) {
+        // Formats without a GPU swizzle kernel
+        swizzle_buf = (uint8_t *)g_malloc(surface->size);
+        gl_read_buf = swizzle_buf;
+    }
+
+    memcpy_image(gl_read_buf, src, surface->pitch,
+                 surface->width * surface->fmt.bytes_per_pixel,
+                 surface->height);
+
+    if (surface->swizzle) {
+        swizzle_rect(swizzle_buf, surface->width, surface->height, pixels,
+                     surface->pitch, surface->fmt.bytes_per_pixel);
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE);
+        g_free(swizzle_buf);
+    }
+}
+
+static void create_readback_buffer(PGRAPHVkState *r, SurfaceBinding *surface)
+{
+    assert(!surface->readback_buffer);
+
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        // Written by vkCmdCopyImageToBuffer or the swizzle kernel, in words
+        .size = ROUND_UP(surface->host_fmt.host_bytes_per_pixel *
+                             surface->width * surface->height,
+                         4),
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+    };
+    VmaAllocationInfo alloc_info;
+    VK_CHECK(vmaCreateBuffer(r->allocator, &buffer_create_info,
+                             &alloc_create_info, &surface->readback_buffer,
+                             &surface->readback_allocation, &alloc_info));
+    surface->readback_mapped = alloc_info.pMappedData;
+}
+
+static void destroy_readback_buffer(PGRAPHVkState *r, SurfaceBinding *surface)
+{
+    if (!surface->readback_buffer) {
+        return;
+    }
+
+    vmaDestroyBuffer(r->allocator, surface->readback_buffer,
+                     surface->readback_allocation);
+    surface->readback_buffer = VK_NULL_HANDLE;
+    surface->readback_allocation = VK_NULL_HANDLE;
+    surface->readback_mapped = NULL;
+    surface->readback_queued = false;
+}
+
+static void resolve_queued_download(NV2AState *d, SurfaceBinding *surface,
+                                    uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->in_command_buffer &&
+        surface->readback_submit_index == r->submit_count) {
+        pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_DOWN);
+    }
+    pgraph_vk_ensure_submit_complete(pg);
+
+    trace_nv2a_pgraph_surface_download(
+        surface->color ? "COLOR" : "ZETA",
+        surface->swizzle ? "sz" : "lin", surface->vram_addr,
+        surface->width, surface->height, surface->pitch,
+        surface->fmt.bytes_per_pixel);
+
+    vmaInvalidateAllocation(r->allocator, surface->readback_allocation, 0,
+                            VK_WHOLE_SIZE);
+    copy_downloaded_surface(surface, surface->readback_mapped, pixels,
+                            surface->readback_swizzled);
+
+    surface->readback_queued = false;
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_QUEUED_HIT);
+}
+
+static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
+                                       uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
+
+    if (surface->readback_queued) {
+        if (surface->readback_draw_time == surface->draw_time) {
+            resolve_queued_download(d, surface, pixels);
+            return;
+        }
+        surface->readback_queued = false;
+    }
+
+    pgraph_vk_rescale_surface(d, surface);
+
+    bool use_compute_to_convert_depth_stencil_format =
+        surface_download_uses_compute(surface);
+
+    bool no_conversion_necessary =
+        surface->color || use_compute_to_convert_depth_stencil_format ||
+        surface->host_fmt.vk_format == VK_FORMAT_D16_UNORM;
+
+    assert(no_conversion_necessary);
+
+    bool gpu_swizzle = surface_download_can_swizzle_on_gpu(surface);
+
+    bool compute_needs_finish = ((use_compute_to_convert_depth_stencil_format ||
+                                  gpu_swizzle) &&
+                                 pgraph_vk_compute_needs_finish(r));
+
+    if (r->in_command_buffer &&
+        surface->draw_time >= r->command_buffer_start_time) {
+        pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_DOWN);
+    } else if (compute_needs_finish) {
+        pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
+    }
+
+    trace_nv2a_pgraph_surface_download(
+        surface->color ? "COLOR" : "ZETA",
+        surface->swizzle ? "sz" : "lin", surface->vram_addr,
+        surface->width, surface->height, surface->pitch,
+        surface->fmt.bytes_per_pixel);
+
+    size_t downloaded_image_size = surface->host_fmt.host_bytes_per_pixel *
+                                   surface->width * surface->height;
+    assert((downloaded_image_size) <=
+           r->storage_buffers[BUFFER_STAGING_DST].buffer_size);
+
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+
+    record_surface_download(pg, surface, cmd,
+                            r->storage_buffers[BUFFER_STAGING_DST].buffer,
+                            gpu_swizzle);
 
     nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_1);
     pgraph_vk_end_debug_marker(r, cmd);
@@ -446,20 +693,10 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                             r->storage_buffers[BUFFER_STAGING_DST].allocation,
                             0, VK_WHOLE_SIZE);
 
-    memcpy_image(gl_read_buf, mapped_memory_ptr, surface->pitch,
-                 surface->width * surface->fmt.bytes_per_pixel,
-                 surface->height);
+    copy_downloaded_surface(surface, mapped_memory_ptr, pixels, gpu_swizzle);
 
     vmaUnmapMemory(r->allocator,
                    r->storage_buffers[BUFFER_STAGING_DST].allocation);
-
-    if (surface->swizzle) {
-        // FIXME: Swizzle in shader
-        swizzle_rect(swizzle_buf, surface->width, surface->height, pixels,
-                     surface->pitch, surface->fmt.bytes_per_pixel);
-        nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE);
-        g_free(swizzle_buf);
-    }
 }
 
 static void download_surface(NV2AState *d, SurfaceBinding *surface, bool force)
@@ -470,6 +707,11 @@ static void download_surface(NV2AState *d, SurfaceBinding *surface, bool force)
 
     // FIXME: Respect write enable at last TOU?
 
+    if (surface->download_pending) {
+        // The CPU reads this surface, start fetching it ahead of time
+        surface->readback_hint = true;
+    }
+
     download_surface_to_buffer(d, surface, d->vram_ptr + surface->vram_addr);
 
     memory_region_set_client_dirty(d->vram, surface->vram_addr,
@@ -524,6 +766,52 @@ void pgraph_vk_download_dirty_surfaces(NV2AState *d)
     qemu_event_set(&r->dirty_surfaces_download_complete);
 }
 
+void pgraph_vk_queue_surface_downloads(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (!surface->readback_hint || !surface->draw_dirty ||
+            surface_download_uses_compute(surface) ||
+            surface->scale != pg->surface_scale_factor) {
+            continue;
+        }
+
+        if (surface->readback_queued) {
+            if (surface->readback_draw_time == surface->draw_time) {
+                continue;
+            }
+
+            // Surface was drawn again before the CPU got to the last copy
+            surface->readback_hint = false;
+            surface->readback_queued = false;
+            continue;
+        }
+
+        if (!surface->readback_buffer) {
+            create_readback_buffer(r, surface);
+        }
+
+        bool gpu_swizzle = surface_download_can_swizzle_on_gpu(surface) &&
+                           !pgraph_vk_compute_needs_finish(r);
+
+        VkCommandBuffer cmd = pgraph_vk_begin_nondraw_commands(pg);
+        pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+        record_surface_download(pg, surface, cmd, surface->readback_buffer,
+                                gpu_swizzle);
+        pgraph_vk_end_debug_marker(r, cmd);
+        pgraph_vk_end_nondraw_commands(pg, cmd);
+
+        surface->readback_queued = true;
+        surface->readback_swizzled = gpu_swizzle;
+        surface->readback_draw_time = surface->draw_time;
+        surface->readback_submit_index = r->submit_count;
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_QUEUED);
+    }
+}
+
 static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
                                     hwaddr len, bool write)
 {
@@ -612,6 +900,8 @@ static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
             surface->draw_time < r->command_buffer_start_time) &&
            "Surface evicted while in use!");
 
+    destroy_readback_buffer(r, surface);
+
     if (surface == r->color_binding) {
         assert(d->pgraph.surface_color.buffer_dirty);
         unbind_surface(d, true);
@@ -624,6 +914,7 @@ static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
     unregister_cpu_access_callback(d, surface);
 
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
+    interval_tree_remove(&surface->range, &r->surface_ranges);
     QTAILQ_INSERT_HEAD(&r->invalid_surfaces, surface, entry);
 }
 
@@ -632,20 +923,16 @@ static void invalidate_overlapping_surfaces(NV2AState *d,
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    uintptr_t e_end = surface->vram_addr + surface->size - 1;
+    hwaddr e_last = surface_range_last(surface);
 
-    SurfaceBinding *s, *next;
-    QTAILQ_FOREACH_SAFE(s, &r->surfaces, entry, next) {
-        uintptr_t s_end = s->vram_addr + s->size - 1;
-        bool overlapping =
-            !(s->vram_addr > e_end || surface->vram_addr > s_end);
-        if (overlapping) {
-            trace_nv2a_pgraph_surface_evict_overlapping(
-                s->vram_addr, s->width, s->height,
-                s->pitch);
-            pgraph_vk_surface_download_if_dirty(d, s);
-            invalidate_surface(d, s);
-        }
+    /* Invalidation removes the surface from the index, so restart lookup */
+    SurfaceBinding *s;
+    while ((s = surface_range_first(r, surface->vram_addr, e_last))) {
+        trace_nv2a_pgraph_surface_evict_overlapping(
+            s->vram_addr, s->width, s->height,
+            s->pitch);
+        pgraph_vk_surface_download_if_dirty(d, s);
+        invalidate_surface(d, s);
     }
 }
 
@@ -659,6 +946,9 @@ static void surface_put(NV2AState *d, SurfaceBinding *surface)
     register_cpu_access_callback(d, surface);
 
     QTAILQ_INSERT_HEAD(&r->surfaces, surface, entry);
+    surface->range.start = surface->vram_addr;
+    surface->range.last = surface_range_last(surface);
+    interval_tree_insert(&surface->range, &r->surface_ranges);
 }
 
 SurfaceBinding *pgraph_vk_surface_get(NV2AState *d, hwaddr addr)
@@ -666,7 +956,8 @@ SurfaceBinding *pgraph_vk_surface_get(NV2AState *d, hwaddr addr)
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (surface = surface_range_first(r, addr, addr); surface;
+         surface = surface_range_next(surface, addr, addr)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -680,9 +971,9 @@ SurfaceBinding *pgraph_vk_surface_get_within(NV2AState *d, hwaddr addr)
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
-        if (addr >= surface->vram_addr &&
-            addr < (surface->vram_addr + surface->size)) {
+    for (surface = surface_range_first(r, addr, addr); surface;
+         surface = surface_range_next(surface, addr, addr)) {
+        if (addr < surface->vram_addr + surface->size) {
             return surface;
         }
     }
@@ -740,6 +1031,8 @@ static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
         "Creating new surface image width=%d height=%d @ %08" HWADDR_PRIx,
         width, height, surface->vram_addr);
 
+    surface->scale = pg->surface_scale_factor;
+
     VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
@@ -801,6 +1094,7 @@ static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
 
 static void migrate_surface_image(SurfaceBinding *dst, SurfaceBinding *src)
 {
+    dst->scale = src->scale;
     dst->image = src->image;
     dst->image_view = src->image_view;
     dst->allocation = src->allocation;
@@ -837,6 +1131,7 @@ static bool check_invalid_surface_is_compatibile(SurfaceBinding *surface,
     return surface->host_fmt.vk_format == target->host_fmt.vk_format &&
            surface->width == target->width &&
            surface->height == target->height &&
+           surface->scale == target->scale &&
            surface->host_fmt.usage == target->host_fmt.usage;
 }
 
@@ -911,6 +1206,119 @@ void pgraph_vk_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface)
     }
 }
 
+/*
+ * Unlike pgraph_vk_set_surface_scale_factor, nothing is flushed here. This is
+ * called on the PGRAPH thread between frames, surfaces keep their images until
+ * they are used again, see pgraph_vk_rescale_surface.
+ */
+void pgraph_vk_apply_surface_scale_factor(NV2AState *d, unsigned int scale)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    // Rebind at the next draw, which rescales the bound surfaces
+    pg->surface_color.draw_dirty = false;
+    pg->surface_zeta.draw_dirty = false;
+    memset(&pg->last_surface_shape, 0, sizeof(pg->last_surface_shape));
+    unbind_surface(d, true);
+    unbind_surface(d, false);
+
+    pg->surface_scale_factor = MAX(scale, 1);
+}
+
+/*
+ * The surface scale can change between frames (see dynamic_scale.c). Rather
+ * than flushing every surface, surfaces drawn at a previous scale are brought
+ * to the current one when they are next bound, sampled, blitted or displayed.
+ */
+void pgraph_vk_rescale_surface(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (surface->scale == pg->surface_scale_factor) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_RESCALE);
+
+    // The old image may be referenced by commands recorded this frame
+    pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_CREATE);
+
+    bool keep_contents = surface->initialized && !surface->upload_pending;
+
+    if (keep_contents && surface_download_uses_compute(surface)) {
+        // Packed depth-stencil surfaces are never blitted, go through VRAM
+        unsigned int scale = pg->surface_scale_factor;
+        pg->surface_scale_factor = surface->scale;
+        pgraph_vk_surface_download_if_dirty(d, surface);
+        pg->surface_scale_factor = scale;
+        surface->upload_pending = true;
+        keep_contents = false;
+    }
+
+    SurfaceBinding old;
+    migrate_surface_image(&old, surface);
+    create_surface_image(pg, surface);
+    set_surface_label(pg, surface);
+
+    if (keep_contents) {
+        unsigned int width = surface->width, height = surface->height;
+        pgraph_apply_scaling_factor(pg, &width, &height);
+
+        VkImageLayout attachment_layout =
+            surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                             VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+        pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+
+        pgraph_vk_transition_image_layout(pg, cmd, old.image,
+                                          surface->host_fmt.vk_format,
+                                          attachment_layout,
+                                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        pgraph_vk_transition_image_layout(pg, cmd, surface->image,
+                                          surface->host_fmt.vk_format,
+                                          attachment_layout,
+                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        VkImageBlit blit_region = {
+            .srcSubresource.aspectMask = surface->host_fmt.aspect,
+            .srcSubresource.mipLevel = 0,
+            .srcSubresource.baseArrayLayer = 0,
+            .srcSubresource.layerCount = 1,
+            .srcOffsets[0] = (VkOffset3D){0, 0, 0},
+            .srcOffsets[1] = (VkOffset3D){surface->width * old.scale,
+                                          surface->height * old.scale, 1},
+
+            .dstSubresource.aspectMask = surface->host_fmt.aspect,
+            .dstSubresource.mipLevel = 0,
+            .dstSubresource.baseArrayLayer = 0,
+            .dstSubresource.layerCount = 1,
+            .dstOffsets[0] = (VkOffset3D){0, 0, 0},
+            .dstOffsets[1] = (VkOffset3D){width, height, 1},
+        };
+
+        vkCmdBlitImage(cmd, old.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       surface->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                       &blit_region,
+                       surface->color ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+
+        pgraph_vk_transition_image_layout(pg, cmd, surface->image,
+                                          surface->host_fmt.vk_format,
+                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                          attachment_layout);
+
+        pgraph_vk_end_debug_marker(r, cmd);
+        pgraph_vk_end_single_time_commands(pg, cmd);
+    }
+
+    destroy_surface_image(r, &old);
+
+    if (surface == r->color_binding || surface == r->zeta_binding) {
+        r->framebuffer_dirty = true;
+    }
+}
+
 void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                                    bool force)
 {
@@ -932,6 +1340,7 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                  surface->fmt.bytes_per_pixel);
 
     surface->upload_pending = false;
+    surface->readback_queued = false;
     surface->draw_time = pg->draw_time;
 
     uint8_t *data = d->vram_ptr;
@@ -1320,6 +1729,7 @@ static void populate_surface_binding_target_sized(NV2AState *d, bool color,
     target->width = width;
     target->height = height;
     target->pitch = surface->pitch;
+    target->scale = pg->surface_scale_factor;
     target->size = height * MAX(surface->pitch, width * fmt.bytes_per_pixel);
     target->upload_pending = true;
     target->download_pending = false;
@@ -1461,6 +1871,8 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
             }
 
             if (is_compatible) {
+                pgraph_vk_rescale_surface(d, surface);
+
                 // FIXME: Refactor
                 pg->surface_binding_dim.width = surface->width;
                 pg->surface_binding_dim.clip_x = surface->shape.clip_x;
@@ -1544,6 +1956,8 @@ void pgraph_vk_surface_update(NV2AState *d, bool upload, bool color_write,
     PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    pgraph_vk_ensure_submit_complete(pg);
+
     pg->surface_shape.z_format =
         GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER),
                  NV_PGRAPH_SETUPRASTER_Z_FORMAT);
@@ -1680,6 +2094,7 @@ void pgraph_vk_init_surfaces(PGRAPHState *pg)
     }
 
     QTAILQ_INIT(&r->surfaces);
+    r->surface_ranges = (IntervalTreeRoot){ 0 };
     QTAILQ_INIT(&r->invalid_surfaces);
 
     r->downloads_pending = false;
@@ -56,9 +56,10 @@ static VkSamplerAddressMode lookup_texture_address_mode(int idx)
 // FIXME: Use simple allocator
 typedef struct TextureLevel {
     unsigned int width, height, depth;
-    hwaddr vram_addr;
+    hwaddr vram_addr; // Source of levels uploaded as-is, if decoded_data unset
     void *decoded_data;
     size_t decoded_size;
+    TextureDecodeJob *decode;
 } TextureLevel;
 
 typedef struct TextureLayer {
@@ -84,6 +85,41 @@ static enum S3TC_DECOMPRESS_FORMAT kelvin_format_to_s3tc_format(int color_format
     }
 }
 
+static const VkFormat s3tc_format_vk_map[] = {
+    [S3TC_DECOMPRESS_FORMAT_DXT1] = VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+    [S3TC_DECOMPRESS_FORMAT_DXT3] = VK_FORMAT_BC2_UNORM_BLOCK,
+    [S3TC_DECOMPRESS_FORMAT_DXT5] = VK_FORMAT_BC3_UNORM_BLOCK,
+};
+
+// Whether the texture can be uploaded in its compressed form
+static bool is_texture_native_s3tc(PGRAPHState *pg, const TextureShape *s)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    // FIXME: 3D textures interleave blocks of 4 slices, and borders are
+    //        cropped after decompression
+    if (!pgraph_is_texture_format_compressed(pg, s->color_format) ||
+        s->dimensionality != 2 || s->border) {
+        return false;
+    }
+
+    return r->s3tc_format_supported[kelvin_format_to_s3tc_format(
+        s->color_format)];
+}
+
+static VkColorFormatInfo get_texture_vk_format(PGRAPHState *pg,
+                                               const TextureShape *s)
+{
+    VkColorFormatInfo vkf = kelvin_color_format_vk_map[s->color_format];
+
+    if (is_texture_native_s3tc(pg, s)) {
+        vkf.vk_format = s3tc_format_vk_map[kelvin_format_to_s3tc_format(
+            s->color_format)];
+    }
+
+    return vkf;
+}
+
 // FIXME: Move to common
 static void memcpy_image(void *dst, void *src, int min_stride, int dst_stride, int src_stride, int height)
 {
@@ -134,9 +170,48 @@ static size_t get_cubemap_layer_size(PGRAPHState *pg, TextureShape s)
     return ROUND_UP(length, NV2A_CUBEMAP_FACE_ALIGNMENT);
 }
 
+static void submit_texture_level_decode(TextureLevel *level,
+                                        const TextureShape *s,
+                                        const void *data,
+                                        const void *palette_data,
+                                        unsigned int width,
+                                        unsigned int height,
+                                        unsigned int depth,
+                                        unsigned int bytes_per_pixel)
+{
+    TextureDecodeJob *job = g_new0(TextureDecodeJob, 1);
+    job->shape = *s;
+    job->data = data;
+    job->palette_data = palette_data;
+    job->width = width;
+    job->height = height;
+    job->depth = depth;
+    job->bytes_per_pixel = bytes_per_pixel;
+    job->compressed = bytes_per_pixel == 0;
+    if (job->compressed) {
+        job->s3tc_format = kelvin_format_to_s3tc_format(s->color_format);
+    }
+    level->decode = job;
+    pgraph_texture_decode_submit(job);
+}
+
+static void wait_texture_level_decode(TextureLevel *level)
+{
+    if (!level->decode) {
+        return;
+    }
+
+    pgraph_texture_decode_wait(level->decode);
+    level->decoded_data = level->decode->decoded_data;
+    if (!level->decoded_size) {
+        level->decoded_size = level->decode->decoded_size;
+    }
+    g_free(level->decode);
+    level->decode = NULL;
+}
+
 // FIXME: Move to common
 // FIXME: More refactoring
-// FIXME: Possible parallelization of decoding
 // FIXME: Bounds checking
 static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
 {
@@ -221,6 +296,7 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
     }
 
     bool is_compressed = pgraph_is_texture_format_compressed(pg, s.color_format);
+    bool is_native_s3tc = is_texture_native_s3tc(pg, &s);
     size_t block_size = 0;
     if (is_compressed) {
         bool is_dxt1 =
@@ -228,6 +304,10 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
         block_size = is_dxt1 ? 8 : 16;
     }
 
+    /*
+     * Swizzled and compressed levels are decoded asynchronously, and only
+     * waited on by upload_texture_image() as each one is copied to staging.
+     */
     if (s.dimensionality == 2) {
         hwaddr layer_size = s.cubemap ? get_cubemap_layer_size(pg, s) : 0;
         const int num_layers = s.cubemap ? 6 : 1;
@@ -241,85 +321,47 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
 
                 width = MAX(width, 1);
                 height = MAX(height, 1);
+
+                TextureLevel *tl = &layout->layers[layer].levels[level];
+                *tl = (TextureLevel){
+                    .width = width,
+                    .height = height,
+                    .depth = 1,
+                };
+
+                if (s.cubemap && adjusted_width != s.width) {
+                    // FIXME: Consider preserving the border.
+                    // There does not seem to be a way to reference the border
+                    // texels in a cubemap, so they are discarded.
+                    // FIXME: Crop by 4 pixels on each side
+                    tl->width = s.width;
+                    tl->height = s.height;
+                }
+
                 if (is_compressed) {
                     // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                    unsigned int tex_width = width, tex_height = height;
                     unsigned int physical_width = (width + 3) & ~3,
                                  physical_height = (height + 3) & ~3;
-                    // if (physical_width != width) {
-                    //     glPixelStorei(GL_UNPACK_ROW_LENGTH, physical_width);
-                    // }
-
-                    size_t converted_size = width * height * 4;
-                    uint8_t *converted = s3tc_decompress_2d(
-                        kelvin_format_to_s3tc_format(s.color_format),
-                        texture_data_ptr, physical_width, physical_height);
-                    assert(converted);
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-
-                        // glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
-                        // glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // if (physical_width == width) {
-                        //     glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        // }
-
-                        // FIXME: Crop by 4 pixels on each side
-                    }
-
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
-
-                    texture_data_ptr +=
+                    size_t physical_size =
                         physical_width / 4 * physical_height / 4 * block_size;
-                } else {
-                    unsigned int pitch = width * f.bytes_per_pixel;
-                    unsigned int tex_width = width, tex_height = height;
-
-                    size_t converted_size = height * pitch;
-                    uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                    unswizzle_rect(texture_data_ptr, width, height,
-                                   unswizzled, pitch, f.bytes_per_pixel);
 
-                    uint8_t *converted = pgraph_convert_texture_data(
-                        s, unswizzled, palette_data_ptr, width, height, 1,
-                        pitch, 0, &converted_size);
-
-                    if (converted) {
-                        g_free(unswizzled);
+                    if (is_native_s3tc) {
+                        tl->vram_addr =
+                            (uint8_t *)texture_data_ptr - d->vram_ptr;
+                        tl->decoded_size = physical_size;
                     } else {
-                        converted = unswizzled;
-                    }
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-                        // glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
-
-                        // FIXME: Crop by 4 pixels on each side
+                        tl->decoded_size = width * height * 4;
+                        submit_texture_level_decode(tl, &s, texture_data_ptr,
+                                                    palette_data_ptr,
+                                                    physical_width,
+                                                    physical_height, 1, 0);
                     }
 
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
+                    texture_data_ptr += physical_size;
+                } else {
+                    submit_texture_level_decode(tl, &s, texture_data_ptr,
+                                                palette_data_ptr, width,
+                                                height, 1, f.bytes_per_pixel);
 
                     texture_data_ptr += width * height * f.bytes_per_pixel;
                 }
@@ -334,6 +376,8 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
                      depth = adjusted_depth;
 
         for (int level = 0; level < s.levels; level++) {
+            TextureLevel *tl = &layout->layers[0].levels[level];
+
             if (is_compressed) {
                 assert(width % 4 == 0 && height % 4 == 0 &&
                        "Compressed 3D texture virtual size");
@@ -342,19 +386,14 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
                 height = MAX(height, 4);
                 depth = MAX(depth, 1);
 
-                size_t converted_size = width * height * depth * 4;
-                uint8_t *converted = s3tc_decompress_3d(
-                    kelvin_format_to_s3tc_format(s.color_format),
-                    texture_data_ptr, width, height, depth);
-                assert(converted);
-
-                layout->layers[0].levels[level] = (TextureLevel){
+                *tl = (TextureLevel){
                     .width = width,
                     .height = height,
                     .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
                 };
+                submit_texture_level_decode(tl, &s, texture_data_ptr,
+                                            palette_data_ptr, width, height,
+                                            depth, 0);
 
                 texture_data_ptr += width / 4 * height / 4 * depth * block_size;
             } else {
@@ -362,34 +401,14 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
                 height = MAX(height, 1);
                 depth = MAX(depth, 1);
 
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-
-                size_t unswizzled_size = slice_pitch * depth;
-                uint8_t *unswizzled = g_malloc(unswizzled_size);
-                unswizzle_box(texture_data_ptr, width, height, depth,
-                              unswizzled, row_pitch, slice_pitch,
-                              f.bytes_per_pixel);
-
-                size_t converted_size;
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data_ptr, width, height, depth,
-                    row_pitch, slice_pitch, &converted_size);
-
-                if (converted) {
-                    g_free(unswizzled);
-                } else {
-                    converted = unswizzled;
-                    converted_size = unswizzled_size;
-                }
-
-                layout->layers[0].levels[level] = (TextureLevel){
+                *tl = (TextureLevel){
                     .width = width,
                     .height = height,
                     .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
                 };
+                submit_texture_level_decode(tl, &s, texture_data_ptr,
+                                            palette_data_ptr, width, height,
+                                            depth, f.bytes_per_pixel);
 
                 texture_data_ptr += width * height * depth * f.bytes_per_pixel;
             }
@@ -404,47 +423,54 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
     return layout;
 }
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
-static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
+static void texture_ranges_insert(PGRAPHVkState *r, TextureBinding *snode)
 {
-    struct pgraph_texture_possibly_dirty_struct *test = opaque;
-
-    TextureBinding *tnode = container_of(node, TextureBinding, node);
-    if (tnode->possibly_dirty) {
-        return;
+    if (snode->key.texture_length > 0) {
+        snode->texture_range.start = snode->key.texture_vram_offset;
+        snode->texture_range.last =
+            snode->key.texture_vram_offset + snode->key.texture_length - 1;
+        interval_tree_insert(&snode->texture_range, &r->texture_ranges);
     }
-
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
-
-    if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
+    if (snode->key.palette_length > 0) {
+        snode->palette_range.start = snode->key.palette_vram_offset;
+        snode->palette_range.last =
+            snode->key.palette_vram_offset + snode->key.palette_length - 1;
+        interval_tree_insert(&snode->palette_range, &r->palette_ranges);
     }
+}
 
-    tnode->possibly_dirty |= overlapping;
+static void texture_ranges_remove(PGRAPHVkState *r, TextureBinding *snode)
+{
+    if (snode->key.texture_length > 0) {
+        interval_tree_remove(&snode->texture_range, &r->texture_ranges);
+    }
+    if (snode->key.palette_length > 0) {
+        interval_tree_remove(&snode->palette_range, &r->palette_ranges);
+    }
 }
 
 void pgraph_vk_mark_textures_possibly_dirty(NV2AState *d,
     hwaddr addr, hwaddr size)
 {
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+    IntervalTreeNode *n;
+
     hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
     addr &= TARGET_PAGE_MASK;
     assert(end <= memory_region_size(d->vram));
 
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_INVALIDATE);
 
-    lru_visit_active(&d->pgraph.vk_renderer_state->texture_cache,
-                     mark_textures_possibly_dirty_visitor,
-                     &test);
+    for (n = interval_tree_iter_first(&r->texture_ranges, addr, end); n;
+         n = interval_tree_iter_next(n, addr, end)) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_INVALIDATE_VISITED);
+        container_of(n, TextureBinding, texture_range)->possibly_dirty = true;
+    }
+    for (n = interval_tree_iter_first(&r->palette_ranges, addr, end); n;
+         n = interval_tree_iter_next(n, addr, end)) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_INVALIDATE_VISITED);
+        container_of(n, TextureBinding, palette_range)->possibly_dirty = true;
+    }
 }
 
 static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
@@ -477,33 +503,322 @@ static bool check_texture_possibly_dirty(NV2AState *d,
     return possibly_dirty;
 }
 
-// FIXME: Make sure we update sampler when data matches. Should we add filtering
-// options to the textureshape?
-static void upload_texture_image(PGRAPHState *pg, int texture_idx,
-                                 TextureBinding *binding)
+// Textures smaller than this are cheaper to decode on the CPU
+#define TEXTURE_COMPUTE_DECODE_MIN_TEXELS (128 * 128)
+
+static ComputeTextureDecode get_compute_texture_decode(PGRAPHState *pg,
+                                                       const TextureShape *s)
 {
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s->color_format];
+
+    // FIXME: Support 3D textures and borders
+    if (s->dimensionality != 2 || s->border ||
+        s->width * s->height < TEXTURE_COMPUTE_DECODE_MIN_TEXELS ||
+        pgraph_is_texture_format_compressed(pg, s->color_format)) {
+        return COMPUTE_TEX_DECODE_NONE;
+    }
+
+    switch (s->color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8:
+        return COMPUTE_TEX_DECODE_I8_PALETTE;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5:
+        return COMPUTE_TEX_DECODE_R6G5B5;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8:
+        return COMPUTE_TEX_DECODE_YUY2;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8:
+        return COMPUTE_TEX_DECODE_UYVY;
+    default:
+        break;
+    }
+
+    if (f.linear) {
+        return COMPUTE_TEX_DECODE_NONE;
+    }
+
+    switch (f.bytes_per_pixel) {
+    case 1:
+        return COMPUTE_TEX_DECODE_UNSWIZZLE_8;
+    case 2:
+        return COMPUTE_TEX_DECODE_UNSWIZZLE_16;
+    case 4:
+        return COMPUTE_TEX_DECODE_UNSWIZZLE_32;
+    default:
+        return COMPUTE_TEX_DECODE_NONE;
+    }
+}
+
+//
+// Upload raw guest texture data and let compute shaders unswizzle and convert
+// it into the final image, avoiding the CPU decode round trip. Returns false
+// if the texture cannot be handled this way.
+//
+static bool upload_texture_image_compute(PGRAPHState *pg, int texture_idx,
+                                         TextureBinding *binding)
+{
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
     PGRAPHVkState *r = pg->vk_renderer_state;
     TextureShape *state = &binding->key.state;
-    VkColorFormatInfo vkf = kelvin_color_format_vk_map[state->color_format];
+    VkColorFormatInfo vkf = get_texture_vk_format(pg, state);
+    BasicColorFormatInfo f = kelvin_color_format_info_map[state->color_format];
 
-    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+    ComputeTextureDecode decode = get_compute_texture_decode(pg, state);
+    if (decode == COMPUTE_TEX_DECODE_NONE ||
+        pgraph_vk_compute_needs_finish(r)) {
+        return false;
+    }
+
+    const VkDeviceSize align =
+        MAX(r->device_props.limits.minStorageBufferOffsetAlignment, 4);
+    // Level offsets must also be a multiple of the 3 byte R8G8B8 texel size
+    const VkDeviceSize out_align = align * 3;
+
+    const size_t vram_size = memory_region_size(d->vram);
+    const hwaddr texture_vram_offset =
+        pgraph_get_texture_phys_addr(pg, texture_idx);
+    const size_t texture_length = pgraph_get_texture_length(pg, state);
+    size_t palette_length;
+    const hwaddr palette_vram_offset =
+        pgraph_get_texture_palette_phys_addr_length(pg, texture_idx,
+                                                    &palette_length);
+    // Any of the 256 palette entries may be referenced
+    palette_length = 256 * 4;
+
+    const VkDeviceSize palette_offset = ROUND_UP(texture_length, align);
+    const VkDeviceSize staging_size = palette_offset + palette_length;
+
+    if (texture_vram_offset + texture_length > vram_size ||
+        staging_size > r->storage_buffers[BUFFER_STAGING_SRC].buffer_size) {
+        return false;
+    }
 
-    g_autofree TextureLayout *layout = get_texture_layout(pg, texture_idx);
     const int num_layers = state->cubemap ? 6 : 1;
+    const size_t layer_size = texture_length / num_layers;
+    const int num_levels = num_layers * state->levels;
+    g_autofree ComputeTextureLevel *levels =
+        g_malloc_n(num_levels, sizeof(ComputeTextureLevel));
+    g_autofree VkBufferImageCopy *regions =
+        g_malloc0_n(num_levels, sizeof(VkBufferImageCopy));
+    VkDeviceSize out_size = 0;
+    int num_regions = 0;
 
-    // Calculate decoded texture data size
-    size_t texture_data_size = 0;
     for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
-        TextureLayer *layer = &layout->layers[layer_idx];
+        unsigned int width = state->width, height = state->height;
+        VkDeviceSize in_offset = layer_idx * layer_size;
+
         for (int level_idx = 0; level_idx < state->levels; level_idx++) {
-            size_t size = layer->levels[level_idx].decoded_size;
-            assert(size);
-            texture_data_size += size;
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+
+            out_size = QEMU_ALIGN_UP(out_size, out_align);
+            levels[num_regions] = (ComputeTextureLevel){
+                .width = width,
+                .height = height,
+                .pitch = f.linear ? state->pitch : width * f.bytes_per_pixel,
+                .in_offset = in_offset,
+                .out_offset = out_size,
+            };
+            regions[num_regions] = (VkBufferImageCopy){
+                .bufferOffset = out_size,
+                .bufferRowLength = 0, // Tightly packed
+                .bufferImageHeight = 0,
+                .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .imageSubresource.mipLevel = level_idx,
+                .imageSubresource.baseArrayLayer = layer_idx,
+                .imageSubresource.layerCount = 1,
+                .imageOffset = (VkOffset3D){ 0, 0, 0 },
+                .imageExtent = (VkExtent3D){ width, height, 1 },
+            };
+            num_regions++;
+
+            in_offset += width * height * f.bytes_per_pixel;
+            out_size +=
+                pgraph_vk_get_texture_decode_output_size(decode, width, height);
+
+            width /= 2;
+            height /= 2;
         }
     }
+    out_size = ROUND_UP(out_size, 4);
+
+    if (out_size > r->storage_buffers[BUFFER_COMPUTE_SRC].buffer_size) {
+        return false;
+    }
+    assert(staging_size <= r->storage_buffers[BUFFER_COMPUTE_DST].buffer_size);
+
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_DECODE_COMPUTE);
+
+    // Copy raw texture data to mapped device buffer
+    uint8_t *mapped_memory_ptr;
+
+    VK_CHECK(vmaMapMemory(r->allocator,
+                          r->storage_buffers[BUFFER_STAGING_SRC].allocation,
+                          (void *)&mapped_memory_ptr));
+
+    memcpy(mapped_memory_ptr, d->vram_ptr + texture_vram_offset,
+           texture_length);
+
+    if (decode == COMPUTE_TEX_DECODE_I8_PALETTE) {
+        size_t palette_copy_length =
+            palette_vram_offset < vram_size ?
+                MIN(palette_length, vram_size - palette_vram_offset) :
+                0;
+        memcpy(mapped_memory_ptr + palette_offset,
+               d->vram_ptr + palette_vram_offset, palette_copy_length);
+        memset(mapped_memory_ptr + palette_offset + palette_copy_length, 0,
+               palette_length - palette_copy_length);
+    }
+
+    vmaFlushAllocation(r->allocator,
+                       r->storage_buffers[BUFFER_STAGING_SRC].allocation, 0,
+                       VK_WHOLE_SIZE);
+
+    vmaUnmapMemory(r->allocator,
+                   r->storage_buffers[BUFFER_STAGING_SRC].allocation);
+
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
+
+    VkBufferMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_HOST_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_STAGING_SRC].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &host_barrier, 0, NULL);
+
+    VkBufferCopy copy_region = { .size = staging_size };
+    vkCmdCopyBuffer(cmd, r->storage_buffers[BUFFER_STAGING_SRC].buffer,
+                    r->storage_buffers[BUFFER_COMPUTE_DST].buffer, 1,
+                    &copy_region);
+
+    VkBufferMemoryBarrier pre_decode_src_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                         1, &pre_decode_src_barrier, 0, NULL);
+
+    VkBufferMemoryBarrier pre_decode_dst_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_COMPUTE_SRC].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                         1, &pre_decode_dst_barrier, 0, NULL);
+
+    VkDescriptorBufferInfo buffers[] = {
+        {
+            .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+            .offset = 0,
+            .range = ROUND_UP(texture_length, 4),
+        },
+        {
+            .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+            .offset = palette_offset,
+            .range = palette_length,
+        },
+        {
+            .buffer = r->storage_buffers[BUFFER_COMPUTE_SRC].buffer,
+            .offset = 0,
+            .range = out_size,
+        },
+    };
+    pgraph_vk_decode_texture(pg, cmd, decode, buffers, levels, num_regions);
+
+    VkBufferMemoryBarrier post_decode_src_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &post_decode_src_barrier, 0, NULL);
+
+    VkBufferMemoryBarrier post_decode_dst_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_COMPUTE_SRC].buffer,
+        .size = out_size
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &post_decode_dst_barrier, 0, NULL);
+
+    pgraph_vk_transition_image_layout(pg, cmd, binding->image, vkf.vk_format,
+                                      binding->current_layout,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    binding->current_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+    vkCmdCopyBufferToImage(cmd, r->storage_buffers[BUFFER_COMPUTE_SRC].buffer,
+                           binding->image, binding->current_layout,
+                           num_regions, regions);
+
+    VkBufferMemoryBarrier post_copy_dst_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_COMPUTE_SRC].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &post_copy_dst_barrier, 0, NULL);
+
+    pgraph_vk_transition_image_layout(pg, cmd, binding->image, vkf.vk_format,
+                                      binding->current_layout,
+                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    binding->current_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_single_time_commands(pg, cmd);
+
+    return true;
+}
+
+// FIXME: Make sure we update sampler when data matches. Should we add filtering
+// options to the textureshape?
+static void upload_texture_image(PGRAPHState *pg, int texture_idx,
+                                 TextureBinding *binding)
+{
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureShape *state = &binding->key.state;
+    VkColorFormatInfo vkf = get_texture_vk_format(pg, state);
+
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+
+    if (upload_texture_image_compute(pg, texture_idx, binding)) {
+        return;
+    }
 
-    assert(texture_data_size <=
-           r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
+    g_autofree TextureLayout *layout = get_texture_layout(pg, texture_idx);
+    const int num_layers = state->cubemap ? 6 : 1;
 
     // Copy texture data to mapped device buffer
     uint8_t *mapped_memory_ptr;
@@ -524,10 +839,16 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
         NV2A_VK_DPRINTF("Layer %d", layer_idx);
         for (int level_idx = 0; level_idx < state->levels; level_idx++) {
             TextureLevel *level = &layer->levels[level_idx];
+            wait_texture_level_decode(level);
+            assert(level->decoded_size);
+            assert(buffer_offset + level->decoded_size <=
+                   r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
             NV2A_VK_DPRINTF(" - Level %d, w=%d h=%d d=%d @ %08" HWADDR_PRIx,
                             level_idx, level->width, level->height,
                             level->depth, buffer_offset);
-            memcpy(mapped_memory_ptr + buffer_offset, level->decoded_data,
+            memcpy(mapped_memory_ptr + buffer_offset,
+                   level->decoded_data ? level->decoded_data :
+                                         d->vram_ptr + level->vram_addr,
                    level->decoded_size);
             *region = (VkBufferImageCopy){
                 .bufferOffset = buffer_offset,
@@ -605,7 +926,7 @@ static void copy_zeta_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surfac
 
     PGRAPHVkState *r = pg->vk_renderer_state;
     TextureShape *state = &texture->key.state;
-    VkColorFormatInfo vkf = kelvin_color_format_vk_map[state->color_format];
+    VkColorFormatInfo vkf = get_texture_vk_format(pg, state);
 
     bool use_compute_to_convert_depth_stencil =
         surface->host_fmt.vk_format == VK_FORMAT_D24_UNORM_S8_UINT ||
@@ -801,7 +1122,7 @@ static void copy_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surface,
 
     PGRAPHVkState *r = pg->vk_renderer_state;
     TextureShape *state = &texture->key.state;
-    VkColorFormatInfo vkf = kelvin_color_format_vk_map[state->color_format];
+    VkColorFormatInfo vkf = get_texture_vk_format(pg, state);
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX);
 
@@ -1134,6 +1455,10 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
         surface_to_texture =
             check_surface_to_texture_compatiblity(surface, &state);
 
+        if (surface_to_texture) {
+            pgraph_vk_rescale_surface(d, surface);
+        }
+
         if (surface_to_texture && surface->upload_pending) {
             pgraph_vk_upload_surface_data(d, surface, false);
         }
@@ -1206,7 +1531,7 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     snode->possibly_dirty = false;
     snode->hash = content_hash;
 
-    VkColorFormatInfo vkf = kelvin_color_format_vk_map[state.color_format];
+    VkColorFormatInfo vkf = get_texture_vk_format(pg, &state);
     assert(vkf.vk_format != 0);
     assert(0 < state.dimensionality);
     assert(state.dimensionality < ARRAY_SIZE(dimensionality_to_vk_image_type));
@@ -1436,14 +1761,18 @@ void pgraph_vk_bind_textures(NV2AState *d)
     NV2A_VK_DGROUP_END();
 }
 
-static void texture_cache_entry_init(Lru *lru, LruNode *node, void *state)
+static void texture_cache_entry_init(Lru *lru, LruNode *node, void *key)
 {
+    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, texture_cache);
     TextureBinding *snode = container_of(node, TextureBinding, node);
 
+    memcpy(&snode->key, key, sizeof(TextureKey));
     snode->image = VK_NULL_HANDLE;
     snode->allocation = VK_NULL_HANDLE;
     snode->image_view = VK_NULL_HANDLE;
     snode->sampler = VK_NULL_HANDLE;
+    snode->possibly_dirty = false;
+    texture_ranges_insert(r, snode);
 }
 
 static void texture_cache_release_node_resources(PGRAPHVkState *r, TextureBinding *snode)
@@ -1486,6 +1815,7 @@ static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, texture_cache);
     TextureBinding *snode = container_of(node, TextureBinding, node);
+    texture_ranges_remove(r, snode);
     texture_cache_release_node_resources(r, snode);
 }
 
@@ -1498,6 +1828,8 @@ static bool texture_cache_entry_compare(Lru *lru, LruNode *node, void *key)
 static void texture_cache_init(PGRAPHVkState *r)
 {
     const size_t texture_cache_size = 1024;
+    r->texture_ranges = (IntervalTreeRoot){ 0 };
+    r->palette_ranges = (IntervalTreeRoot){ 0 };
     lru_init(&r->texture_cache);
     r->texture_cache_entries = g_malloc_n(texture_cache_size, sizeof(TextureBinding));
     assert(r->texture_cache_entries != NULL);
@@ -1547,6 +1879,21 @@ void pgraph_vk_init_textures(PGRAPHState *pg)
             r->physical_device, kelvin_color_format_vk_map[i].vk_format,
             &r->texture_format_properties[i]);
     }
+
+    const VkFormatFeatureFlags s3tc_required_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+    for (int i = 0; i < ARRAY_SIZE(s3tc_format_vk_map); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(r->physical_device,
+                                            s3tc_format_vk_map[i], &props);
+        r->s3tc_format_supported[i] =
+            r->texture_compression_bc_enabled &&
+            (props.optimalTilingFeatures & s3tc_required_features) ==
+                s3tc_required_features;
+    }
 }
 
 void pgraph_vk_finalize_textures(PGRAPHState *pg)
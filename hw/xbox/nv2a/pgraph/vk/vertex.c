@@ -47,6 +47,7 @@ void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset,
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    pgraph_vk_ensure_submit_complete(pg);
     pgraph_vk_download_surfaces_in_range_if_dirty(pg, offset, size);
 
     size_t offset_bit = offset / 4096;
@@ -132,6 +133,7 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
     pg->compressed_attrs = 0;
     pg->uniform_attrs = 0;
     pg->swizzle_attrs = 0;
+    pg->fetch_attrs = 0;
 
     r->num_active_vertex_attribute_descriptions = 0;
     r->num_active_vertex_binding_descriptions = 0;
@@ -243,6 +245,23 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
         last_entry += stride * provoking_element_index;
         pgraph_update_inline_value(attr, last_entry);
 
+        r->vertex_attribute_offsets[i] = attrib_data_addr;
+
+        bool aligned = (attrib_data_addr % attr->size == 0) &&
+                       (stride % attr->size == 0);
+        if (!inline_data && !aligned && r->vertex_fetch_supported) {
+            /*
+             * Vulkan cannot consume this layout as a vertex binding, have the
+             * vertex shader decode it from the VRAM mirror instead.
+             */
+            pg->fetch_attrs |= 1 << i;
+            pg->compressed_attrs &= ~(1 << i);
+            pg->swizzle_attrs &= ~(1 << i);
+            nv2a_profile_inc_counter(NV2A_PROF_ATTR_FETCH);
+            NV2A_VK_DGROUP_END();
+            continue;
+        }
+
         r->vertex_attribute_to_description_location[i] =
             r->num_active_vertex_binding_descriptions;
 
@@ -262,8 +281,6 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
                 .format = vk_format,
             };
 
-        r->vertex_attribute_offsets[i] = attrib_data_addr;
-
         NV2A_VK_DGROUP_END();
     }
 
@@ -278,6 +295,7 @@ void pgraph_vk_bind_vertex_attributes_inline(NV2AState *d)
     pg->compressed_attrs = 0;
     pg->uniform_attrs = 0;
     pg->swizzle_attrs = 0;
+    pg->fetch_attrs = 0;
 
     r->num_active_vertex_attribute_descriptions = 0;
     r->num_active_vertex_binding_descriptions = 0;
@@ -0,0 +1,709 @@
+/*
+ * Geforce NV2A PGRAPH CPU vertex program executor
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "vsh-cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "host/cpuinfo.h"
+#define VSH_CPU_HAVE_X86 1
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#define VSH_GLUE_(a, b) a##b
+#define VSH_GLUE(a, b) VSH_GLUE_(a, b)
+
+/*
+ * Program tokens are decoded with the same field layout as field_mapping in
+ * glsl/vsh-prog.c.
+ */
+#define TOKEN_FIELD(token, word, bit, len) \
+    (((token)[word] >> (bit)) & ((1u << (len)) - 1))
+
+#define FLD_ILU(t)          TOKEN_FIELD(t, 1, 25, 3)
+#define FLD_MAC(t)          TOKEN_FIELD(t, 1, 21, 4)
+#define FLD_CONST(t)        TOKEN_FIELD(t, 1, 13, 8)
+#define FLD_V(t)            TOKEN_FIELD(t, 1, 9, 4)
+#define FLD_A_NEG(t)        TOKEN_FIELD(t, 1, 8, 1)
+#define FLD_A_SWZ(t)        TOKEN_FIELD(t, 1, 0, 8)
+#define FLD_A_R(t)          TOKEN_FIELD(t, 2, 28, 4)
+#define FLD_A_MUX(t)        TOKEN_FIELD(t, 2, 26, 2)
+#define FLD_B_NEG(t)        TOKEN_FIELD(t, 2, 25, 1)
+#define FLD_B_SWZ(t)        TOKEN_FIELD(t, 2, 17, 8)
+#define FLD_B_R(t)          TOKEN_FIELD(t, 2, 13, 4)
+#define FLD_B_MUX(t)        TOKEN_FIELD(t, 2, 11, 2)
+#define FLD_C_NEG(t)        TOKEN_FIELD(t, 2, 10, 1)
+#define FLD_C_SWZ(t)        TOKEN_FIELD(t, 2, 2, 8)
+#define FLD_C_R_HIGH(t)     TOKEN_FIELD(t, 2, 0, 2)
+#define FLD_C_R_LOW(t)      TOKEN_FIELD(t, 3, 30, 2)
+#define FLD_C_MUX(t)        TOKEN_FIELD(t, 3, 28, 2)
+#define FLD_OUT_MAC_MASK(t) TOKEN_FIELD(t, 3, 24, 4)
+#define FLD_OUT_R(t)        TOKEN_FIELD(t, 3, 20, 4)
+#define FLD_OUT_ILU_MASK(t) TOKEN_FIELD(t, 3, 16, 4)
+#define FLD_OUT_O_MASK(t)   TOKEN_FIELD(t, 3, 12, 4)
+#define FLD_OUT_ORB(t)      TOKEN_FIELD(t, 3, 11, 1)
+#define FLD_OUT_ADDRESS(t)  TOKEN_FIELD(t, 3, 3, 8)
+#define FLD_OUT_MUX(t)      TOKEN_FIELD(t, 3, 2, 1)
+#define FLD_A0X(t)          TOKEN_FIELD(t, 3, 1, 1)
+#define FLD_FINAL(t)        TOKEN_FIELD(t, 3, 0, 1)
+
+enum {
+    MAC_NOP, MAC_MOV, MAC_MUL, MAC_ADD, MAC_MAD, MAC_DP3, MAC_DPH, MAC_DP4,
+    MAC_DST, MAC_MIN, MAC_MAX, MAC_SLT, MAC_SGE, MAC_ARL,
+};
+
+enum {
+    ILU_NOP, ILU_MOV, ILU_RCP, ILU_RCC, ILU_RSQ, ILU_EXP, ILU_LOG, ILU_LIT,
+};
+
+enum {
+    PARAM_R = 1,
+    PARAM_V,
+    PARAM_C,
+};
+
+#define OUTPUT_C 0
+#define OMUX_MAC 0
+#define OMUX_ILU 1
+#define OUTPUT_REG_FOG 5
+
+enum VshCpuOpcode {
+    VSH_CPU_OP_MOV,
+    VSH_CPU_OP_MUL,
+    VSH_CPU_OP_ADD,
+    VSH_CPU_OP_MAD,
+    VSH_CPU_OP_DP3,
+    VSH_CPU_OP_DPH,
+    VSH_CPU_OP_DP4,
+    VSH_CPU_OP_DST,
+    VSH_CPU_OP_MIN,
+    VSH_CPU_OP_MAX,
+    VSH_CPU_OP_SLT,
+    VSH_CPU_OP_SGE,
+    VSH_CPU_OP_ARL,
+    VSH_CPU_OP_RCP,
+    VSH_CPU_OP_RCC,
+    VSH_CPU_OP_RSQ,
+    VSH_CPU_OP_EXP,
+    VSH_CPU_OP_LOG,
+    VSH_CPU_OP_LIT,
+    /* A0 = temporary address of a paired ARL */
+    VSH_CPU_OP_SET_A0,
+};
+
+static const uint8_t vsh_cpu_op_num_srcs[] = {
+    [VSH_CPU_OP_MOV] = 1, [VSH_CPU_OP_MUL] = 2, [VSH_CPU_OP_ADD] = 2,
+    [VSH_CPU_OP_MAD] = 3, [VSH_CPU_OP_DP3] = 2, [VSH_CPU_OP_DPH] = 2,
+    [VSH_CPU_OP_DP4] = 2, [VSH_CPU_OP_DST] = 2, [VSH_CPU_OP_MIN] = 2,
+    [VSH_CPU_OP_MAX] = 2, [VSH_CPU_OP_SLT] = 2, [VSH_CPU_OP_SGE] = 2,
+    [VSH_CPU_OP_ARL] = 1, [VSH_CPU_OP_RCP] = 1, [VSH_CPU_OP_RCC] = 1,
+    [VSH_CPU_OP_RSQ] = 1, [VSH_CPU_OP_EXP] = 1, [VSH_CPU_OP_LOG] = 1,
+    [VSH_CPU_OP_LIT] = 1, [VSH_CPU_OP_SET_A0] = 0,
+};
+
+enum VshCpuFile {
+    VSH_CPU_FILE_R,
+    VSH_CPU_FILE_V,
+    VSH_CPU_FILE_C,
+};
+
+/*
+ * Register file: R0-R11, then the outputs, so that R12 aliases oPos, then the
+ * temporary used to emulate paired MAC+ILU instructions.
+ */
+#define VSH_CPU_REG_R(n) (n)
+#define VSH_CPU_REG_O(n) (12 + (n))
+#define VSH_CPU_REG_TEMP VSH_CPU_REG_O(VSH_CPU_OUTPUTS)
+#define VSH_CPU_REGS (VSH_CPU_REG_TEMP + 1)
+
+/* ARL destinations */
+#define VSH_CPU_DST_A0 0
+#define VSH_CPU_DST_TEMP_ADDR 1
+
+typedef struct VshCpuSrc {
+    uint8_t file;
+    uint8_t index;
+    uint8_t swizzle[4];
+    bool neg;
+    bool relative;
+} VshCpuSrc;
+
+typedef struct VshCpuOp {
+    uint8_t opcode;
+    uint8_t dst;
+    /* Bit 0 is x */
+    uint8_t mask;
+    VshCpuSrc src[3];
+} VshCpuOp;
+
+struct VshCpuProgram {
+    unsigned int num_ops;
+    /* Input registers that need to be transposed */
+    uint16_t inputs_read;
+    VshCpuOp ops[];
+};
+
+/* Scalar helpers, shared by all kernels so results do not depend on them */
+
+static int32_t vsh_cpu_arl(float x)
+{
+    /* Same bias as _ARL in the generated GLSL */
+    float f = floorf(x + 0.001f);
+    if (!(f >= -2147483648.0f && f < 2147483648.0f)) {
+        return INT32_MIN;
+    }
+    return (int32_t)f;
+}
+
+static float vsh_cpu_rsq(float x)
+{
+    if (x == 0.0f) {
+        return INFINITY;
+    }
+    if (isinf(x)) {
+        return 0.0f;
+    }
+    return 1.0f / sqrtf(fabsf(x));
+}
+
+static void vsh_cpu_exp(float x, float r[4])
+{
+    r[0] = exp2f(floorf(x));
+    r[1] = x - floorf(x);
+    r[2] = exp2f(x);
+    r[3] = 1.0f;
+}
+
+static void vsh_cpu_log(float x, float r[4])
+{
+    float t = fabsf(x);
+    if (t == 0.0f) {
+        r[0] = -INFINITY;
+        r[1] = 1.0f;
+        r[2] = -INFINITY;
+        r[3] = 1.0f;
+        return;
+    }
+    r[0] = floorf(log2f(t));
+    r[1] = t / exp2f(floorf(log2f(t)));
+    r[2] = log2f(t);
+    r[3] = 1.0f;
+}
+
+static float glsl_max(float a, float b)
+{
+    return a < b ? b : a;
+}
+
+static float glsl_min(float a, float b)
+{
+    return b < a ? b : a;
+}
+
+static void vsh_cpu_lit(const float s[4], float r[4])
+{
+    const float limit = 128.0f - 1.0f / 256.0f;
+    float w = glsl_min(glsl_max(s[3], -limit), limit);
+    float x = glsl_max(s[0], 0.0f);
+    float y = glsl_max(s[1], 0.0f);
+
+    r[0] = 1.0f;
+    r[1] = x;
+    r[2] = x > 0.0f ? exp2f(w * log2f(y)) : 0.0f;
+    r[3] = 1.0f;
+}
+
+#define VEC_LANES 4
+#define VEC_NAME generic
+#define VEC_ATTR
+#include "vsh-cpu.c.inc"
+#undef VEC_LANES
+#undef VEC_NAME
+#undef VEC_ATTR
+
+#ifdef VSH_CPU_HAVE_X86
+#define VEC_LANES 8
+#define VEC_NAME avx2
+#define VEC_ATTR __attribute__((target("avx2")))
+#include "vsh-cpu.c.inc"
+#undef VEC_LANES
+#undef VEC_NAME
+#undef VEC_ATTR
+#endif
+
+typedef void (*VshCpuExecuteFunc)(const VshCpuProgram *prog,
+                                  const float (*constants)[4],
+                                  const float (*inputs)[VSH_CPU_INPUTS][4],
+                                  float (*outputs)[VSH_CPU_OUTPUTS][4],
+                                  unsigned int count);
+
+typedef struct VshCpuAccel {
+    const char *name;
+    VshCpuExecuteFunc execute;
+} VshCpuAccel;
+
+/* Ordered from slowest to fastest */
+static const VshCpuAccel accel_table[] = {
+    { "generic", vsh_cpu_execute_generic },
+#ifdef VSH_CPU_HAVE_X86
+    { "avx2", vsh_cpu_execute_avx2 },
+#endif
+};
+
+static unsigned accel_index;
+static const VshCpuAccel *vsh_cpu_accel = &accel_table[0];
+
+static unsigned best_accel(void)
+{
+#ifdef VSH_CPU_HAVE_X86
+    unsigned info = cpuinfo_init();
+    return (info & CPUINFO_AVX2) ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    vsh_cpu_accel = &accel_table[accel_index];
+}
+
+bool vsh_cpu_test_next_accel(void)
+{
+    if (accel_index != 0) {
+        vsh_cpu_accel = &accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+const char *vsh_cpu_accel_name(void)
+{
+    return vsh_cpu_accel->name;
+}
+
+void vsh_cpu_execute(const VshCpuProgram *prog, const float (*constants)[4],
+                     const float (*inputs)[VSH_CPU_INPUTS][4],
+                     float (*outputs)[VSH_CPU_OUTPUTS][4], unsigned int count)
+{
+    vsh_cpu_accel->execute(prog, constants, inputs, outputs, count);
+}
+
+/* Program translation */
+
+static VshCpuProgram *alloc_program(unsigned int max_ops)
+{
+    VshCpuProgram *prog =
+        malloc(sizeof(VshCpuProgram) + max_ops * sizeof(VshCpuOp));
+    if (prog) {
+        prog->num_ops = 0;
+    }
+    return prog;
+}
+
+static void finish_program(VshCpuProgram *prog)
+{
+    prog->inputs_read = 0;
+    for (unsigned int i = 0; i < prog->num_ops; i++) {
+        const VshCpuOp *op = &prog->ops[i];
+        for (int j = 0; j < vsh_cpu_op_num_srcs[op->opcode]; j++) {
+            if (op->src[j].file == VSH_CPU_FILE_V) {
+                prog->inputs_read |= 1 << op->src[j].index;
+            }
+        }
+    }
+}
+
+void vsh_cpu_program_free(VshCpuProgram *prog)
+{
+    free(prog);
+}
+
+/* Token masks have x in bit 3, ours have x in bit 0 */
+static uint8_t convert_mask(unsigned int mask)
+{
+    return ((mask & 8) >> 3) | ((mask & 4) >> 1) | ((mask & 2) << 1) |
+           ((mask & 1) << 3);
+}
+
+static bool decode_src(const uint32_t *token, unsigned int mux, bool neg,
+                       unsigned int swizzle, unsigned int reg,
+                       bool force_scalar, VshCpuSrc *src)
+{
+    memset(src, 0, sizeof(*src));
+    src->neg = neg;
+
+    switch (mux) {
+    case PARAM_R:
+        /* R12 reads oPos, there is no R13 and above */
+        if (reg > 12) {
+            return false;
+        }
+        src->file = VSH_CPU_FILE_R;
+        src->index = VSH_CPU_REG_R(reg);
+        break;
+    case PARAM_V:
+        src->file = VSH_CPU_FILE_V;
+        src->index = FLD_V(token);
+        break;
+    case PARAM_C:
+        src->file = VSH_CPU_FILE_C;
+        src->index = FLD_CONST(token);
+        src->relative = FLD_A0X(token);
+        if (!src->relative && src->index >= VSH_CPU_CONSTANTS) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    for (int c = 0; c < 4; c++) {
+        /* Swizzle fields are stored from w in the low bits up to x */
+        src->swizzle[c] = force_scalar ? (swizzle >> 6) & 3 :
+                                         (swizzle >> (6 - 2 * c)) & 3;
+    }
+
+    return true;
+}
+
+static VshCpuOp *emit(VshCpuProgram *prog, uint8_t opcode, uint8_t dst,
+                      uint8_t mask, const VshCpuSrc *srcs)
+{
+    VshCpuOp *op = &prog->ops[prog->num_ops++];
+
+    op->opcode = opcode;
+    op->dst = dst;
+    op->mask = mask;
+    memcpy(op->src, srcs, sizeof(op->src));
+    return op;
+}
+
+/*
+ * Emit the operations for one half (MAC or ILU) of an instruction, following
+ * decode_opcode in glsl/vsh-prog.c. Returns false if the GLSL path would
+ * reject the instruction.
+ */
+static bool decode_opcode(VshCpuProgram *prog, const uint32_t *token,
+                          unsigned int out_mux, unsigned int mask,
+                          uint8_t opcode, const VshCpuSrc *srcs,
+                          VshCpuOp *suffix, bool *has_suffix)
+{
+    unsigned int reg = FLD_OUT_R(token);
+    bool use_temp = false;
+
+    if (out_mux == OMUX_MAC && FLD_ILU(token) != ILU_NOP) {
+        use_temp = true;
+        if (reg == 1) {
+            /* Ignore paired MAC opcodes that write to R1 */
+            mask = 0;
+        }
+    } else if (out_mux == OMUX_ILU && FLD_MAC(token) != MAC_NOP) {
+        /* Paired ILU opcodes can only write to R1 */
+        reg = 1;
+    }
+
+    if (FLD_OUT_MUX(token) == out_mux && FLD_OUT_O_MASK(token) != 0) {
+        if (FLD_OUT_ORB(token) == OUTPUT_C || opcode == VSH_CPU_OP_ARL) {
+            return false;
+        }
+        unsigned int out_reg = FLD_OUT_ADDRESS(token) & 0xF;
+        if (out_reg == 1 || out_reg == 2 || out_reg > 12) {
+            return false;
+        }
+        uint8_t out_mask = convert_mask(FLD_OUT_O_MASK(token));
+        if (out_reg == OUTPUT_REG_FOG) {
+            /* Fog takes as many components as are masked, starting at x */
+            out_mask = (1 << __builtin_popcount(out_mask)) - 1;
+        }
+        emit(prog, opcode, VSH_CPU_REG_O(out_reg), out_mask, srcs);
+    }
+
+    if (opcode != VSH_CPU_OP_ARL && mask > 0 && reg > 12) {
+        return false;
+    }
+
+    if (use_temp) {
+        VshCpuSrc temp = {
+            .file = VSH_CPU_FILE_R,
+            .index = VSH_CPU_REG_TEMP,
+            .swizzle = { 0, 1, 2, 3 },
+        };
+        if (opcode == VSH_CPU_OP_ARL) {
+            emit(prog, opcode, VSH_CPU_DST_TEMP_ADDR, 0, srcs);
+            suffix->opcode = VSH_CPU_OP_SET_A0;
+            *has_suffix = true;
+        } else if (mask > 0) {
+            emit(prog, opcode, VSH_CPU_REG_TEMP, convert_mask(mask), srcs);
+            suffix->opcode = VSH_CPU_OP_MOV;
+            suffix->dst = VSH_CPU_REG_R(reg);
+            suffix->mask = convert_mask(mask);
+            suffix->src[0] = temp;
+            *has_suffix = true;
+        }
+    } else if (opcode == VSH_CPU_OP_ARL) {
+        emit(prog, opcode, VSH_CPU_DST_A0, 0, srcs);
+    } else if (mask > 0) {
+        emit(prog, opcode, VSH_CPU_REG_R(reg), convert_mask(mask), srcs);
+    }
+
+    return true;
+}
+
+static bool decode_token(VshCpuProgram *prog, const uint32_t *token)
+{
+    unsigned int mac = FLD_MAC(token);
+    unsigned int ilu = FLD_ILU(token);
+
+    if (mac == MAC_NOP && ilu == ILU_NOP) {
+        return true;
+    }
+    if (mac > MAC_ARL) {
+        return false;
+    }
+
+    /* Scalar ILU operations replicate the x swizzle of input C */
+    bool force_scalar = ilu >= ILU_RCP && ilu <= ILU_LOG;
+    VshCpuSrc a, b, c;
+    bool have_a = decode_src(token, FLD_A_MUX(token), FLD_A_NEG(token),
+                             FLD_A_SWZ(token), FLD_A_R(token), false, &a);
+    bool have_b = decode_src(token, FLD_B_MUX(token), FLD_B_NEG(token),
+                             FLD_B_SWZ(token), FLD_B_R(token), false, &b);
+    bool have_c = decode_src(
+        token, FLD_C_MUX(token), FLD_C_NEG(token), FLD_C_SWZ(token),
+        (FLD_C_R_HIGH(token) << 2) | FLD_C_R_LOW(token), force_scalar, &c);
+
+    VshCpuOp suffix;
+    bool has_suffix = false;
+
+    if (mac != MAC_NOP) {
+        static const uint8_t mac_ops[] = {
+            [MAC_MOV] = VSH_CPU_OP_MOV, [MAC_MUL] = VSH_CPU_OP_MUL,
+            [MAC_ADD] = VSH_CPU_OP_ADD, [MAC_MAD] = VSH_CPU_OP_MAD,
+            [MAC_DP3] = VSH_CPU_OP_DP3, [MAC_DPH] = VSH_CPU_OP_DPH,
+            [MAC_DP4] = VSH_CPU_OP_DP4, [MAC_DST] = VSH_CPU_OP_DST,
+            [MAC_MIN] = VSH_CPU_OP_MIN, [MAC_MAX] = VSH_CPU_OP_MAX,
+            [MAC_SLT] = VSH_CPU_OP_SLT, [MAC_SGE] = VSH_CPU_OP_SGE,
+            [MAC_ARL] = VSH_CPU_OP_ARL,
+        };
+        uint8_t opcode = mac_ops[mac];
+        VshCpuSrc srcs[3];
+        bool valid = have_a;
+
+        memset(srcs, 0, sizeof(srcs));
+        srcs[0] = a;
+        switch (mac) {
+        case MAC_MOV:
+        case MAC_ARL:
+            break;
+        case MAC_ADD:
+            /* ADD takes inputs A and C */
+            srcs[1] = c;
+            valid = valid && have_c;
+            break;
+        case MAC_MAD:
+            srcs[1] = b;
+            srcs[2] = c;
+            valid = valid && have_b && have_c;
+            break;
+        default:
+            srcs[1] = b;
+            valid = valid && have_b;
+            break;
+        }
+        if (!valid ||
+            !decode_opcode(prog, token, OMUX_MAC, FLD_OUT_MAC_MASK(token),
+                           opcode, srcs, &suffix, &has_suffix)) {
+            return false;
+        }
+    }
+
+    if (ilu != ILU_NOP) {
+        static const uint8_t ilu_ops[] = {
+            [ILU_MOV] = VSH_CPU_OP_MOV, [ILU_RCP] = VSH_CPU_OP_RCP,
+            [ILU_RCC] = VSH_CPU_OP_RCC, [ILU_RSQ] = VSH_CPU_OP_RSQ,
+            [ILU_EXP] = VSH_CPU_OP_EXP, [ILU_LOG] = VSH_CPU_OP_LOG,
+            [ILU_LIT] = VSH_CPU_OP_LIT,
+        };
+        VshCpuSrc srcs[3];
+
+        memset(srcs, 0, sizeof(srcs));
+        srcs[0] = c;
+        if (!have_c ||
+            !decode_opcode(prog, token, OMUX_ILU, FLD_OUT_ILU_MASK(token),
+                           ilu_ops[ilu], srcs, NULL, NULL)) {
+            return false;
+        }
+    }
+
+    if (has_suffix) {
+        prog->ops[prog->num_ops++] = suffix;
+    }
+
+    return true;
+}
+
+/* Each instruction expands to at most two writes per half and the suffix */
+#define MAX_OPS_PER_TOKEN 5
+
+VshCpuProgram *vsh_cpu_compile_program(const uint32_t (*tokens)[4],
+                                       unsigned int length)
+{
+    VshCpuProgram *prog = alloc_program(length * MAX_OPS_PER_TOKEN);
+    if (!prog) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < length; i++) {
+        if (!decode_token(prog, tokens[i])) {
+            break;
+        }
+        if (FLD_FINAL(tokens[i])) {
+            finish_program(prog);
+            return prog;
+        }
+    }
+
+    vsh_cpu_program_free(prog);
+    return NULL;
+}
+
+VshCpuProgram *vsh_cpu_compile_fixed_function(unsigned int composite_matrix)
+{
+    static const struct {
+        unsigned int output, input;
+    } passthrough[] = {
+        { VSH_CPU_OUT_D0, 3 },
+        { VSH_CPU_OUT_D1, 4 },
+        { VSH_CPU_OUT_T0 + 0, 9 },
+        { VSH_CPU_OUT_T0 + 1, 10 },
+        { VSH_CPU_OUT_T0 + 2, 11 },
+        { VSH_CPU_OUT_T0 + 3, 12 },
+    };
+
+    if (composite_matrix + 4 > VSH_CPU_CONSTANTS) {
+        return NULL;
+    }
+
+    VshCpuProgram *prog = alloc_program(4 + sizeof(passthrough) /
+                                                sizeof(passthrough[0]));
+    if (!prog) {
+        return NULL;
+    }
+
+    /* oPos = position * compositeMat, as in glsl/vsh-ff.c */
+    for (unsigned int i = 0; i < 4; i++) {
+        VshCpuSrc srcs[3] = {
+            { .file = VSH_CPU_FILE_V, .index = 0, .swizzle = { 0, 1, 2, 3 } },
+            { .file = VSH_CPU_FILE_C, .index = composite_matrix + i,
+              .swizzle = { 0, 1, 2, 3 } },
+        };
+        emit(prog, VSH_CPU_OP_DP4, VSH_CPU_REG_O(VSH_CPU_OUT_POS), 1 << i,
+             srcs);
+    }
+
+    for (unsigned int i = 0; i < sizeof(passthrough) / sizeof(passthrough[0]);
+         i++) {
+        VshCpuSrc srcs[3] = {
+            { .file = VSH_CPU_FILE_V, .index = passthrough[i].input,
+              .swizzle = { 0, 1, 2, 3 } },
+        };
+        emit(prog, VSH_CPU_OP_MOV, VSH_CPU_REG_O(passthrough[i].output), 0xF,
+             srcs);
+    }
+
+    finish_program(prog);
+    return prog;
+}
+
+/*
+ * Outcodes are computed for the clip space position the generated shaders
+ * hand to the host API. Programs output screen space positions which are
+ * only divided by a negative w, in which case the vertex is clipped and the
+ * half spaces flip. The fixed function pipeline outputs homogeneous
+ * positions, so the viewport is scaled by w instead.
+ */
+void vsh_cpu_project(const VshCpuViewport *vp,
+                     const float (*outputs)[VSH_CPU_OUTPUTS][4],
+                     float (*screen)[4], uint8_t *clip, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        const float *pos = outputs[i][VSH_CPU_OUT_POS];
+        float x = pos[0], y = pos[1], z = pos[2], w = pos[3];
+        float inv_w = (w == 0.0f || isinf(w)) ? 1.0f : 1.0f / w;
+        uint8_t flags = 0;
+
+        if (vp->fixed_function) {
+            x += vp->offset_x * w;
+            y += vp->offset_y * w;
+            if (w <= 0.0f) {
+                flags |= VSH_CPU_CLIP_W;
+            }
+            flags |= (x < 0.0f ? VSH_CPU_CLIP_LEFT : 0) |
+                     (x > vp->width * w ? VSH_CPU_CLIP_RIGHT : 0) |
+                     (y < 0.0f ? VSH_CPU_CLIP_TOP : 0) |
+                     (y > vp->height * w ? VSH_CPU_CLIP_BOTTOM : 0);
+            if (vp->depth_clip && w > 0.0f) {
+                flags |= (z < vp->zmin * w ? VSH_CPU_CLIP_NEAR : 0) |
+                         (z > vp->zmax * w ? VSH_CPU_CLIP_FAR : 0);
+            }
+            screen[i][0] = x * inv_w;
+            screen[i][1] = y * inv_w;
+            screen[i][2] = z * inv_w;
+        } else {
+            if (vp->z_perspective) {
+                z = w;
+            }
+            bool flip = w < 0.0f;
+            if (flip) {
+                flags |= VSH_CPU_CLIP_W;
+            }
+            uint8_t outside =
+                (x < 0.0f ? VSH_CPU_CLIP_LEFT : 0) |
+                (x > vp->width ? VSH_CPU_CLIP_RIGHT : 0) |
+                (y < 0.0f ? VSH_CPU_CLIP_TOP : 0) |
+                (y > vp->height ? VSH_CPU_CLIP_BOTTOM : 0);
+            if (vp->depth_clip) {
+                outside |= (z < vp->zmin ? VSH_CPU_CLIP_NEAR : 0) |
+                           (z > vp->zmax ? VSH_CPU_CLIP_FAR : 0);
+            }
+            if (flip) {
+                /* Swap each pair of opposite planes */
+                outside = ((outside & 0x15) << 1) | ((outside & 0x2A) >> 1);
+            }
+            flags |= outside;
+            screen[i][0] = x;
+            screen[i][1] = y;
+            screen[i][2] = z;
+        }
+
+        screen[i][3] = inv_w;
+        clip[i] = flags;
+    }
+}
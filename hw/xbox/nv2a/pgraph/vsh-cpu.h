@@ -0,0 +1,109 @@
+/*
+ * Geforce NV2A PGRAPH CPU vertex program executor
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_VSH_CPU_H
+#define HW_XBOX_NV2A_PGRAPH_VSH_CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Executes vertex programs on the CPU with the semantics of the GLSL that
+ * glsl/vsh-prog.c generates, so results match the GPU backends. Programs are
+ * translated once into a flat list of operations, which are then run over
+ * several vertices at a time in structure-of-arrays form.
+ */
+
+#define VSH_CPU_INPUTS 16
+#define VSH_CPU_CONSTANTS 192
+
+/* Output registers, numbered as in the program output address field */
+enum VshCpuOutput {
+    VSH_CPU_OUT_POS = 0,
+    VSH_CPU_OUT_D0 = 3,
+    VSH_CPU_OUT_D1 = 4,
+    VSH_CPU_OUT_FOG = 5,
+    VSH_CPU_OUT_PTS = 6,
+    VSH_CPU_OUT_B0 = 7,
+    VSH_CPU_OUT_B1 = 8,
+    VSH_CPU_OUT_T0 = 9,
+    VSH_CPU_OUTPUTS = 13,
+};
+
+/* Outcodes, a primitive is invisible if its vertices share any of them */
+#define VSH_CPU_CLIP_LEFT   (1 << 0)
+#define VSH_CPU_CLIP_RIGHT  (1 << 1)
+#define VSH_CPU_CLIP_TOP    (1 << 2)
+#define VSH_CPU_CLIP_BOTTOM (1 << 3)
+#define VSH_CPU_CLIP_NEAR   (1 << 4)
+#define VSH_CPU_CLIP_FAR    (1 << 5)
+#define VSH_CPU_CLIP_W      (1 << 6)
+
+typedef struct VshCpuProgram VshCpuProgram;
+
+/*
+ * Returns NULL if the program cannot be translated, e.g. because it writes
+ * constant registers or is not terminated by a final token.
+ */
+VshCpuProgram *vsh_cpu_compile_program(const uint32_t (*tokens)[4],
+                                       unsigned int length);
+
+/*
+ * Fixed function position transform by the composite matrix starting at
+ * constant composite_matrix. Diffuse, specular and texture coordinates are
+ * passed through, lighting, skinning and texgen are not modelled.
+ */
+VshCpuProgram *vsh_cpu_compile_fixed_function(unsigned int composite_matrix);
+
+void vsh_cpu_program_free(VshCpuProgram *prog);
+
+void vsh_cpu_execute(const VshCpuProgram *prog, const float (*constants)[4],
+                     const float (*inputs)[VSH_CPU_INPUTS][4],
+                     float (*outputs)[VSH_CPU_OUTPUTS][4], unsigned int count);
+
+typedef struct VshCpuViewport {
+    /* Surface size in (non anti-aliased) pixels */
+    float width, height;
+    /* Depth clip range in depth buffer units, as in ZCLIPMIN/ZCLIPMAX */
+    bool depth_clip;
+    float zmin, zmax;
+    /* Viewport offset applied by the fixed function pipeline */
+    float offset_x, offset_y;
+    bool fixed_function;
+    bool z_perspective;
+} VshCpuViewport;
+
+/*
+ * Compute screen space positions (x, y, z, 1/w) and outcodes of transformed
+ * vertices, mirroring the position fixup at the end of the generated vertex
+ * shaders. Screen positions are only meaningful without VSH_CPU_CLIP_W.
+ */
+void vsh_cpu_project(const VshCpuViewport *vp,
+                     const float (*outputs)[VSH_CPU_OUTPUTS][4],
+                     float (*screen)[4], uint8_t *clip, unsigned int count);
+
+/*
+ * The fastest kernel supported by the host is selected at startup. For
+ * testing, vsh_cpu_test_next_accel() steps down to the next slower kernel
+ * and returns false once the generic kernel is reached.
+ */
+bool vsh_cpu_test_next_accel(void);
+const char *vsh_cpu_accel_name(void);
+
+#endif
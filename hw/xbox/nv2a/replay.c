@@ -0,0 +1,374 @@
+/*
+ * QEMU Geforce NV2A pushbuffer replay
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+#include "capture.h"
+#include "qemu/main-loop.h"
+#include "xemu-version.h"
+
+/*
+ * Replay feeds a capture back through pgraph_method on the PFIFO thread with
+ * the guest CPU stopped, so the renderers see exactly the method stream and
+ * memory contents the guest produced. Per-frame render times are reported on
+ * completion.
+ */
+
+typedef struct NV2AReplayState {
+    GMappedFile *mapped;
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    GPtrArray *pages;
+    GArray *frame_times;
+    int64_t frame_start;
+    uint64_t num_methods;
+    uint64_t num_mismatches;
+} NV2AReplayState;
+
+static char *replay_path;
+
+void nv2a_replay_set_path(const char *path)
+{
+    g_free(replay_path);
+    replay_path = g_strdup(path);
+}
+
+bool nv2a_replay_is_enabled(void)
+{
+    return replay_path != NULL;
+}
+
+static bool replay_open(NV2AState *d, NV2AReplayState *r)
+{
+    g_autoptr(GError) err = NULL;
+
+    /* Writable private mapping, parameters are passed as non-const words */
+    r->mapped = g_mapped_file_new(replay_path, TRUE, &err);
+    if (!r->mapped) {
+        error_report("nv2a replay: failed to open %s: %s", replay_path,
+                     err->message);
+        return false;
+    }
+
+    r->data = (const uint8_t *)g_mapped_file_get_contents(r->mapped);
+    r->size = g_mapped_file_get_length(r->mapped);
+
+    NV2ACaptureFileHeader header;
+    if (r->size < sizeof(header)) {
+        error_report("nv2a replay: %s is truncated", replay_path);
+        return false;
+    }
+    memcpy(&header, r->data, sizeof(header));
+    r->offset = sizeof(header);
+
+    if (header.magic != NV2A_CAPTURE_MAGIC ||
+        header.format_version != NV2A_CAPTURE_FORMAT_VERSION) {
+        error_report("nv2a replay: %s is not a supported capture file",
+                     replay_path);
+        return false;
+    }
+
+    header.xemu_version[sizeof(header.xemu_version) - 1] = '\0';
+    if (strcmp(header.xemu_version, xemu_version)) {
+        warn_report("nv2a replay: capture was created by xemu %s, "
+                    "replaying with %s", header.xemu_version, xemu_version);
+    }
+
+    if (header.vram_size != memory_region_size(d->vram) ||
+        header.ramin_size != memory_region_size(&d->ramin)) {
+        error_report("nv2a replay: memory size mismatch (capture has %" PRIu64
+                     " MiB VRAM)", header.vram_size / MiB);
+        return false;
+    }
+
+    r->pages = g_ptr_array_new();
+    r->frame_times = g_array_new(false, false, sizeof(int64_t));
+
+    return true;
+}
+
+static void replay_close(NV2AReplayState *r)
+{
+    if (r->pages) {
+        g_ptr_array_free(r->pages, true);
+    }
+    if (r->frame_times) {
+        g_array_free(r->frame_times, true);
+    }
+    if (r->mapped) {
+        g_mapped_file_unref(r->mapped);
+    }
+}
+
+static bool replay_load_state(NV2AState *d, const uint8_t *payload,
+                              size_t length)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (length != nv2a_capture_get_state_size()) {
+        error_report("nv2a replay: state record size mismatch");
+        return false;
+    }
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&pg->lock);
+    nv2a_capture_load_state(d, payload);
+    qemu_mutex_unlock(&pg->lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    /* Drop any cached surfaces/textures, as is done after loading a vm */
+    qatomic_set(&pg->flush_pending, true);
+    pgraph_process_pending(d);
+
+    return true;
+}
+
+static bool replay_map_page(NV2AState *d, NV2AReplayState *r,
+                            const NV2ACapturePageMap *map)
+{
+    if (map->data_id >= r->pages->len) {
+        error_report("nv2a replay: invalid page data id %u", map->data_id);
+        return false;
+    }
+
+    const uint8_t *src = g_ptr_array_index(r->pages, map->data_id);
+    hwaddr addr = (hwaddr)map->page_index * NV2A_CAPTURE_PAGE_SIZE;
+
+    switch (map->space) {
+    case NV2A_CAPTURE_SPACE_VRAM:
+        if (addr + NV2A_CAPTURE_PAGE_SIZE > memory_region_size(d->vram)) {
+            break;
+        }
+        memcpy(d->vram_ptr + addr, src, NV2A_CAPTURE_PAGE_SIZE);
+        memory_region_set_client_dirty(d->vram, addr, NV2A_CAPTURE_PAGE_SIZE,
+                                       DIRTY_MEMORY_NV2A);
+        memory_region_set_client_dirty(d->vram, addr, NV2A_CAPTURE_PAGE_SIZE,
+                                       DIRTY_MEMORY_NV2A_TEX);
+        return true;
+    case NV2A_CAPTURE_SPACE_RAMIN:
+        if (addr + NV2A_CAPTURE_PAGE_SIZE > memory_region_size(&d->ramin)) {
+            break;
+        }
+        memcpy(d->ramin_ptr + addr, src, NV2A_CAPTURE_PAGE_SIZE);
+        return true;
+    default:
+        break;
+    }
+
+    error_report("nv2a replay: invalid page mapping");
+    return false;
+}
+
+static void replay_set_context(NV2AState *d, const NV2ACaptureContext *ctx)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&pg->lock);
+
+    /* Bind the channel directly instead of raising a context switch irq */
+    uint32_t context_user = pgraph_reg_r(pg, NV_PGRAPH_CTX_USER);
+    SET_MASK(context_user, NV_PGRAPH_CTX_USER_CHID, ctx->channel_id);
+    pgraph_reg_w(pg, NV_PGRAPH_CTX_USER, context_user);
+    pgraph_reg_w(pg, NV_PGRAPH_CTX_CONTROL,
+                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CONTROL) |
+                     NV_PGRAPH_CTX_CONTROL_CHID);
+
+    qemu_mutex_unlock(&pg->lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+}
+
+static bool replay_method(NV2AState *d, NV2AReplayState *r,
+                          const uint8_t *payload, size_t length)
+{
+    PGRAPHState *pg = &d->pgraph;
+    NV2ACaptureMethod m;
+
+    if (length < sizeof(m)) {
+        return false;
+    }
+    memcpy(&m, payload, sizeof(m));
+    if (length != sizeof(m) + m.num_words * sizeof(uint32_t) ||
+        m.num_words < m.num_words_available) {
+        return false;
+    }
+
+    uint32_t *parameters = (uint32_t *)(payload + sizeof(m));
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&pg->lock);
+
+    int num_processed =
+        pgraph_method(d, m.subchannel, m.method, m.parameter, parameters,
+                      m.num_words_available, m.num_words, m.inc);
+    bool is_flip = m.method == NV097_FLIP_STALL &&
+                   GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CTX_SWITCH1),
+                            NV_PGRAPH_CTX_SWITCH1_GRCLASS) ==
+                       NV_KELVIN_PRIMITIVE;
+
+    /* Nothing services notifies or flips during replay, don't wait on them */
+    pg->waiting_for_nop = false;
+    pg->waiting_for_flip = false;
+    pg->pending_interrupts = 0;
+
+    qemu_mutex_unlock(&pg->lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    r->num_methods++;
+    if (num_processed != (int)m.num_words_processed) {
+        if (!r->num_mismatches) {
+            warn_report("nv2a replay: method 0x%x consumed %d words, "
+                        "%u during capture",
+                        m.method, num_processed, m.num_words_processed);
+        }
+        r->num_mismatches++;
+    }
+
+    if (is_flip) {
+        pgraph_process_pending(d);
+        pgraph_process_pending_reports(d);
+
+        int64_t now = get_clock_realtime();
+        int64_t frame_time = now - r->frame_start;
+        g_array_append_val(r->frame_times, frame_time);
+        r->frame_start = now;
+    }
+
+    return true;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void replay_report(NV2AReplayState *r)
+{
+    unsigned int num_frames = r->frame_times->len;
+
+    info_report("nv2a replay: %" PRIu64 " methods, %u frames, "
+                "%" PRIu64 " mismatches",
+                r->num_methods, num_frames, r->num_mismatches);
+
+    if (!num_frames) {
+        return;
+    }
+
+    int64_t *times = &g_array_index(r->frame_times, int64_t, 0);
+    qsort(times, num_frames, sizeof(int64_t), compare_int64);
+
+    int64_t total = 0;
+    for (unsigned int i = 0; i < num_frames; i++) {
+        total += times[i];
+    }
+
+    unsigned int p99 = MIN(num_frames - 1, (num_frames * 99) / 100);
+    info_report("nv2a replay: frame ms avg %.3f min %.3f max %.3f "
+                "median %.3f p99 %.3f",
+                total / (double)num_frames / SCALE_MS,
+                times[0] / (double)SCALE_MS,
+                times[num_frames - 1] / (double)SCALE_MS,
+                times[num_frames / 2] / (double)SCALE_MS,
+                times[p99] / (double)SCALE_MS);
+}
+
+/* Called on the PFIFO thread with the pfifo lock held */
+void nv2a_replay_run(NV2AState *d)
+{
+    NV2AReplayState r = { 0 };
+    bool ok = replay_open(d, &r);
+
+    r.frame_start = get_clock_realtime();
+
+    while (ok && !d->exiting) {
+        NV2ACaptureRecord rec;
+        if (r.offset + sizeof(rec) > r.size) {
+            error_report("nv2a replay: unexpected end of capture");
+            ok = false;
+            break;
+        }
+        memcpy(&rec, r.data + r.offset, sizeof(rec));
+        r.offset += sizeof(rec);
+
+        if (rec.length > r.size - r.offset) {
+            error_report("nv2a replay: truncated record");
+            ok = false;
+            break;
+        }
+        const uint8_t *payload = r.data + r.offset;
+        r.offset += rec.length;
+
+        switch (rec.type) {
+        case NV2A_CAPTURE_REC_STATE:
+            ok = replay_load_state(d, payload, rec.length);
+            break;
+        case NV2A_CAPTURE_REC_PAGE_DATA:
+            if (rec.length != NV2A_CAPTURE_PAGE_SIZE) {
+                ok = false;
+                break;
+            }
+            g_ptr_array_add(r.pages, (gpointer)payload);
+            break;
+        case NV2A_CAPTURE_REC_PAGE_MAP: {
+            NV2ACapturePageMap map;
+            if (rec.length != sizeof(map)) {
+                ok = false;
+                break;
+            }
+            memcpy(&map, payload, sizeof(map));
+            ok = replay_map_page(d, &r, &map);
+            break;
+        }
+        case NV2A_CAPTURE_REC_CONTEXT: {
+            NV2ACaptureContext ctx;
+            if (rec.length != sizeof(ctx)) {
+                ok = false;
+                break;
+            }
+            memcpy(&ctx, payload, sizeof(ctx));
+            replay_set_context(d, &ctx);
+            break;
+        }
+        case NV2A_CAPTURE_REC_METHOD:
+            ok = replay_method(d, &r, payload, rec.length);
+            break;
+        case NV2A_CAPTURE_REC_END:
+            replay_report(&r);
+            goto done;
+        default:
+            error_report("nv2a replay: unknown record type %u", rec.type);
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok) {
+        error_report("nv2a replay: stopped at offset %zu", r.offset);
+    }
+
+done:
+    replay_close(&r);
+
+    qemu_mutex_unlock(&d->pfifo.lock);
+    bql_lock();
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
+    bql_unlock();
+    qemu_mutex_lock(&d->pfifo.lock);
+}
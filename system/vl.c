@@ -140,6 +140,7 @@
 #include "ui/xemu-net.h"
 #include "ui/xemu-input.h"
 #include "hw/xbox/eeprom_generation.h"
+#include "hw/xbox/nv2a/debug.h"
 
 #define MAX_VIRTIO_CONSOLES 1
 
@@ -2972,6 +2973,20 @@ void qemu_init(int argc, char **argv)
         }
     }
 
+    // Replay an NV2A capture with the guest CPU stopped
+    bool nv2a_replay = false;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && strcmp(argv[i], "-nv2a_replay") == 0) {
+            argv[i] = NULL;
+            if (i < argc - 1 && argv[i+1]) {
+                nv2a_replay_set_path(argv[i+1]);
+                nv2a_replay = true;
+                argv[i+1] = NULL;
+            }
+            break;
+        }
+    }
+
     if (strlen(dvd_path) > 0) {
         if (xemu_check_file(dvd_path) || strcmp(dvd_path, hdd_path) == 0) {
             char *msg = g_strdup_printf("Failed to open DVD image file '%s'. Please check machine settings.", dvd_path);
@@ -2996,6 +3011,10 @@ void qemu_init(int argc, char **argv)
     fake_argv[fake_argc++] = strdup("-device");
     fake_argv[fake_argc++] = strdup("usb-hub,port=1,ports=4");
 
+    if (nv2a_replay) {
+        fake_argv[fake_argc++] = strdup("-S");
+    }
+
     for (int i = 1; i < argc; i++) {
         if (argv[i] != NULL) {
             fake_argv[fake_argc++] = argv[i];
@@ -0,0 +1,258 @@
+/*
+ * Crosscheck and benchmark NV2A image blits.
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hw/xbox/nv2a/pgraph/blit.h"
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+int widths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 640 };
+int heights[] = { 1, 2, 5 };
+int bpps[] = { 1, 2, 4 };
+uint32_t betas[] = { 0, 0x00800000, 0x3f800000, 0x40000000, 0x7f000000,
+                     0x7f800000 };
+
+/* The original two-pass implementation */
+static void ref_image_blit_rect(uint8_t *dest, unsigned int dest_pitch,
+                                const uint8_t *source,
+                                unsigned int source_pitch, unsigned int width,
+                                unsigned int height,
+                                unsigned int bytes_per_pixel,
+                                ImageBlitOperation operation, uint32_t beta,
+                                bool patch_alpha, uint8_t alpha)
+{
+    const uint8_t *source_row = source;
+    uint8_t *dest_row = dest;
+
+    if (operation == IMAGE_BLIT_SRCCOPY) {
+        for (unsigned int y = 0; y < height; y++) {
+            memmove(dest_row, source_row, width * bytes_per_pixel);
+            source_row += source_pitch;
+            dest_row += dest_pitch;
+        }
+    } else {
+        uint32_t max_beta_mult = 0x7f80;
+        uint32_t beta_mult = beta >> 16;
+        uint32_t inv_beta_mult = max_beta_mult - beta_mult;
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int x = 0; x < width; x++) {
+                for (unsigned int ch = 0; ch < 3; ch++) {
+                    uint32_t a = source_row[x * 4 + ch] * beta_mult;
+                    uint32_t b = dest_row[x * 4 + ch] * inv_beta_mult;
+                    dest_row[x * 4 + ch] = (a + b) / max_beta_mult;
+                }
+            }
+            source_row += source_pitch;
+            dest_row += dest_pitch;
+        }
+    }
+
+    if (patch_alpha) {
+        dest_row = dest;
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int x = 0; x < width; x++) {
+                dest_row[x * 4 + 3] = alpha;
+            }
+            dest_row += dest_pitch;
+        }
+    }
+}
+
+static void crosscheck_one(ImageBlitOperation operation, int width,
+                           int height, int bpp, uint32_t beta,
+                           bool patch_alpha, int pitch_adjust)
+{
+    size_t pitch = width * 4 + pitch_adjust;
+    size_t size_bytes = pitch * height;
+
+    uint8_t *source = calloc(1, size_bytes);
+    uint8_t *dest_ref = malloc(size_bytes);
+    uint8_t *dest = malloc(size_bytes);
+    for (size_t i = 0; i < size_bytes; i++) {
+        source[i] = rand();
+        dest_ref[i] = rand();
+    }
+    memcpy(dest, dest_ref, size_bytes);
+
+    ref_image_blit_rect(dest_ref, pitch, source, pitch, width, height, bpp,
+                        operation, beta, patch_alpha, 0x5a);
+    image_blit_rect(dest, pitch, source, pitch, width, height, bpp,
+                    operation, beta, patch_alpha, 0x5a);
+    assert(!memcmp(dest, dest_ref, size_bytes));
+
+    free(dest);
+    free(dest_ref);
+    free(source);
+}
+
+static void crosscheck_overlap(void)
+{
+    /* Scroll within one buffer, in both directions */
+    const int width = 37, height = 9, pitch = width * 4 + 4;
+    size_t size_bytes = pitch * (height + 2);
+
+    for (int shift = -6; shift <= 6; shift++) {
+        uint8_t *ref = malloc(size_bytes);
+        uint8_t *buf = malloc(size_bytes);
+        for (size_t i = 0; i < size_bytes; i++) {
+            ref[i] = rand();
+        }
+        memcpy(buf, ref, size_bytes);
+
+        size_t src_off = pitch + 8, dst_off = pitch + 8 + shift * 4;
+        ref_image_blit_rect(ref + dst_off, pitch, ref + src_off, pitch,
+                            width - 2, height, 4, IMAGE_BLIT_SRCCOPY, 0,
+                            true, 0xff);
+        image_blit_rect(buf + dst_off, pitch, buf + src_off, pitch,
+                        width - 2, height, 4, IMAGE_BLIT_SRCCOPY, 0, true,
+                        0xff);
+        assert(!memcmp(buf, ref, size_bytes));
+
+        free(buf);
+        free(ref);
+    }
+}
+
+static void crosscheck(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    for (int pitch_adjust = 0; pitch_adjust < 8; pitch_adjust += 3)
+    for (int width_idx = 0; width_idx < ARRAY_SIZE(widths); width_idx++)
+    for (int height_idx = 0; height_idx < ARRAY_SIZE(heights); height_idx++)
+    for (int patch_alpha = 0; patch_alpha < 2; patch_alpha++) {
+        int width = widths[width_idx];
+        int height = heights[height_idx];
+
+        for (int bpp_idx = 0; bpp_idx < ARRAY_SIZE(bpps); bpp_idx++) {
+            int bpp = bpps[bpp_idx];
+            crosscheck_one(IMAGE_BLIT_SRCCOPY, width, height, bpp, 0,
+                           patch_alpha && bpp == 4, pitch_adjust);
+        }
+
+        for (int beta_idx = 0; beta_idx < ARRAY_SIZE(betas); beta_idx++) {
+            crosscheck_one(IMAGE_BLIT_BLEND_AND, width, height, 4,
+                           betas[beta_idx], patch_alpha, pitch_adjust);
+        }
+    }
+
+    /* Exhaustive over channel values for every implemented beta */
+    uint8_t *source = malloc(256 * 256 * 4);
+    uint8_t *dest_ref = malloc(256 * 256 * 4);
+    uint8_t *dest = malloc(256 * 256 * 4);
+    for (int i = 0; i < 256 * 256; i++) {
+        source[i * 4 + 0] = source[i * 4 + 1] = source[i * 4 + 2] = i & 0xff;
+        dest_ref[i * 4 + 0] = dest_ref[i * 4 + 1] = dest_ref[i * 4 + 2] =
+            i >> 8;
+        source[i * 4 + 3] = dest_ref[i * 4 + 3] = 0;
+    }
+    for (uint32_t k = 0; k < 256; k++) {
+        uint32_t beta = k << 23;
+        uint8_t *expected = malloc(256 * 256 * 4);
+        memcpy(expected, dest_ref, 256 * 256 * 4);
+        memcpy(dest, dest_ref, 256 * 256 * 4);
+        ref_image_blit_rect(expected, 256 * 4, source, 256 * 4, 256, 256, 4,
+                            IMAGE_BLIT_BLEND_AND, beta, false, 0);
+        image_blit_rect(dest, 256 * 4, source, 256 * 4, 256, 256, 4,
+                        IMAGE_BLIT_BLEND_AND, beta, false, 0);
+        assert(!memcmp(dest, expected, 256 * 256 * 4));
+        free(expected);
+    }
+    free(dest);
+    free(dest_ref);
+    free(source);
+
+    crosscheck_overlap();
+
+    fprintf(stderr, "ok!\n");
+}
+
+#define NUM_ITERATIONS 10
+
+static int compare_ints(const void *a, const void *b)
+{
+    return *(int*)a - *(int*)b;
+}
+
+typedef void (*BlitFunc)(uint8_t *dest, unsigned int dest_pitch,
+                         const uint8_t *source, unsigned int source_pitch,
+                         unsigned int width, unsigned int height,
+                         unsigned int bytes_per_pixel,
+                         ImageBlitOperation operation, uint32_t beta,
+                         bool patch_alpha, uint8_t alpha);
+
+static void bench_one(const char *name, BlitFunc func,
+                      ImageBlitOperation operation, bool patch_alpha)
+{
+    const int width = 640, height = 480, pitch = width * 4;
+    size_t size_bytes = pitch * height;
+
+    uint8_t *src_data = calloc(1, size_bytes);
+    uint8_t *dst_data = calloc(1, size_bytes);
+
+    int samples[NUM_ITERATIONS];
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        func(dst_data, pitch, src_data, pitch, width, height, 4, operation,
+             0x40000000, patch_alpha, 0xff);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+        uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+        samples[iter] = (end_ns - start_ns) / 1000;
+    }
+
+    qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+
+    fprintf(stderr, "[%9s] %9s alpha:%d  med: %6d us\n", name,
+            operation == IMAGE_BLIT_SRCCOPY ? "srccopy" : "blend_and",
+            patch_alpha, samples[ARRAY_SIZE(samples) / 2]);
+
+    free(dst_data);
+    free(src_data);
+}
+
+static void bench(void)
+{
+    for (int op = IMAGE_BLIT_SRCCOPY; op <= IMAGE_BLIT_BLEND_AND; op++)
+    for (int patch_alpha = 0; patch_alpha < 2; patch_alpha++) {
+        bench_one("reference", ref_image_blit_rect, op, patch_alpha);
+        bench_one("fused", image_blit_rect, op, patch_alpha);
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    srand(1337);
+
+    crosscheck();
+    if (argc > 1 && !strcmp(argv[1], "--bench")) {
+        bench();
+    }
+
+    return 0;
+}
@@ -17,6 +17,7 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -24,59 +25,69 @@
 #include <unistd.h>
 #include <time.h>
 
-#define X_METHODS \
-    X(A)
-    // X(B)
-
-typedef void (*swizzle_box_handler)(
-    const uint8_t *src_buf,
-    unsigned int width,
-    unsigned int height,
-    unsigned int depth,
-    uint8_t *dst_buf,
-    unsigned int row_pitch,
-    unsigned int slice_pitch,
-    unsigned int bytes_per_pixel);
-
-typedef struct Method {
-    const char *name;
-    swizzle_box_handler swizzle, unswizzle;
-} Method;
-
-#define PROTO(m) \
-    void m( \
-    const uint8_t *src_buf, \
-    unsigned int width, \
-    unsigned int height, \
-    unsigned int depth, \
-    uint8_t *dst_buf, \
-    unsigned int row_pitch, \
-    unsigned int slice_pitch, \
-    unsigned int bytes_per_pixel);
-
-#define X(m) \
-    PROTO(swizzle_box_ ## m) \
-    PROTO(unswizzle_box_ ## m)
-X_METHODS
-#undef X
-
-const Method methods[] = {
-    #define X(m) { #m, swizzle_box_ ## m, unswizzle_box_ ## m},
-    X_METHODS
-    #undef X
-};
+/* Built into the test to reach every kernel, not only the selected one */
+#include "hw/xbox/nv2a/pgraph/swizzle.c"
+
+#ifdef SWIZZLE_HAVE_X86
+/* Stand-in for util/cpuinfo-i386.c, which needs the full QEMU build */
+unsigned cpuinfo_init(void)
+{
+    __builtin_cpu_init();
+    return CPUINFO_ALWAYS |
+           (__builtin_cpu_supports("sse2") ? CPUINFO_SSE2 : 0) |
+           (__builtin_cpu_supports("avx2") ? CPUINFO_AVX2 : 0) |
+           (__builtin_cpu_supports("bmi2") ? CPUINFO_BMI2 : 0);
+}
+#endif
 
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 
-int widths[] = { 1, 2, 4, 8, 16, 32 };
-int heights[] = { 1, 2, 4, 8, 16, 32 };
-int depths[] = { 1, 2, 4, 8, 16, 32 };
+int widths[] = { 1, 2, 4, 8, 16, 32, 64 };
+int heights[] = { 1, 2, 4, 8, 16, 32, 64 };
+int depths[] = { 1, 2, 4, 8 };
 int bpps[] = { 1, 2, 3, 4 };
 
+/* Straightforward bit interleave, independent of the kernels under test */
+static size_t ref_swizzle_offset(unsigned int x, unsigned int y,
+                                 unsigned int z, unsigned int width,
+                                 unsigned int height, unsigned int depth)
+{
+    size_t offset = 0;
+    unsigned int out_bit = 0;
+
+    for (unsigned int bit = 1; bit < width || bit < height || bit < depth;
+         bit <<= 1) {
+        if (bit < width) {
+            offset |= (size_t)((x & bit) ? 1 : 0) << out_bit++;
+        }
+        if (bit < height) {
+            offset |= (size_t)((y & bit) ? 1 : 0) << out_bit++;
+        }
+        if (bit < depth) {
+            offset |= (size_t)((z & bit) ? 1 : 0) << out_bit++;
+        }
+    }
+
+    return offset;
+}
+
+static void ref_swizzle_box(const uint8_t *src_buf, unsigned int width,
+                            unsigned int height, unsigned int depth,
+                            uint8_t *dst_buf, unsigned int row_pitch,
+                            unsigned int slice_pitch, unsigned int bpp)
+{
+    for (unsigned int z = 0; z < depth; z++)
+    for (unsigned int y = 0; y < height; y++)
+    for (unsigned int x = 0; x < width; x++) {
+        size_t off = ref_swizzle_offset(x, y, z, width, height, depth);
+        memcpy(dst_buf + off * bpp,
+               src_buf + z * slice_pitch + y * row_pitch + x * bpp, bpp);
+    }
+}
+
 static void crosscheck(void)
 {
-    assert(ARRAY_SIZE(methods) > 0);
-    fprintf(stderr, "%s...", __func__);
+    fprintf(stderr, "%s [%6s]...", __func__, swizzle_accel_name());
     for (int row_pitch_adjust = 0; row_pitch_adjust < 4; row_pitch_adjust++)
     for (int slice_pitch_adjust = 0; slice_pitch_adjust < 4; slice_pitch_adjust++)
     for (int depth_idx = 0; depth_idx < ARRAY_SIZE(depths); depth_idx++)
@@ -90,51 +101,35 @@ static void crosscheck(void)
         int bpp = bpps[bpp_idx];
 
         size_t row_pitch = width * bpp + row_pitch_adjust;
-        size_t slice_pitch = row_pitch * height;
-        size_t size_bytes = slice_pitch * depth + slice_pitch_adjust;
+        size_t slice_pitch = row_pitch * height + slice_pitch_adjust;
+        size_t size_bytes = slice_pitch * depth;
 
         uint8_t *original_data = malloc(size_bytes);
         for (int i = 0; i < size_bytes; i++) {
             original_data[i] = rand();
         }
 
-        void *swizzled_data_A = malloc(size_bytes);
-        memcpy(swizzled_data_A, original_data, size_bytes);
-        methods[0].swizzle(original_data, width, height, depth, swizzled_data_A,
-                           row_pitch, slice_pitch, bpp);
-
-        void *unswizzled_data_A = malloc(size_bytes);
-        memcpy(unswizzled_data_A, original_data, size_bytes);
-        methods[0].unswizzle(swizzled_data_A, width, height, depth,
-                             unswizzled_data_A, row_pitch, slice_pitch, bpp);
-        assert(!memcmp(original_data, unswizzled_data_A, size_bytes));
-
-        for (int method_idx = 1;
-             method_idx < ARRAY_SIZE(methods);
-             method_idx++) {
-            void *swizzled_data_B = malloc(size_bytes);
-            memcpy(swizzled_data_B, original_data, size_bytes);
-            methods[method_idx].swizzle(original_data, width, height, depth,
-                                        swizzled_data_B, row_pitch, slice_pitch,
-                                        bpp);
-            assert(!memcmp(swizzled_data_B, swizzled_data_A, size_bytes));
-
-            void *unswizzled_data_B = malloc(size_bytes);
-            memcpy(unswizzled_data_B, original_data, size_bytes);
-            methods[method_idx].unswizzle(swizzled_data_B, width, height, depth,
-                                          unswizzled_data_B, row_pitch,
-                                          slice_pitch, bpp);
-            assert(!memcmp(original_data, unswizzled_data_B, size_bytes));
-
-            free(unswizzled_data_B);
-            free(swizzled_data_B);
-        }
-
-        free(unswizzled_data_A);
-        free(swizzled_data_A);
+        uint8_t *swizzled_ref = malloc(size_bytes);
+        memcpy(swizzled_ref, original_data, size_bytes);
+        ref_swizzle_box(original_data, width, height, depth, swizzled_ref,
+                        row_pitch, slice_pitch, bpp);
+
+        uint8_t *swizzled = malloc(size_bytes);
+        memcpy(swizzled, original_data, size_bytes);
+        swizzle_box(original_data, width, height, depth, swizzled,
+                    row_pitch, slice_pitch, bpp);
+        assert(!memcmp(swizzled, swizzled_ref, size_bytes));
+
+        uint8_t *unswizzled = malloc(size_bytes);
+        memcpy(unswizzled, original_data, size_bytes);
+        unswizzle_box(swizzled_ref, width, height, depth, unswizzled,
+                      row_pitch, slice_pitch, bpp);
+        assert(!memcmp(original_data, unswizzled, size_bytes));
+
+        free(unswizzled);
+        free(swizzled);
+        free(swizzled_ref);
         free(original_data);
-
-        // fprintf(stderr, "w:%d, h:%d, d:%d, bpp:%d pitch:%d,%d\n", width, height, depth, bpp, row_pitch_adjust, slice_pitch_adjust);
     }
 
     fprintf(stderr, "ok!\n");
@@ -147,71 +142,102 @@ static int compare_ints(const void *a, const void *b)
     return *(int*)a - *(int*)b;
 }
 
-static void bench(void)
-{
-    fprintf(stderr, "%s...", __func__);
-
-    int width = 256;
-    int height = 256;
-    int depth = 256;
-    int bpp = 4;
+typedef void (*SwizzleFunc)(const uint8_t *src_buf, unsigned int width,
+                            unsigned int height, unsigned int depth,
+                            uint8_t *dst_buf, unsigned int row_pitch,
+                            unsigned int slice_pitch,
+                            unsigned int bytes_per_pixel);
 
+static void bench_one(const char *op, SwizzleFunc func, int width, int height,
+                      int depth, int bpp)
+{
     size_t row_pitch = width * bpp;
     size_t slice_pitch = row_pitch * height;
     size_t size_bytes = slice_pitch * depth;
-    size_t size_mib = size_bytes / (1024*1024);
-    fprintf(stderr, "with w: %d, h: %d, d: %d, bpp: %d, "
-                    "size: %zu MiB, iterations: %d\n",
-                    width, height, depth, bpp, size_mib, NUM_ITERATIONS);
 
-    void *original_data = malloc(size_bytes);
-    memset(original_data, 0, size_bytes);
+    void *src_data = malloc(size_bytes);
+    memset(src_data, 0, size_bytes);
 
-    void *swizzled_data = malloc(size_bytes);
-    memset(swizzled_data, 0, size_bytes);
+    void *dst_data = malloc(size_bytes);
+    memset(dst_data, 0, size_bytes);
 
+    int samples[NUM_ITERATIONS];
+    int sum = 0;
 
-    for (int method_idx = 0; method_idx < ARRAY_SIZE(methods); method_idx++) {
-        const Method * const method = &methods[method_idx];
-        fprintf(stderr, "[%6s] ", method->name);
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
+        struct timespec start, end;
 
-        int samples[NUM_ITERATIONS];
-        int sum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        func(src_data, width, height, depth, dst_data, row_pitch, slice_pitch,
+             bpp);
+        clock_gettime(CLOCK_MONOTONIC, &end);
 
-        for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
-            struct timespec start, end;
+        uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+        uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
 
-            clock_gettime(CLOCK_MONOTONIC, &start);
-            method->swizzle(original_data, width, height, depth, swizzled_data, row_pitch, slice_pitch, bpp);
-            clock_gettime(CLOCK_MONOTONIC, &end);
-
-            uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
-            uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+        samples[iter] = (end_ns - start_ns) / 1000;
+        sum += samples[iter];
+    }
 
-            samples[iter] = (end_ns - start_ns) / 1000;
-            sum += samples[iter];
-        }
+    qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+
+    int min = samples[0],
+        max = samples[ARRAY_SIZE(samples) - 1],
+        avg = sum / ARRAY_SIZE(samples),
+        med = samples[ARRAY_SIZE(samples) / 2] > 0 ?
+              samples[ARRAY_SIZE(samples) / 2] : 1;
+    fprintf(stderr, "[%6s] %9s %4dx%4dx%3d bpp:%d  "
+                    "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  "
+                    "-- %.2f GiB/s\n",
+            swizzle_accel_name(), op, width, height, depth, bpp,
+            min, max, avg, med,
+            (size_bytes / (1024.0 * 1024.0 * 1024.0)) / (med / 1000000.0));
+
+    free(dst_data);
+    free(src_data);
+}
 
-        qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+static void bench(void)
+{
+    static const struct {
+        int width, height, depth;
+    } shapes[] = {
+        { 1024, 1024, 1 },
+        { 128, 128, 128 },
+    };
+
+    for (int shape_idx = 0; shape_idx < ARRAY_SIZE(shapes); shape_idx++)
+    for (int bpp_idx = 0; bpp_idx < ARRAY_SIZE(bpps); bpp_idx++) {
+        int width = shapes[shape_idx].width;
+        int height = shapes[shape_idx].height;
+        int depth = shapes[shape_idx].depth;
+        int bpp = bpps[bpp_idx];
 
-        int min = samples[0],
-            max = samples[ARRAY_SIZE(samples) - 1],
-            avg = sum / ARRAY_SIZE(samples),
-            med = samples[ARRAY_SIZE(samples) / 2];
-        fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
-                min, max, avg, med, (size_mib / 1024.0) / (med / 1000000.0));
+        bench_one("swizzle", swizzle_box, width, height, depth, bpp);
+        bench_one("unswizzle", unswizzle_box, width, height, depth, bpp);
     }
-
-    free(swizzled_data);
-    free(original_data);
 }
 
 int main(int argc, char const *argv[])
 {
+    bool run_bench = argc > 1 && !strcmp(argv[1], "--bench");
+
     srand(1337);
 
-    crosscheck();
-    bench();
+    /* Check and optionally benchmark every kernel usable on this host */
+    unsigned info = get_host_cpuinfo();
+    for (size_t i = 0; i < ARRAY_SIZE(accel_table); i++) {
+        if (!accel_supported(&accel_table[i], info)) {
+            fprintf(stderr, "[%6s] not supported by host, skipped\n",
+                    accel_table[i].name);
+            continue;
+        }
+        swizzle_accel = &accel_table[i];
+        crosscheck();
+        if (run_bench) {
+            bench();
+        }
+    }
 
     return 0;
 }
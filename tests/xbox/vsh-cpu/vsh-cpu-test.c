@@ -0,0 +1,831 @@
+/*
+ * Crosscheck and benchmark the CPU vertex program executor.
+ *
+ * Copyright (c) 2025 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hw/xbox/nv2a/pgraph/vsh-cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "host/cpuinfo.h"
+
+/* Stand-in for util/cpuinfo-i386.c, which needs the full QEMU build */
+unsigned cpuinfo_init(void)
+{
+    __builtin_cpu_init();
+    return CPUINFO_ALWAYS |
+           (__builtin_cpu_supports("sse2") ? CPUINFO_SSE2 : 0) |
+           (__builtin_cpu_supports("avx2") ? CPUINFO_AVX2 : 0) |
+           (__builtin_cpu_supports("bmi2") ? CPUINFO_BMI2 : 0);
+}
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+/*
+ * Reference interpreter, a direct transcription of the GLSL that
+ * glsl/vsh-prog.c generates. It runs one vertex at a time on the raw tokens.
+ */
+
+typedef enum {
+    FLD_ILU, FLD_MAC, FLD_CONST, FLD_V,
+    FLD_A_NEG, FLD_A_SWZ_X, FLD_A_SWZ_Y, FLD_A_SWZ_Z, FLD_A_SWZ_W, FLD_A_R,
+    FLD_A_MUX,
+    FLD_B_NEG, FLD_B_SWZ_X, FLD_B_SWZ_Y, FLD_B_SWZ_Z, FLD_B_SWZ_W, FLD_B_R,
+    FLD_B_MUX,
+    FLD_C_NEG, FLD_C_SWZ_X, FLD_C_SWZ_Y, FLD_C_SWZ_Z, FLD_C_SWZ_W,
+    FLD_C_R_HIGH, FLD_C_R_LOW, FLD_C_MUX,
+    FLD_OUT_MAC_MASK, FLD_OUT_R, FLD_OUT_ILU_MASK, FLD_OUT_O_MASK,
+    FLD_OUT_ORB, FLD_OUT_ADDRESS, FLD_OUT_MUX, FLD_A0X, FLD_FINAL,
+} Field;
+
+static const struct {
+    uint8_t word, bit, len;
+} fields[] = {
+    [FLD_ILU] = { 1, 25, 3 },       [FLD_MAC] = { 1, 21, 4 },
+    [FLD_CONST] = { 1, 13, 8 },     [FLD_V] = { 1, 9, 4 },
+    [FLD_A_NEG] = { 1, 8, 1 },      [FLD_A_SWZ_X] = { 1, 6, 2 },
+    [FLD_A_SWZ_Y] = { 1, 4, 2 },    [FLD_A_SWZ_Z] = { 1, 2, 2 },
+    [FLD_A_SWZ_W] = { 1, 0, 2 },    [FLD_A_R] = { 2, 28, 4 },
+    [FLD_A_MUX] = { 2, 26, 2 },     [FLD_B_NEG] = { 2, 25, 1 },
+    [FLD_B_SWZ_X] = { 2, 23, 2 },   [FLD_B_SWZ_Y] = { 2, 21, 2 },
+    [FLD_B_SWZ_Z] = { 2, 19, 2 },   [FLD_B_SWZ_W] = { 2, 17, 2 },
+    [FLD_B_R] = { 2, 13, 4 },       [FLD_B_MUX] = { 2, 11, 2 },
+    [FLD_C_NEG] = { 2, 10, 1 },     [FLD_C_SWZ_X] = { 2, 8, 2 },
+    [FLD_C_SWZ_Y] = { 2, 6, 2 },    [FLD_C_SWZ_Z] = { 2, 4, 2 },
+    [FLD_C_SWZ_W] = { 2, 2, 2 },    [FLD_C_R_HIGH] = { 2, 0, 2 },
+    [FLD_C_R_LOW] = { 3, 30, 2 },   [FLD_C_MUX] = { 3, 28, 2 },
+    [FLD_OUT_MAC_MASK] = { 3, 24, 4 }, [FLD_OUT_R] = { 3, 20, 4 },
+    [FLD_OUT_ILU_MASK] = { 3, 16, 4 }, [FLD_OUT_O_MASK] = { 3, 12, 4 },
+    [FLD_OUT_ORB] = { 3, 11, 1 },   [FLD_OUT_ADDRESS] = { 3, 3, 8 },
+    [FLD_OUT_MUX] = { 3, 2, 1 },    [FLD_A0X] = { 3, 1, 1 },
+    [FLD_FINAL] = { 3, 0, 1 },
+};
+
+enum { MAC_NOP, MAC_MOV, MAC_MUL, MAC_ADD, MAC_MAD, MAC_DP3, MAC_DPH, MAC_DP4,
+       MAC_DST, MAC_MIN, MAC_MAX, MAC_SLT, MAC_SGE, MAC_ARL };
+enum { ILU_NOP, ILU_MOV, ILU_RCP, ILU_RCC, ILU_RSQ, ILU_EXP, ILU_LOG,
+       ILU_LIT };
+enum { PARAM_R = 1, PARAM_V, PARAM_C };
+
+static uint32_t get(const uint32_t *t, Field f)
+{
+    return (t[fields[f].word] >> fields[f].bit) & ((1u << fields[f].len) - 1);
+}
+
+static void put(uint32_t *t, Field f, uint32_t v)
+{
+    uint32_t mask = ((1u << fields[f].len) - 1) << fields[f].bit;
+    t[fields[f].word] = (t[fields[f].word] & ~mask) |
+                        ((v << fields[f].bit) & mask);
+}
+
+typedef struct RefState {
+    float r[12][4];
+    float o[16][4];
+    float temp_vec[4];
+    int a0, temp_addr;
+    const float (*v)[4];
+    const float (*c)[4];
+} RefState;
+
+static float *ref_reg(RefState *s, unsigned int n)
+{
+    return n == 12 ? s->o[0] : s->r[n];
+}
+
+static void ref_input(RefState *s, const uint32_t *t, unsigned int mux,
+                      Field neg, unsigned int reg, float out[4])
+{
+    const float zero[4] = { 0 };
+    const float *val;
+
+    switch (mux) {
+    case PARAM_R:
+        val = ref_reg(s, reg);
+        break;
+    case PARAM_V:
+        val = s->v[get(t, FLD_V)];
+        break;
+    case PARAM_C: {
+        int64_t idx = get(t, FLD_CONST);
+        if (get(t, FLD_A0X)) {
+            idx += s->a0;
+        }
+        val = (idx >= 0 && idx < VSH_CPU_CONSTANTS) ? s->c[idx] : zero;
+        break;
+    }
+    default:
+        assert(!"Bad mux");
+        return;
+    }
+
+    bool scalar = neg == FLD_C_NEG && get(t, FLD_ILU) >= ILU_RCP &&
+                  get(t, FLD_ILU) <= ILU_LOG;
+    for (int i = 0; i < 4; i++) {
+        float f = val[get(t, scalar ? neg + 1 : neg + 1 + i)];
+        out[i] = get(t, neg) ? -f : f;
+    }
+}
+
+static float ref_max(float a, float b) { return a < b ? b : a; }
+static float ref_min(float a, float b) { return b < a ? b : a; }
+
+static float ref_sign(float x)
+{
+    return x > 0.0f ? 1.0f : (x < 0.0f ? -1.0f : 0.0f);
+}
+
+static void ref_mul(const float *a, const float *b, float *r)
+{
+    for (int i = 0; i < 4; i++) {
+        r[i] = ref_sign(a[i]) * ref_sign(b[i]) == 0.0f ? 0.0f : a[i] * b[i];
+    }
+}
+
+static void ref_mac(int op, const float *a, const float *b, const float *c,
+                    float *r)
+{
+    float d;
+
+    switch (op) {
+    case MAC_MOV: memcpy(r, a, 16); break;
+    case MAC_MUL: ref_mul(a, b, r); break;
+    case MAC_ADD: for (int i = 0; i < 4; i++) r[i] = a[i] + c[i]; break;
+    case MAC_MAD:
+        ref_mul(a, b, r);
+        for (int i = 0; i < 4; i++) r[i] += c[i];
+        break;
+    case MAC_DP3:
+        d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+        r[0] = r[1] = r[2] = r[3] = d;
+        break;
+    case MAC_DPH:
+        d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + 1.0f * b[3];
+        r[0] = r[1] = r[2] = r[3] = d;
+        break;
+    case MAC_DP4:
+        d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+        r[0] = r[1] = r[2] = r[3] = d;
+        break;
+    case MAC_DST:
+        r[0] = 1.0f; r[1] = a[1] * b[1]; r[2] = a[2]; r[3] = b[3];
+        break;
+    case MAC_MIN: for (int i = 0; i < 4; i++) r[i] = ref_min(a[i], b[i]); break;
+    case MAC_MAX: for (int i = 0; i < 4; i++) r[i] = ref_max(a[i], b[i]); break;
+    case MAC_SLT: for (int i = 0; i < 4; i++) r[i] = a[i] < b[i]; break;
+    case MAC_SGE: for (int i = 0; i < 4; i++) r[i] = a[i] >= b[i]; break;
+    default: assert(!"Bad MAC op");
+    }
+}
+
+static void ref_ilu(int op, const float *s, float *r)
+{
+    float x = s[0], t;
+
+    switch (op) {
+    case ILU_MOV: memcpy(r, s, 16); return;
+    case ILU_RCP: t = 1.0f / x; break;
+    case ILU_RCC:
+        t = 1.0f / x;
+        if (t > 0.0f) {
+            t = ref_min(ref_max(t, 5.42101e-20f), 1.884467e19f);
+        } else {
+            t = ref_min(ref_max(t, -1.884467e19f), -5.42101e-20f);
+        }
+        break;
+    case ILU_RSQ:
+        t = x == 0.0f ? INFINITY : isinf(x) ? 0.0f : 1.0f / sqrtf(fabsf(x));
+        break;
+    case ILU_EXP:
+        r[0] = exp2f(floorf(x)); r[1] = x - floorf(x);
+        r[2] = exp2f(x); r[3] = 1.0f;
+        return;
+    case ILU_LOG:
+        t = fabsf(x);
+        if (t == 0.0f) {
+            r[0] = -INFINITY; r[1] = 1.0f; r[2] = -INFINITY; r[3] = 1.0f;
+        } else {
+            r[0] = floorf(log2f(t)); r[1] = t / exp2f(floorf(log2f(t)));
+            r[2] = log2f(t); r[3] = 1.0f;
+        }
+        return;
+    case ILU_LIT: {
+        float eps = 1.0f / 256.0f;
+        float w = ref_min(ref_max(s[3], -(128.0f - eps)), 128.0f - eps);
+        float sx = ref_max(s[0], 0.0f), sy = ref_max(s[1], 0.0f);
+        r[0] = 1.0f; r[1] = sx;
+        r[2] = sx > 0.0f ? exp2f(w * log2f(sy)) : 0.0f; r[3] = 1.0f;
+        return;
+    }
+    default: assert(!"Bad ILU op"); return;
+    }
+    r[0] = r[1] = r[2] = r[3] = t;
+}
+
+static void ref_write(float *dst, unsigned int mask, const float *val)
+{
+    for (int i = 0; i < 4; i++) {
+        if (mask & (8 >> i)) {
+            dst[i] = val[i];
+        }
+    }
+}
+
+static void ref_write_output(RefState *s, const uint32_t *t, const float *val)
+{
+    unsigned int reg = get(t, FLD_OUT_ADDRESS) & 0xF;
+    unsigned int mask = get(t, FLD_OUT_O_MASK);
+
+    if (reg == 5) {
+        /* fog_mask_str */
+        mask = (0xF0 >> __builtin_popcount(mask)) & 0xF;
+    }
+    ref_write(s->o[reg], mask, val);
+}
+
+static void ref_execute(const uint32_t (*tokens)[4], const float (*c)[4],
+                        const float (*v)[4], float (*out)[4])
+{
+    RefState s;
+
+    memset(&s, 0, sizeof(s));
+    for (int i = 0; i < 16; i++) {
+        s.o[i][3] = 1.0f;
+    }
+    s.v = v;
+    s.c = c;
+
+    for (int slot = 0;; slot++) {
+        const uint32_t *t = tokens[slot];
+        int mac = get(t, FLD_MAC), ilu = get(t, FLD_ILU);
+        bool paired = mac != MAC_NOP && ilu != ILU_NOP;
+        float a[4], b[4], cc[4], res[4];
+        bool set_a0 = false, set_r = false;
+        unsigned int suffix_reg = 0, suffix_mask = 0;
+
+        if (mac != MAC_NOP) {
+            ref_input(&s, t, get(t, FLD_A_MUX), FLD_A_NEG, get(t, FLD_A_R), a);
+            if (mac != MAC_MOV && mac != MAC_ADD && mac != MAC_ARL) {
+                ref_input(&s, t, get(t, FLD_B_MUX), FLD_B_NEG,
+                          get(t, FLD_B_R), b);
+            }
+            if (mac == MAC_ADD || mac == MAC_MAD) {
+                ref_input(&s, t, get(t, FLD_C_MUX), FLD_C_NEG,
+                          get(t, FLD_C_R_HIGH) << 2 | get(t, FLD_C_R_LOW),
+                          cc);
+            }
+
+            unsigned int reg = get(t, FLD_OUT_R);
+            unsigned int mask = get(t, FLD_OUT_MAC_MASK);
+            if (paired && reg == 1) {
+                mask = 0;
+            }
+            if (mac != MAC_ARL) {
+                ref_mac(mac, a, b, cc, res);
+                if (get(t, FLD_OUT_MUX) == 0 && get(t, FLD_OUT_O_MASK)) {
+                    ref_write_output(&s, t, res);
+                }
+                /* Inputs are read again for each write, like the GLSL */
+                ref_input(&s, t, get(t, FLD_A_MUX), FLD_A_NEG,
+                          get(t, FLD_A_R), a);
+                if (mac != MAC_MOV && mac != MAC_ADD) {
+                    ref_input(&s, t, get(t, FLD_B_MUX), FLD_B_NEG,
+                              get(t, FLD_B_R), b);
+                }
+                if (mac == MAC_ADD || mac == MAC_MAD) {
+                    ref_input(&s, t, get(t, FLD_C_MUX), FLD_C_NEG,
+                              get(t, FLD_C_R_HIGH) << 2 | get(t, FLD_C_R_LOW),
+                              cc);
+                }
+                ref_mac(mac, a, b, cc, res);
+            }
+
+            if (mac == MAC_ARL) {
+                /* Out of range conversions are undefined in GLSL */
+                float f = floorf(a[0] + 0.001f);
+                int addr = f >= -2147483648.0f && f < 2147483648.0f ?
+                           (int)f : INT32_MIN;
+                if (paired) {
+                    s.temp_addr = addr;
+                    set_a0 = true;
+                } else {
+                    s.a0 = addr;
+                }
+            } else if (mask) {
+                if (paired) {
+                    ref_write(s.temp_vec, mask, res);
+                    set_r = true;
+                    suffix_reg = reg;
+                    suffix_mask = mask;
+                } else {
+                    ref_write(ref_reg(&s, reg), mask, res);
+                }
+            }
+        }
+
+        if (ilu != ILU_NOP) {
+            unsigned int reg = paired ? 1 : get(t, FLD_OUT_R);
+            unsigned int cr = get(t, FLD_C_R_HIGH) << 2 | get(t, FLD_C_R_LOW);
+
+            ref_input(&s, t, get(t, FLD_C_MUX), FLD_C_NEG, cr, cc);
+            ref_ilu(ilu, cc, res);
+            if (get(t, FLD_OUT_MUX) == 1 && get(t, FLD_OUT_O_MASK)) {
+                ref_write_output(&s, t, res);
+            }
+            ref_input(&s, t, get(t, FLD_C_MUX), FLD_C_NEG, cr, cc);
+            ref_ilu(ilu, cc, res);
+            ref_write(ref_reg(&s, reg), get(t, FLD_OUT_ILU_MASK), res);
+        }
+
+        if (set_r) {
+            ref_write(ref_reg(&s, suffix_reg), suffix_mask, s.temp_vec);
+        }
+        if (set_a0) {
+            s.a0 = s.temp_addr;
+        }
+
+        if (get(t, FLD_FINAL)) {
+            break;
+        }
+    }
+
+    memcpy(out, s.o, VSH_CPU_OUTPUTS * sizeof(out[0]));
+}
+
+/* Token with identity swizzles, R0 inputs and output to the O registers */
+static void init_token(uint32_t t[4])
+{
+    memset(t, 0, 4 * sizeof(uint32_t));
+    for (int i = 0; i < 4; i++) {
+        put(t, FLD_A_SWZ_X + i, i);
+        put(t, FLD_B_SWZ_X + i, i);
+        put(t, FLD_C_SWZ_X + i, i);
+    }
+    put(t, FLD_A_MUX, PARAM_R);
+    put(t, FLD_B_MUX, PARAM_R);
+    put(t, FLD_C_MUX, PARAM_R);
+    put(t, FLD_OUT_ORB, 1);
+}
+
+static float frand(void)
+{
+    static const float specials[] = {
+        0.0f, -0.0f, 1.0f, -1.0f, INFINITY, -INFINITY, 16.999f, 0.5f,
+    };
+    if (rand() % 8 == 0) {
+        return specials[rand() % ARRAY_SIZE(specials)];
+    }
+    return ((float)rand() / RAND_MAX - 0.5f) * 8.0f;
+}
+
+static bool same_float(float a, float b)
+{
+    if (isnan(a) || isnan(b)) {
+        return isnan(a) && isnan(b);
+    }
+    return !memcmp(&a, &b, sizeof(a));
+}
+
+static void random_token(uint32_t t[4], bool final)
+{
+    static const uint8_t outputs[] = { 0, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+    for (int i = 0; i < 4; i++) {
+        t[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    }
+    put(t, FLD_MAC, rand() % (MAC_ARL + 1));
+    put(t, FLD_A_MUX, 1 + rand() % 3);
+    put(t, FLD_B_MUX, 1 + rand() % 3);
+    put(t, FLD_C_MUX, 1 + rand() % 3);
+    put(t, FLD_A_R, rand() % 13);
+    put(t, FLD_B_R, rand() % 13);
+    unsigned int cr = rand() % 13;
+    put(t, FLD_C_R_HIGH, cr >> 2);
+    put(t, FLD_C_R_LOW, cr & 3);
+    put(t, FLD_OUT_R, rand() % 13);
+    put(t, FLD_OUT_ORB, 1);
+    put(t, FLD_OUT_ADDRESS, outputs[rand() % ARRAY_SIZE(outputs)]);
+    if (get(t, FLD_A0X)) {
+        put(t, FLD_CONST, rand() % 16);
+    } else {
+        put(t, FLD_CONST, rand() % VSH_CPU_CONSTANTS);
+    }
+    if (get(t, FLD_MAC) == MAC_ARL && get(t, FLD_OUT_MUX) == 0) {
+        put(t, FLD_OUT_O_MASK, 0);
+    }
+    put(t, FLD_FINAL, final);
+}
+
+static void check_outputs(float (*expected)[4], float (*actual)[4])
+{
+    for (int i = 0; i < VSH_CPU_OUTPUTS; i++) {
+        for (int c = 0; c < 4; c++) {
+            if (!same_float(expected[i][c], actual[i][c])) {
+                fprintf(stderr, "\no%d.%c: expected %a, got %a\n", i,
+                        "xyzw"[c], expected[i][c], actual[i][c]);
+                abort();
+            }
+        }
+    }
+}
+
+#define MAX_VERTICES 19
+
+static void crosscheck(void)
+{
+    fprintf(stderr, "%s [%7s]...", __func__, vsh_cpu_accel_name());
+
+    static float constants[VSH_CPU_CONSTANTS][4];
+    for (int i = 0; i < VSH_CPU_CONSTANTS; i++) {
+        for (int c = 0; c < 4; c++) {
+            constants[i][c] = frand();
+        }
+    }
+
+    for (int iter = 0; iter < 2000; iter++) {
+        uint32_t tokens[16][4];
+        int length = 1 + rand() % ARRAY_SIZE(tokens);
+        for (int i = 0; i < length; i++) {
+            random_token(tokens[i], i == length - 1);
+        }
+
+        VshCpuProgram *prog = vsh_cpu_compile_program(
+            (const uint32_t (*)[4])tokens, length);
+        assert(prog);
+
+        int count = 1 + rand() % MAX_VERTICES;
+        float inputs[MAX_VERTICES][VSH_CPU_INPUTS][4];
+        float outputs[MAX_VERTICES][VSH_CPU_OUTPUTS][4];
+        for (int v = 0; v < count; v++) {
+            for (int i = 0; i < VSH_CPU_INPUTS; i++) {
+                for (int c = 0; c < 4; c++) {
+                    inputs[v][i][c] = frand();
+                }
+            }
+        }
+
+        vsh_cpu_execute(prog, (const float (*)[4])constants,
+                        (const float (*)[VSH_CPU_INPUTS][4])inputs, outputs,
+                        count);
+
+        for (int v = 0; v < count; v++) {
+            float expected[VSH_CPU_OUTPUTS][4];
+            ref_execute((const uint32_t (*)[4])tokens,
+                        (const float (*)[4])constants,
+                        (const float (*)[4])inputs[v], expected);
+            check_outputs(expected, outputs[v]);
+        }
+
+        vsh_cpu_program_free(prog);
+    }
+
+    fprintf(stderr, " ok\n");
+}
+
+/* Run a single token on one vertex and return one output register */
+static void run_one(const uint32_t t[4], const float (*c)[4],
+                    const float (*v)[4], int output, float out[4])
+{
+    VshCpuProgram *prog = vsh_cpu_compile_program(
+        (const uint32_t (*)[4])t, 1);
+    assert(prog);
+
+    float inputs[1][VSH_CPU_INPUTS][4];
+    float outputs[1][VSH_CPU_OUTPUTS][4];
+    memcpy(inputs[0], v, sizeof(inputs[0]));
+    vsh_cpu_execute(prog, c, (const float (*)[VSH_CPU_INPUTS][4])inputs,
+                    outputs, 1);
+    memcpy(out, outputs[0][output], 4 * sizeof(float));
+
+    vsh_cpu_program_free(prog);
+}
+
+static void check_semantics(void)
+{
+    fprintf(stderr, "%s [%7s]...", __func__, vsh_cpu_accel_name());
+
+    static float c[VSH_CPU_CONSTANTS][4];
+    float v[VSH_CPU_INPUTS][4] = { { 0 } };
+    uint32_t t[2][4];
+    float out[4];
+
+    /* MUL: 0 * inf is 0 */
+    init_token(t[0]);
+    put(t[0], FLD_MAC, MAC_MUL);
+    put(t[0], FLD_A_MUX, PARAM_V);
+    put(t[0], FLD_V, 1);
+    put(t[0], FLD_B_MUX, PARAM_C);
+    put(t[0], FLD_CONST, 7);
+    put(t[0], FLD_OUT_O_MASK, 0xF);
+    put(t[0], FLD_OUT_ADDRESS, 0);
+    put(t[0], FLD_FINAL, 1);
+    v[1][0] = 0.0f; v[1][1] = INFINITY; v[1][2] = -0.0f; v[1][3] = 2.0f;
+    c[7][0] = INFINITY; c[7][1] = 0.0f; c[7][2] = 3.0f; c[7][3] = 3.0f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 0, out);
+    assert(out[0] == 0.0f && out[1] == 0.0f && out[2] == 0.0f &&
+           out[3] == 6.0f);
+
+    /* RSQ of 0 and inf, RCC clamps, replicated C.x swizzle */
+    init_token(t[0]);
+    put(t[0], FLD_ILU, ILU_RSQ);
+    put(t[0], FLD_C_MUX, PARAM_V);
+    put(t[0], FLD_V, 2);
+    put(t[0], FLD_C_SWZ_X, 1);
+    put(t[0], FLD_OUT_MUX, 1);
+    put(t[0], FLD_OUT_O_MASK, 0xF);
+    put(t[0], FLD_OUT_ADDRESS, 9);
+    put(t[0], FLD_FINAL, 1);
+    v[2][0] = 4.0f; v[2][1] = 0.0f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(isinf(out[0]) && out[0] > 0 && isinf(out[3]));
+    v[2][1] = -INFINITY;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(out[0] == 0.0f);
+    v[2][1] = -4.0f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(out[0] == 0.5f && out[2] == 0.5f);
+    put(t[0], FLD_ILU, ILU_RCC);
+    v[2][1] = 1e-30f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(out[0] == 1.884467e19f);
+    v[2][1] = -1e30f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(out[0] == -5.42101e-20f);
+    v[2][1] = 0.0f;
+
+    /* LOG of 0 */
+    put(t[0], FLD_ILU, ILU_LOG);
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 9, out);
+    assert(out[0] == -INFINITY && out[1] == 1.0f && out[2] == -INFINITY);
+
+    /* Fog takes the masked components from x */
+    put(t[0], FLD_ILU, ILU_MOV);
+    put(t[0], FLD_C_SWZ_X, 0);
+    put(t[0], FLD_OUT_ADDRESS, 5);
+    put(t[0], FLD_OUT_O_MASK, 0x1);
+    v[2][0] = 42.0f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 5, out);
+    assert(out[0] == 42.0f && out[1] == 0.0f && out[3] == 1.0f);
+
+    /* ARL rounds up values just below an integer, then relative addressing */
+    init_token(t[0]);
+    put(t[0], FLD_MAC, MAC_ARL);
+    put(t[0], FLD_A_MUX, PARAM_V);
+    put(t[0], FLD_V, 3);
+    init_token(t[1]);
+    put(t[1], FLD_MAC, MAC_MOV);
+    put(t[1], FLD_A_MUX, PARAM_C);
+    put(t[1], FLD_A0X, 1);
+    put(t[1], FLD_CONST, 3);
+    put(t[1], FLD_OUT_O_MASK, 0xF);
+    put(t[1], FLD_OUT_ADDRESS, 3);
+    put(t[1], FLD_FINAL, 1);
+    v[3][0] = 16.9995f;
+    c[20][0] = 123.0f;
+    {
+        VshCpuProgram *prog = vsh_cpu_compile_program(
+            (const uint32_t (*)[4])t, 2);
+        float outputs[1][VSH_CPU_OUTPUTS][4];
+        vsh_cpu_execute(prog, (const float (*)[4])c,
+                        (const float (*)[VSH_CPU_INPUTS][4])v, outputs, 1);
+        assert(outputs[0][VSH_CPU_OUT_D0][0] == 123.0f);
+        vsh_cpu_program_free(prog);
+    }
+
+    /* Paired MAC and ILU both read the registers from before the pair */
+    {
+        uint32_t p[3][4];
+        init_token(p[0]);
+        put(p[0], FLD_MAC, MAC_MOV);
+        put(p[0], FLD_A_MUX, PARAM_V);
+        put(p[0], FLD_V, 5);
+        put(p[0], FLD_OUT_R, 1);
+        put(p[0], FLD_OUT_MAC_MASK, 0xF);
+        /* R3 = R1 * R1 and R1 = 1 / v6.x */
+        init_token(p[1]);
+        put(p[1], FLD_MAC, MAC_MUL);
+        put(p[1], FLD_A_R, 1);
+        put(p[1], FLD_B_R, 1);
+        put(p[1], FLD_ILU, ILU_RCP);
+        put(p[1], FLD_C_MUX, PARAM_V);
+        put(p[1], FLD_V, 6);
+        put(p[1], FLD_OUT_R, 3);
+        put(p[1], FLD_OUT_MAC_MASK, 0xF);
+        put(p[1], FLD_OUT_ILU_MASK, 0xF);
+        /* oT0 = R3 + R1 */
+        init_token(p[2]);
+        put(p[2], FLD_MAC, MAC_ADD);
+        put(p[2], FLD_A_R, 3);
+        put(p[2], FLD_C_R_LOW, 1);
+        put(p[2], FLD_OUT_O_MASK, 0xF);
+        put(p[2], FLD_OUT_ADDRESS, 9);
+        put(p[2], FLD_FINAL, 1);
+        v[5][0] = 1.0f; v[5][1] = 2.0f; v[5][2] = 3.0f; v[5][3] = 4.0f;
+        v[6][0] = 0.25f;
+
+        VshCpuProgram *prog = vsh_cpu_compile_program(
+            (const uint32_t (*)[4])p, 3);
+        float outputs[1][VSH_CPU_OUTPUTS][4];
+        vsh_cpu_execute(prog, (const float (*)[4])c,
+                        (const float (*)[VSH_CPU_INPUTS][4])v, outputs, 1);
+        assert(outputs[0][VSH_CPU_OUT_T0][0] == 5.0f &&
+               outputs[0][VSH_CPU_OUT_T0][3] == 20.0f);
+        vsh_cpu_program_free(prog);
+    }
+
+    /* R12 is oPos */
+    init_token(t[0]);
+    put(t[0], FLD_MAC, MAC_MOV);
+    put(t[0], FLD_A_MUX, PARAM_V);
+    put(t[0], FLD_V, 4);
+    put(t[0], FLD_OUT_R, 12);
+    put(t[0], FLD_OUT_MAC_MASK, 0x8);
+    put(t[0], FLD_FINAL, 1);
+    v[4][0] = 7.0f;
+    run_one(t[0], (const float (*)[4])c, (const float (*)[4])v, 0, out);
+    assert(out[0] == 7.0f && out[3] == 1.0f);
+
+    /* Writes to constant registers are not supported */
+    put(t[0], FLD_OUT_O_MASK, 0xF);
+    put(t[0], FLD_OUT_ORB, 0);
+    assert(!vsh_cpu_compile_program((const uint32_t (*)[4])t, 1));
+
+    /* Programs must end with a final token */
+    init_token(t[0]);
+    put(t[0], FLD_MAC, MAC_MOV);
+    assert(!vsh_cpu_compile_program((const uint32_t (*)[4])t, 1));
+
+    fprintf(stderr, " ok\n");
+}
+
+static void check_fixed_function(void)
+{
+    fprintf(stderr, "%s [%7s]...", __func__, vsh_cpu_accel_name());
+
+    static float c[VSH_CPU_CONSTANTS][4];
+    float inputs[MAX_VERTICES][VSH_CPU_INPUTS][4];
+    float outputs[MAX_VERTICES][VSH_CPU_OUTPUTS][4];
+    const unsigned int cmat = 64;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            c[cmat + i][j] = frand();
+        }
+    }
+    for (int v = 0; v < MAX_VERTICES; v++) {
+        for (int i = 0; i < VSH_CPU_INPUTS; i++) {
+            for (int j = 0; j < 4; j++) {
+                inputs[v][i][j] = frand();
+            }
+        }
+    }
+
+    VshCpuProgram *prog = vsh_cpu_compile_fixed_function(cmat);
+    vsh_cpu_execute(prog, (const float (*)[4])c,
+                    (const float (*)[VSH_CPU_INPUTS][4])inputs, outputs,
+                    MAX_VERTICES);
+    for (int v = 0; v < MAX_VERTICES; v++) {
+        for (int i = 0; i < 4; i++) {
+            const float *p = inputs[v][0], *m = c[cmat + i];
+            float d = p[0] * m[0] + p[1] * m[1] + p[2] * m[2] + p[3] * m[3];
+            assert(same_float(outputs[v][VSH_CPU_OUT_POS][i], d));
+        }
+        assert(!memcmp(outputs[v][VSH_CPU_OUT_D0], inputs[v][3],
+                       4 * sizeof(float)));
+        assert(!memcmp(outputs[v][VSH_CPU_OUT_T0 + 3], inputs[v][12],
+                       4 * sizeof(float)));
+    }
+    vsh_cpu_program_free(prog);
+
+    fprintf(stderr, " ok\n");
+}
+
+static void check_project(void)
+{
+    fprintf(stderr, "%s...", __func__);
+
+    VshCpuViewport vp = {
+        .width = 640, .height = 480,
+        .depth_clip = true, .zmin = 0, .zmax = 65535,
+    };
+    float outputs[4][VSH_CPU_OUTPUTS][4] = {
+        { { 10, 20, 30, 2 } },
+        { { -10, 20, 30, 1 } },
+        { { 700, 500, -1, 0 } },
+        /* Divided by a negative w, the opposite planes apply */
+        { { -10, 20, 70000, -1 } },
+    };
+    float screen[4][4];
+    uint8_t clip[4];
+
+    vsh_cpu_project(&vp, (const float (*)[VSH_CPU_OUTPUTS][4])outputs,
+                    screen, clip, 4);
+    assert(clip[0] == 0 && screen[0][3] == 0.5f);
+    assert(clip[1] == VSH_CPU_CLIP_LEFT);
+    assert(clip[2] == (VSH_CPU_CLIP_RIGHT | VSH_CPU_CLIP_BOTTOM |
+                       VSH_CPU_CLIP_NEAR) &&
+           screen[2][3] == 1.0f);
+    assert(clip[3] == (VSH_CPU_CLIP_W | VSH_CPU_CLIP_RIGHT |
+                       VSH_CPU_CLIP_NEAR));
+
+    /* The programmed clip range applies, not the depth buffer range */
+    vp.zmin = 40;
+    vp.zmax = 50;
+    vsh_cpu_project(&vp, (const float (*)[VSH_CPU_OUTPUTS][4])outputs,
+                    screen, clip, 2);
+    assert(clip[0] == VSH_CPU_CLIP_NEAR);
+    vp.zmin = 10;
+    vp.zmax = 20;
+    vsh_cpu_project(&vp, (const float (*)[VSH_CPU_OUTPUTS][4])outputs,
+                    screen, clip, 2);
+    assert(clip[0] == VSH_CPU_CLIP_FAR);
+    vp.zmin = 0;
+    vp.zmax = 65535;
+
+    vp.fixed_function = true;
+    vsh_cpu_project(&vp, (const float (*)[VSH_CPU_OUTPUTS][4])outputs,
+                    screen, clip, 4);
+    assert(clip[0] == 0 && screen[0][0] == 5.0f && screen[0][2] == 15.0f);
+    assert(clip[2] & VSH_CPU_CLIP_W);
+
+    fprintf(stderr, " ok\n");
+}
+
+static void bench_one(const char *name, const VshCpuProgram *prog)
+{
+    static float c[VSH_CPU_CONSTANTS][4];
+    static float inputs[1024][VSH_CPU_INPUTS][4];
+    static float outputs[1024][VSH_CPU_OUTPUTS][4];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 1000; i++) {
+        vsh_cpu_execute(prog, (const float (*)[4])c,
+                        (const float (*)[VSH_CPU_INPUTS][4])inputs, outputs,
+                        ARRAY_SIZE(inputs));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("%-8s %-16s %7.1f Mvertices/s\n", vsh_cpu_accel_name(), name,
+           1000 * ARRAY_SIZE(inputs) / secs / 1e6);
+}
+
+static void bench(void)
+{
+    uint32_t tokens[32][4];
+
+    for (int i = 0; i < ARRAY_SIZE(tokens); i++) {
+        random_token(tokens[i], i == ARRAY_SIZE(tokens) - 1);
+    }
+    VshCpuProgram *prog = vsh_cpu_compile_program(
+        (const uint32_t (*)[4])tokens, ARRAY_SIZE(tokens));
+    bench_one("random", prog);
+    vsh_cpu_program_free(prog);
+
+    prog = vsh_cpu_compile_fixed_function(64);
+    bench_one("fixed function", prog);
+    vsh_cpu_program_free(prog);
+}
+
+int main(int argc, char const *argv[])
+{
+    bool run_bench = argc > 1 && !strcmp(argv[1], "--bench");
+
+    srand(1337);
+    check_project();
+
+    /* Check and optionally benchmark every kernel usable on this host */
+    do {
+        check_semantics();
+        check_fixed_function();
+        crosscheck();
+        if (run_bench) {
+            bench();
+        }
+    } while (vsh_cpu_test_next_accel());
+
+    return 0;
+}
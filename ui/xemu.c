@@ -55,6 +55,9 @@
 
 #include "hw/xbox/smbus.h" // For eject, drive tray
 #include "hw/xbox/nv2a/nv2a.h"
+#ifdef CONFIG_VULKAN
+#include "hw/xbox/nv2a/pgraph/vk/present.h"
+#endif
 #include "ui/xemu-notifications.h"
 
 #include <stb_image.h>
@@ -94,8 +97,6 @@ void xb_surface_gl_create_texture(DisplaySurface *surface);
 void xb_surface_gl_update_texture(DisplaySurface *surface, int x, int y, int w, int h);
 void xb_surface_gl_destroy_texture(DisplaySurface *surface);
 
-static void sleep_ns(int64_t ns);
-
 static int sdl2_num_outputs;
 static struct sdl2_console *sdl2_console;
 static SDL_Surface *guest_sprite_surface;
@@ -114,6 +115,13 @@ static SDL_Cursor *guest_sprite;
 static Notifier mouse_mode_notifier;
 static SDL_Window *m_window;
 static SDL_GLContext m_context;
+/*
+ * Window of the UI's OpenGL context. It's the main window, unless frames are
+ * presented directly with Vulkan, in which case the UI still renders some of
+ * its widgets with OpenGL offscreen on this hidden window.
+ */
+static SDL_Window *m_gl_window;
+static bool m_direct_present;
 // struct decal_shader *blit;
 
 static QemuSemaphore display_init_sem;
@@ -125,6 +133,11 @@ int xemu_is_fullscreen(void)
     return gui_fullscreen;
 }
 
+bool xemu_is_direct_present(void)
+{
+    return m_direct_present;
+}
+
 void xemu_toggle_fullscreen(void)
 {
     toggle_full_screen(&sdl2_console[0]);
@@ -756,7 +769,18 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
         window_height = min_window_height;
     }
 
-    SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+#ifdef CONFIG_VULKAN
+    // The renderer is fixed for the session, see xemu_is_direct_present
+    m_direct_present =
+        g_config.display.vulkan.direct_present &&
+        g_config.display.renderer == CONFIG_DISPLAY_RENDERER_VULKAN;
+    if (m_direct_present) {
+        nv2a_vk_enable_direct_present();
+    }
+#endif
+
+    SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+    window_flags |= m_direct_present ? SDL_WINDOW_VULKAN : SDL_WINDOW_OPENGL;
 
     // Create main window
     m_window = SDL_CreateWindow(
@@ -777,7 +801,20 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
         SDL_SetWindowPosition(m_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
     }
 
-    m_context = SDL_GL_CreateContext(m_window);
+    if (m_direct_present) {
+        m_gl_window = SDL_CreateWindow(
+            "xemu (OpenGL)", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if (m_gl_window == NULL) {
+            fprintf(stderr, "Failed to create OpenGL window\n");
+            SDL_Quit();
+            exit(1);
+        }
+    } else {
+        m_gl_window = m_window;
+    }
+
+    m_context = SDL_GL_CreateContext(m_gl_window);
 
     if (m_context != NULL && epoxy_gl_version() < 40) {
         SDL_GL_MakeCurrent(NULL, NULL);
@@ -830,8 +867,10 @@ static void sdl2_display_early_init(DisplayOptions *o)
     assert(o->type == DISPLAY_TYPE_XEMU);
     display_opengl = 1;
 
-    SDL_GL_MakeCurrent(m_window, m_context);
-    SDL_GL_SetSwapInterval(g_config.display.window.vsync ? 1 : 0);
+    SDL_GL_MakeCurrent(m_gl_window, m_context);
+    if (!m_direct_present) {
+        SDL_GL_SetSwapInterval(g_config.display.window.vsync ? 1 : 0);
+    }
     xemu_hud_init(m_window, m_context);
     // blit = create_decal_shader(SHADER_TYPE_BLIT_GAMMA);
 }
@@ -843,7 +882,7 @@ static void sdl2_display_init(DisplayState *ds, DisplayOptions *o)
     SDL_SysWMinfo info;
 
     assert(o->type == DISPLAY_TYPE_XEMU);
-    SDL_GL_MakeCurrent(m_window, m_context);
+    SDL_GL_MakeCurrent(m_gl_window, m_context);
 
     memset(&info, 0, sizeof(info));
     SDL_VERSION(&info.version);
@@ -979,7 +1018,7 @@ void sdl2_gl_update(DisplayChangeListener *dcl,
     struct sdl2_console *scon = container_of(dcl, struct sdl2_console, dcl);
     assert(scon->opengl);
 
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(m_gl_window, scon->winctx);
 }
 
 void sdl2_gl_switch(DisplayChangeListener *dcl,
@@ -987,7 +1026,7 @@ void sdl2_gl_switch(DisplayChangeListener *dcl,
 {
     struct sdl2_console *scon = container_of(dcl, struct sdl2_console, dcl);
     assert(scon->opengl);
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(m_gl_window, scon->winctx);
     xb_surface_gl_destroy_texture(scon->surface);
     scon->surface = new_surface;
     if (!new_surface) {
@@ -997,7 +1036,7 @@ void sdl2_gl_switch(DisplayChangeListener *dcl,
     if (!scon->real_window) {
         scon->real_window = m_window;
         scon->winctx = m_context;
-        SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+        SDL_GL_MakeCurrent(m_gl_window, scon->winctx);
     }
 }
 
@@ -1016,15 +1055,99 @@ static void update_fps(void)
     fps = 1000.0/avg;
 }
 
+/*
+ * Pace presentation on the guest's flips, falling back to 60Hz when the guest
+ * isn't flipping (e.g. VGA output or a paused VM). The deadline is measured
+ * from the last present, so it doesn't add to a swap that blocked for vsync.
+ */
+static void wait_for_next_frame(void)
+{
+    static unsigned int flip_count;
+    static int64_t last_update;
+
+    int64_t deadline = last_update + 16666666;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int timeout_ms = now < deadline ? DIV_ROUND_UP(deadline - now, SCALE_MS) : 0;
+    nv2a_wait_for_flip(&flip_count, timeout_ms);
+
+    last_update = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+#ifdef CONFIG_VULKAN
+static void direct_present_failed(void)
+{
+    /* Fall back to presenting through OpenGL on the next start */
+    g_config.display.vulkan.direct_present = false;
+
+    SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
+        "Unable to present with Vulkan",
+        "Unable to present frames directly with Vulkan. This usually means\r\n"
+        "the Vulkan renderer could not be initialized, or it cannot present\r\n"
+        "to the xemu window on this system.\r\n"
+        "\r\n"
+        "Direct presentation has been disabled. xemu cannot continue and\r\n"
+        "will now exit.",
+        m_window);
+    SDL_DestroyWindow(m_window);
+    SDL_Quit();
+    exit(1);
+}
+
+/*
+ * Like sdl2_gl_refresh, but the display image and the UI are put on a Vulkan
+ * swapchain of the window by the UI. There is no VGA fallback, the renderer
+ * doesn't share its surfaces with OpenGL in this mode.
+ */
+static void sdl2_vk_refresh(struct sdl2_console *scon)
+{
+    /* The renderer must not redraw the display image while it's sampled */
+    xemu_vk_present_wait();
+    nv2a_get_framebuffer_surface();
+
+    if (!xemu_vk_present_begin(m_window)) {
+        nv2a_release_framebuffer_surface();
+        direct_present_failed();
+    }
+
+    qemu_mutex_lock_main_loop();
+    bql_lock();
+    sdl2_poll_events(scon);
+    xemu_snapshots_set_framebuffer_texture(0, false);
+    xemu_hud_set_framebuffer_texture(0, false);
+    xemu_hud_render();
+    bql_unlock();
+    qemu_mutex_unlock_main_loop();
+
+    /* Presenting may block for vsync, so it's done without the BQL */
+    xemu_vk_present_end();
+    nv2a_release_framebuffer_surface();
+
+    qemu_mutex_lock_main_loop();
+    bql_lock();
+    graphic_hw_update(scon->dcl.con);
+    bql_unlock();
+    qemu_mutex_unlock_main_loop();
+
+    wait_for_next_frame();
+}
+#endif
+
 void sdl2_gl_refresh(DisplayChangeListener *dcl)
 {
     struct sdl2_console *scon = container_of(dcl, struct sdl2_console, dcl);
     assert(scon->opengl);
     bool flip_required = false;
 
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(m_gl_window, scon->winctx);
     update_fps();
 
+#ifdef CONFIG_VULKAN
+    if (m_direct_present) {
+        sdl2_vk_refresh(scon);
+        return;
+    }
+#endif
+
     /* XXX: Note that this bypasses the usual VGA path in order to quickly
      * get the surface. This is simple and fast, at the cost of accuracy.
      * Ideally, this should go through the VGA code and opportunistically pull
@@ -1063,11 +1186,14 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     bql_unlock();
     qemu_mutex_unlock_main_loop();
 
-    glFinish();
+    /*
+     * Fences the frame instead of draining the pipeline, the renderer won't
+     * reuse the texture until the commands above have been executed.
+     */
     nv2a_release_framebuffer_surface();
     SDL_GL_SwapWindow(scon->real_window);
 
-    /* VGA update (see note above) + vblank */
+    /* VGA update (see note above) */
     qemu_mutex_lock_main_loop();
     bql_lock();
     graphic_hw_update(scon->dcl.con);
@@ -1077,48 +1203,7 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     bql_unlock();
     qemu_mutex_unlock_main_loop();
 
-    /*
-     * Throttle to make sure swaps happen at 60Hz
-     */
-    static int64_t last_update = 0;
-    int64_t deadline = last_update + 16666666;
-
-#ifdef DEBUG_XEMU_C
-    int64_t sleep_acc = 0;
-    int64_t spin_acc = 0;
-#endif
-
-#ifndef _WIN32
-    const int64_t sleep_threshold = 2000000;
-#else
-    const int64_t sleep_threshold = 250000;
-#endif
-
-    while (1) {
-        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-        int64_t time_remaining = deadline - now;
-        if (now < deadline) {
-            if (time_remaining > sleep_threshold) {
-                // Try to sleep until the until reaching the sleep threshold.
-                sleep_ns(time_remaining - sleep_threshold);
-#ifdef DEBUG_XEMU_C
-                sleep_acc += qemu_clock_get_ns(QEMU_CLOCK_REALTIME)-now;
-#endif
-            } else {
-                // Simply spin to avoid extra delays incurred with swapping to
-                // another process and back in the event of being within
-                // threshold to desired event.
-#ifdef DEBUG_XEMU_C
-                spin_acc++;
-#endif
-            }
-        } else {
-            DPRINTF("zzZz %g %ld\n", (double)sleep_acc/1000000.0, spin_acc);
-            last_update = now;
-            break;
-        }
-    }
-
+    wait_for_next_frame();
 }
 
 void sdl2_gl_redraw(struct sdl2_console *scon)
@@ -1250,19 +1335,6 @@ static void *call_qemu_main(void *opaque)
     exit(status);
 }
 
-/* Note: only supports millisecond resolution on Windows */
-static void sleep_ns(int64_t ns)
-{
-#ifndef _WIN32
-        struct timespec sleep_delay, rem_delay;
-        sleep_delay.tv_sec = ns / 1000000000LL;
-        sleep_delay.tv_nsec = ns % 1000000000LL;
-        nanosleep(&sleep_delay, &rem_delay);
-#else
-        Sleep(ns / SCALE_MS);
-#endif
-}
-
 int main(int argc, char **argv)
 {
     QemuThread thread;
@@ -18,6 +18,10 @@
 //
 #include "font-manager.hh"
 #include "viewport-manager.hh"
+#include "xemu-hud.h"
+#ifdef CONFIG_VULKAN
+#include "vk-present.hh"
+#endif
 
 #include "data/Roboto-Medium.ttf.h"
 #include "data/RobotoCondensed-Regular.ttf.h"
@@ -106,6 +110,12 @@ void FontManager::Rebuild()
         m_fixed_width_font = io.Fonts->AddFontDefault(&config);
     }
 
+#ifdef CONFIG_VULKAN
+    if (xemu_is_direct_present()) {
+        g_vk_presenter.InvalidateFonts();
+        return;
+    }
+#endif
     ImGui_ImplOpenGL3_CreateFontsTexture();
 }
 
@@ -25,6 +25,7 @@
 #include "data/xemu_64x64.png.h"
 #include "data/xmu_mask.png.h"
 #include "notifications.hh"
+#include "xemu-hud.h"
 #include "stb_image.h"
 #include <fpng.h>
 #include <math.h>
@@ -33,6 +34,10 @@
 
 #include "ui/shader/xemu-logo-frag.h"
 
+#ifdef CONFIG_VULKAN
+#include "vk-present.hh"
+#endif
+
 Fbo *controller_fbo, *xmu_fbo, *logo_fbo;
 GLuint g_controller_duke_tex, g_controller_s_tex, g_logo_tex, g_icon_tex, g_xmu_tex;
 
@@ -929,17 +934,8 @@ float GetDisplayAspectRatio(int width, int height)
     }
 }
 
-void RenderFramebuffer(GLint tex, int width, int height, bool flip)
+void GetFramebufferScale(int tw, int th, int width, int height, float scale[2])
 {
-    int tw, th;
-    float scale[2];
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tw);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &th);
-
-    // Calculate scaling factors
     if (g_config.display.ui.fit == CONFIG_DISPLAY_UI_FIT_STRETCH) {
         // Stretch to fit
         scale[0] = 1.0;
@@ -960,10 +956,32 @@ void RenderFramebuffer(GLint tex, int width, int height, bool flip)
             scale[1] = w_ratio/t_ratio;
         }
     }
+}
 
+void RenderFramebuffer(GLint tex, int width, int height, bool flip)
+{
+    int tw, th;
+    float scale[2];
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tw);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &th);
+
+    GetFramebufferScale(tw, th, width, height, scale);
     RenderFramebuffer(tex, width, height, flip, scale);
 }
 
+ImTextureID GetTextureId(GLuint tex)
+{
+#ifdef CONFIG_VULKAN
+    if (xemu_is_direct_present()) {
+        return g_vk_presenter.GetTextureId(tex);
+    }
+#endif
+    return (ImTextureID)(intptr_t)tex;
+}
+
 bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, int max_width, int max_height)
 {
     int width, height;
@@ -49,8 +49,10 @@ void RenderControllerPort(float frame_x, float frame_y, int i,
                           uint32_t port_color);
 void RenderXmu(float frame_x, float frame_y, uint32_t primary_color,
                uint32_t secondary_color);
+void GetFramebufferScale(int tw, int th, int width, int height, float scale[2]);
 void RenderFramebuffer(GLint tex, int width, int height, bool flip);
 void RenderFramebuffer(GLint tex, int width, int height, bool flip, float scale[2]);
 bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, int max_width = 0, int max_height = 0);
 void SaveScreenshot(GLuint tex, bool flip);
+ImTextureID GetTextureId(GLuint tex);
 void ScaleDimensions(int src_width, int src_height, int max_width, int max_height, int *out_width, int *out_height);
@@ -65,6 +65,13 @@ void MainMenuGeneralView::Draw()
 
     Toggle("Cache shaders to disk", &g_config.perf.cache_shaders,
            "Reduce stutter in games by caching previously generated shaders");
+    Toggle("Compile shaders asynchronously",
+           &g_config.perf.async_shader_compile,
+           "Skip draws until their shaders are compiled, trading briefly "
+           "missing geometry for less stutter (Vulkan)");
+    Toggle("Cull invisible draws on the CPU", &g_config.perf.cull_batches,
+           "Transform vertices on the CPU and skip draws that are entirely "
+           "off screen or degenerate");
 
     SectionTitle("Miscellaneous");
     Toggle("Skip startup animation", &g_config.general.skip_boot_anim,
@@ -96,7 +103,7 @@ void MainMenuInputView::Draw()
 
     // Setup rendering to fbo for controller and port images
     controller_fbo->Target();
-    ImTextureID id = (ImTextureID)(intptr_t)controller_fbo->Texture();
+    ImTextureID id = GetTextureId(controller_fbo->Texture());
 
     //
     // Render buttons with icons of the Xbox style port sockets with
@@ -328,7 +335,7 @@ void MainMenuInputView::Draw()
         ImGui::Columns(2, "mixed", false);
 
         xmu_fbo->Target();
-        id = (ImTextureID)(intptr_t)xmu_fbo->Texture();
+        id = GetTextureId(xmu_fbo->Texture());
 
         const char *img_file_filters = ".img Files\0*.img\0All Files\0*.*\0";
         const char *comboLabels[2] = { "###ExpansionSlotA",
@@ -490,14 +497,21 @@ void MainMenuInputView::Draw()
 void MainMenuDisplayView::Draw()
 {
     SectionTitle("Renderer");
+    // The window can only be presented to by the renderer it was created for
+    const bool direct_present = xemu_is_direct_present();
+    if (direct_present) ImGui::BeginDisabled();
     ChevronCombo("Backend", &g_config.display.renderer,
                  "Null\0"
                  "OpenGL\0"
 #ifdef CONFIG_VULKAN
                  "Vulkan\0"
+#else
+                 "Vulkan (unavailable)\0"
 #endif
+                 "Software\0"
                  ,
                  "Select desired renderer implementation");
+    if (direct_present) ImGui::EndDisabled();
     int rendering_scale = nv2a_get_surface_scale_factor() - 1;
     if (ChevronCombo("Internal resolution scale", &rendering_scale,
                      "1x\0"
@@ -513,6 +527,9 @@ void MainMenuDisplayView::Draw()
                      "Increase surface scaling factor for higher quality")) {
         nv2a_set_surface_scale_factor(rendering_scale+1);
     }
+    Toggle("Dynamic resolution scaling",
+           &g_config.display.quality.dynamic_scale,
+           "Lower the scale in demanding scenes, up to the one above");
 
     SectionTitle("Window");
     bool fs = xemu_is_fullscreen();
@@ -537,6 +554,17 @@ void MainMenuDisplayView::Draw()
     }
     Toggle("Vertical refresh sync", &g_config.display.window.vsync,
            "Sync to screen vertical refresh to reduce tearing artifacts");
+#ifdef CONFIG_VULKAN
+    Toggle("Present directly with Vulkan",
+           &g_config.display.vulkan.direct_present,
+           "Present frames on a Vulkan swapchain instead of through OpenGL, "
+           "with the Vulkan renderer (requires restart)");
+    ChevronCombo("Vulkan present mode", &g_config.display.vulkan.present_mode,
+                 "FIFO\0"
+                 "FIFO Relaxed\0"
+                 "Mailbox\0",
+                 "Swapchain present mode used with vertical refresh sync");
+#endif
 
     SectionTitle("Interface");
     Toggle("Show main menu bar", &g_config.display.ui.show_menubar,
@@ -958,7 +986,7 @@ bool MainMenuSnapshotsView::BigSnapshotButton(QEMUSnapshotInfo *snapshot,
                thumbnail_min.y + (thumbnail_size.y - scaled_height) / 2);
     ImVec2 img_max =
         ImVec2(img_min.x + scaled_width, img_min.y + scaled_height);
-    draw_list->AddImage((ImTextureID)(uint64_t)thumbnail, img_min, img_max);
+    draw_list->AddImage(GetTextureId(thumbnail), img_min, img_max);
 
     // Snapshot title
     ImGui::PushFont(g_font_mgr.m_menu_font_medium);
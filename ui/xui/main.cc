@@ -53,6 +53,9 @@
 #if defined(_WIN32)
 #include "update.hh"
 #endif
+#ifdef CONFIG_VULKAN
+#include "vk-present.hh"
+#endif
 
 bool g_screenshot_pending;
 const char *g_snapshot_pending_load_name;
@@ -144,9 +147,14 @@ void xemu_hud_init(SDL_Window* window, void* sdl_gl_context)
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
     io.IniFilename = NULL;
 
-    // Setup Platform/Renderer bindings
-    ImGui_ImplSDL2_InitForOpenGL(window, sdl_gl_context);
-    ImGui_ImplOpenGL3_Init("#version 150");
+    // Setup Platform/Renderer bindings. When presenting directly, the Vulkan
+    // renderer binding is initialized along with the swapchain.
+    if (xemu_is_direct_present()) {
+        ImGui_ImplSDL2_InitForVulkan(window);
+    } else {
+        ImGui_ImplSDL2_InitForOpenGL(window, sdl_gl_context);
+        ImGui_ImplOpenGL3_Init("#version 150");
+    }
     g_sdl_window = window;
     ImPlot::CreateContext();
 
@@ -163,7 +171,9 @@ void xemu_hud_init(SDL_Window* window, void* sdl_gl_context)
 
 void xemu_hud_cleanup(void)
 {
-    ImGui_ImplOpenGL3_Shutdown();
+    if (!xemu_is_direct_present()) {
+        ImGui_ImplOpenGL3_Shutdown();
+    }
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 }
@@ -200,13 +210,22 @@ void xemu_hud_render(void)
         g_last_scale = g_viewport_mgr.m_scale;
     }
 
-    if (!first_boot_window.is_open) {
+    const bool direct_present = xemu_is_direct_present();
+
+    if (!first_boot_window.is_open && !direct_present) {
         int ww, wh;
         SDL_GL_GetDrawableSize(g_sdl_window, &ww, &wh);
         RenderFramebuffer(g_tex, ww, wh, g_flip_req);
     }
 
-    ImGui_ImplOpenGL3_NewFrame();
+#ifdef CONFIG_VULKAN
+    if (direct_present) {
+        g_vk_presenter.NewFrame();
+    } else
+#endif
+    {
+        ImGui_ImplOpenGL3_NewFrame();
+    }
     io.ConfigFlags &= ~ImGuiConfigFlags_NavEnableGamepad;
     ImGui_ImplSDL2_NewFrame(g_sdl_window);
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
@@ -216,6 +235,12 @@ void xemu_hud_render(void)
     ImGui::NewFrame();
     ProcessKeyboardShortcuts();
 
+#ifdef CONFIG_VULKAN
+    if (direct_present && !first_boot_window.is_open) {
+        g_vk_presenter.DrawFramebuffer();
+    }
+#endif
+
 #if defined(CONFIG_RENDERDOC)
     if (g_capture_renderdoc_frame) {
         nv2a_dbg_renderdoc_capture_frames(1);
@@ -317,6 +342,18 @@ void xemu_hud_render(void)
     // if (show_demo) ImGui::ShowDemoWindow(&show_demo);
 
     ImGui::Render();
+
+    if (direct_present) {
+        // Drawn and presented by the swapchain, which also handles vsync
+        if (g_screenshot_pending) {
+            xemu_queue_notification(
+                "Screenshots are not available when presenting directly "
+                "with Vulkan");
+            g_screenshot_pending = false;
+        }
+        return;
+    }
+
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
     if (g_vsync != g_config.display.window.vsync) {
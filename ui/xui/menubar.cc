@@ -169,13 +169,18 @@ void ShowMainMenu()
                 }
             }
 
+            if (xemu_is_direct_present()) ImGui::BeginDisabled();
             ImGui::Combo("Backend", &g_config.display.renderer,
                  "Null\0"
                  "OpenGL\0"
 #ifdef CONFIG_VULKAN
                  "Vulkan\0"
+#else
+                 "Vulkan (unavailable)\0"
 #endif
+                 "Software\0"
                 );
+            if (xemu_is_direct_present()) ImGui::EndDisabled();
 
             int rendering_scale = nv2a_get_surface_scale_factor() - 1;
             if (ImGui::Combo("Int. Resolution Scale", &rendering_scale,
@@ -212,6 +217,10 @@ void ShowMainMenu()
             ImGui::MenuItem("Monitor", "~", &monitor_window.is_open);
             ImGui::MenuItem("Audio", NULL, &apu_window.m_is_open);
             ImGui::MenuItem("Video", NULL, &video_window.m_is_open);
+            if (ImGui::MenuItem("NV2A: Capture Pushbuffer", NULL, false,
+                                !nv2a_dbg_capture_active())) {
+                nv2a_dbg_capture_frames(1);
+            }
 #ifdef CONFIG_RENDERDOC
             if (nv2a_dbg_renderdoc_available()) {
                 ImGui::MenuItem("RenderDoc: Capture", NULL, &g_capture_renderdoc_frame);
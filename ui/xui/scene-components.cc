@@ -22,6 +22,7 @@
 #include "font-manager.hh"
 #include "input-manager.hh"
 #include "viewport-manager.hh"
+#include "gl-helpers.hh"
 
 BackgroundGradient::BackgroundGradient()
 : m_animation(0.2, 0.2) {}
@@ -259,7 +260,7 @@ public:
             ImVec2 p0 = ImGui::GetItemRectMin();
             ImVec2 p1 = ImGui::GetItemRectMax();
             ImDrawList *draw_list = ImGui::GetWindowDrawList();
-            draw_list->AddImageRounded((ImTextureID)screenshot, p0, p1, ImVec2(0, 0), ImVec2(1, 1), ImGui::GetColorU32(ImVec4(1,1,1,m_animation.getSinInterpolatedValue())), 3*g_viewport_mgr.m_scale);
+            draw_list->AddImageRounded(GetTextureId(screenshot), p0, p1, ImVec2(0, 0), ImVec2(1, 1), ImGui::GetColorU32(ImVec4(1,1,1,m_animation.getSinInterpolatedValue())), 3*g_viewport_mgr.m_scale);
 
             ImGui::NextColumn();
 
@@ -0,0 +1,927 @@
+//
+// xemu User Interface
+//
+// Copyright (C) 2020-2025 Matt Borgerson
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <SDL_vulkan.h>
+#include <algorithm>
+#include "vk-present.hh"
+#include "gl-helpers.hh"
+#include "xemu-hud.h"
+
+VkPresenter g_vk_presenter;
+
+// Frames a GL texture may go undrawn before its copy is released
+static const int gl_texture_max_unused_frames = 60;
+
+static void CheckVkResult(VkResult err)
+{
+    if (err == VK_SUCCESS) {
+        return;
+    }
+    fprintf(stderr, "vk-present: vk_result = %d\n", err);
+    assert(err > 0 && "vk check failed");
+}
+
+static PFN_vkVoidFunction LoadFunction(const char *name, void *user_data)
+{
+    return vkGetInstanceProcAddr(*(VkInstance *)user_data, name);
+}
+
+VkPresenter::VkPresenter()
+{
+    qemu_mutex_init(&m_lock);
+    m_initialized = false;
+    m_window = NULL;
+    m_surface = VK_NULL_HANDLE;
+    m_render_pass = VK_NULL_HANDLE;
+    m_swapchain = VK_NULL_HANDLE;
+    m_extent = { 0, 0 };
+    m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    m_vsync = false;
+    m_present_mode_setting = 0;
+    m_drawable_width = m_drawable_height = 0;
+    m_swapchain_dirty = false;
+    m_image_acquired = VK_NULL_HANDLE;
+    m_command_pool = VK_NULL_HANDLE;
+    m_command_buffer = VK_NULL_HANDLE;
+    m_fence = VK_NULL_HANDLE;
+    m_frame_pending = false;
+    m_descriptor_pool = VK_NULL_HANDLE;
+    m_sampler = VK_NULL_HANDLE;
+    m_imgui_initialized = false;
+    m_display_set = VK_NULL_HANDLE;
+    m_display_width = m_display_height = 0;
+    m_display_valid = false;
+}
+
+bool VkPresenter::Init()
+{
+    if (!nv2a_vk_get_present_context(&m_ctx)) {
+        fprintf(stderr, "vk-present: Renderer does not support presenting\n");
+        return false;
+    }
+
+    VkDevice dev = m_ctx.device;
+
+    if (!SDL_Vulkan_CreateSurface(m_window, m_ctx.instance, &m_surface)) {
+        fprintf(stderr, "vk-present: SDL_Vulkan_CreateSurface failed: %s\n",
+                SDL_GetError());
+        return false;
+    }
+
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(m_ctx.physical_device,
+                                         m_ctx.queue_family, m_surface,
+                                         &supported);
+    if (!supported) {
+        fprintf(stderr, "vk-present: Queue family cannot present to window\n");
+        Destroy();
+        return false;
+    }
+
+    uint32_t num_formats = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(m_ctx.physical_device, m_surface,
+                                         &num_formats, NULL);
+    if (num_formats == 0) {
+        fprintf(stderr, "vk-present: No surface formats\n");
+        Destroy();
+        return false;
+    }
+    std::vector<VkSurfaceFormatKHR> formats(num_formats);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(m_ctx.physical_device, m_surface,
+                                         &num_formats, formats.data());
+
+    // The UI blends without sRGB conversion, like it does with OpenGL
+    m_surface_format = formats[0];
+    if (m_surface_format.format == VK_FORMAT_UNDEFINED) {
+        m_surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+    }
+    for (auto &f : formats) {
+        if ((f.format == VK_FORMAT_B8G8R8A8_UNORM ||
+             f.format == VK_FORMAT_R8G8B8A8_UNORM) &&
+            f.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            m_surface_format = f;
+            break;
+        }
+    }
+
+    if (!CreateRenderPass()) {
+        Destroy();
+        return false;
+    }
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = m_ctx.queue_family;
+    CheckVkResult(vkCreateCommandPool(dev, &pool_info, NULL, &m_command_pool));
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = m_command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    CheckVkResult(
+        vkAllocateCommandBuffers(dev, &alloc_info, &m_command_buffer));
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    CheckVkResult(vkCreateFence(dev, &fence_info, NULL, &m_fence));
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    CheckVkResult(
+        vkCreateSemaphore(dev, &semaphore_info, NULL, &m_image_acquired));
+
+    VkSamplerCreateInfo sampler_info = {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxAnisotropy = 1.0f;
+    sampler_info.minLod = -1000;
+    sampler_info.maxLod = 1000;
+    CheckVkResult(vkCreateSampler(dev, &sampler_info, NULL, &m_sampler));
+
+    // Fonts, the display image and the GL textures drawn by the UI
+    VkDescriptorPoolSize pool_size = {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = 64;
+    VkDescriptorPoolCreateInfo descriptor_pool_info = {};
+    descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_info.flags =
+        VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptor_pool_info.maxSets = pool_size.descriptorCount;
+    descriptor_pool_info.poolSizeCount = 1;
+    descriptor_pool_info.pPoolSizes = &pool_size;
+    CheckVkResult(vkCreateDescriptorPool(dev, &descriptor_pool_info, NULL,
+                                         &m_descriptor_pool));
+
+    if (!CreateSwapchain()) {
+        Destroy();
+        return false;
+    }
+
+    VkSurfaceCapabilitiesKHR caps;
+    CheckVkResult(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+        m_ctx.physical_device, m_surface, &caps));
+
+    // Function pointers are loaded by volk, the backend needs its own
+    ImGui_ImplVulkan_LoadFunctions(LoadFunction, &m_ctx.instance);
+
+    ImGui_ImplVulkan_InitInfo init_info = {};
+    init_info.Instance = m_ctx.instance;
+    init_info.PhysicalDevice = m_ctx.physical_device;
+    init_info.Device = dev;
+    init_info.QueueFamily = m_ctx.queue_family;
+    init_info.Queue = m_ctx.queue;
+    init_info.DescriptorPool = m_descriptor_pool;
+    init_info.RenderPass = m_render_pass;
+    init_info.MinImageCount = std::max(caps.minImageCount, 2u);
+    init_info.ImageCount =
+        std::max((uint32_t)m_images.size(), init_info.MinImageCount);
+    init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    init_info.CheckVkResultFn = CheckVkResult;
+    ImGui_ImplVulkan_Init(&init_info);
+    m_imgui_initialized = true;
+
+    nv2a_vk_set_present_finalize(Finalize, this);
+    m_initialized = true;
+
+    return true;
+}
+
+void VkPresenter::Destroy()
+{
+    VkDevice dev = m_ctx.device;
+
+    if (m_frame_pending) {
+        CheckVkResult(
+            vkWaitForFences(dev, 1, &m_fence, VK_TRUE, UINT64_MAX));
+        m_frame_pending = false;
+    }
+
+    for (auto &it : m_gl_textures) {
+        DestroyGlTextureImage(it.second);
+    }
+    m_gl_textures.clear();
+
+    if (m_display_set != VK_NULL_HANDLE) {
+        ImGui_ImplVulkan_RemoveTexture(m_display_set);
+        m_display_set = VK_NULL_HANDLE;
+    }
+    m_display_valid = false;
+
+    if (m_imgui_initialized) {
+        ImGui_ImplVulkan_Shutdown();
+        m_imgui_initialized = false;
+    }
+
+    DestroySwapchain();
+    vkDestroySwapchainKHR(dev, m_swapchain, NULL);
+    m_swapchain = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(dev, m_descriptor_pool, NULL);
+    m_descriptor_pool = VK_NULL_HANDLE;
+    vkDestroySampler(dev, m_sampler, NULL);
+    m_sampler = VK_NULL_HANDLE;
+    vkDestroySemaphore(dev, m_image_acquired, NULL);
+    m_image_acquired = VK_NULL_HANDLE;
+    vkDestroyFence(dev, m_fence, NULL);
+    m_fence = VK_NULL_HANDLE;
+    vkDestroyCommandPool(dev, m_command_pool, NULL);
+    m_command_pool = VK_NULL_HANDLE;
+    m_command_buffer = VK_NULL_HANDLE;
+    vkDestroyRenderPass(dev, m_render_pass, NULL);
+    m_render_pass = VK_NULL_HANDLE;
+    vkDestroySurfaceKHR(m_ctx.instance, m_surface, NULL);
+    m_surface = VK_NULL_HANDLE;
+
+    m_initialized = false;
+}
+
+void VkPresenter::Finalize(void *opaque)
+{
+    VkPresenter *p = (VkPresenter *)opaque;
+
+    qemu_mutex_lock(&p->m_lock);
+    p->Destroy();
+    qemu_mutex_unlock(&p->m_lock);
+}
+
+bool VkPresenter::CreateRenderPass()
+{
+    VkAttachmentDescription attachment = {};
+    attachment.format = m_surface_format.format;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkAttachmentReference color_reference = {};
+    color_reference.attachment = 0;
+    color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+    // Wait for the acquired image before writing to it
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    VkRenderPassCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = 1;
+    info.pAttachments = &attachment;
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+    info.dependencyCount = 1;
+    info.pDependencies = &dependency;
+
+    VkResult result =
+        vkCreateRenderPass(m_ctx.device, &info, NULL, &m_render_pass);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "vk-present: vkCreateRenderPass failed: %d\n", result);
+        return false;
+    }
+
+    return true;
+}
+
+VkPresentModeKHR VkPresenter::ChoosePresentMode()
+{
+    uint32_t num_modes = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(m_ctx.physical_device,
+                                              m_surface, &num_modes, NULL);
+    std::vector<VkPresentModeKHR> modes(num_modes);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(
+        m_ctx.physical_device, m_surface, &num_modes, modes.data());
+
+    auto supported = [&](VkPresentModeKHR mode) {
+        return std::find(modes.begin(), modes.end(), mode) != modes.end();
+    };
+
+    if (!m_vsync) {
+        if (supported(VK_PRESENT_MODE_IMMEDIATE_KHR)) {
+            return VK_PRESENT_MODE_IMMEDIATE_KHR;
+        }
+        if (supported(VK_PRESENT_MODE_MAILBOX_KHR)) {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    switch (m_present_mode_setting) {
+    case CONFIG_DISPLAY_VULKAN_PRESENT_MODE_FIFO_RELAXED:
+        if (supported(VK_PRESENT_MODE_FIFO_RELAXED_KHR)) {
+            return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        }
+        break;
+    case CONFIG_DISPLAY_VULKAN_PRESENT_MODE_MAILBOX:
+        if (supported(VK_PRESENT_MODE_MAILBOX_KHR)) {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // Always supported
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void VkPresenter::DestroySwapchain()
+{
+    VkDevice dev = m_ctx.device;
+
+    for (auto fb : m_framebuffers) {
+        vkDestroyFramebuffer(dev, fb, NULL);
+    }
+    m_framebuffers.clear();
+    for (auto view : m_image_views) {
+        vkDestroyImageView(dev, view, NULL);
+    }
+    m_image_views.clear();
+    for (auto semaphore : m_render_finished) {
+        vkDestroySemaphore(dev, semaphore, NULL);
+    }
+    m_render_finished.clear();
+    m_images.clear();
+}
+
+bool VkPresenter::CreateSwapchain()
+{
+    VkDevice dev = m_ctx.device;
+
+    SDL_Vulkan_GetDrawableSize(m_window, &m_drawable_width,
+                               &m_drawable_height);
+    m_vsync = g_config.display.window.vsync;
+    m_present_mode_setting = g_config.display.vulkan.present_mode;
+    m_swapchain_dirty = false;
+
+    if (m_swapchain != VK_NULL_HANDLE) {
+        // Semaphores may still be waited on by a pending present
+        nv2a_vk_wait_queue_idle();
+    }
+    DestroySwapchain();
+
+    VkSurfaceCapabilitiesKHR caps;
+    CheckVkResult(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+        m_ctx.physical_device, m_surface, &caps));
+
+    VkExtent2D extent = caps.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        extent.width = std::clamp((uint32_t)m_drawable_width,
+                                  caps.minImageExtent.width,
+                                  caps.maxImageExtent.width);
+        extent.height = std::clamp((uint32_t)m_drawable_height,
+                                   caps.minImageExtent.height,
+                                   caps.maxImageExtent.height);
+    }
+
+    if (extent.width == 0 || extent.height == 0) {
+        // Minimized, there is nothing to present to until restored
+        vkDestroySwapchainKHR(dev, m_swapchain, NULL);
+        m_swapchain = VK_NULL_HANDLE;
+        m_extent = extent;
+        return true;
+    }
+
+    uint32_t image_count = caps.minImageCount + 1;
+    if (caps.maxImageCount && image_count > caps.maxImageCount) {
+        image_count = caps.maxImageCount;
+    }
+
+    VkCompositeAlphaFlagBitsKHR composite_alpha =
+        VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(caps.supportedCompositeAlpha & composite_alpha)) {
+        static const VkCompositeAlphaFlagBitsKHR fallbacks[] = {
+            VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
+            VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR,
+            VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR,
+        };
+        for (auto f : fallbacks) {
+            if (caps.supportedCompositeAlpha & f) {
+                composite_alpha = f;
+                break;
+            }
+        }
+    }
+
+    m_present_mode = ChoosePresentMode();
+
+    VkSwapchainKHR old_swapchain = m_swapchain;
+    VkSwapchainCreateInfoKHR info = {};
+    info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    info.surface = m_surface;
+    info.minImageCount = image_count;
+    info.imageFormat = m_surface_format.format;
+    info.imageColorSpace = m_surface_format.colorSpace;
+    info.imageExtent = extent;
+    info.imageArrayLayers = 1;
+    info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.preTransform = caps.currentTransform;
+    info.compositeAlpha = composite_alpha;
+    info.presentMode = m_present_mode;
+    info.clipped = VK_TRUE;
+    info.oldSwapchain = old_swapchain;
+    VkResult result = vkCreateSwapchainKHR(dev, &info, NULL, &m_swapchain);
+    vkDestroySwapchainKHR(dev, old_swapchain, NULL);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "vk-present: vkCreateSwapchainKHR failed: %d\n",
+                result);
+        m_swapchain = VK_NULL_HANDLE;
+        return false;
+    }
+    m_extent = extent;
+
+    uint32_t num_images = 0;
+    vkGetSwapchainImagesKHR(dev, m_swapchain, &num_images, NULL);
+    m_images.resize(num_images);
+    vkGetSwapchainImagesKHR(dev, m_swapchain, &num_images, m_images.data());
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (auto image : m_images) {
+        VkImageViewCreateInfo view_info = {};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = image;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = m_surface_format.format;
+        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.layerCount = 1;
+        VkImageView view;
+        CheckVkResult(vkCreateImageView(dev, &view_info, NULL, &view));
+        m_image_views.push_back(view);
+
+        VkFramebufferCreateInfo fb_info = {};
+        fb_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        fb_info.renderPass = m_render_pass;
+        fb_info.attachmentCount = 1;
+        fb_info.pAttachments = &view;
+        fb_info.width = extent.width;
+        fb_info.height = extent.height;
+        fb_info.layers = 1;
+        VkFramebuffer fb;
+        CheckVkResult(vkCreateFramebuffer(dev, &fb_info, NULL, &fb));
+        m_framebuffers.push_back(fb);
+
+        // Per image, the present of an image may outlive the frame
+        VkSemaphore semaphore;
+        CheckVkResult(
+            vkCreateSemaphore(dev, &semaphore_info, NULL, &semaphore));
+        m_render_finished.push_back(semaphore);
+    }
+
+    return true;
+}
+
+uint32_t VkPresenter::FindMemoryType(uint32_t type_bits,
+                                     VkMemoryPropertyFlags props)
+{
+    VkPhysicalDeviceMemoryProperties mem_props;
+    vkGetPhysicalDeviceMemoryProperties(m_ctx.physical_device, &mem_props);
+
+    for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++) {
+        if ((type_bits & (1 << i)) &&
+            (mem_props.memoryTypes[i].propertyFlags & props) == props) {
+            return i;
+        }
+    }
+
+    assert(!"No suitable memory type");
+    return 0;
+}
+
+void VkPresenter::CreateGlTextureImage(GlTextureImage &t, int width,
+                                       int height)
+{
+    VkDevice dev = m_ctx.device;
+
+    t.width = width;
+    t.height = height;
+    t.used = false;
+    t.unused_frames = 0;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = { (uint32_t)width, (uint32_t)height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage =
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    CheckVkResult(vkCreateImage(dev, &image_info, NULL, &t.image));
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(dev, t.image, &reqs);
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = reqs.size;
+    alloc_info.memoryTypeIndex = FindMemoryType(
+        reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    CheckVkResult(vkAllocateMemory(dev, &alloc_info, NULL, &t.memory));
+    CheckVkResult(vkBindImageMemory(dev, t.image, t.memory, 0));
+
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = t.image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = image_info.format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    CheckVkResult(vkCreateImageView(dev, &view_info, NULL, &t.view));
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = (VkDeviceSize)width * height * 4;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    CheckVkResult(vkCreateBuffer(dev, &buffer_info, NULL, &t.staging));
+
+    vkGetBufferMemoryRequirements(dev, t.staging, &reqs);
+    alloc_info.allocationSize = reqs.size;
+    alloc_info.memoryTypeIndex =
+        FindMemoryType(reqs.memoryTypeBits,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    CheckVkResult(
+        vkAllocateMemory(dev, &alloc_info, NULL, &t.staging_memory));
+    CheckVkResult(vkBindBufferMemory(dev, t.staging, t.staging_memory, 0));
+    CheckVkResult(vkMapMemory(dev, t.staging_memory, 0, VK_WHOLE_SIZE, 0,
+                              &t.staging_ptr));
+
+    t.set = ImGui_ImplVulkan_AddTexture(
+        m_sampler, t.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void VkPresenter::DestroyGlTextureImage(GlTextureImage &t)
+{
+    VkDevice dev = m_ctx.device;
+
+    ImGui_ImplVulkan_RemoveTexture(t.set);
+    vkDestroyBuffer(dev, t.staging, NULL);
+    vkFreeMemory(dev, t.staging_memory, NULL);
+    vkDestroyImageView(dev, t.view, NULL);
+    vkDestroyImage(dev, t.image, NULL);
+    vkFreeMemory(dev, t.memory, NULL);
+}
+
+ImTextureID VkPresenter::GetTextureId(GLuint tex)
+{
+    qemu_mutex_lock(&m_lock);
+    ImTextureID id = GetTextureIdLocked(tex);
+    qemu_mutex_unlock(&m_lock);
+    return id;
+}
+
+ImTextureID VkPresenter::GetTextureIdLocked(GLuint tex)
+{
+    if (!m_initialized) {
+        return (ImTextureID)0;
+    }
+
+    GLint bound, width, height;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glBindTexture(GL_TEXTURE_2D, bound);
+
+    if (width <= 0 || height <= 0) {
+        return (ImTextureID)0;
+    }
+
+    // The previous frame is complete, a stale copy can be replaced now
+    auto it = m_gl_textures.find(tex);
+    if (it != m_gl_textures.end() &&
+        (it->second.width != width || it->second.height != height)) {
+        DestroyGlTextureImage(it->second);
+        m_gl_textures.erase(it);
+        it = m_gl_textures.end();
+    }
+    if (it == m_gl_textures.end()) {
+        GlTextureImage t;
+        CreateGlTextureImage(t, width, height);
+        it = m_gl_textures.emplace(tex, t).first;
+    }
+
+    // Contents are copied at the end of the frame, once the UI drew them
+    it->second.used = true;
+    it->second.unused_frames = 0;
+
+    return (ImTextureID)(uintptr_t)it->second.set;
+}
+
+void VkPresenter::UploadGlTextures(VkCommandBuffer cmd)
+{
+    GLint bound;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    for (auto &it : m_gl_textures) {
+        GlTextureImage &t = it.second;
+        if (!t.used) {
+            continue;
+        }
+
+        // Rows stay bottom-up, UI code already flips GL textures with UVs
+        glBindTexture(GL_TEXTURE_2D, it.first);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                      t.staging_ptr);
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = t.image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                             NULL, 1, &barrier);
+
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { (uint32_t)t.width, (uint32_t)t.height, 1 };
+        vkCmdCopyBufferToImage(cmd, t.staging, t.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                               &region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+                             NULL, 0, NULL, 1, &barrier);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, bound);
+}
+
+void VkPresenter::ReleaseUnusedGlTextures()
+{
+    for (auto it = m_gl_textures.begin(); it != m_gl_textures.end();) {
+        GlTextureImage &t = it->second;
+        if (t.used) {
+            t.used = false;
+        } else if (++t.unused_frames > gl_texture_max_unused_frames) {
+            // Not referenced by the frame in flight
+            DestroyGlTextureImage(t);
+            it = m_gl_textures.erase(it);
+            continue;
+        }
+        it++;
+    }
+}
+
+void VkPresenter::WaitForPreviousFrame()
+{
+    qemu_mutex_lock(&m_lock);
+    if (m_frame_pending) {
+        CheckVkResult(
+            vkWaitForFences(m_ctx.device, 1, &m_fence, VK_TRUE, UINT64_MAX));
+        m_frame_pending = false;
+    }
+    qemu_mutex_unlock(&m_lock);
+}
+
+bool VkPresenter::Begin(SDL_Window *window)
+{
+    qemu_mutex_lock(&m_lock);
+
+    m_window = window;
+
+    if (!m_initialized && !Init()) {
+        qemu_mutex_unlock(&m_lock);
+        return false;
+    }
+
+    int width, height;
+    SDL_Vulkan_GetDrawableSize(m_window, &width, &height);
+    if (m_swapchain_dirty || width != m_drawable_width ||
+        height != m_drawable_height ||
+        m_vsync != g_config.display.window.vsync ||
+        m_present_mode_setting != g_config.display.vulkan.present_mode) {
+        if (!CreateSwapchain()) {
+            // Retried next frame, the UI is still updated meanwhile
+            m_swapchain_dirty = true;
+        }
+    }
+
+    // The previous frame is complete, so its descriptor can be dropped. The
+    // display image may have been recreated since.
+    if (m_display_set != VK_NULL_HANDLE) {
+        ImGui_ImplVulkan_RemoveTexture(m_display_set);
+        m_display_set = VK_NULL_HANDLE;
+    }
+    NV2AVkDisplayImage display;
+    m_display_valid = nv2a_vk_get_display_image(&display);
+    if (m_display_valid) {
+        m_display_set = ImGui_ImplVulkan_AddTexture(
+            m_sampler, display.image_view,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        m_display_width = display.width;
+        m_display_height = display.height;
+    }
+
+    qemu_mutex_unlock(&m_lock);
+    return true;
+}
+
+void VkPresenter::NewFrame()
+{
+    qemu_mutex_lock(&m_lock);
+    if (m_imgui_initialized) {
+        // The font atlas is uploaded on the queue when rebuilt
+        nv2a_vk_lock_queue();
+        ImGui_ImplVulkan_NewFrame();
+        nv2a_vk_unlock_queue();
+    }
+    qemu_mutex_unlock(&m_lock);
+}
+
+void VkPresenter::InvalidateFonts()
+{
+    qemu_mutex_lock(&m_lock);
+    if (m_imgui_initialized) {
+        ImGui_ImplVulkan_DestroyFontsTexture();
+    }
+    qemu_mutex_unlock(&m_lock);
+}
+
+void VkPresenter::DrawFramebuffer()
+{
+    qemu_mutex_lock(&m_lock);
+    if (m_display_valid && !nv2a_get_screen_off()) {
+        ImGuiIO &io = ImGui::GetIO();
+        float scale[2];
+        GetFramebufferScale(m_display_width, m_display_height,
+                            io.DisplaySize.x * io.DisplayFramebufferScale.x,
+                            io.DisplaySize.y * io.DisplayFramebufferScale.y,
+                            scale);
+
+        ImVec2 center = io.DisplaySize * 0.5f;
+        ImVec2 half(center.x * scale[0], center.y * scale[1]);
+        ImGui::GetBackgroundDrawList()->AddImage(
+            (ImTextureID)(uintptr_t)m_display_set, center - half,
+            center + half);
+    }
+    qemu_mutex_unlock(&m_lock);
+}
+
+void VkPresenter::Present(ImDrawData *draw_data)
+{
+    VkDevice dev = m_ctx.device;
+
+    uint32_t image_index;
+    VkResult result =
+        vkAcquireNextImageKHR(dev, m_swapchain, UINT64_MAX, m_image_acquired,
+                              VK_NULL_HANDLE, &image_index);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        m_swapchain_dirty = true;
+        return;
+    } else if (result == VK_SUBOPTIMAL_KHR) {
+        m_swapchain_dirty = true;
+    } else {
+        CheckVkResult(result);
+    }
+
+    VkCommandBuffer cmd = m_command_buffer;
+    CheckVkResult(vkResetCommandBuffer(cmd, 0));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CheckVkResult(vkBeginCommandBuffer(cmd, &begin_info));
+
+    // The renderer waited for the display image before handing it out
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier,
+                         0, NULL, 0, NULL);
+
+    UploadGlTextures(cmd);
+
+    VkClearValue clear_value = {};
+    VkRenderPassBeginInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = m_render_pass;
+    render_pass_info.framebuffer = m_framebuffers[image_index];
+    render_pass_info.renderArea.extent = m_extent;
+    render_pass_info.clearValueCount = 1;
+    render_pass_info.pClearValues = &clear_value;
+    vkCmdBeginRenderPass(cmd, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    ImGui_ImplVulkan_RenderDrawData(draw_data, cmd);
+    vkCmdEndRenderPass(cmd);
+    CheckVkResult(vkEndCommandBuffer(cmd));
+
+    VkPipelineStageFlags wait_stage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &m_image_acquired;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &m_render_finished[image_index];
+    VkPresentInfoKHR present_info = {};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.waitSemaphoreCount = 1;
+    present_info.pWaitSemaphores = &m_render_finished[image_index];
+    present_info.swapchainCount = 1;
+    present_info.pSwapchains = &m_swapchain;
+    present_info.pImageIndices = &image_index;
+
+    // The queue may be shared with PGRAPH, which mustn't wait on a present
+    // blocked by vsync for longer than the call itself
+    CheckVkResult(vkResetFences(dev, 1, &m_fence));
+    nv2a_vk_lock_queue();
+    CheckVkResult(vkQueueSubmit(m_ctx.queue, 1, &submit_info, m_fence));
+    nv2a_vk_unlock_queue();
+    m_frame_pending = true;
+
+    nv2a_vk_lock_queue();
+    result = vkQueuePresentKHR(m_ctx.queue, &present_info);
+    nv2a_vk_unlock_queue();
+
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        m_swapchain_dirty = true;
+    } else {
+        CheckVkResult(result);
+    }
+}
+
+void VkPresenter::End()
+{
+    qemu_mutex_lock(&m_lock);
+    if (m_initialized) {
+        if (m_swapchain != VK_NULL_HANDLE) {
+            Present(ImGui::GetDrawData());
+        }
+        ReleaseUnusedGlTextures();
+    }
+    qemu_mutex_unlock(&m_lock);
+}
+
+void xemu_vk_present_wait(void)
+{
+    g_vk_presenter.WaitForPreviousFrame();
+}
+
+bool xemu_vk_present_begin(SDL_Window *window)
+{
+    return g_vk_presenter.Begin(window);
+}
+
+void xemu_vk_present_end(void)
+{
+    g_vk_presenter.End();
+}
@@ -0,0 +1,112 @@
+//
+// xemu User Interface
+//
+// Copyright (C) 2020-2025 Matt Borgerson
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <map>
+#include <vector>
+#include "common.hh"
+#include "hw/xbox/nv2a/pgraph/vk/present.h"
+extern "C" {
+#include "qemu/thread.h"
+}
+#include <imgui_impl_vulkan.h>
+
+// Presents the display image and the UI on a Vulkan swapchain of the main
+// window, sharing the device of the Vulkan renderer. The UI keeps rendering
+// its own widgets (controller, logo, etc.) with OpenGL offscreen, those
+// textures are copied over when they are drawn.
+class VkPresenter
+{
+protected:
+    struct GlTextureImage {
+        int width, height;
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        VkBuffer staging;
+        VkDeviceMemory staging_memory;
+        void *staging_ptr;
+        VkDescriptorSet set;
+        bool used;
+        int unused_frames;
+    };
+
+    QemuMutex m_lock;
+    bool m_initialized;
+    SDL_Window *m_window;
+    NV2AVkPresentContext m_ctx;
+
+    VkSurfaceKHR m_surface;
+    VkSurfaceFormatKHR m_surface_format;
+    VkRenderPass m_render_pass;
+    VkSwapchainKHR m_swapchain;
+    VkExtent2D m_extent;
+    VkPresentModeKHR m_present_mode;
+    bool m_vsync;
+    int m_present_mode_setting;
+    int m_drawable_width, m_drawable_height;
+    bool m_swapchain_dirty;
+    std::vector<VkImage> m_images;
+    std::vector<VkImageView> m_image_views;
+    std::vector<VkFramebuffer> m_framebuffers;
+    std::vector<VkSemaphore> m_render_finished;
+    VkSemaphore m_image_acquired;
+
+    VkCommandPool m_command_pool;
+    VkCommandBuffer m_command_buffer;
+    VkFence m_fence;
+    bool m_frame_pending;
+
+    VkDescriptorPool m_descriptor_pool;
+    VkSampler m_sampler;
+    bool m_imgui_initialized;
+
+    VkImageView m_display_view;
+    VkDescriptorSet m_display_set;
+    int m_display_width, m_display_height;
+    bool m_display_valid;
+
+    std::map<GLuint, GlTextureImage> m_gl_textures;
+
+    bool Init();
+    void Destroy();
+    bool CreateRenderPass();
+    bool CreateSwapchain();
+    void DestroySwapchain();
+    VkPresentModeKHR ChoosePresentMode();
+    uint32_t FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags props);
+    void CreateGlTextureImage(GlTextureImage &t, int width, int height);
+    void DestroyGlTextureImage(GlTextureImage &t);
+    void UploadGlTextures(VkCommandBuffer cmd);
+    void ReleaseUnusedGlTextures();
+    ImTextureID GetTextureIdLocked(GLuint tex);
+    void Present(ImDrawData *draw_data); // Called with m_lock held
+    static void Finalize(void *opaque);
+
+public:
+    VkPresenter();
+    void WaitForPreviousFrame();
+    bool Begin(SDL_Window *window);
+    void NewFrame();
+    void DrawFramebuffer();
+    void End();
+    void InvalidateFonts();
+    ImTextureID GetTextureId(GLuint tex);
+};
+
+extern VkPresenter g_vk_presenter;
@@ -32,6 +32,7 @@ extern "C" {
 
 // Implemented in xemu.c
 int xemu_is_fullscreen(void);
+bool xemu_is_direct_present(void);
 void xemu_toggle_fullscreen(void);
 void xemu_eject_disc(Error **errp);
 void xemu_load_disc(const char *path, Error **errp);
@@ -44,6 +45,11 @@ void xemu_hud_process_sdl_events(SDL_Event *event);
 void xemu_hud_should_capture_kbd_mouse(int *kbd, int *mouse);
 void xemu_hud_set_framebuffer_texture(GLuint tex, bool flip);
 
+// Implemented in xui/vk-present.cc, only when presenting directly with Vulkan
+void xemu_vk_present_wait(void);
+bool xemu_vk_present_begin(SDL_Window *window);
+void xemu_vk_present_end(void);
+
 #ifdef __cplusplus
 }
 #endif